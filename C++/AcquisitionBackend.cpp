@@ -0,0 +1,440 @@
+﻿/*************************************************************************************/
+/*
+ * File name: AcquisitionBackend.cpp
+ *
+ * Synopsis:  Acquisition backends of the MulticastMonitor example.
+ *
+ *            The MIL backend drives the monitor digitizer with MdigProcess. The
+ *            synthetic backend generates frames in a thread of its own and calls
+ *            the same processing code as the MdigProcess hook, which allows the
+ *            hook cost, the drop rate and the data format change recovery to be
+ *            measured without a GigE Vision device. The native backend receives
+ *            the GVSP stream itself, see GvspReceiver.h. The replay backend
+ *            feeds the frames of a recording, see FrameReplay.h.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#if M_MIL_USE_WINDOWS
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "MulticastMonitor.h"
+
+static MIL_UINT32 MFTYPE SyntheticGrabThread(void* ThreadContext);
+
+/* User and system CPU time of the process, in seconds.                      */
+/* -----------------------------------------------------------------------   */
+static MIL_DOUBLE ProcessCpuTime(void)
+   {
+#if M_MIL_USE_WINDOWS
+   FILETIME CreationTime, ExitTime, KernelTime, UserTime;
+
+   GetProcessTimes(GetCurrentProcess(), &CreationTime, &ExitTime, &KernelTime, &UserTime);
+   return 1e-7 * ((((MIL_UINT64)KernelTime.dwHighDateTime << 32) | KernelTime.dwLowDateTime) +
+                  (((MIL_UINT64)UserTime.dwHighDateTime << 32) | UserTime.dwLowDateTime));
+#else
+   rusage Usage;
+
+   getrusage(RUSAGE_SELF, &Usage);
+   return Usage.ru_utime.tv_sec + 1e-6 * Usage.ru_utime.tv_usec +
+          Usage.ru_stime.tv_sec + 1e-6 * Usage.ru_stime.tv_usec;
+#endif
+   }
+
+/* Returns the MIL buffer format able to hold a given GenICam pixel format.  */
+/* -----------------------------------------------------------------------   */
+void GetBufferFormat(MIL_INT PixelFormat, MIL_INT* SizeBandPtr, MIL_INT* TypePtr,
+                     MIL_INT64* SourceDataFormatPtr)
+   {
+   *SizeBandPtr         = 1;
+   *TypePtr             = 8 + M_UNSIGNED;
+   *SourceDataFormatPtr = 0;
+
+   switch(PixelFormat)
+      {
+      case PFNC_MONO10:
+      case PFNC_MONO10_PACKED:
+      case PFNC_MONO10P:
+      case PFNC_MONO12:
+      case PFNC_MONO12_PACKED:
+      case PFNC_MONO12P:
+      case PFNC_MONO16:
+         *TypePtr = 16 + M_UNSIGNED;
+         break;
+
+      /* The bytes of the stream are stored as they come: the order of the */
+      /* channels is that of the buffer format.                            */
+      case PFNC_RGB8:
+         *SizeBandPtr         = 3;
+         *SourceDataFormatPtr = M_PACKED + M_RGB24;
+         break;
+
+      case PFNC_BGR8:
+         *SizeBandPtr         = 3;
+         *SourceDataFormatPtr = M_PACKED + M_BGR24;
+         break;
+
+      case PFNC_BGRA8:
+         *SizeBandPtr         = 3;
+         *SourceDataFormatPtr = M_PACKED + M_BGR32;
+         break;
+
+      case PFNC_YUV422_8:
+         *SizeBandPtr         = 3;
+         *SourceDataFormatPtr = M_PACKED + M_YUV16;
+         break;
+
+      default:
+         break;
+      }
+   }
+
+/* Starts the acquisition of the selected backend.                           */
+/* -----------------------------------------------------------------------   */
+void StartAcquisition(HookDataStruct* HookDataPtr)
+   {
+   if(HookDataPtr->Display)
+      DisplayStageResume(HookDataPtr->Display);
+   HookDataPtr->AcquisitionCpuStart = ProcessCpuTime();
+   HookDataPtr->AcquisitionPlaced   = false;
+   if(HookDataPtr->Stats->AcquisitionStartTime == 0)
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS,
+                &HookDataPtr->Stats->AcquisitionStartTime);
+
+   switch(HookDataPtr->Backend)
+      {
+      case eAcquisitionMil:
+         MdigProcess(HookDataPtr->MilDigitizer, HookDataPtr->MilGrabBufferList,
+            HookDataPtr->MilGrabBufferListSize, M_START, M_DEFAULT, ProcessingFunction,
+            HookDataPtr);
+         break;
+
+      case eAcquisitionSynthetic:
+         HookDataPtr->Synthetic.StopRequested = false;
+         MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, &SyntheticGrabThread, HookDataPtr,
+            &HookDataPtr->Synthetic.Thread);
+         break;
+
+      case eAcquisitionNative:
+         GvspReceiverStart(HookDataPtr->Receiver);
+         break;
+
+      case eAcquisitionReplay:
+         FrameReplayStart(HookDataPtr->Replay);
+         break;
+      }
+   }
+
+/* Stops the acquisition of the selected backend.                            */
+/* -----------------------------------------------------------------------   */
+void StopAcquisition(HookDataStruct* HookDataPtr)
+   {
+   switch(HookDataPtr->Backend)
+      {
+      case eAcquisitionMil:
+         MdigProcess(HookDataPtr->MilDigitizer, HookDataPtr->MilGrabBufferList,
+            HookDataPtr->MilGrabBufferListSize, M_STOP, M_DEFAULT, ProcessingFunction,
+            HookDataPtr);
+         break;
+
+      case eAcquisitionSynthetic:
+         if(HookDataPtr->Synthetic.Thread)
+            {
+            HookDataPtr->Synthetic.StopRequested = true;
+            MthrWait(HookDataPtr->Synthetic.Thread, M_THREAD_END_WAIT, M_NULL);
+            MthrFree(HookDataPtr->Synthetic.Thread);
+            HookDataPtr->Synthetic.Thread = M_NULL;
+            }
+         break;
+
+      case eAcquisitionNative:
+         GvspReceiverStop(HookDataPtr->Receiver);
+         break;
+
+      case eAcquisitionReplay:
+         FrameReplayStop(HookDataPtr->Replay);
+         break;
+      }
+   HookDataPtr->AcquisitionCpuTime += ProcessCpuTime() - HookDataPtr->AcquisitionCpuStart;
+
+   /* The grab buffers may only be reused once the workers and the display */
+   /* are done with them.                                                   */
+   if(HookDataPtr->Pipeline)
+      PipelineDrain(HookDataPtr->Pipeline, HookDataPtr->PipelineLane);
+   if(HookDataPtr->Display)
+      DisplayStagePause(HookDataPtr->Display);
+   }
+
+/* Grab buffer references. A grab buffer referenced by a worker or by the   */
+/* display must not be filled again by the grab.                             */
+/* -----------------------------------------------------------------------   */
+void AcquireGrabBuffer(HookDataStruct* HookDataPtr, MIL_INT BufferIndex)
+   {
+   if(HookDataPtr->BufferRefCount[BufferIndex].fetch_add(1, std::memory_order_acq_rel) == 0)
+      GrabQueueBufferBusy(&HookDataPtr->GrabQueue, BufferIndex);
+   }
+
+void ReleaseGrabBuffer(HookDataStruct* HookDataPtr, MIL_INT BufferIndex)
+   {
+   /* Read while referenced: the grab may reuse the buffer once released. */
+   MIL_DOUBLE BusyTime = HookDataPtr->GrabQueue.BusyTime[BufferIndex];
+
+   if(HookDataPtr->BufferRefCount[BufferIndex].fetch_sub(1, std::memory_order_acq_rel) == 1)
+      GrabQueueBufferFree(&HookDataPtr->GrabQueue, BusyTime);
+   }
+
+/* Returns true if a grab buffer can be filled: no worker or display       */
+/* references it. A frame only waiting in the display slot is taken back.    */
+/* References are only added by the hook, or while one is held, so a free   */
+/* buffer stays free until the hook is called with it.                       */
+/* -----------------------------------------------------------------------   */
+bool GrabBufferFree(HookDataStruct* HookDataPtr, MIL_INT BufferIndex)
+   {
+   if(HookDataPtr->BufferRefCount[BufferIndex].load(std::memory_order_acquire) &&
+      HookDataPtr->Display)
+      DisplayStageRevoke(HookDataPtr->Display, BufferIndex);
+   return HookDataPtr->BufferRefCount[BufferIndex].load(std::memory_order_acquire) == 0;
+   }
+
+/* Called by the MdigProcess hook before it hands the frame over. The grab  */
+/* fills its queued buffers in list order without the hook, so the buffers  */
+/* that follow this one are the next ones it reaches. Returns false if one  */
+/* of them is still in use: the hook then skips the frame rather than wait, */
+/* so that the workers catch up, and the grab queue grows. The emulated     */
+/* sources check the buffer itself before they fill it, see GrabBufferFree. */
+/* -----------------------------------------------------------------------   */
+bool NextGrabBuffersFree(HookDataStruct* HookDataPtr, MIL_INT BufferIndex)
+   {
+   MIL_INT BufferCount   = HookDataPtr->MilGrabBufferListSize;
+   MIL_INT GuardDistance = BufferCount > GRAB_GUARD_DISTANCE ?
+                           GRAB_GUARD_DISTANCE : BufferCount - 1;
+   bool    Free          = true;
+
+   for(MIL_INT i = 1; i <= GuardDistance; i++)
+      {
+      if(!GrabBufferFree(HookDataPtr, (BufferIndex + i) % BufferCount))
+         Free = false;
+      }
+   return Free;
+   }
+
+/* Returns true if frames are currently being acquired.                      */
+/* -----------------------------------------------------------------------   */
+bool IsAcquisitionInProgress(HookDataStruct* HookDataPtr)
+   {
+   MIL_INT DigProcessInProgress = M_FALSE;
+
+   switch(HookDataPtr->Backend)
+      {
+      case eAcquisitionMil:
+         MdigInquire(HookDataPtr->MilDigitizer, M_DIG_PROCESS_IN_PROGRESS,
+            &DigProcessInProgress);
+         return DigProcessInProgress == M_TRUE;
+
+      case eAcquisitionSynthetic:
+         return HookDataPtr->Synthetic.Thread != M_NULL;
+
+      case eAcquisitionNative:
+         return HookDataPtr->Receiver->Thread != M_NULL;
+
+      case eAcquisitionReplay:
+         return HookDataPtr->Replay->Thread != M_NULL;
+      }
+   return false;
+   }
+
+/* Returns the frame count and rate of the last acquisition, and prints    */
+/* the receive cost of the backends that receive packets: packets/s and    */
+/* process CPU time per Gbit. The MIL backend packets are estimated from   */
+/* the frame count and the last data format.                                */
+/* -----------------------------------------------------------------------   */
+void GetAcquisitionStatistics(HookDataStruct* HookDataPtr, MIL_INT* FrameCountPtr,
+                              MIL_DOUBLE* FrameRatePtr)
+   {
+   SyntheticSourceStruct* SyntheticPtr = &HookDataPtr->Synthetic;
+   GvspReceiverStruct*    ReceiverPtr  = HookDataPtr->Receiver;
+   MIL_DOUBLE             RunTime      = 0;
+   MIL_DOUBLE             WireBytes    = 0;
+   MIL_DOUBLE             PacketCount  = 0;
+
+   switch(HookDataPtr->Backend)
+      {
+      case eAcquisitionMil:
+         MdigInquire(HookDataPtr->MilDigitizer, M_PROCESS_FRAME_COUNT, FrameCountPtr);
+         MdigInquire(HookDataPtr->MilDigitizer, M_PROCESS_FRAME_RATE, FrameRatePtr);
+         if(*FrameRatePtr > 0)
+            {
+            MIL_INT PacketSize = 0;
+            size_t  BlockPackets;
+
+            MdigInquire(HookDataPtr->MilDigitizer, M_GC_PACKET_SIZE, &PacketSize);
+            if(PacketSize > GVSP_PACKET_OVERHEAD)
+               {
+               WireBytes   = (MIL_DOUBLE)*FrameCountPtr * GvspBlockWireBytes(
+                  (uint32_t)HookDataPtr->FramePixelFormat, (uint32_t)HookDataPtr->FrameSizeX,
+                  (uint32_t)HookDataPtr->FrameSizeY, (size_t)PacketSize, &BlockPackets);
+               PacketCount = (MIL_DOUBLE)*FrameCountPtr * BlockPackets;
+               RunTime     = *FrameCountPtr / *FrameRatePtr;
+               }
+            }
+#if defined(M_GC_TOTAL_PACKETS_MISSED) && defined(M_GC_TOTAL_PACKETS_RESENT)
+         {
+         /* The hook only tells whether a frame is corrupt; the packet level */
+         /* loss is only available as totals.                                 */
+         MIL_INT MissedPackets = 0, ResentPackets = 0;
+
+         MdigInquire(HookDataPtr->MilDigitizer, M_GC_TOTAL_PACKETS_MISSED, &MissedPackets);
+         MdigInquire(HookDataPtr->MilDigitizer, M_GC_TOTAL_PACKETS_RESENT, &ResentPackets);
+         MosPrintf(MIL_TEXT("\nDigitizer packets: %lld missed, %lld resent.\n"),
+            (long long)MissedPackets, (long long)ResentPackets);
+         }
+#endif
+         break;
+
+      case eAcquisitionSynthetic:
+         *FrameCountPtr = (MIL_INT)SyntheticPtr->HookCallCount;
+         *FrameRatePtr  = SyntheticPtr->RunTime > 0 ?
+                          SyntheticPtr->HookCallCount / SyntheticPtr->RunTime : 0;
+         if(SyntheticPtr->HookCallCount)
+            {
+            MosPrintf(MIL_TEXT("\nSynthetic source hook time: %.1f us average, "),
+               1e6 * SyntheticPtr->HookTimeTotal / SyntheticPtr->HookCallCount);
+            MosPrintf(MIL_TEXT("%.1f us max.\n"), 1e6 * SyntheticPtr->HookTimeMax);
+            }
+         break;
+
+      case eAcquisitionNative:
+         *FrameCountPtr = (MIL_INT)ReceiverPtr->FrameCount;
+         *FrameRatePtr  = ReceiverPtr->RunTime > 0 ?
+                          ReceiverPtr->FrameCount / ReceiverPtr->RunTime : 0;
+         WireBytes      = (MIL_DOUBLE)ReceiverPtr->ByteCount;
+         PacketCount    = (MIL_DOUBLE)ReceiverPtr->PacketCount;
+         RunTime        = ReceiverPtr->RunTime;
+         break;
+
+      case eAcquisitionReplay:
+         *FrameCountPtr = (MIL_INT)HookDataPtr->Replay->FrameCount;
+         *FrameRatePtr  = HookDataPtr->Replay->RunTime > 0 ?
+                          HookDataPtr->Replay->FrameCount / HookDataPtr->Replay->RunTime : 0;
+         break;
+      }
+
+   if(RunTime > 0 && WireBytes > 0)
+      MosPrintf(MIL_TEXT("\nReceive cost: %.0f packets/s, %.3f Gbit/s, %.3f process CPU sec ")
+                MIL_TEXT("per Gbit.\n"), PacketCount / RunTime, 8e-9 * WireBytes / RunTime,
+                HookDataPtr->AcquisitionCpuTime / (8e-9 * WireBytes));
+   }
+
+/* Fills a grab buffer with a moving ramp, clipped to the buffer size.       */
+/* -----------------------------------------------------------------------   */
+static void FillSyntheticFrame(MIL_ID BufferId, MIL_INT SizeY, MIL_INT64 FrameIndex)
+   {
+   MIL_UINT8* HostAddress = M_NULL;
+   MIL_INT    PitchByte   = MbufInquire(BufferId, M_PITCH_BYTE, M_NULL);
+   MIL_INT    BufferSizeY = MbufInquire(BufferId, M_SIZE_Y, M_NULL);
+
+   MbufInquire(BufferId, M_HOST_ADDRESS, &HostAddress);
+   if(HostAddress == M_NULL)
+      {
+      MbufClear(BufferId, (MIL_DOUBLE)(FrameIndex & 0xFF));
+      return;
+      }
+
+   for(MIL_INT y = 0; y < SizeY && y < BufferSizeY; y++)
+      memset(HostAddress + y * PitchByte, (int)((y + FrameIndex) & 0xFF), (size_t)PitchByte);
+   }
+
+/* Synthetic acquisition thread. Emulates MdigProcess: fills the grab        */
+/* buffers in turn at the simulated frame rate and calls the processing      */
+/* code, which the MIL backend calls from ProcessingFunction.               */
+/* -----------------------------------------------------------------------   */
+static MIL_UINT32 MFTYPE SyntheticGrabThread(void* ThreadContext)
+   {
+   HookDataStruct*              HookDataPtr  = (HookDataStruct*)ThreadContext;
+   SyntheticSourceStruct*       SyntheticPtr = &HookDataPtr->Synthetic;
+   const SimulatorConfigStruct* ConfigPtr    = &HookDataPtr->SourceConfig;
+   MIL_INT                      BufferIndex  = 0;
+   MIL_DOUBLE                   StartTime, HookStart, HookEnd;
+   auto                         NextFrame    = std::chrono::steady_clock::now();
+   auto                         Period       = std::chrono::nanoseconds(
+      ConfigPtr->FrameRate > 0 ? (long long)(1e9 / ConfigPtr->FrameRate) : 0);
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &StartTime);
+   HookEnd = StartTime;
+
+   while(!SyntheticPtr->StopRequested && HookDataPtr->MilGrabBufferListSize > 0)
+      {
+      FrameInfoStruct FrameInfo;
+      MIL_INT64       FrameIndex = SyntheticPtr->FrameIndex++;
+      MIL_INT         PacketCount;
+
+      /* Never fill a buffer still in use: the frame is skipped instead. */
+      if(!GrabBufferFree(HookDataPtr, BufferIndex))
+         {
+         HookDataPtr->GrabQueue.SkipCount.fetch_add(1, std::memory_order_relaxed);
+         BufferIndex = (BufferIndex + 1) % HookDataPtr->MilGrabBufferListSize;
+         if(Period.count() > 0)
+            {
+            NextFrame += Period;
+            std::this_thread::sleep_until(NextFrame);
+            }
+         continue;
+         }
+
+      SimulatorFrameSize(ConfigPtr, FrameIndex, &FrameInfo.FrameSizeX, &FrameInfo.FrameSizeY);
+      FrameInfo.BufferIndex      = BufferIndex;
+      FrameInfo.BufferId         = HookDataPtr->MilGrabBufferList[BufferIndex];
+      FrameInfo.FramePixelFormat = ConfigPtr->PixelFormat;
+      FrameInfo.FramePacketSize  = ConfigPtr->PacketSize;
+      FrameInfo.IsFrameCorrupt   = M_FALSE;
+      FrameInfo.BlockId          = FrameIndex % 0xFFFF + 1;
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &FrameInfo.DeviceTimestamp);
+
+      /* A frame is corrupt as soon as one of its packets is lost. */
+      PacketCount = SimulatorPacketCount(ConfigPtr, FrameInfo.FrameSizeX,
+                                         FrameInfo.FrameSizeY);
+      SyntheticPtr->ReceivedPackets.assign((PacketCount + 63) / 64, ~0ULL);
+      if(ConfigPtr->PacketLossPercent > 0)
+         {
+         for(MIL_INT i = 0; i < PacketCount; i++)
+            {
+            if(SimulatorPacketLost(&SyntheticPtr->RandomState, ConfigPtr->PacketLossPercent))
+               {
+               SyntheticPtr->ReceivedPackets[i / 64] &= ~(1ULL << (i % 64));
+               FrameInfo.IsFrameCorrupt = M_TRUE;
+               }
+            }
+         }
+      FrameInfo.ReceivedPackets    = PacketCount > 0 ? &SyntheticPtr->ReceivedPackets[0] : M_NULL;
+      FrameInfo.PayloadPacketCount = PacketCount;
+
+      FillSyntheticFrame(FrameInfo.BufferId, FrameInfo.FrameSizeY, FrameIndex);
+
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &HookStart);
+      FrameInfo.HookEntryTime = HookStart;
+      ProcessFrame(HookDataPtr, &FrameInfo);
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &HookEnd);
+
+      SyntheticPtr->HookCallCount++;
+      SyntheticPtr->HookTimeTotal += HookEnd - HookStart;
+      if(HookEnd - HookStart > SyntheticPtr->HookTimeMax)
+         SyntheticPtr->HookTimeMax = HookEnd - HookStart;
+
+      BufferIndex = (BufferIndex + 1) % HookDataPtr->MilGrabBufferListSize;
+
+      if(Period.count() > 0)
+         {
+         NextFrame += Period;
+         std::this_thread::sleep_until(NextFrame);
+         }
+      }
+
+   SyntheticPtr->RunTime += HookEnd - StartTime;
+   return 0;
+   }
@@ -0,0 +1,604 @@
+﻿/*************************************************************************************/
+/*
+ * File name: BufferPool.cpp
+ *
+ * Synopsis:  Grab buffer pools and the cache of recently used pools.
+ *
+ *            The builder thread derives the buffer format of a new pool from the
+ *            pixel format of the grabbed frames (see GetBufferFormat()), so that
+ *            it can be allocated without touching the digitizer while it grabs.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#if M_MIL_USE_WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+#include "MulticastMonitor.h"
+
+#define POOL_HUGE_PAGE_SIZE   (2 * 1024 * 1024)
+#define POOL_MPOL_PREFERRED   1     /* <numaif.h>, without depending on libnuma. */
+
+static MIL_UINT32 MFTYPE PoolBuilderThread(void* ThreadContext);
+
+#if !M_MIL_USE_WINDOWS
+/* Binds the pages of an arena, not touched yet, to a node. The node is      */
+/* preferred rather than required: if it runs out of memory, the pages come  */
+/* from another one.                                                          */
+/* -----------------------------------------------------------------------   */
+static bool ArenaBindNode(void* Arena, size_t Size, MIL_INT Node)
+   {
+   unsigned long Mask[16];
+   size_t        MaskBits = 8 * sizeof(unsigned long);
+
+   if(Node < 0 || Node >= (MIL_INT)(MaskBits * 16))
+      return false;
+   memset(Mask, 0, sizeof(Mask));
+   Mask[Node / MaskBits] |= 1UL << (Node % MaskBits);
+   return syscall(SYS_mbind, Arena, Size, POOL_MPOL_PREFERRED, Mask, 8 * sizeof(Mask) + 1,
+                  0) == 0;
+   }
+#endif
+
+/* Arena of host memory for the grab buffers of a pool, bound to a node if  */
+/* it is known. With huge pages, the size is rounded up to the huge page    */
+/* size; if they cannot be had, the arena falls back to regular pages.      */
+/* A locked arena is faulted in and kept resident, so that the grab never   */
+/* waits on a page fault; it is left unlocked if the limit of locked memory */
+/* (ulimit -l) is too low.                                                   */
+/* -----------------------------------------------------------------------   */
+static void* ArenaAlloc(size_t* SizePtr, MIL_INT PoolFlags, MIL_INT Node,
+                        BufferPoolStruct* PoolPtr)
+   {
+   bool  HugePages = (PoolFlags & POOL_HUGE_PAGES) != 0;
+   void* Arena     = M_NULL;
+
+   PoolPtr->ArenaHugePages = false;
+   PoolPtr->ArenaLocked    = false;
+   PoolPtr->ArenaNode      = CPU_NODE_UNKNOWN;
+#if M_MIL_USE_WINDOWS
+   DWORD  AllocationType = MEM_RESERVE | MEM_COMMIT;
+   size_t Size           = *SizePtr;
+
+   if(HugePages && GetLargePageMinimum() > 0)
+      {
+      size_t PageSize = GetLargePageMinimum();
+
+      Size  = (*SizePtr + PageSize - 1) / PageSize * PageSize;
+      Arena = Node >= 0 ?
+         VirtualAllocExNuma(GetCurrentProcess(), M_NULL, Size,
+                            AllocationType | MEM_LARGE_PAGES, PAGE_READWRITE, (DWORD)Node) :
+         VirtualAlloc(M_NULL, Size, AllocationType | MEM_LARGE_PAGES, PAGE_READWRITE);
+      if(Arena)
+         {
+         /* Large pages are never paged out. */
+         *SizePtr                = Size;
+         PoolPtr->ArenaHugePages = true;
+         PoolPtr->ArenaLocked    = true;
+         PoolPtr->ArenaNode      = Node;
+         return Arena;
+         }
+      }
+   Arena = Node >= 0 ?
+      VirtualAllocExNuma(GetCurrentProcess(), M_NULL, *SizePtr, AllocationType,
+                         PAGE_READWRITE, (DWORD)Node) :
+      VirtualAlloc(M_NULL, *SizePtr, AllocationType, PAGE_READWRITE);
+   if(!Arena)
+      return M_NULL;
+   PoolPtr->ArenaNode = Node;
+   if(PoolFlags & POOL_LOCKED_MEMORY)
+      PoolPtr->ArenaLocked = VirtualLock(Arena, *SizePtr) != 0;
+#else
+   if(HugePages)
+      {
+      size_t Size = (*SizePtr + POOL_HUGE_PAGE_SIZE - 1) / POOL_HUGE_PAGE_SIZE *
+                    POOL_HUGE_PAGE_SIZE;
+
+      Arena = mmap(M_NULL, Size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if(Arena != MAP_FAILED)
+         {
+         *SizePtr                = Size;
+         PoolPtr->ArenaHugePages = true;
+         }
+      else
+         Arena = M_NULL;
+      }
+   if(!Arena)
+      {
+      Arena = mmap(M_NULL, *SizePtr, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(Arena == MAP_FAILED)
+         return M_NULL;
+#ifdef MADV_HUGEPAGE
+      /* Transparent huge pages, if enabled in madvise mode. */
+      if(HugePages)
+         madvise(Arena, *SizePtr, MADV_HUGEPAGE);
+#endif
+      }
+   if(ArenaBindNode(Arena, *SizePtr, Node))
+      PoolPtr->ArenaNode = Node;
+   if(PoolFlags & POOL_LOCKED_MEMORY)
+      PoolPtr->ArenaLocked = mlock(Arena, *SizePtr) == 0;
+#endif
+   return Arena;
+   }
+
+static void ArenaFree(void* Arena, size_t Size)
+   {
+#if M_MIL_USE_WINDOWS
+   VirtualFree(Arena, 0, MEM_RELEASE);
+#else
+   /* Unmapping also unlocks the pages. */
+   munmap(Arena, Size);
+#endif
+   }
+
+/* Bytes per pixel of the formats that can be created on host memory with   */
+/* a single address. 0 if the buffer has to be allocated by MIL.           */
+/* -----------------------------------------------------------------------   */
+static MIL_INT PixelBytes(MIL_INT SizeBand, MIL_INT Type, MIL_INT64 SourceDataFormat)
+   {
+   if(SourceDataFormat == M_PACKED + M_BGR24 || SourceDataFormat == M_PACKED + M_RGB24)
+      return 3;
+   if(SourceDataFormat == M_PACKED + M_BGR32)
+      return 4;
+   if(SourceDataFormat == M_PACKED + M_YUV16)
+      return 2;
+   if(SizeBand == 1)
+      return ((Type & 0xFF) + 7) / 8;
+   return 0;
+   }
+
+static MIL_INT PitchBytes(MIL_INT SizeBand, MIL_INT SizeX, MIL_INT Type,
+                          MIL_INT64 SourceDataFormat)
+   {
+   MIL_INT Bytes = PixelBytes(SizeBand, Type, SourceDataFormat);
+
+   return (SizeX * (Bytes ? Bytes : SizeBand * (((Type & 0xFF) + 7) / 8)) + 63) & ~(MIL_INT)63;
+   }
+
+/* Memory taken by one grab buffer of the given format.                     */
+/* -----------------------------------------------------------------------   */
+MIL_INT64 BufferPoolBufferBytes(MIL_INT SizeBand, MIL_INT SizeX, MIL_INT SizeY,
+                                MIL_INT Type, MIL_INT64 SourceDataFormat)
+   {
+   MIL_INT64 Bytes = (MIL_INT64)PitchBytes(SizeBand, SizeX, Type, SourceDataFormat) * SizeY;
+
+   if(!PixelBytes(SizeBand, Type, SourceDataFormat))
+      Bytes *= SizeBand;
+   return (Bytes + POOL_SLICE_ALIGNMENT - 1) / POOL_SLICE_ALIGNMENT * POOL_SLICE_ALIGNMENT;
+   }
+
+/* Memory taken by the display buffer of a pool; see BufferPoolAlloc().     */
+/* -----------------------------------------------------------------------   */
+MIL_INT64 BufferPoolDisplayBytes(MIL_INT SizeX, MIL_INT SizeY, MIL_INT PixelFormat,
+                                 MIL_INT64 BufferBytes, MIL_INT PoolFlags)
+   {
+   if(!(PoolFlags & POOL_DISPLAY_BUFFER))
+      return 0;
+
+   switch(PixelConvertDisplayOperation((uint32_t)PixelFormat))
+      {
+      case eConvertDownshift: return (MIL_INT64)SizeX * SizeY;
+      case eConvertDebayer:   return (MIL_INT64)SizeX * SizeY * 4;
+      default:                return BufferBytes;
+      }
+   }
+
+/* Allocates a pool: the display buffer, if any, and up to BufferCount      */
+/* grab buffers. The grab buffers are created on slices of the arena, on    */
+/* NumaNode if known; if the arena cannot be allocated, as many as possible */
+/* are allocated by MIL.                                                     */
+/* The display buffer has the format of the grab buffers, unless the       */
+/* frames are converted for the display (see DisplayStageCopy).            */
+/* The memory of the pool is charged to QueuePtr, if not M_NULL, until it   */
+/* is freed.                                                                 */
+/* -----------------------------------------------------------------------   */
+BufferPoolStruct* BufferPoolAlloc(MIL_ID MilSystem, MIL_INT SizeBand, MIL_INT SizeX,
+                                  MIL_INT SizeY, MIL_INT Type, MIL_INT64 SourceDataFormat,
+                                  MIL_INT PixelFormat, MIL_INT BufferCount, MIL_INT PoolFlags,
+                                  MIL_INT NumaNode, GrabQueueStruct* QueuePtr)
+   {
+   BufferPoolStruct* PoolPtr = new BufferPoolStruct;
+   MIL_INT           PitchByte = PitchBytes(SizeBand, SizeX, Type, SourceDataFormat);
+
+   if(BufferCount > BUFFERING_SIZE_MAX)
+      BufferCount = BUFFERING_SIZE_MAX;
+
+   PoolPtr->FrameSizeX         = SizeX;
+   PoolPtr->FrameSizeY         = SizeY;
+   PoolPtr->FramePixelFormat   = PixelFormat;
+   PoolPtr->SizeBand           = SizeBand;
+   PoolPtr->Type               = Type;
+   PoolPtr->SourceDataFormat   = SourceDataFormat;
+   PoolPtr->GrabBufferListSize = 0;
+   PoolPtr->ImageDisp          = M_NULL;
+   PoolPtr->LastUsed           = 0;
+   PoolPtr->IdleSince          = 0;
+   PoolPtr->Arena              = M_NULL;
+   PoolPtr->ArenaSize          = 0;
+   PoolPtr->ArenaHugePages     = false;
+   PoolPtr->ArenaLocked        = false;
+   PoolPtr->ArenaNode          = CPU_NODE_UNKNOWN;
+   PoolPtr->BufferBytes        = BufferPoolBufferBytes(SizeBand, SizeX, SizeY, Type,
+                                                       SourceDataFormat);
+   PoolPtr->TotalBytes         = 0;
+   PoolPtr->Queue              = QueuePtr;
+
+   /* Allocate the display buffer and clear it. */
+   if(PoolFlags & POOL_DISPLAY_BUFFER)
+      {
+      switch(PixelConvertDisplayOperation((uint32_t)PixelFormat))
+         {
+         case eConvertDownshift:
+            MbufAlloc2d(MilSystem, SizeX, SizeY, 8+M_UNSIGNED, M_IMAGE+M_DISP+M_PROC,
+                        &PoolPtr->ImageDisp);
+            break;
+         case eConvertDebayer:
+            MbufAllocColor(MilSystem, 3, SizeX, SizeY, 8+M_UNSIGNED,
+                           M_IMAGE+M_DISP+M_PROC+M_PACKED+M_BGR32, &PoolPtr->ImageDisp);
+            break;
+         default:
+            MbufAllocColor(MilSystem, SizeBand, SizeX, SizeY, Type,
+                           M_IMAGE+M_DISP+M_GRAB+M_PROC+SourceDataFormat, &PoolPtr->ImageDisp);
+            break;
+         }
+      MbufClear(PoolPtr->ImageDisp, M_COLOR_BLACK);
+      }
+
+   MappControl(M_ERROR, M_PRINT_DISABLE);
+
+   /* Create the grab buffers on the arena. */
+   if(PixelBytes(SizeBand, Type, SourceDataFormat))
+      {
+      PoolPtr->ArenaSize = (size_t)(PoolPtr->BufferBytes * BufferCount);
+      PoolPtr->Arena     = ArenaAlloc(&PoolPtr->ArenaSize, PoolFlags, NumaNode, PoolPtr);
+      }
+   if(PoolPtr->Arena)
+      {
+      for(; PoolPtr->GrabBufferListSize < BufferCount; PoolPtr->GrabBufferListSize++)
+         {
+         void* SliceAddress = (MIL_UINT8*)PoolPtr->Arena +
+                              PoolPtr->GrabBufferListSize * PoolPtr->BufferBytes;
+
+         MbufCreateColor(MilSystem, SizeBand, SizeX, SizeY, Type,
+                         M_IMAGE+M_GRAB+M_PROC+SourceDataFormat,
+                         M_HOST_ADDRESS+M_PITCH_BYTE, PitchByte, &SliceAddress,
+                         &PoolPtr->GrabBufferList[PoolPtr->GrabBufferListSize]);
+         if(!PoolPtr->GrabBufferList[PoolPtr->GrabBufferListSize])
+            break;
+         MbufClear(PoolPtr->GrabBufferList[PoolPtr->GrabBufferListSize], M_COLOR_WHITE);
+         }
+
+      /* Not grabbable on host memory: fall back to MIL buffers. */
+      if(PoolPtr->GrabBufferListSize == 0)
+         {
+         ArenaFree(PoolPtr->Arena, PoolPtr->ArenaSize);
+         PoolPtr->Arena          = M_NULL;
+         PoolPtr->ArenaHugePages = false;
+         PoolPtr->ArenaLocked    = false;
+         PoolPtr->ArenaNode      = CPU_NODE_UNKNOWN;
+         }
+      }
+
+   /* Allocate the grab buffers and clear them. */
+   if(!PoolPtr->Arena)
+      {
+      for(; PoolPtr->GrabBufferListSize < BufferCount; PoolPtr->GrabBufferListSize++)
+         {
+         MbufAllocColor(MilSystem, SizeBand, SizeX, SizeY, Type,
+                        M_IMAGE+M_GRAB+M_PROC+SourceDataFormat,
+                        &PoolPtr->GrabBufferList[PoolPtr->GrabBufferListSize]);
+
+         if(PoolPtr->GrabBufferList[PoolPtr->GrabBufferListSize])
+            MbufClear(PoolPtr->GrabBufferList[PoolPtr->GrabBufferListSize], M_COLOR_WHITE);
+         else
+            break;
+         }
+      }
+
+   MappControl(M_ERROR, M_PRINT_ENABLE);
+
+   /* Charge the memory actually allocated. */
+   PoolPtr->TotalBytes = PoolPtr->Arena ? (MIL_INT64)PoolPtr->ArenaSize :
+                         PoolPtr->GrabBufferListSize * PoolPtr->BufferBytes;
+   if(PoolPtr->ImageDisp)
+      PoolPtr->TotalBytes += BufferPoolDisplayBytes(SizeX, SizeY, PixelFormat,
+                                                    PoolPtr->BufferBytes, PoolFlags);
+   if(QueuePtr)
+      GrabQueueCharge(QueuePtr, PoolPtr->TotalBytes);
+
+   return PoolPtr;
+   }
+
+void BufferPoolFree(BufferPoolStruct* PoolPtr)
+   {
+   if(!PoolPtr)
+      return;
+
+   while(PoolPtr->GrabBufferListSize > 0)
+      MbufFree(PoolPtr->GrabBufferList[--PoolPtr->GrabBufferListSize]);
+   if(PoolPtr->ImageDisp)
+      MbufFree(PoolPtr->ImageDisp);
+   if(PoolPtr->Arena)
+      ArenaFree(PoolPtr->Arena, PoolPtr->ArenaSize);
+   if(PoolPtr->Queue)
+      GrabQueueCharge(PoolPtr->Queue, -PoolPtr->TotalBytes);
+
+   delete PoolPtr;
+   }
+
+bool BufferPoolMatches(const BufferPoolStruct* PoolPtr, MIL_INT SizeX, MIL_INT SizeY,
+                       MIL_INT PixelFormat)
+   {
+   return PoolPtr->FrameSizeX == SizeX && PoolPtr->FrameSizeY == SizeY &&
+          PoolPtr->FramePixelFormat == PixelFormat;
+   }
+
+/* Allocates the pool cache and starts the builder thread. The pools are    */
+/* placed on NumaNode if known and charged to QueuePtr. NotifyEvent is set  */
+/* every time a pool has been built.                                         */
+/* -----------------------------------------------------------------------   */
+PoolCacheStruct* PoolCacheAlloc(MIL_ID MilSystem, MIL_INT PoolFlags, MIL_INT NumaNode,
+                                MIL_ID NotifyEvent, GrabQueueStruct* QueuePtr)
+   {
+   PoolCacheStruct* CachePtr = new PoolCacheStruct;
+
+   CachePtr->MilSystem     = MilSystem;
+   CachePtr->PoolFlags     = PoolFlags;
+   CachePtr->NumaNode      = NumaNode;
+   CachePtr->Queue         = QueuePtr;
+   CachePtr->UseCount      = 0;
+   CachePtr->HitCount      = 0;
+   CachePtr->BuildCount    = 0;
+   CachePtr->EvictCount    = 0;
+   CachePtr->ExpireCount   = 0;
+   CachePtr->BuildTimeSum  = 0;
+   CachePtr->BuildTimeMax  = 0;
+   CachePtr->RequestBytes  = 0;
+   CachePtr->NotifyEvent   = NotifyEvent;
+   CachePtr->StopRequested = false;
+   CachePtr->Building      = false;
+   CachePtr->BuildTime     = 0;
+   CachePtr->BuiltPool     = M_NULL;
+   for(MIL_INT i = 0; i < POOL_CACHE_SIZE; i++)
+      CachePtr->Pools[i] = M_NULL;
+
+   MthrAlloc(MilSystem, M_EVENT, M_NOT_SIGNALED+M_AUTO_RESET, M_NULL, M_NULL,
+      &CachePtr->RequestEvent);
+   MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, &PoolBuilderThread, CachePtr,
+      &CachePtr->Thread);
+
+   return CachePtr;
+   }
+
+/* Stops the builder thread and frees the idle pools.                        */
+/* -----------------------------------------------------------------------   */
+void PoolCacheFree(PoolCacheStruct* CachePtr)
+   {
+   if(!CachePtr)
+      return;
+
+   CachePtr->StopRequested = true;
+   MthrControl(CachePtr->RequestEvent, M_EVENT_SET, M_SIGNALED);
+   MthrWait(CachePtr->Thread, M_THREAD_END_WAIT, M_NULL);
+   MthrFree(CachePtr->Thread);
+   MthrFree(CachePtr->RequestEvent);
+
+   /* A request the builder thread stopped before. */
+   if(CachePtr->Building && !CachePtr->BuiltPool.load())
+      GrabQueueCharge(CachePtr->Queue, -CachePtr->RequestBytes);
+
+   BufferPoolFree(CachePtr->BuiltPool.exchange(M_NULL));
+   for(MIL_INT i = 0; i < POOL_CACHE_SIZE; i++)
+      BufferPoolFree(CachePtr->Pools[i]);
+
+   delete CachePtr;
+   }
+
+/* Removes the idle pool of a data format from the cache. Returns M_NULL    */
+/* if there is none.                                                         */
+/* -----------------------------------------------------------------------   */
+BufferPoolStruct* PoolCacheTake(PoolCacheStruct* CachePtr, MIL_INT SizeX, MIL_INT SizeY,
+                                MIL_INT PixelFormat)
+   {
+   for(MIL_INT i = 0; i < POOL_CACHE_SIZE; i++)
+      {
+      BufferPoolStruct* PoolPtr = CachePtr->Pools[i];
+
+      if(PoolPtr && BufferPoolMatches(PoolPtr, SizeX, SizeY, PixelFormat))
+         {
+         CachePtr->Pools[i] = M_NULL;
+         CachePtr->HitCount++;
+         CachePtr->Queue->IdleBytes -= PoolPtr->TotalBytes;
+         return PoolPtr;
+         }
+      }
+   return M_NULL;
+   }
+
+/* Slot of the least recently used idle pool, -1 if there is none.        */
+/* -----------------------------------------------------------------------   */
+static MIL_INT LeastRecentlyUsed(const PoolCacheStruct* CachePtr)
+   {
+   MIL_INT Slot = -1;
+
+   for(MIL_INT i = 0; i < POOL_CACHE_SIZE; i++)
+      {
+      if(CachePtr->Pools[i] &&
+         (Slot < 0 || CachePtr->Pools[i]->LastUsed < CachePtr->Pools[Slot]->LastUsed))
+         Slot = i;
+      }
+   return Slot;
+   }
+
+static void FreeIdlePool(PoolCacheStruct* CachePtr, MIL_INT Slot)
+   {
+   CachePtr->Queue->IdleBytes -= CachePtr->Pools[Slot]->TotalBytes;
+   BufferPoolFree(CachePtr->Pools[Slot]);
+   CachePtr->Pools[Slot] = M_NULL;
+   }
+
+/* Puts a pool that is no longer grabbed into back in the cache. The least  */
+/* recently used pool is freed if the cache is full.                         */
+/* -----------------------------------------------------------------------   */
+void PoolCachePut(PoolCacheStruct* CachePtr, BufferPoolStruct* PoolPtr)
+   {
+   MIL_INT Slot = -1;
+
+   if(!PoolPtr)
+      return;
+
+   for(MIL_INT i = 0; i < POOL_CACHE_SIZE && Slot < 0; i++)
+      {
+      if(!CachePtr->Pools[i])
+         Slot = i;
+      }
+   if(Slot < 0)
+      {
+      Slot = LeastRecentlyUsed(CachePtr);
+      FreeIdlePool(CachePtr, Slot);
+      }
+   PoolPtr->LastUsed = ++CachePtr->UseCount;
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &PoolPtr->IdleSince);
+   CachePtr->Pools[Slot] = PoolPtr;
+   CachePtr->Queue->IdleBytes += PoolPtr->TotalBytes;
+   }
+
+/* Frees the least recently used idle pools until Bytes more fit in the    */
+/* memory budget, or there are none left.                                    */
+/* -----------------------------------------------------------------------   */
+void PoolCacheMakeRoom(PoolCacheStruct* CachePtr, MIL_INT64 Bytes)
+   {
+   while(GrabQueueOverBudget(CachePtr->Queue, Bytes) > 0)
+      {
+      MIL_INT Slot = LeastRecentlyUsed(CachePtr);
+
+      if(Slot < 0)
+         break;
+      FreeIdlePool(CachePtr, Slot);
+      CachePtr->EvictCount++;
+      }
+   }
+
+/* Frees the idle pools of the formats not seen for POOL_IDLE_TIMEOUT.     */
+/* -----------------------------------------------------------------------   */
+void PoolCacheExpire(PoolCacheStruct* CachePtr, MIL_DOUBLE CurrentTime)
+   {
+   for(MIL_INT i = 0; i < POOL_CACHE_SIZE; i++)
+      {
+      if(CachePtr->Pools[i] &&
+         CurrentTime - CachePtr->Pools[i]->IdleSince >= POOL_IDLE_TIMEOUT)
+         {
+         FreeIdlePool(CachePtr, i);
+         CachePtr->ExpireCount++;
+         }
+      }
+   }
+
+/* Time the next idle pool expires, 0 if there is none.                     */
+/* -----------------------------------------------------------------------   */
+MIL_DOUBLE PoolCacheNextExpiry(const PoolCacheStruct* CachePtr)
+   {
+   MIL_DOUBLE NextTime = 0;
+
+   for(MIL_INT i = 0; i < POOL_CACHE_SIZE; i++)
+      {
+      if(CachePtr->Pools[i] &&
+         (NextTime == 0 || CachePtr->Pools[i]->IdleSince + POOL_IDLE_TIMEOUT < NextTime))
+         NextTime = CachePtr->Pools[i]->IdleSince + POOL_IDLE_TIMEOUT;
+      }
+   return NextTime;
+   }
+
+/* Asks the builder thread for a pool of the given data format and number  */
+/* of buffers. Returns false if it is still busy with a previous request.    */
+/* -----------------------------------------------------------------------   */
+bool PoolCacheBuild(PoolCacheStruct* CachePtr, MIL_INT SizeX, MIL_INT SizeY,
+                    MIL_INT PixelFormat, MIL_INT BufferCount)
+   {
+   MIL_INT   SizeBand, Type;
+   MIL_INT64 SourceDataFormat, BufferBytes;
+
+   if(CachePtr->Building)
+      return false;
+
+   /* The pool is charged from now on; it is built alongside the others. */
+   GetBufferFormat(PixelFormat, &SizeBand, &Type, &SourceDataFormat);
+   BufferBytes = BufferPoolBufferBytes(SizeBand, SizeX, SizeY, Type, SourceDataFormat);
+   CachePtr->RequestBytes = BufferCount * BufferBytes +
+                            BufferPoolDisplayBytes(SizeX, SizeY, PixelFormat, BufferBytes,
+                                                   CachePtr->PoolFlags);
+   PoolCacheMakeRoom(CachePtr, CachePtr->RequestBytes);
+   GrabQueueCharge(CachePtr->Queue, CachePtr->RequestBytes);
+
+   CachePtr->Building           = true;
+   CachePtr->RequestSizeX       = SizeX;
+   CachePtr->RequestSizeY       = SizeY;
+   CachePtr->RequestPixelFormat = PixelFormat;
+   CachePtr->RequestBufferCount = BufferCount;
+   MthrControl(CachePtr->RequestEvent, M_EVENT_SET, M_SIGNALED);
+   return true;
+   }
+
+/* Returns the pool built by the builder thread, if it is done.             */
+/* -----------------------------------------------------------------------   */
+BufferPoolStruct* PoolCacheTakeBuilt(PoolCacheStruct* CachePtr)
+   {
+   BufferPoolStruct* PoolPtr = CachePtr->BuiltPool.exchange(M_NULL, std::memory_order_acquire);
+
+   if(PoolPtr)
+      {
+      CachePtr->Building = false;
+      CachePtr->BuildCount++;
+      CachePtr->BuildTimeSum += CachePtr->BuildTime;
+      if(CachePtr->BuildTime > CachePtr->BuildTimeMax)
+         CachePtr->BuildTimeMax = CachePtr->BuildTime;
+      }
+   return PoolPtr;
+   }
+
+/* Builder thread: allocates the requested pools.                            */
+/* -----------------------------------------------------------------------   */
+static MIL_UINT32 MFTYPE PoolBuilderThread(void* ThreadContext)
+   {
+   PoolCacheStruct* CachePtr = (PoolCacheStruct*)ThreadContext;
+
+   /* The buffers are first touched, when cleared, on the node of the NIC. */
+   if(CachePtr->NumaNode != CPU_NODE_UNKNOWN)
+      CpuTopologyBindThread(CachePtr->NumaNode);
+
+   for(;;)
+      {
+      BufferPoolStruct* PoolPtr;
+      MIL_INT           SizeBand, Type;
+      MIL_INT64         SourceDataFormat;
+      MIL_DOUBLE        BuildStart, BuildEnd;
+
+      MthrWait(CachePtr->RequestEvent, M_EVENT_WAIT, M_NULL);
+      if(CachePtr->StopRequested)
+         break;
+
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &BuildStart);
+      GetBufferFormat(CachePtr->RequestPixelFormat, &SizeBand, &Type, &SourceDataFormat);
+      PoolPtr = BufferPoolAlloc(CachePtr->MilSystem, SizeBand, CachePtr->RequestSizeX,
+                                CachePtr->RequestSizeY, Type, SourceDataFormat,
+                                CachePtr->RequestPixelFormat, CachePtr->RequestBufferCount,
+                                CachePtr->PoolFlags, CachePtr->NumaNode, CachePtr->Queue);
+      GrabQueueCharge(CachePtr->Queue, -CachePtr->RequestBytes);
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &BuildEnd);
+      CachePtr->BuildTime = BuildEnd - BuildStart;
+
+      CachePtr->BuiltPool.store(PoolPtr, std::memory_order_release);
+      if(CachePtr->NotifyEvent)
+         MthrControl(CachePtr->NotifyEvent, M_EVENT_SET, M_SIGNALED);
+      }
+
+   return 0;
+   }
@@ -0,0 +1,125 @@
+﻿/*************************************************************************************/
+/*
+ * File name: BufferPool.h
+ *
+ * Synopsis:  Grab buffer pools, one per data format. A pool for a new data format
+ *            is allocated by a builder thread while the grab keeps running in the
+ *            current pool, and the pools of recently used formats are kept in a
+ *            small cache so that switching back to them costs no allocation.
+ *
+ *            The grab buffers of a pool are slices of one contiguous arena,
+ *            optionally backed by huge pages and locked in memory, rather than
+ *            separate allocations. The arena is placed on the NUMA node of the
+ *            NIC of the stream, when known: its pages are bound to the node
+ *            before they are first touched, and the builder thread that clears
+ *            them runs on the node.
+ *
+ *            The memory of every pool, idle or being built too, is charged to the
+ *            budget of the grab queue, and the least recently used idle pools are
+ *            freed when a new pool would not fit in it. An idle pool is also freed
+ *            once its format has not been seen for POOL_IDLE_TIMEOUT.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <mil.h>
+#include <atomic>
+#include "GrabQueue.h"
+
+/* Number of idle pools kept for formats used recently. */
+#define POOL_CACHE_SIZE 3
+
+/* Seconds an idle pool is kept for its format to come back. */
+#define POOL_IDLE_TIMEOUT 60.0
+
+/* Pool allocation flags. */
+#define POOL_DISPLAY_BUFFER   0x1      /* Also allocate the display buffer.        */
+#define POOL_HUGE_PAGES       0x2      /* Back the arena with huge pages if can.   */
+#define POOL_LOCKED_MEMORY    0x4      /* Lock the arena in memory if can.         */
+
+#define POOL_SLICE_ALIGNMENT  4096
+
+/* Grab buffers, and the display buffer, for one data format. */
+typedef struct
+   {
+   MIL_INT    FrameSizeX;          /* Data format the pool was allocated for.       */
+   MIL_INT    FrameSizeY;
+   MIL_INT    FramePixelFormat;
+   MIL_INT    SizeBand;
+   MIL_INT    Type;
+   MIL_INT64  SourceDataFormat;
+   MIL_ID     GrabBufferList[BUFFERING_SIZE_MAX];
+   MIL_INT    GrabBufferListSize;
+   MIL_ID     ImageDisp;           /* 8-bit if the frames are converted to display. */
+   MIL_INT64  LastUsed;
+   MIL_DOUBLE IdleSince;           /* When it was put in the cache.                 */
+   void*      Arena;               /* M_NULL if the buffers were allocated by MIL.   */
+   size_t     ArenaSize;
+   bool       ArenaHugePages;
+   bool       ArenaLocked;
+   MIL_INT    ArenaNode;           /* Node the arena is bound to, or unknown.       */
+   MIL_INT64  BufferBytes;
+   MIL_INT64  TotalBytes;          /* Grab and display buffers.                     */
+   GrabQueueStruct* Queue;         /* Charged with TotalBytes, or M_NULL.           */
+   } BufferPoolStruct;
+
+/* Idle pools and the builder thread. Only the main thread takes and puts    */
+/* pools; the builder thread hands over the pool it built through BuiltPool. */
+typedef struct
+   {
+   MIL_ID                          MilSystem;
+   MIL_INT                         PoolFlags;
+   MIL_INT                         NumaNode;      /* Of the NIC, or unknown.      */
+   GrabQueueStruct*                Queue;         /* Charged for the pools.       */
+   BufferPoolStruct*               Pools[POOL_CACHE_SIZE];
+   MIL_INT64                       UseCount;
+   MIL_INT64                       HitCount;
+   MIL_INT64                       BuildCount;
+   MIL_INT64                       EvictCount;    /* Freed for memory.            */
+   MIL_INT64                       ExpireCount;   /* Freed when idle too long.    */
+   MIL_DOUBLE                      BuildTimeSum;  /* Of the pools taken, seconds. */
+   MIL_DOUBLE                      BuildTimeMax;
+
+   MIL_ID                          Thread;
+   MIL_ID                          RequestEvent;
+   MIL_ID                          NotifyEvent;   /* Set when a pool is built.    */
+   std::atomic<bool>               StopRequested;
+   bool                            Building;
+   MIL_INT                         RequestSizeX;
+   MIL_INT                         RequestSizeY;
+   MIL_INT                         RequestPixelFormat;
+   MIL_INT                         RequestBufferCount;
+   MIL_INT64                       RequestBytes;  /* Charged until it is built.   */
+   MIL_DOUBLE                      BuildTime;     /* Of BuiltPool.                */
+   std::atomic<BufferPoolStruct*>  BuiltPool;
+   } PoolCacheStruct;
+
+MIL_INT64 BufferPoolBufferBytes(MIL_INT SizeBand, MIL_INT SizeX, MIL_INT SizeY,
+                                MIL_INT Type, MIL_INT64 SourceDataFormat);
+MIL_INT64 BufferPoolDisplayBytes(MIL_INT SizeX, MIL_INT SizeY, MIL_INT PixelFormat,
+                                 MIL_INT64 BufferBytes, MIL_INT PoolFlags);
+BufferPoolStruct* BufferPoolAlloc(MIL_ID MilSystem, MIL_INT SizeBand, MIL_INT SizeX,
+                                  MIL_INT SizeY, MIL_INT Type, MIL_INT64 SourceDataFormat,
+                                  MIL_INT PixelFormat, MIL_INT BufferCount, MIL_INT PoolFlags,
+                                  MIL_INT NumaNode, GrabQueueStruct* QueuePtr);
+void BufferPoolFree(BufferPoolStruct* PoolPtr);
+bool BufferPoolMatches(const BufferPoolStruct* PoolPtr, MIL_INT SizeX, MIL_INT SizeY,
+                       MIL_INT PixelFormat);
+
+PoolCacheStruct* PoolCacheAlloc(MIL_ID MilSystem, MIL_INT PoolFlags, MIL_INT NumaNode,
+                                MIL_ID NotifyEvent, GrabQueueStruct* QueuePtr);
+void PoolCacheFree(PoolCacheStruct* CachePtr);
+BufferPoolStruct* PoolCacheTake(PoolCacheStruct* CachePtr, MIL_INT SizeX, MIL_INT SizeY,
+                                MIL_INT PixelFormat);
+void PoolCachePut(PoolCacheStruct* CachePtr, BufferPoolStruct* PoolPtr);
+void PoolCacheMakeRoom(PoolCacheStruct* CachePtr, MIL_INT64 Bytes);
+void PoolCacheExpire(PoolCacheStruct* CachePtr, MIL_DOUBLE CurrentTime);
+MIL_DOUBLE PoolCacheNextExpiry(const PoolCacheStruct* CachePtr);
+bool PoolCacheBuild(PoolCacheStruct* CachePtr, MIL_INT SizeX, MIL_INT SizeY,
+                    MIL_INT PixelFormat, MIL_INT BufferCount);
+BufferPoolStruct* PoolCacheTakeBuilt(PoolCacheStruct* CachePtr);
+
+#endif /* BUFFER_POOL_H */
@@ -0,0 +1,223 @@
+﻿/*************************************************************************************/
+/*
+ * File name: CpuTopology.cpp
+ *
+ * Synopsis:  NUMA nodes of the NICs and binding of the threads to their CPUs.
+ *
+ *            Linux: the nodes come from /sys/devices/system/node, the node of a
+ *            NIC from /sys/class/net/<interface>/device/numa_node (-1, or no such
+ *            file for virtual interfaces, when the platform does not tell), and
+ *            the interface of a group from the local address a UDP socket
+ *            connected to the group is bound to.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#if M_MIL_USE_WINDOWS
+#include <windows.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CpuTopology.h"
+
+#if !M_MIL_USE_WINDOWS
+
+/* Reads the first line of a sysfs file.                                     */
+/* -----------------------------------------------------------------------   */
+static bool ReadSysfsLine(const std::string& Path, std::string* LinePtr)
+   {
+   FILE* File = fopen(Path.c_str(), "r");
+   char  Line[4096];
+   bool  Read;
+
+   if(!File)
+      return false;
+   Read = fgets(Line, sizeof(Line), File) != M_NULL;
+   fclose(File);
+   if(!Read)
+      return false;
+
+   *LinePtr = Line;
+   while(!LinePtr->empty() && (LinePtr->back() == '\n' || LinePtr->back() == ' '))
+      LinePtr->pop_back();
+   return true;
+   }
+
+/* Parses a CPU or node list, such as "0-7,16-23".                           */
+/* -----------------------------------------------------------------------   */
+static void ParseList(const std::string& List, std::vector<int>* ValuesPtr)
+   {
+   const char* Position = List.c_str();
+
+   ValuesPtr->clear();
+   while(*Position)
+      {
+      char* End;
+      long  First = strtol(Position, &End, 10);
+      long  Last  = First;
+
+      if(End == Position)
+         break;
+      Position = End;
+      if(*Position == '-')
+         {
+         Last = strtol(Position + 1, &End, 10);
+         Position = End;
+         }
+      for(long Value = First; Value <= Last; Value++)
+         ValuesPtr->push_back((int)Value);
+      if(*Position == ',')
+         Position++;
+      }
+   }
+
+MIL_INT CpuTopologyNodeCount(void)
+   {
+   std::string      Line;
+   std::vector<int> Nodes;
+
+   if(!ReadSysfsLine("/sys/devices/system/node/online", &Line))
+      return 1;
+   ParseList(Line, &Nodes);
+   return Nodes.empty() ? 1 : (MIL_INT)Nodes.back() + 1;
+   }
+
+bool CpuTopologyNodeCpus(MIL_INT Node, std::vector<int>* CpusPtr)
+   {
+   std::string Line;
+
+   CpusPtr->clear();
+   if(Node < 0 ||
+      !ReadSysfsLine("/sys/devices/system/node/node" + std::to_string((long long)Node) +
+                     "/cpulist", &Line))
+      return false;
+   ParseList(Line, CpusPtr);
+   return !CpusPtr->empty();
+   }
+
+/* Interface the route to a multicast group goes out of, empty if unknown.  */
+/* No packet is sent: connecting a UDP socket only selects the route.        */
+/* -----------------------------------------------------------------------   */
+std::string CpuTopologyRouteInterface(const MIL_STRING& MulticastAddress, MIL_INT UdpPort)
+   {
+   sockaddr_in Group, Local;
+   socklen_t   LocalSize = sizeof(Local);
+   ifaddrs*    Interfaces = M_NULL;
+   std::string Name;
+   int         Socket;
+
+   memset(&Group, 0, sizeof(Group));
+   Group.sin_family = AF_INET;
+   Group.sin_port   = htons((uint16_t)UdpPort);
+   if(inet_pton(AF_INET, MulticastAddress.c_str(), &Group.sin_addr) != 1)
+      return Name;
+
+   Socket = socket(AF_INET, SOCK_DGRAM, 0);
+   if(Socket < 0)
+      return Name;
+   if(connect(Socket, (sockaddr*)&Group, sizeof(Group)) != 0 ||
+      getsockname(Socket, (sockaddr*)&Local, &LocalSize) != 0)
+      {
+      close(Socket);
+      return Name;
+      }
+   close(Socket);
+
+   if(getifaddrs(&Interfaces) != 0)
+      return Name;
+   for(ifaddrs* InterfacePtr = Interfaces; InterfacePtr; InterfacePtr = InterfacePtr->ifa_next)
+      {
+      if(InterfacePtr->ifa_addr && InterfacePtr->ifa_addr->sa_family == AF_INET &&
+         ((sockaddr_in*)InterfacePtr->ifa_addr)->sin_addr.s_addr == Local.sin_addr.s_addr)
+         {
+         Name = InterfacePtr->ifa_name;
+         break;
+         }
+      }
+   freeifaddrs(Interfaces);
+   return Name;
+   }
+
+MIL_INT CpuTopologyInterfaceNode(const std::string& Interface)
+   {
+   std::string Line;
+
+   if(Interface.empty() ||
+      !ReadSysfsLine("/sys/class/net/" + Interface + "/device/numa_node", &Line))
+      return CPU_NODE_UNKNOWN;
+   return atoi(Line.c_str()) >= 0 ? (MIL_INT)atoi(Line.c_str()) : CPU_NODE_UNKNOWN;
+   }
+
+/* Binds the calling thread to the CPUs of a node.                           */
+/* -----------------------------------------------------------------------   */
+bool CpuTopologyBindThread(MIL_INT Node)
+   {
+   std::vector<int> Cpus;
+   cpu_set_t        Set;
+
+   if(!CpuTopologyNodeCpus(Node, &Cpus))
+      return false;
+
+   CPU_ZERO(&Set);
+   for(size_t i = 0; i < Cpus.size(); i++)
+      {
+      if(Cpus[i] < CPU_SETSIZE)
+         CPU_SET(Cpus[i], &Set);
+      }
+   return pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set) == 0;
+   }
+
+#else
+
+MIL_INT CpuTopologyNodeCount(void)
+   {
+   ULONG HighestNode = 0;
+
+   return GetNumaHighestNodeNumber(&HighestNode) ? (MIL_INT)HighestNode + 1 : 1;
+   }
+
+bool CpuTopologyNodeCpus(MIL_INT Node, std::vector<int>* CpusPtr)
+   {
+   GROUP_AFFINITY Affinity;
+
+   CpusPtr->clear();
+   if(Node < 0 || !GetNumaNodeProcessorMaskEx((USHORT)Node, &Affinity))
+      return false;
+   for(int Bit = 0; Bit < (int)(8 * sizeof(KAFFINITY)); Bit++)
+      {
+      if(Affinity.Mask & ((KAFFINITY)1 << Bit))
+         CpusPtr->push_back(Affinity.Group * (int)(8 * sizeof(KAFFINITY)) + Bit);
+      }
+   return !CpusPtr->empty();
+   }
+
+std::string CpuTopologyRouteInterface(const MIL_STRING& MulticastAddress, MIL_INT UdpPort)
+   {
+   return std::string();
+   }
+
+MIL_INT CpuTopologyInterfaceNode(const std::string& Interface)
+   {
+   return CPU_NODE_UNKNOWN;
+   }
+
+bool CpuTopologyBindThread(MIL_INT Node)
+   {
+   GROUP_AFFINITY Affinity;
+
+   if(Node < 0 || !GetNumaNodeProcessorMaskEx((USHORT)Node, &Affinity))
+      return false;
+   return SetThreadGroupAffinity(GetCurrentThread(), &Affinity, M_NULL) != 0;
+   }
+
+#endif
@@ -0,0 +1,33 @@
+﻿/*************************************************************************************/
+/*
+ * File name: CpuTopology.h
+ *
+ * Synopsis:  NUMA placement of the threads of a stream. The node of the NIC a
+ *            multicast group is received on is read from sysfs, through the
+ *            interface the route to the group goes out of, and the threads that
+ *            receive and process the stream are bound to the CPUs of that node,
+ *            so that the packets, the grab buffers and the processing stay on the
+ *            memory controller closest to the NIC.
+ *
+ *            On Windows, the threads can be bound to a node but the node of a
+ *            NIC is not known: streams are left unbound.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <mil.h>
+#include <string>
+#include <vector>
+
+#define CPU_NODE_UNKNOWN  (-1)
+
+MIL_INT CpuTopologyNodeCount(void);
+bool CpuTopologyNodeCpus(MIL_INT Node, std::vector<int>* CpusPtr);
+std::string CpuTopologyRouteInterface(const MIL_STRING& MulticastAddress, MIL_INT UdpPort);
+MIL_INT CpuTopologyInterfaceNode(const std::string& Interface);
+bool CpuTopologyBindThread(MIL_INT Node);
+
+#endif /* CPU_TOPOLOGY_H */
@@ -0,0 +1,287 @@
+﻿/*************************************************************************************/
+/*
+ * File name: DisplayStage.cpp
+ *
+ * Synopsis:  Display stage decoupled from the grab rate.
+ *
+ *            A published grab buffer stays referenced until the display thread
+ *            has copied it or a newer frame replaced it in the slot, so the grab
+ *            cannot reuse it in the meantime. If the grab needs that buffer
+ *            back before the next display update, the hook revokes it from the
+ *            slot instead of waiting for the display.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "MulticastMonitor.h"
+
+static MIL_UINT32 MFTYPE DisplayStageThread(void* ThreadContext);
+
+/* Allocates the display stage and starts its thread.                        */
+/* -----------------------------------------------------------------------   */
+DisplayStageStruct* DisplayStageAlloc(MIL_DOUBLE DisplayRate,
+                                      const ThreadPlacementStruct* PlacementPtr,
+                                      void* HookDataPtr)
+   {
+   DisplayStageStruct* DisplayPtr = new DisplayStageStruct;
+
+   DisplayPtr->HookDataPtr    = HookDataPtr;
+   DisplayPtr->DisplayRate    = DisplayRate;
+   DisplayPtr->Placement      = *PlacementPtr;
+   DisplayPtr->LatestSlot     = DISPLAY_SLOT_EMPTY;
+   DisplayPtr->StopRequested  = false;
+   DisplayPtr->PauseRequested = false;
+   DisplayPtr->Rendering      = false;
+   DisplayPtr->PublishedCount = 0;
+   DisplayPtr->RenderedCount  = 0;
+   DisplayPtr->SkippedCount   = 0;
+   DisplayPtr->RevokedCount   = 0;
+   DisplayPtr->BytesCopied    = 0;
+
+   MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, &DisplayStageThread, DisplayPtr,
+      &DisplayPtr->Thread);
+
+   return DisplayPtr;
+   }
+
+/* Stops the display thread and frees the display stage.                     */
+/* -----------------------------------------------------------------------   */
+void DisplayStageFree(DisplayStageStruct* DisplayPtr)
+   {
+   if(!DisplayPtr)
+      return;
+
+   DisplayPtr->StopRequested = true;
+   MthrWait(DisplayPtr->Thread, M_THREAD_END_WAIT, M_NULL);
+   MthrFree(DisplayPtr->Thread);
+
+   DisplayStagePause(DisplayPtr);
+   delete DisplayPtr;
+   }
+
+/* Makes a processed grab buffer the latest frame to display. The frame it   */
+/* replaces, if any, is skipped without having been copied.                  */
+/* -----------------------------------------------------------------------   */
+void DisplayStagePublish(DisplayStageStruct* DisplayPtr, MIL_INT BufferIndex)
+   {
+   HookDataStruct* HookDataPtr = (HookDataStruct*)DisplayPtr->HookDataPtr;
+   MIL_INT         Previous;
+
+   AcquireGrabBuffer(HookDataPtr, BufferIndex);
+   Previous = DisplayPtr->LatestSlot.exchange(BufferIndex, std::memory_order_acq_rel);
+   if(Previous != DISPLAY_SLOT_EMPTY)
+      {
+      ReleaseGrabBuffer(HookDataPtr, Previous);
+      DisplayPtr->SkippedCount.fetch_add(1, std::memory_order_relaxed);
+      }
+   DisplayPtr->PublishedCount.fetch_add(1, std::memory_order_relaxed);
+   }
+
+/* Takes back a buffer that is waiting in the slot. Returns true if the     */
+/* buffer was waiting there and is released.                                 */
+/* -----------------------------------------------------------------------   */
+bool DisplayStageRevoke(DisplayStageStruct* DisplayPtr, MIL_INT BufferIndex)
+   {
+   MIL_INT Expected = BufferIndex;
+
+   if(DisplayPtr->LatestSlot.compare_exchange_strong(Expected, DISPLAY_SLOT_EMPTY,
+                                                     std::memory_order_acq_rel))
+      {
+      ReleaseGrabBuffer((HookDataStruct*)DisplayPtr->HookDataPtr, BufferIndex);
+      DisplayPtr->RevokedCount.fetch_add(1, std::memory_order_relaxed);
+      return true;
+      }
+   return false;
+   }
+
+/* Empties the slot and waits for the display thread to be idle, so that    */
+/* the grab and display buffers can be reallocated.                          */
+/* -----------------------------------------------------------------------   */
+void DisplayStagePause(DisplayStageStruct* DisplayPtr)
+   {
+   MIL_INT Previous;
+
+   DisplayPtr->PauseRequested.store(true);
+   while(DisplayPtr->Rendering.load())
+      std::this_thread::yield();
+
+   Previous = DisplayPtr->LatestSlot.exchange(DISPLAY_SLOT_EMPTY);
+   if(Previous != DISPLAY_SLOT_EMPTY)
+      ReleaseGrabBuffer((HookDataStruct*)DisplayPtr->HookDataPtr, Previous);
+   }
+
+void DisplayStageResume(DisplayStageStruct* DisplayPtr)
+   {
+   DisplayPtr->PauseRequested.store(false);
+   }
+
+/* Prints the display statistics.                                           */
+/* -----------------------------------------------------------------------   */
+void DisplayStagePrintStatistics(DisplayStageStruct* DisplayPtr)
+   {
+   MIL_INT64 Rendered = DisplayPtr->RenderedCount.load();
+
+   MosPrintf(MIL_TEXT("\nDisplay stage (%.1f Hz):\n"), DisplayPtr->DisplayRate);
+   MosPrintf(MIL_TEXT("  Frames published:        %lld\n"),
+      (long long)DisplayPtr->PublishedCount.load());
+   MosPrintf(MIL_TEXT("  Frames displayed:        %lld\n"), (long long)Rendered);
+   MosPrintf(MIL_TEXT("  Frames skipped:          %lld (%lld taken back by the grab)\n"),
+      (long long)(DisplayPtr->SkippedCount.load() + DisplayPtr->RevokedCount.load()),
+      (long long)DisplayPtr->RevokedCount.load());
+   MosPrintf(MIL_TEXT("  Bytes copied per frame:  %.0f\n"), Rendered ?
+      (MIL_DOUBLE)DisplayPtr->BytesCopied / Rendered : 0.0);
+   }
+
+/* Draws the overlay of a frame on the display buffer. MgraText is only    */
+/* used if the display buffer cannot be drawn into directly.                 */
+/* -----------------------------------------------------------------------   */
+static void DrawOverlay(HookDataStruct* HookData, MIL_INT64 FrameCount, MIL_ID GraphicContext)
+   {
+   FrameOverlayStruct* OverlayPtr = HookData->Overlay;
+   char                Line[OVERLAY_LINE_MAX + 1];
+   MIL_TEXT_CHAR       Text[OVERLAY_LINE_MAX + 1];
+   MIL_INT             PosY = OVERLAY_POS_Y;
+
+   if(FrameOverlayDraw(OverlayPtr, FrameCount))
+      return;
+
+   for(int Field = 0; Field < eOverlayFieldCount; Field++)
+      {
+      size_t Length;
+
+      if(!(OverlayPtr->FieldMask & (1u << Field)))
+         continue;
+      Length = FrameOverlayFormatLine(OverlayPtr, (OverlayFieldType)Field, FrameCount, Line);
+      for(size_t i = 0; i <= Length; i++)
+         Text[i] = (MIL_TEXT_CHAR)Line[i];
+      MgraText(GraphicContext, HookData->MilImageDisp, OVERLAY_POS_X, PosY, Text);
+      PosY += 16;
+      }
+   }
+
+/* Copies rows of a frame shown as it is; the display buffer has the format */
+/* of the grab buffer, so a row is at most the smaller of the two pitches.  */
+/* -----------------------------------------------------------------------   */
+static void CopyRows(const ConvertJobStruct* JobPtr, uint32_t FirstRow, uint32_t RowCount)
+   {
+   size_t RowBytes = (size_t)(JobPtr->SrcPitch < JobPtr->DstPitch ? JobPtr->SrcPitch :
+                                                                    JobPtr->DstPitch);
+
+   for(uint32_t y = FirstRow; y < FirstRow + RowCount; y++)
+      memcpy(JobPtr->Dst + y * JobPtr->DstPitch, JobPtr->Src + y * JobPtr->SrcPitch, RowBytes);
+   }
+
+/* Copies a grab buffer to the display buffer, converting it to 8 bits with  */
+/* the pixel conversion kernels if the display buffer was allocated for it, */
+/* and draws the overlay on it. Returns the bytes read from the grab buffer. */
+/* When the buffers can be addressed, the rows the overlay covers are done  */
+/* last, OVERLAY_ROW_STEP at a time, and the overlay rows are copied over   */
+/* each step while it is still in the cache.                                 */
+/* -----------------------------------------------------------------------   */
+MIL_INT64 DisplayStageCopy(void* HookDataPtr, MIL_ID BufferId, MIL_INT BufferIndex,
+                           MIL_ID GraphicContext)
+   {
+   HookDataStruct*     HookData   = (HookDataStruct*)HookDataPtr;
+   BufferPoolStruct*   PoolPtr    = HookData->ActivePool;
+   FrameOverlayStruct* OverlayPtr = HookData->Overlay;
+   ConvertJobStruct    Job;
+   MIL_UINT8*          SrcAddress = M_NULL;
+   MIL_UINT8*          DstAddress = M_NULL;
+   uint32_t            BandRows   = 0;
+   MIL_INT64           Bytes;
+
+   Job.Operation = PoolPtr ? PixelConvertDisplayOperation((uint32_t)PoolPtr->FramePixelFormat) :
+                             eConvertNone;
+   if(PoolPtr)
+      {
+      MbufInquire(BufferId, M_HOST_ADDRESS, &SrcAddress);
+      MbufInquire(HookData->MilImageDisp, M_HOST_ADDRESS, &DstAddress);
+      }
+   if(!SrcAddress || !DstAddress)
+      {
+      MbufCopy(BufferId, HookData->MilImageDisp);
+      if(OverlayPtr)
+         DrawOverlay(HookData, HookData->BufferFrameCount[BufferIndex], GraphicContext);
+      return MbufInquire(BufferId, M_SIZE_BYTE, M_NULL);
+      }
+
+   Job.PixelFormat = (uint32_t)PoolPtr->FramePixelFormat;
+   Job.SizeX       = (uint32_t)PoolPtr->FrameSizeX;
+   Job.SizeY       = (uint32_t)PoolPtr->FrameSizeY;
+   Job.Src         = SrcAddress;
+   Job.SrcPitch    = MbufInquire(BufferId, M_PITCH_BYTE, M_NULL);
+   Job.Dst         = DstAddress;
+   Job.DstPitch    = MbufInquire(HookData->MilImageDisp, M_PITCH_BYTE, M_NULL);
+   Bytes           = Job.Operation == eConvertNone ?
+                     MbufInquire(BufferId, M_SIZE_BYTE, M_NULL) :
+                     (MIL_INT64)(PixelConvertSourceRowBytes(&Job) * Job.SizeY);
+
+   if(OverlayPtr)
+      BandRows = FrameOverlayCompose(OverlayPtr, HookData->BufferFrameCount[BufferIndex]);
+   if(BandRows > Job.SizeY)
+      BandRows = Job.SizeY;
+   if(Job.Operation == eConvertNone)
+      MbufCopyColor2d(BufferId, HookData->MilImageDisp, M_ALL_BANDS, 0, BandRows, M_ALL_BANDS,
+                      0, BandRows, Job.SizeX, Job.SizeY - BandRows);
+   else
+      PixelConvertRunRows(HookData->Converter, &Job, BandRows, Job.SizeY - BandRows);
+   for(uint32_t Row = 0; Row < BandRows; Row += OVERLAY_ROW_STEP)
+      {
+      uint32_t Rows = BandRows - Row < OVERLAY_ROW_STEP ? BandRows - Row : OVERLAY_ROW_STEP;
+
+      if(Job.Operation == eConvertNone)
+         CopyRows(&Job, Row, Rows);
+      else
+         PixelConvertRows(&Job, Row, Rows);
+      FrameOverlayDrawRows(OverlayPtr, Row, Rows);
+      }
+   if(OverlayPtr && BandRows == 0)
+      DrawOverlay(HookData, HookData->BufferFrameCount[BufferIndex], GraphicContext);
+   return Bytes;
+   }
+
+/* Display thread: copies the latest frame once per display period.          */
+/* -----------------------------------------------------------------------   */
+static MIL_UINT32 MFTYPE DisplayStageThread(void* ThreadContext)
+   {
+   DisplayStageStruct* DisplayPtr  = (DisplayStageStruct*)ThreadContext;
+   HookDataStruct*     HookDataPtr = (HookDataStruct*)DisplayPtr->HookDataPtr;
+   auto                Period      = std::chrono::nanoseconds((long long)(1e9 /
+                                     (DisplayPtr->DisplayRate > 0 ? DisplayPtr->DisplayRate : 60)));
+   auto                NextUpdate  = std::chrono::steady_clock::now();
+
+   ThreadPlacementApply(&DisplayPtr->Placement, eThreadDisplay, THREAD_INDEX_ANY);
+
+   while(!DisplayPtr->StopRequested)
+      {
+      NextUpdate += Period;
+      std::this_thread::sleep_until(NextUpdate);
+
+      DisplayPtr->Rendering.store(true);
+      if(!DisplayPtr->PauseRequested.load())
+         {
+         MIL_INT BufferIndex = DisplayPtr->LatestSlot.exchange(DISPLAY_SLOT_EMPTY,
+                                                               std::memory_order_acq_rel);
+         if(BufferIndex != DISPLAY_SLOT_EMPTY)
+            {
+            MIL_ID BufferId = HookDataPtr->MilGrabBufferList[BufferIndex];
+
+            DisplayPtr->BytesCopied += DisplayStageCopy(HookDataPtr, BufferId, BufferIndex,
+                                                        M_DEFAULT);
+            ReleaseGrabBuffer(HookDataPtr, BufferIndex);
+            DisplayPtr->RenderedCount.fetch_add(1, std::memory_order_relaxed);
+            }
+         }
+      DisplayPtr->Rendering.store(false);
+
+      /* Do not try to catch up after a stall. */
+      if(NextUpdate < std::chrono::steady_clock::now())
+         NextUpdate = std::chrono::steady_clock::now();
+      }
+
+   return 0;
+   }
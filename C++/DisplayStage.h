@@ -0,0 +1,53 @@
+﻿/*************************************************************************************/
+/*
+ * File name: DisplayStage.h
+ *
+ * Synopsis:  Display stage decoupled from the grab rate. Processed frames are
+ *            published into a single "latest frame" slot; a display thread copies
+ *            the latest one into the display buffer at the display rate. Together
+ *            with the grab buffer being filled and the display buffer, the slot
+ *            forms a triple buffer: frames published in between two display
+ *            updates are replaced in the slot and never copied.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef DISPLAY_STAGE_H
+#define DISPLAY_STAGE_H
+
+#include <mil.h>
+#include <atomic>
+#include "ThreadPlacement.h"
+
+#define DISPLAY_SLOT_EMPTY (-1)
+
+typedef struct
+   {
+   void*                  HookDataPtr;
+   MIL_ID                 Thread;
+   MIL_DOUBLE             DisplayRate;
+   ThreadPlacementStruct  Placement;
+   std::atomic<MIL_INT>   LatestSlot;       /* Grab buffer index, or empty.        */
+   std::atomic<bool>      StopRequested;
+   std::atomic<bool>      PauseRequested;
+   std::atomic<bool>      Rendering;
+   std::atomic<MIL_INT64> PublishedCount;
+   std::atomic<MIL_INT64> RenderedCount;
+   std::atomic<MIL_INT64> SkippedCount;
+   std::atomic<MIL_INT64> RevokedCount;
+   MIL_INT64              BytesCopied;
+   } DisplayStageStruct;
+
+DisplayStageStruct* DisplayStageAlloc(MIL_DOUBLE DisplayRate,
+                                      const ThreadPlacementStruct* PlacementPtr,
+                                      void* HookDataPtr);
+void DisplayStageFree(DisplayStageStruct* DisplayPtr);
+void DisplayStagePublish(DisplayStageStruct* DisplayPtr, MIL_INT BufferIndex);
+bool DisplayStageRevoke(DisplayStageStruct* DisplayPtr, MIL_INT BufferIndex);
+void DisplayStagePause(DisplayStageStruct* DisplayPtr);
+void DisplayStageResume(DisplayStageStruct* DisplayPtr);
+void DisplayStagePrintStatistics(DisplayStageStruct* DisplayPtr);
+MIL_INT64 DisplayStageCopy(void* HookDataPtr, MIL_ID BufferId, MIL_INT BufferIndex,
+                           MIL_ID GraphicContext);
+
+#endif /* DISPLAY_STAGE_H */
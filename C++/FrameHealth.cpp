@@ -0,0 +1,509 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameHealth.cpp
+ *
+ * Synopsis:  Image health analysis of the grabbed frames.
+ *
+ *            A row is first brought to 8 bits, one value per pixel: the samples
+ *            of mono and Bayer formats shifted down, the green of RGB formats,
+ *            the luma of YUV 4:2:2. The SSE2 row kernel then sums the values and
+ *            their differences to the pixel Distance to the right (SAD against
+ *            the row shifted), and counts the dark and saturated pixels in byte
+ *            counters flushed every 255 vectors. The histogram is scalar, over
+ *            one pixel in HEALTH_HISTOGRAM_STEP, in four tables so that equal
+ *            values in a row do not wait on each other.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <string.h>
+#include <chrono>
+#include "GvspProtocol.h"
+#include "FrameHealth.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define HEALTH_SSE2 1
+#include <emmintrin.h>
+#else
+#define HEALTH_SSE2 0
+#endif
+
+/* Where the analysed value is in the pixels of a format. */
+typedef struct
+   {
+   uint32_t SampleBytes;      /* 1, or 2 for the formats unpacked to 16 bits.     */
+   uint32_t Step;             /* Samples from a pixel to the next.                */
+   uint32_t Offset;           /* Sample of the pixel analysed.                    */
+   uint32_t Shift;            /* To 8 bits.                                       */
+   uint32_t Distance;         /* Pixels between the two ends of a gradient: 2 in  */
+                              /* a Bayer mosaic, to compare the same colour.      */
+   } HealthFormatStruct;
+
+/* Sums of a set of rows. */
+typedef struct
+   {
+   uint64_t Sum;
+   uint64_t Dark;
+   uint64_t Saturated;
+   uint64_t Gradient;
+   uint64_t PixelCount;
+   uint64_t GradientCount;
+   } HealthSumsStruct;
+
+static bool GetFormat(uint32_t PixelFormat, HealthFormatStruct* FormatPtr)
+   {
+   HealthFormatStruct Format = { 1, 1, 0, 0, 1 };
+
+   switch(PixelFormat)
+      {
+      case PFNC_MONO8:
+         break;
+      case PFNC_MONO10:
+      case PFNC_MONO10_PACKED:
+      case PFNC_MONO10P:
+         Format.SampleBytes = 2;
+         Format.Shift       = 2;
+         break;
+      case PFNC_MONO12:
+      case PFNC_MONO12_PACKED:
+      case PFNC_MONO12P:
+         Format.SampleBytes = 2;
+         Format.Shift       = 4;
+         break;
+      case PFNC_MONO16:
+         Format.SampleBytes = 2;
+         Format.Shift       = 8;
+         break;
+      case PFNC_BAYER_GR8:
+      case PFNC_BAYER_RG8:
+      case PFNC_BAYER_GB8:
+      case PFNC_BAYER_BG8:
+         Format.Distance = 2;
+         break;
+      case PFNC_RGB8:
+      case PFNC_BGR8:
+         Format.Step   = 3;
+         Format.Offset = 1;
+         break;
+      case PFNC_BGRA8:
+         Format.Step   = 4;
+         Format.Offset = 1;
+         break;
+      case PFNC_YUV422_8:
+         Format.Step = 2;
+         break;
+      default:
+         return false;
+      }
+   *FormatPtr = Format;
+   return true;
+   }
+
+bool FrameHealthSupports(uint32_t PixelFormat)
+   {
+   HealthFormatStruct Format;
+
+   return GetFormat(PixelFormat, &Format);
+   }
+
+FrameHealthStruct* FrameHealthAlloc(uint32_t Period)
+   {
+   FrameHealthStruct* HealthPtr = new FrameHealthStruct;
+
+   HealthPtr->Period            = Period > 0 ? Period : 1;
+   HealthPtr->Busy              = false;
+   HealthPtr->LastHash          = 0;
+   HealthPtr->LastHashValid     = false;
+   HealthPtr->SharpnessBaseline = 0;
+   HealthPtr->BaselineCount     = 0;
+   HealthPtr->Mean              = 0;
+   HealthPtr->DarkRatio         = 0;
+   HealthPtr->SaturatedRatio    = 0;
+   HealthPtr->Sharpness         = 0;
+   for(int i = 0; i < eHealthLevelCount; i++)
+      HealthPtr->Levels[i] = 0;
+   for(int i = 0; i < eHealthAlertCount; i++)
+      {
+      HealthPtr->Streaks[i]     = 0;
+      HealthPtr->AlertCounts[i] = 0;
+      }
+   HealthPtr->ActiveAlerts      = 0;
+   HealthPtr->FrameCount        = 0;
+   HealthPtr->RepeatCount       = 0;
+   HealthPtr->BusyCount         = 0;
+   HealthPtr->AnalysisTime      = 0;
+   HealthPtr->AnalysisTimeMax   = 0;
+   HealthPtr->ReportedAlerts    = 0;
+   return HealthPtr;
+   }
+
+void FrameHealthFree(FrameHealthStruct* HealthPtr)
+   {
+   delete HealthPtr;
+   }
+
+const char* FrameHealthAlertName(HealthAlertType Alert)
+   {
+   switch(Alert)
+      {
+      case eHealthFrozen: return "frozen";
+      case eHealthBlack:  return "black";
+      case eHealthBlown:  return "blown";
+      case eHealthFocus:  return "focus";
+      default:            return "?";
+      }
+   }
+
+/* Hash of the raw bytes of a row, four 64-bit lanes of multiply-rotate     */
+/* rounds so that the multiplications overlap.                               */
+/* -----------------------------------------------------------------------   */
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+
+static inline uint64_t HashRound(uint64_t Lane, uint64_t Word)
+   {
+   Lane += Word * HASH_PRIME2;
+   Lane  = (Lane << 31) | (Lane >> 33);
+   return Lane * HASH_PRIME1;
+   }
+
+static uint64_t HashBytes(uint64_t Seed, const uint8_t* Data, size_t Bytes)
+   {
+   uint64_t Lanes[4] = { Seed + HASH_PRIME1, Seed + HASH_PRIME2, Seed, Seed - HASH_PRIME1 };
+   uint64_t Word, Hash;
+   size_t   i = 0;
+
+   for(; i + 32 <= Bytes; i += 32)
+      {
+      for(int l = 0; l < 4; l++)
+         {
+         memcpy(&Word, Data + i + 8 * l, sizeof(Word));
+         Lanes[l] = HashRound(Lanes[l], Word);
+         }
+      }
+   for(; i + 8 <= Bytes; i += 8)
+      {
+      memcpy(&Word, Data + i, sizeof(Word));
+      Lanes[0] = HashRound(Lanes[0], Word);
+      }
+   if(i < Bytes)
+      {
+      Word = 0;
+      memcpy(&Word, Data + i, Bytes - i);
+      Lanes[1] = HashRound(Lanes[1], Word);
+      }
+
+   Hash = HashRound(HashRound(HashRound(HashRound(Bytes, Lanes[0]), Lanes[1]), Lanes[2]),
+                    Lanes[3]);
+   return Hash ^ (Hash >> 29);
+   }
+
+/* Brings a row to 8 bits, one value per pixel. Rows of 8-bit samples with  */
+/* one sample per pixel are used as they are.                                */
+/* -----------------------------------------------------------------------   */
+static const uint8_t* RowTo8Bits(FrameHealthStruct* HealthPtr, const HealthFormatStruct* FormatPtr,
+                                 const uint8_t* Src, uint32_t SizeX)
+   {
+   uint8_t* Dst = HealthPtr->Row.data();
+   uint32_t x   = 0;
+
+   if(FormatPtr->SampleBytes == 1 && FormatPtr->Step == 1)
+      return Src;
+
+#if HEALTH_SSE2
+   if(FormatPtr->SampleBytes == 2)
+      {
+      __m128i Shift = _mm_cvtsi32_si128((int)FormatPtr->Shift);
+
+      for(; x + 16 <= SizeX; x += 16)
+         {
+         __m128i Low  = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(Src + 2 * x)), Shift);
+         __m128i High = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(Src + 2 * x + 16)), Shift);
+         _mm_storeu_si128((__m128i*)(Dst + x), _mm_packus_epi16(Low, High));
+         }
+      }
+   else if(FormatPtr->Step == 2)
+      {
+      __m128i Mask = _mm_set1_epi16(0x00FF);
+
+      for(; x + 16 <= SizeX; x += 16)
+         {
+         __m128i Low  = _mm_and_si128(_mm_loadu_si128((const __m128i*)(Src + 2 * x)), Mask);
+         __m128i High = _mm_and_si128(_mm_loadu_si128((const __m128i*)(Src + 2 * x + 16)), Mask);
+         _mm_storeu_si128((__m128i*)(Dst + x), _mm_packus_epi16(Low, High));
+         }
+      }
+   else if(FormatPtr->Step == 4)
+      {
+      __m128i Mask = _mm_set1_epi32(0xFF);
+
+      for(; x + 16 <= SizeX; x += 16)
+         {
+         const __m128i* SrcPtr = (const __m128i*)(Src + 4 * x);
+         __m128i A = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128(SrcPtr + 0), 8), Mask);
+         __m128i B = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128(SrcPtr + 1), 8), Mask);
+         __m128i C = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128(SrcPtr + 2), 8), Mask);
+         __m128i D = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128(SrcPtr + 3), 8), Mask);
+         _mm_storeu_si128((__m128i*)(Dst + x),
+                          _mm_packus_epi16(_mm_packs_epi32(A, B), _mm_packs_epi32(C, D)));
+         }
+      }
+#endif
+
+   if(FormatPtr->SampleBytes == 2)
+      {
+      for(; x < SizeX; x++)
+         {
+         uint32_t Value = (uint32_t)(Src[2 * x] | (Src[2 * x + 1] << 8)) >> FormatPtr->Shift;
+         Dst[x] = (uint8_t)(Value < 255 ? Value : 255);
+         }
+      }
+   else
+      {
+      for(; x < SizeX; x++)
+         Dst[x] = Src[x * FormatPtr->Step + FormatPtr->Offset];
+      }
+   return Dst;
+   }
+
+/* Sums, dark and saturated counts and gradient of an 8-bit row.            */
+/* -----------------------------------------------------------------------   */
+static void RowSums(const uint8_t* Row, uint32_t SizeX, uint32_t Distance,
+                    HealthSumsStruct* SumsPtr)
+   {
+   uint32_t x = 0;
+
+#if HEALTH_SSE2
+   const __m128i Zero      = _mm_setzero_si128();
+   const __m128i Dark      = _mm_set1_epi8((char)HEALTH_DARK_LEVEL);
+   const __m128i Saturated = _mm_set1_epi8((char)HEALTH_SATURATED_LEVEL);
+   __m128i       Sum       = Zero;
+   __m128i       Gradient  = Zero;
+   __m128i       DarkSum   = Zero;
+   __m128i       SatSum    = Zero;
+   uint64_t      Lanes[2];
+
+   while(x + 16 + Distance <= SizeX)
+      {
+      /* The byte counters hold 255 vectors. */
+      __m128i DarkCount = Zero;
+      __m128i SatCount  = Zero;
+
+      for(int n = 0; n < 255 && x + 16 + Distance <= SizeX; n++, x += 16)
+         {
+         __m128i Value = _mm_loadu_si128((const __m128i*)(Row + x));
+         __m128i Next  = _mm_loadu_si128((const __m128i*)(Row + x + Distance));
+
+         Sum       = _mm_add_epi64(Sum, _mm_sad_epu8(Value, Zero));
+         Gradient  = _mm_add_epi64(Gradient, _mm_sad_epu8(Value, Next));
+         DarkCount = _mm_sub_epi8(DarkCount, _mm_cmpeq_epi8(_mm_min_epu8(Value, Dark), Value));
+         SatCount  = _mm_sub_epi8(SatCount, _mm_cmpeq_epi8(_mm_max_epu8(Value, Saturated), Value));
+         }
+      DarkSum = _mm_add_epi64(DarkSum, _mm_sad_epu8(DarkCount, Zero));
+      SatSum  = _mm_add_epi64(SatSum, _mm_sad_epu8(SatCount, Zero));
+      }
+
+   _mm_storeu_si128((__m128i*)Lanes, Sum);
+   SumsPtr->Sum += Lanes[0] + Lanes[1];
+   _mm_storeu_si128((__m128i*)Lanes, Gradient);
+   SumsPtr->Gradient += Lanes[0] + Lanes[1];
+   _mm_storeu_si128((__m128i*)Lanes, DarkSum);
+   SumsPtr->Dark += Lanes[0] + Lanes[1];
+   _mm_storeu_si128((__m128i*)Lanes, SatSum);
+   SumsPtr->Saturated += Lanes[0] + Lanes[1];
+   SumsPtr->GradientCount += x;
+#endif
+
+   for(; x < SizeX; x++)
+      {
+      uint32_t Value = Row[x];
+
+      SumsPtr->Sum       += Value;
+      SumsPtr->Dark      += Value <= HEALTH_DARK_LEVEL;
+      SumsPtr->Saturated += Value >= HEALTH_SATURATED_LEVEL;
+      if(x + Distance < SizeX)
+         {
+         uint32_t Next = Row[x + Distance];
+
+         SumsPtr->Gradient += Value > Next ? Value - Next : Next - Value;
+         SumsPtr->GradientCount++;
+         }
+      }
+   SumsPtr->PixelCount += SizeX;
+   }
+
+/* Histogram of one pixel in HEALTH_HISTOGRAM_STEP of an 8-bit row.         */
+/* -----------------------------------------------------------------------   */
+static void RowHistogram(const uint8_t* Row, uint32_t SizeX, uint32_t (*Tables)[256])
+   {
+   const uint32_t Step = HEALTH_HISTOGRAM_STEP;
+   uint32_t       x    = 0;
+
+   for(; x + 4 * Step <= SizeX; x += 4 * Step)
+      {
+      Tables[0][Row[x]]++;
+      Tables[1][Row[x + Step]]++;
+      Tables[2][Row[x + 2 * Step]]++;
+      Tables[3][Row[x + 3 * Step]]++;
+      }
+   for(; x < SizeX; x += Step)
+      Tables[0][Row[x]]++;
+   }
+
+/* Level under which Percentile % of the histogram is.                       */
+/* -----------------------------------------------------------------------   */
+static double HistogramLevel(const uint32_t* Histogram, uint64_t Total, double Percentile)
+   {
+   uint64_t Target = (uint64_t)(Percentile / 100.0 * Total);
+   uint64_t Count  = 0;
+
+   for(int Level = 0; Level < 256; Level++)
+      {
+      Count += Histogram[Level];
+      if(Count > Target)
+         return Level;
+      }
+   return 255;
+   }
+
+/* Counts a frame for which the condition of an alert does or does not     */
+/* hold. Returns true if the alert is raised or cleared.                    */
+/* -----------------------------------------------------------------------   */
+static bool UpdateAlert(FrameHealthStruct* HealthPtr, HealthAlertType Alert, bool Condition,
+                        uint32_t* ActivePtr)
+   {
+   bool Active = (*ActivePtr & (1u << Alert)) != 0;
+
+   if(Condition == Active)
+      {
+      HealthPtr->Streaks[Alert] = 0;
+      return false;
+      }
+   if(++HealthPtr->Streaks[Alert] < HEALTH_ALERT_FRAMES)
+      return false;
+
+   HealthPtr->Streaks[Alert] = 0;
+   *ActivePtr ^= 1u << Alert;
+   if(Condition)
+      HealthPtr->AlertCounts[Alert].fetch_add(1, std::memory_order_relaxed);
+   return true;
+   }
+
+/* Analyses a frame. Called by the workers; a frame that comes while        */
+/* another one of the stream is analysed is skipped. Returns true if an     */
+/* alert was raised or cleared.                                              */
+/* -----------------------------------------------------------------------   */
+bool FrameHealthAnalyze(FrameHealthStruct* HealthPtr, uint32_t PixelFormat,
+                        const uint8_t* Address, size_t Pitch, uint32_t SizeX, uint32_t SizeY)
+   {
+   auto               StartTime = std::chrono::steady_clock::now();
+   HealthFormatStruct Format;
+   HealthSumsStruct   Sums = { 0, 0, 0, 0, 0, 0 };
+   uint32_t           Tables[4][256];
+   uint32_t           RowStep, Active;
+   uint64_t           Hash, HistogramTotal = 0;
+   size_t             RowBytes;
+   double             Mean, DarkRatio, SaturatedRatio, Sharpness;
+   bool               Repeated, Black, Blown, Unfocused, Changed = false;
+   int64_t            Elapsed, Max;
+
+   if(!GetFormat(PixelFormat, &Format) || SizeX <= Format.Distance || SizeY == 0)
+      return false;
+   if(HealthPtr->Busy.exchange(true, std::memory_order_acquire))
+      {
+      HealthPtr->BusyCount.fetch_add(1, std::memory_order_relaxed);
+      return false;
+      }
+
+   if(HealthPtr->Row.size() < SizeX)
+      HealthPtr->Row.resize(SizeX);
+   memset(Tables, 0, sizeof(Tables));
+   RowStep  = SizeY > HEALTH_ROW_COUNT ? SizeY / HEALTH_ROW_COUNT : 1;
+   RowBytes = (size_t)SizeX * Format.SampleBytes * Format.Step;
+
+   /* The first row is always hashed: the cameras that stamp a counter or a */
+   /* time in the image put it there.                                        */
+   Hash = HashBytes(0, Address, RowBytes);
+   for(uint32_t y = RowStep / 2; y < SizeY; y += RowStep)
+      {
+      const uint8_t* Src = Address + y * Pitch;
+      const uint8_t* Row;
+
+#if HEALTH_SSE2
+      /* The rows are far apart: fetch the next one while this one is       */
+      /* analysed, rather than waiting on each of its cache lines.          */
+      if(y + RowStep < SizeY)
+         for(size_t Offset = 0; Offset < RowBytes; Offset += 64)
+            _mm_prefetch((const char*)(Src + RowStep * Pitch + Offset), _MM_HINT_T0);
+#endif
+      Hash = HashBytes(Hash, Src, RowBytes);
+      Row  = RowTo8Bits(HealthPtr, &Format, Src, SizeX);
+      RowSums(Row, SizeX, Format.Distance, &Sums);
+      RowHistogram(Row, SizeX, Tables);
+      }
+
+   for(int Level = 0; Level < 256; Level++)
+      {
+      HealthPtr->Histogram[Level] = Tables[0][Level] + Tables[1][Level] +
+                                    Tables[2][Level] + Tables[3][Level];
+      HistogramTotal += HealthPtr->Histogram[Level];
+      }
+
+   Mean           = (double)Sums.Sum / Sums.PixelCount;
+   DarkRatio      = (double)Sums.Dark / Sums.PixelCount;
+   SaturatedRatio = (double)Sums.Saturated / Sums.PixelCount;
+   Sharpness      = Sums.GradientCount ?
+                    100.0 * Sums.Gradient / Sums.GradientCount / (Mean > 1.0 ? Mean : 1.0) : 0;
+
+   /* Conditions. The sharpness of black or blown frames says nothing of the */
+   /* focus.                                                                  */
+   Active    = HealthPtr->ActiveAlerts.load(std::memory_order_relaxed);
+   Repeated  = HealthPtr->LastHashValid && Hash == HealthPtr->LastHash;
+   Black     = DarkRatio >= HEALTH_BLACK_RATIO;
+   Blown     = SaturatedRatio >= HEALTH_BLOWN_RATIO;
+   Unfocused = !Black && !Blown && HealthPtr->BaselineCount >= HEALTH_FOCUS_WARMUP &&
+               Sharpness < HEALTH_FOCUS_RATIO * HealthPtr->SharpnessBaseline;
+
+   if(!Black && !Blown && !Unfocused && !(Active & (1u << eHealthFocus)))
+      {
+      if(HealthPtr->BaselineCount < HEALTH_FOCUS_WARMUP)
+         HealthPtr->SharpnessBaseline += (Sharpness - HealthPtr->SharpnessBaseline) /
+                                         (HealthPtr->BaselineCount + 1);
+      else
+         HealthPtr->SharpnessBaseline += (Sharpness - HealthPtr->SharpnessBaseline) *
+                                         HEALTH_FOCUS_DECAY;
+      HealthPtr->BaselineCount++;
+      }
+   HealthPtr->LastHash      = Hash;
+   HealthPtr->LastHashValid = true;
+
+   Changed |= UpdateAlert(HealthPtr, eHealthFrozen, Repeated, &Active);
+   Changed |= UpdateAlert(HealthPtr, eHealthBlack, Black, &Active);
+   Changed |= UpdateAlert(HealthPtr, eHealthBlown, Blown, &Active);
+   Changed |= UpdateAlert(HealthPtr, eHealthFocus, Unfocused, &Active);
+
+   /* Publish the figures. */
+   HealthPtr->Mean           = Mean;
+   HealthPtr->DarkRatio      = DarkRatio;
+   HealthPtr->SaturatedRatio = SaturatedRatio;
+   HealthPtr->Sharpness      = Sharpness;
+   HealthPtr->Levels[eHealthLevelP1]  = HistogramLevel(HealthPtr->Histogram, HistogramTotal, 1);
+   HealthPtr->Levels[eHealthLevelP50] = HistogramLevel(HealthPtr->Histogram, HistogramTotal, 50);
+   HealthPtr->Levels[eHealthLevelP99] = HistogramLevel(HealthPtr->Histogram, HistogramTotal, 99);
+   if(Repeated)
+      HealthPtr->RepeatCount.fetch_add(1, std::memory_order_relaxed);
+   if(Changed)
+      HealthPtr->ActiveAlerts.store(Active, std::memory_order_release);
+
+   Elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - StartTime).count();
+   HealthPtr->FrameCount.fetch_add(1, std::memory_order_relaxed);
+   HealthPtr->AnalysisTime.fetch_add(Elapsed, std::memory_order_relaxed);
+   Max = HealthPtr->AnalysisTimeMax.load(std::memory_order_relaxed);
+   while(Elapsed > Max &&
+         !HealthPtr->AnalysisTimeMax.compare_exchange_weak(Max, Elapsed, std::memory_order_relaxed))
+      ;
+
+   HealthPtr->Busy.store(false, std::memory_order_release);
+   return Changed;
+   }
@@ -0,0 +1,106 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameHealth.h
+ *
+ * Synopsis:  Image health analysis: catches a frozen camera, black frames, blown
+ *            exposure and a loss of focus from the content of the frames.
+ *
+ *            The workers analyse one frame in HealthPeriod, after the display is
+ *            updated, never the hook. A frame is analysed on a subset of evenly
+ *            spaced rows (HEALTH_ROW_COUNT at most), so that the cost depends on
+ *            the width of the frames only. Each row is brought to 8 bits, then
+ *            gives its mean, its dark and saturated pixels, its horizontal
+ *            gradient (the sharpness) and a part of the intensity histogram. The
+ *            raw bytes of the rows are hashed to find the frames that repeat.
+ *
+ *            An alert is raised when its condition holds on HEALTH_ALERT_FRAMES
+ *            frames analysed in a row, and cleared likewise. The analysis tells
+ *            its caller when the alerts change, for it to wake up the main
+ *            thread, which reports them; the figures of the last frame and the
+ *            alert counts are exported with the frame statistics.
+ *
+ *            This module does not depend on MIL, see FrameHealthBench.cpp.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef FRAME_HEALTH_H
+#define FRAME_HEALTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+#define HEALTH_ROW_COUNT       128    /* Rows analysed per frame, at most.        */
+#define HEALTH_HISTOGRAM_STEP  4      /* Pixels of a row counted in the histogram. */
+#define HEALTH_DARK_LEVEL      16     /* 8-bit levels at or below: dark pixel.     */
+#define HEALTH_SATURATED_LEVEL 250    /* 8-bit levels at or above: saturated.      */
+
+/* Alert conditions. */
+#define HEALTH_ALERT_FRAMES    3      /* Frames analysed to raise or clear.        */
+#define HEALTH_BLACK_RATIO     0.98   /* Dark pixels in a black frame.             */
+#define HEALTH_BLOWN_RATIO     0.25   /* Saturated pixels in a blown frame.        */
+#define HEALTH_FOCUS_RATIO     0.5    /* Sharpness under this part of its baseline. */
+#define HEALTH_FOCUS_WARMUP    30     /* Frames analysed before the baseline is used. */
+#define HEALTH_FOCUS_DECAY     (1.0 / 256)
+
+typedef enum
+   {
+   eHealthFrozen = 0,         /* Same content as the frame analysed before.       */
+   eHealthBlack,
+   eHealthBlown,
+   eHealthFocus,              /* Sharpness far under its baseline.                */
+   eHealthAlertCount
+   } HealthAlertType;
+
+typedef enum
+   {
+   eHealthLevelP1 = 0,        /* Percentiles of the intensity, 8-bit levels.      */
+   eHealthLevelP50,
+   eHealthLevelP99,
+   eHealthLevelCount
+   } HealthLevelType;
+
+typedef struct
+   {
+   uint32_t                 Period;        /* One frame analysed in Period.       */
+   std::atomic<bool>        Busy;          /* A worker analyses a frame.          */
+
+   /* Analysis state, owned by the worker that set Busy. */
+   std::vector<uint8_t>     Row;           /* A row in 8 bits.                    */
+   uint32_t                 Histogram[256];
+   uint64_t                 LastHash;
+   bool                     LastHashValid;
+   uint32_t                 Streaks[eHealthAlertCount];
+   double                   SharpnessBaseline;
+   int64_t                  BaselineCount;
+
+   /* Figures of the last frame analysed. */
+   std::atomic<double>      Mean;          /* 8-bit levels.                       */
+   std::atomic<double>      DarkRatio;
+   std::atomic<double>      SaturatedRatio;
+   std::atomic<double>      Sharpness;     /* Mean gradient, % of the mean level. */
+   std::atomic<double>      Levels[eHealthLevelCount];
+
+   /* Alerts and counts. */
+   std::atomic<uint32_t>    ActiveAlerts;  /* Bit n for the alert n.              */
+   std::atomic<int64_t>     AlertCounts[eHealthAlertCount];   /* Raised.          */
+   std::atomic<int64_t>     FrameCount;    /* Analysed.                           */
+   std::atomic<int64_t>     RepeatCount;   /* Same content as the one before.     */
+   std::atomic<int64_t>     BusyCount;     /* Not analysed, a worker was busy.    */
+   std::atomic<int64_t>     AnalysisTime;  /* Nanoseconds.                        */
+   std::atomic<int64_t>     AnalysisTimeMax;
+
+   /* Main thread only. */
+   uint32_t                 ReportedAlerts;
+   } FrameHealthStruct;
+
+FrameHealthStruct* FrameHealthAlloc(uint32_t Period);
+void FrameHealthFree(FrameHealthStruct* HealthPtr);
+bool FrameHealthSupports(uint32_t PixelFormat);
+bool FrameHealthAnalyze(FrameHealthStruct* HealthPtr, uint32_t PixelFormat,
+                        const uint8_t* Address, size_t Pitch, uint32_t SizeX, uint32_t SizeY);
+const char* FrameHealthAlertName(HealthAlertType Alert);
+
+#endif /* FRAME_HEALTH_H */
@@ -0,0 +1,118 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameHealthBench.cpp
+ *
+ * Synopsis:  Microbenchmark of the image health analysis of FrameHealth.h. Analyses
+ *            frames of several sizes and pixel formats, each one different from
+ *            the one before as from a live camera, and reports the time per frame
+ *            with the analysed rows out of the cache, as they come from the grab.
+ *
+ *            Does not need MIL: make bench in the linux directory.
+ *
+ *            Usage: FrameHealthBench [-iterations=<n>]
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "GvspProtocol.h"
+#include "FrameHealth.h"
+
+typedef struct
+   {
+   const char* Name;
+   uint32_t    PixelFormat;
+   uint32_t    PixelBytes;    /* In the grab buffer, unpacked. */
+   } BenchFormatStruct;
+
+static const BenchFormatStruct g_Formats[] =
+   {
+   { "Mono8",    PFNC_MONO8,     1 },
+   { "Mono12",   PFNC_MONO12,    2 },
+   { "BayerRG8", PFNC_BAYER_RG8, 1 },
+   { "RGB8",     PFNC_RGB8,      3 },
+   { "BGRA8",    PFNC_BGRA8,     4 },
+   { "YUV422",   PFNC_YUV422_8,  2 },
+   };
+
+static const uint32_t g_Sizes[][2] =
+   {
+   {  640,  480 },
+   { 1920, 1080 },
+   { 4096, 2160 },
+   { 7680, 4320 },
+   };
+
+#define BENCH_FRAME_COUNT 3   /* Frames analysed in turn. */
+
+int main(int argc, char* argv[])
+   {
+   int Iterations = 1000;
+
+   for(int i = 1; i < argc; i++)
+      {
+      if(strncmp(argv[i], "-iterations=", 12) == 0)
+         Iterations = atoi(argv[i] + 12);
+      else
+         {
+         printf("Usage: %s [-iterations=<n>]\n", argv[0]);
+         return 1;
+         }
+      }
+   if(Iterations <= 0)
+      {
+      printf("Invalid iteration count.\n");
+      return 1;
+      }
+
+   printf("Image health benchmark, %d frames per case, %d rows at most.\n\n", Iterations,
+          HEALTH_ROW_COUNT);
+   printf("%-9s %11s %10s %10s %8s %10s\n", "Format", "Size", "Average us", "Max us", "Mean",
+          "Sharpness");
+
+   for(const BenchFormatStruct& Format : g_Formats)
+      {
+      for(const auto& Size : g_Sizes)
+         {
+         FrameHealthStruct*                Health = FrameHealthAlloc(1);
+         size_t                            Pitch  = (size_t)Size[0] * Format.PixelBytes;
+         std::vector<std::vector<uint8_t>> Frames(BENCH_FRAME_COUNT);
+         uint32_t                          Seed   = 12345;
+         bool                              Wide   = Format.PixelFormat == PFNC_MONO12;
+
+         /* Textured frames, in 12 bits for the 16-bit formats. */
+         for(std::vector<uint8_t>& Frame : Frames)
+            {
+            Frame.resize(Pitch * Size[1]);
+            for(size_t i = 0; i < Frame.size(); i += Wide ? 2 : 1)
+               {
+               Seed = Seed * 1664525u + 1013904223u;
+               if(Wide)
+                  {
+                  uint16_t Value = (uint16_t)(((i / 2) % 4096 + (Seed >> 24)) & 0xFFF);
+                  memcpy(&Frame[i], &Value, sizeof(Value));
+                  }
+               else
+                  Frame[i] = (uint8_t)((i % 251) + (Seed >> 28));
+               }
+            }
+
+         for(int i = 0; i < Iterations; i++)
+            {
+            const std::vector<uint8_t>& Frame = Frames[(size_t)i % BENCH_FRAME_COUNT];
+
+            FrameHealthAnalyze(Health, Format.PixelFormat, Frame.data(), Pitch, Size[0], Size[1]);
+            }
+
+         printf("%-9s %5u x %-4u %10.2f %10.2f %8.1f %10.1f\n", Format.Name, Size[0], Size[1],
+                1e-3 * Health->AnalysisTime.load() / Health->FrameCount.load(),
+                1e-3 * Health->AnalysisTimeMax.load(), Health->Mean.load(),
+                Health->Sharpness.load());
+         FrameHealthFree(Health);
+         }
+      }
+   return 0;
+   }
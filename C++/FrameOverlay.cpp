@@ -0,0 +1,546 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameOverlay.cpp
+ *
+ * Synopsis:  Overlay of the frame count and stream figures on the display buffer.
+ *
+ *            The font has 5 x 7 glyphs, magnified OVERLAY_SCALE times. A cell
+ *            is a glyph with a column of spacing on its right and a row above
+ *            and below it, black around white. The cells are stored one after
+ *            the other in the atlas, each row in the pixel layout of the display
+ *            buffer, so that a line of text is composed by copying the rows of
+ *            its cells side by side into a strip, only for the characters
+ *            that changed since the previous frame. The strip stays in cache
+ *            and is copied to the display buffer one row at a time, as the
+ *            display copy writes these rows (see DisplayStageCopy()).
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <mutex>
+#include "GvspProtocol.h"
+#include "PixelConvert.h"
+#include "FrameOverlay.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define OVERLAY_SSE2 1
+#include <emmintrin.h>
+#else
+#define OVERLAY_SSE2 0
+#endif
+
+#define GLYPH_WIDTH   5
+#define GLYPH_HEIGHT  7
+#define CELL_COLUMNS  (GLYPH_WIDTH + 1)
+#define CELL_ROWS     (GLYPH_HEIGHT + 2)
+
+/* Pixel layouts of the display buffer. */
+typedef enum
+   {
+   eLayoutMono8 = 0,
+   eLayoutBgr24,
+   eLayoutBgr32,
+   eLayoutYuv422,             /* YUYV: the chroma of the two pixels is neutral.  */
+   eLayoutCount
+   } OverlayLayoutType;
+
+typedef struct
+   {
+   uint32_t PixelBytes;
+   uint8_t  Foreground[4];
+   uint8_t  Background[4];
+   } OverlayLayoutStruct;
+
+static const OverlayLayoutStruct g_Layouts[eLayoutCount] =
+   {
+   { 1, { 0xFF                   }, { 0x00                   } },
+   { 3, { 0xFF, 0xFF, 0xFF       }, { 0x00, 0x00, 0x00       } },
+   { 4, { 0xFF, 0xFF, 0xFF, 0xFF }, { 0x00, 0x00, 0x00, 0xFF } },
+   { 2, { 0xFF, 0x80             }, { 0x00, 0x80             } },
+   };
+
+/* Characters of the font, and their glyphs: one byte per row, the leftmost */
+/* pixel in bit 4. Upper case letters are drawn in lower case.               */
+static const char g_Charset[] = " 0123456789.:%-/abcdefghijklmnopqrstuvwxyz";
+
+static const uint8_t g_Glyphs[sizeof(g_Charset) - 1][GLYPH_HEIGHT] =
+   {
+   { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   /* ' ' */
+   { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },   /* '0' */
+   { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },   /* '1' */
+   { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },   /* '2' */
+   { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },   /* '3' */
+   { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },   /* '4' */
+   { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },   /* '5' */
+   { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },   /* '6' */
+   { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },   /* '7' */
+   { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },   /* '8' */
+   { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },   /* '9' */
+   { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },   /* '.' */
+   { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },   /* ':' */
+   { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },   /* '%' */
+   { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 },   /* '-' */
+   { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },   /* '/' */
+   { 0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F },   /* 'a' */
+   { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E },   /* 'b' */
+   { 0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E },   /* 'c' */
+   { 0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F },   /* 'd' */
+   { 0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E },   /* 'e' */
+   { 0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08 },   /* 'f' */
+   { 0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E },   /* 'g' */
+   { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11 },   /* 'h' */
+   { 0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E },   /* 'i' */
+   { 0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C },   /* 'j' */
+   { 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12 },   /* 'k' */
+   { 0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },   /* 'l' */
+   { 0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11 },   /* 'm' */
+   { 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11 },   /* 'n' */
+   { 0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E },   /* 'o' */
+   { 0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10 },   /* 'p' */
+   { 0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01 },   /* 'q' */
+   { 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10 },   /* 'r' */
+   { 0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E },   /* 's' */
+   { 0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06 },   /* 't' */
+   { 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D },   /* 'u' */
+   { 0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04 },   /* 'v' */
+   { 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A },   /* 'w' */
+   { 0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11 },   /* 'x' */
+   { 0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E },   /* 'y' */
+   { 0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F },   /* 'z' */
+   };
+
+/* Lines of the fields: label, value, unit. */
+typedef struct
+   {
+   const char* Name;          /* In the -overlay option.                          */
+   const char* Label;
+   const char* Unit;
+   int         Decimals;
+   } OverlayFieldStruct;
+
+static const OverlayFieldStruct g_Fields[eOverlayFieldCount] =
+   {
+   { "frame",   "",     "",     0 },
+   { "fps",     "",     " fps", 1 },
+   { "latency", "lat ", " ms",  2 },
+   { "loss",    "loss ", "%",   2 },
+   };
+
+/* Glyph of each character, 0 (space) for those not in the font. */
+static uint8_t        g_GlyphIndex[128];
+static std::once_flag g_GlyphIndexOnce;
+
+static void InitGlyphIndex(void)
+   {
+   for(size_t i = 0; i < sizeof(g_Charset) - 1; i++)
+      {
+      g_GlyphIndex[(uint8_t)g_Charset[i]] = (uint8_t)i;
+      if(g_Charset[i] >= 'a' && g_Charset[i] <= 'z')
+         g_GlyphIndex[(uint8_t)(g_Charset[i] - 'a' + 'A')] = (uint8_t)i;
+      }
+   }
+
+/* Display layout of a stream pixel format; see BufferPoolAlloc().           */
+/* -----------------------------------------------------------------------   */
+static OverlayLayoutType DisplayLayout(uint32_t PixelFormat)
+   {
+   switch(PixelConvertDisplayOperation(PixelFormat))
+      {
+      case eConvertDownshift: return eLayoutMono8;
+      case eConvertDebayer:   return eLayoutBgr32;
+      default:                break;
+      }
+   switch(PixelFormat)
+      {
+      case PFNC_RGB8:
+      case PFNC_BGR8:         return eLayoutBgr24;
+      case PFNC_BGRA8:        return eLayoutBgr32;
+      case PFNC_YUV422_8:     return eLayoutYuv422;
+      default:                return eLayoutMono8;
+      }
+   }
+
+/* Renders the glyphs of a layout.                                           */
+/* -----------------------------------------------------------------------   */
+static OverlayAtlasStruct* BuildAtlas(OverlayLayoutType Layout)
+   {
+   const OverlayLayoutStruct* LayoutPtr = &g_Layouts[Layout];
+   OverlayAtlasStruct*        AtlasPtr  = new OverlayAtlasStruct;
+   size_t                     GlyphCount = sizeof(g_Charset) - 1;
+
+   AtlasPtr->PixelBytes   = LayoutPtr->PixelBytes;
+   AtlasPtr->Layout       = (uint32_t)Layout;
+   AtlasPtr->CellWidth    = CELL_COLUMNS * OVERLAY_SCALE;
+   AtlasPtr->CellHeight   = CELL_ROWS * OVERLAY_SCALE;
+   AtlasPtr->CellRowBytes = (size_t)AtlasPtr->CellWidth * LayoutPtr->PixelBytes;
+   AtlasPtr->GlyphBytes   = AtlasPtr->CellRowBytes * AtlasPtr->CellHeight;
+   AtlasPtr->Cells.resize(GlyphCount * AtlasPtr->GlyphBytes);
+
+   for(size_t g = 0; g < GlyphCount; g++)
+      {
+      uint8_t* Cell = AtlasPtr->Cells.data() + g * AtlasPtr->GlyphBytes;
+
+      for(uint32_t y = 0; y < AtlasPtr->CellHeight; y++)
+         {
+         int32_t GlyphRow = (int32_t)(y / OVERLAY_SCALE) - 1;
+
+         for(uint32_t x = 0; x < AtlasPtr->CellWidth; x++)
+            {
+            uint32_t GlyphColumn = x / OVERLAY_SCALE;
+            bool     IsSet = GlyphRow >= 0 && GlyphRow < GLYPH_HEIGHT &&
+                             GlyphColumn < GLYPH_WIDTH &&
+                             (g_Glyphs[g][GlyphRow] >> (GLYPH_WIDTH - 1 - GlyphColumn)) & 1;
+
+            memcpy(Cell + y * AtlasPtr->CellRowBytes + x * LayoutPtr->PixelBytes,
+                   IsSet ? LayoutPtr->Foreground : LayoutPtr->Background,
+                   LayoutPtr->PixelBytes);
+            }
+         }
+      }
+   return AtlasPtr;
+   }
+
+FrameOverlayStruct* FrameOverlayAlloc(uint32_t FieldMask)
+   {
+   FrameOverlayStruct* OverlayPtr = new FrameOverlayStruct;
+
+   std::call_once(g_GlyphIndexOnce, InitGlyphIndex);
+   OverlayPtr->FieldMask   = FieldMask;
+   for(int i = 0; i < eOverlayFieldCount; i++)
+      OverlayPtr->Values[i] = NAN;
+   OverlayPtr->Atlas       = NULL;
+   OverlayPtr->Target      = NULL;
+   OverlayPtr->TargetPitch = 0;
+   OverlayPtr->TargetSizeX = 0;
+   OverlayPtr->TargetSizeY = 0;
+   OverlayPtr->StripRowBytes = 0;
+   for(int i = 0; i < eOverlayFieldCount; i++)
+      OverlayPtr->StripLength[i] = 0;
+   OverlayPtr->BandRows    = 0;
+   OverlayPtr->FrameTime   = 0;
+   OverlayPtr->DrawCount   = 0;
+   OverlayPtr->DrawTime    = 0;
+   OverlayPtr->DrawTimeMax = 0;
+   OverlayPtr->LastSampleTime   = 0;
+   OverlayPtr->LastFrameCount   = 0;
+   OverlayPtr->LastCorruptCount = 0;
+   OverlayPtr->LastLatencyCount = 0;
+   OverlayPtr->LastLatencySum   = 0;
+   return OverlayPtr;
+   }
+
+void FrameOverlayFree(FrameOverlayStruct* OverlayPtr)
+   {
+   if(!OverlayPtr)
+      return;
+
+   for(size_t i = 0; i < OverlayPtr->Atlases.size(); i++)
+      delete OverlayPtr->Atlases[i];
+   delete OverlayPtr;
+   }
+
+/* Parses a comma-separated list of field names, or "all" or "none".        */
+/* -----------------------------------------------------------------------   */
+bool FrameOverlayParseFields(const std::string& List, uint32_t* FieldMaskPtr)
+   {
+   size_t Start = 0;
+
+   *FieldMaskPtr = 0;
+   if(List == "all")
+      {
+      *FieldMaskPtr = OVERLAY_FIELDS_ALL;
+      return true;
+      }
+   if(List == "none")
+      return true;
+
+   while(Start <= List.size())
+      {
+      size_t      End  = List.find(',', Start);
+      std::string Name = List.substr(Start, End == std::string::npos ? std::string::npos :
+                                                                       End - Start);
+      int         Field;
+
+      for(Field = 0; Field < eOverlayFieldCount; Field++)
+         {
+         if(Name == g_Fields[Field].Name)
+            break;
+         }
+      if(Field == eOverlayFieldCount)
+         return false;
+      *FieldMaskPtr |= 1u << Field;
+
+      if(End == std::string::npos)
+         break;
+      Start = End + 1;
+      }
+   return true;
+   }
+
+/* Sets the display buffer drawn into, NULL for none. Must not be called     */
+/* while drawing. The atlas of the layout is built the first time it is     */
+/* needed, and the strip is composed again from it.                         */
+/* -----------------------------------------------------------------------   */
+void FrameOverlaySetTarget(FrameOverlayStruct* OverlayPtr, uint32_t PixelFormat,
+                           uint8_t* Address, size_t Pitch, uint32_t SizeX, uint32_t SizeY)
+   {
+   OverlayLayoutType Layout = DisplayLayout(PixelFormat);
+
+   OverlayPtr->Target      = Address;
+   OverlayPtr->TargetPitch = Pitch;
+   OverlayPtr->TargetSizeX = SizeX;
+   OverlayPtr->TargetSizeY = SizeY;
+   OverlayPtr->Atlas       = NULL;
+   OverlayPtr->BandRows    = 0;
+   if(!Address)
+      return;
+
+   for(size_t i = 0; i < OverlayPtr->Atlases.size(); i++)
+      {
+      if(OverlayPtr->Atlases[i]->Layout == (uint32_t)Layout)
+         OverlayPtr->Atlas = OverlayPtr->Atlases[i];
+      }
+   if(!OverlayPtr->Atlas)
+      {
+      OverlayPtr->Atlas = BuildAtlas(Layout);
+      OverlayPtr->Atlases.push_back(OverlayPtr->Atlas);
+      }
+
+   OverlayPtr->StripRowBytes = OVERLAY_LINE_MAX * OverlayPtr->Atlas->CellRowBytes;
+   OverlayPtr->Strip.resize(eOverlayFieldCount * OverlayPtr->Atlas->CellHeight *
+                            OverlayPtr->StripRowBytes);
+   for(int i = 0; i < eOverlayFieldCount; i++)
+      OverlayPtr->StripLength[i] = 0;
+   }
+
+void FrameOverlaySetValue(FrameOverlayStruct* OverlayPtr, OverlayFieldType Field,
+                          double Value)
+   {
+   OverlayPtr->Values[Field].store(Value, std::memory_order_relaxed);
+   }
+
+/* Writes an unsigned integer; returns the characters written.             */
+/* -----------------------------------------------------------------------   */
+static size_t FormatUnsigned(uint64_t Value, char* Text)
+   {
+   char   Digits[20];
+   size_t Count = 0;
+
+   do
+      {
+      Digits[Count++] = (char)('0' + Value % 10);
+      Value /= 10;
+      }
+   while(Value);
+
+   for(size_t i = 0; i < Count; i++)
+      Text[i] = Digits[Count - 1 - i];
+   return Count;
+   }
+
+/* Formats the line of a field, without the printf family: the frame count */
+/* line is formatted for every frame. Returns its length.                    */
+/* -----------------------------------------------------------------------   */
+size_t FrameOverlayFormatLine(FrameOverlayStruct* OverlayPtr, OverlayFieldType Field,
+                              int64_t FrameCount, char* Text)
+   {
+   const OverlayFieldStruct* FieldPtr = &g_Fields[Field];
+   size_t                    Length   = strlen(FieldPtr->Label);
+   double                    Value    = Field == eOverlayFrameCount ? (double)FrameCount :
+                                        OverlayPtr->Values[Field].load(std::memory_order_relaxed);
+
+   memcpy(Text, FieldPtr->Label, Length);
+   if(Field == eOverlayFrameCount)
+      Length += FormatUnsigned(FrameCount > 0 ? (uint64_t)FrameCount : 0, Text + Length);
+   else if(Value != Value || Value < 0 || Value >= 1e12)
+      Text[Length++] = '-';
+   else
+      {
+      uint64_t Power = 1;
+      uint64_t Fixed;
+
+      for(int i = 0; i < FieldPtr->Decimals; i++)
+         Power *= 10;
+      Fixed = (uint64_t)(Value * Power + 0.5);
+
+      Length += FormatUnsigned(Fixed / Power, Text + Length);
+      if(FieldPtr->Decimals > 0)
+         {
+         Text[Length++] = '.';
+         for(uint64_t Digit = Power / 10; Digit > 0; Digit /= 10)
+            Text[Length++] = (char)('0' + Fixed / Digit % 10);
+         }
+      }
+   memcpy(Text + Length, FieldPtr->Unit, strlen(FieldPtr->Unit));
+   Length += strlen(FieldPtr->Unit);
+   if(Length > OVERLAY_LINE_MAX)
+      Length = OVERLAY_LINE_MAX;
+   Text[Length] = '\0';
+   return Length;
+   }
+
+/* Copies a row of a cell, 12 to 48 bytes: a run of 16-byte copies, the    */
+/* last one overlapping the previous if needed, or two overlapping 8-byte   */
+/* copies below 16 bytes.                                                    */
+/* -----------------------------------------------------------------------   */
+static inline void CopyCellRow(uint8_t* Dst, const uint8_t* Src, size_t Bytes)
+   {
+#if OVERLAY_SSE2
+   if(Bytes >= 16)
+      {
+      size_t i;
+
+      for(i = 0; i + 16 <= Bytes; i += 16)
+         _mm_storeu_si128((__m128i*)(Dst + i), _mm_loadu_si128((const __m128i*)(Src + i)));
+      if(i < Bytes)
+         _mm_storeu_si128((__m128i*)(Dst + Bytes - 16),
+                          _mm_loadu_si128((const __m128i*)(Src + Bytes - 16)));
+      return;
+      }
+   if(Bytes >= 8)
+      {
+      _mm_storel_epi64((__m128i*)Dst, _mm_loadl_epi64((const __m128i*)Src));
+      _mm_storel_epi64((__m128i*)(Dst + Bytes - 8),
+                       _mm_loadl_epi64((const __m128i*)(Src + Bytes - 8)));
+      return;
+      }
+#endif
+   memcpy(Dst, Src, Bytes);
+   }
+
+/* Composes the cells of a line whose character changed since the line   */
+/* was last drawn.                                                           */
+/* -----------------------------------------------------------------------   */
+static void ComposeLine(FrameOverlayStruct* OverlayPtr, int Field, const char* Text,
+                        size_t Length)
+   {
+   const OverlayAtlasStruct* AtlasPtr = OverlayPtr->Atlas;
+   char*                     Drawn    = OverlayPtr->StripText[Field];
+   uint8_t*                  Line     = OverlayPtr->Strip.data() +
+                                        Field * AtlasPtr->CellHeight * OverlayPtr->StripRowBytes;
+
+   for(size_t c = 0; c < Length; c++)
+      {
+      const uint8_t* Glyph;
+
+      if(c < OverlayPtr->StripLength[Field] && Drawn[c] == Text[c])
+         continue;
+      Glyph = AtlasPtr->Cells.data() + g_GlyphIndex[(uint8_t)Text[c] & 0x7F] * AtlasPtr->GlyphBytes;
+      for(uint32_t y = 0; y < AtlasPtr->CellHeight; y++)
+         CopyCellRow(Line + y * OverlayPtr->StripRowBytes + c * AtlasPtr->CellRowBytes,
+                     Glyph + y * AtlasPtr->CellRowBytes, AtlasPtr->CellRowBytes);
+      Drawn[c] = Text[c];
+      }
+   OverlayPtr->StripLength[Field] = Length;
+   }
+
+/* Draws the rows of a line of the strip at a position that fall between    */
+/* FirstRow and EndRow (excluded), clipped to the buffer.                    */
+/* -----------------------------------------------------------------------   */
+static void DrawLine(FrameOverlayStruct* OverlayPtr, int Field, uint32_t PosX, uint32_t PosY,
+                     uint32_t FirstRow, uint32_t EndRow)
+   {
+   const OverlayAtlasStruct* AtlasPtr = OverlayPtr->Atlas;
+   const uint8_t*            Line     = OverlayPtr->Strip.data() +
+                                        Field * AtlasPtr->CellHeight * OverlayPtr->StripRowBytes;
+   size_t                    Length   = OverlayPtr->StripLength[Field];
+   size_t                    Columns;
+
+   if(PosX >= OverlayPtr->TargetSizeX)
+      return;
+   Columns = (OverlayPtr->TargetSizeX - PosX) / AtlasPtr->CellWidth;
+   if(Length > Columns)
+      Length = Columns;
+   if(FirstRow < PosY)
+      FirstRow = PosY;
+   if(EndRow > PosY + AtlasPtr->CellHeight)
+      EndRow = PosY + AtlasPtr->CellHeight;
+   if(EndRow > OverlayPtr->TargetSizeY)
+      EndRow = OverlayPtr->TargetSizeY;
+
+   for(uint32_t y = FirstRow; y < EndRow; y++)
+      memcpy(OverlayPtr->Target + y * OverlayPtr->TargetPitch + (size_t)PosX * AtlasPtr->PixelBytes,
+             Line + (y - PosY) * OverlayPtr->StripRowBytes, Length * AtlasPtr->CellRowBytes);
+   }
+
+/* Formats and composes the lines of a frame, to be drawn by                */
+/* FrameOverlayDrawRows(). Returns the number of display rows, from the top, */
+/* the lines reach; 0 if the display buffer cannot be drawn into directly.  */
+/* -----------------------------------------------------------------------   */
+uint32_t FrameOverlayCompose(FrameOverlayStruct* OverlayPtr, int64_t FrameCount)
+   {
+   auto     Start = std::chrono::steady_clock::now();
+   uint32_t PosY  = OVERLAY_POS_Y;
+   char     Text[OVERLAY_LINE_MAX + 1];
+   size_t   Length;
+
+   if(!OverlayPtr->Target || !OverlayPtr->Atlas)
+      return 0;
+
+   for(int Field = 0; Field < eOverlayFieldCount; Field++)
+      {
+      if(!(OverlayPtr->FieldMask & (1u << Field)))
+         continue;
+      Length = FrameOverlayFormatLine(OverlayPtr, (OverlayFieldType)Field, FrameCount, Text);
+      ComposeLine(OverlayPtr, Field, Text, Length);
+      PosY += OverlayPtr->Atlas->CellHeight;
+      }
+
+   OverlayPtr->BandRows  = PosY < OverlayPtr->TargetSizeY ? PosY : OverlayPtr->TargetSizeY;
+   OverlayPtr->FrameTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - Start).count();
+   return OverlayPtr->BandRows;
+   }
+
+/* Copies the rows of the lines composed between FirstRow and FirstRow +    */
+/* RowCount (excluded) to the display buffer. The frame is counted as drawn */
+/* once the rows up to the count FrameOverlayCompose() returned are.        */
+/* -----------------------------------------------------------------------   */
+void FrameOverlayDrawRows(FrameOverlayStruct* OverlayPtr, uint32_t FirstRow, uint32_t RowCount)
+   {
+   auto     Start  = std::chrono::steady_clock::now();
+   uint32_t PosY   = OVERLAY_POS_Y;
+   uint32_t EndRow = FirstRow + RowCount;
+   int64_t  Max;
+
+   if(!OverlayPtr->Target || !OverlayPtr->Atlas || OverlayPtr->BandRows == 0)
+      return;
+
+   for(int Field = 0; Field < eOverlayFieldCount && PosY < EndRow; Field++)
+      {
+      if(!(OverlayPtr->FieldMask & (1u << Field)))
+         continue;
+      if(PosY + OverlayPtr->Atlas->CellHeight > FirstRow)
+         DrawLine(OverlayPtr, Field, OVERLAY_POS_X, PosY, FirstRow, EndRow);
+      PosY += OverlayPtr->Atlas->CellHeight;
+      }
+
+   OverlayPtr->FrameTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - Start).count();
+   if(EndRow < OverlayPtr->BandRows)
+      return;
+
+   OverlayPtr->BandRows = 0;
+   OverlayPtr->DrawCount.fetch_add(1, std::memory_order_relaxed);
+   OverlayPtr->DrawTime.fetch_add(OverlayPtr->FrameTime, std::memory_order_relaxed);
+   Max = OverlayPtr->DrawTimeMax.load(std::memory_order_relaxed);
+   while(OverlayPtr->FrameTime > Max &&
+         !OverlayPtr->DrawTimeMax.compare_exchange_weak(Max, OverlayPtr->FrameTime,
+                                                        std::memory_order_relaxed))
+      ;
+   }
+
+/* Draws the overlay of a frame into the display buffer at once. Returns    */
+/* false if the display buffer cannot be drawn into directly.                */
+/* -----------------------------------------------------------------------   */
+bool FrameOverlayDraw(FrameOverlayStruct* OverlayPtr, int64_t FrameCount)
+   {
+   if(!OverlayPtr->Target || !OverlayPtr->Atlas)
+      return false;
+
+   FrameOverlayDrawRows(OverlayPtr, 0, FrameOverlayCompose(OverlayPtr, FrameCount));
+   return true;
+   }
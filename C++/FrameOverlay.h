@@ -0,0 +1,128 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameOverlay.h
+ *
+ * Synopsis:  Overlay of the frame count and of the stream figures (frame rate,
+ *            transport latency, loss) on the display buffer. The grab buffers
+ *            are left untouched, as recorded and shared.
+ *
+ *            The glyphs of a small built-in font are rendered once per display
+ *            pixel layout into an atlas of opaque cells. The lines are composed
+ *            from the atlas into a strip, where only the cells whose character
+ *            changed since the last frame are copied again, and drawing a frame
+ *            is a copy of the strip rows into the display buffer, with no text
+ *            rendering on the frame path. The atlases of the layouts seen are
+ *            kept, so a data format change back and forth builds none.
+ *
+ *            Composing touches a few cells per frame and the strip stays in the
+ *            cache. The strip rows are copied by the display copy itself, every
+ *            OVERLAY_ROW_STEP display rows right after it wrote them, rather than
+ *            in a second pass once the whole frame is copied (see
+ *            FrameOverlayCompose() and FrameOverlayDrawRows()). What is left is
+ *            the write of the overlay rows, about 100 KB at 4 bytes per pixel:
+ *            1 to 4 us for a small frame, 5 to 20 us for a large one on the test
+ *            machine, where it runs at the speed of the memory stores either way.
+ *            FrameOverlayBench.cpp measures the three cases.
+ *
+ *            A field is a line of the overlay. The frame count is given with
+ *            each frame; the other values are set by the main thread as they
+ *            are sampled. To show another figure, add a field to the enum and
+ *            to the table of FrameOverlay.cpp.
+ *
+ *            This module does not depend on MIL, see FrameOverlayBench.cpp.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef FRAME_OVERLAY_H
+#define FRAME_OVERLAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define OVERLAY_POS_X          20     /* Top left of the first line, in pixels.  */
+#define OVERLAY_POS_Y          20
+#define OVERLAY_LINE_MAX       24     /* Characters per line.                    */
+#define OVERLAY_SAMPLE_PERIOD  1.0    /* Seconds between samples of the values.  */
+#define OVERLAY_ROW_STEP       8      /* Display rows written between two draws  */
+                                      /* of the overlay rows.                    */
+
+/* Magnification of the glyphs. The cells are the same size at any frame   */
+/* size, so that the cost of the overlay does not grow with the resolution. */
+#define OVERLAY_SCALE          2
+
+typedef enum
+   {
+   eOverlayFrameCount = 0,
+   eOverlayFrameRate,
+   eOverlayLatency,           /* Mean transport latency, ms.                    */
+   eOverlayLoss,              /* Corrupt frames, percent.                       */
+   eOverlayFieldCount
+   } OverlayFieldType;
+
+#define OVERLAY_FIELDS_ALL     ((1u << eOverlayFieldCount) - 1)
+
+/* Glyphs of one display layout. */
+typedef struct
+   {
+   uint32_t             PixelBytes;
+   uint32_t             Layout;
+   uint32_t             CellWidth;     /* Pixels.                                 */
+   uint32_t             CellHeight;
+   size_t               CellRowBytes;  /* CellWidth pixels.                       */
+   size_t               GlyphBytes;    /* Of a glyph in the atlas.                */
+   std::vector<uint8_t> Cells;
+   } OverlayAtlasStruct;
+
+typedef struct
+   {
+   uint32_t                         FieldMask;
+   std::atomic<double>              Values[eOverlayFieldCount];
+
+   /* Display buffer, set while nothing is drawn. */
+   OverlayAtlasStruct*              Atlas;
+   uint8_t*                         Target;
+   size_t                           TargetPitch;
+   uint32_t                         TargetSizeX;
+   uint32_t                         TargetSizeY;
+   std::vector<OverlayAtlasStruct*> Atlases;
+
+   /* Lines as last drawn, composed from the atlas; drawing thread only. */
+   std::vector<uint8_t>             Strip;
+   size_t                           StripRowBytes;
+   char                             StripText[eOverlayFieldCount][OVERLAY_LINE_MAX];
+   size_t                           StripLength[eOverlayFieldCount];
+   uint32_t                         BandRows;      /* Reached by the lines of the  */
+                                                   /* frame being drawn, or 0.     */
+   int64_t                          FrameTime;     /* Spent on it so far, ns.      */
+
+   /* Drawing cost. */
+   std::atomic<int64_t>             DrawCount;
+   std::atomic<int64_t>             DrawTime;      /* Nanoseconds.                 */
+   std::atomic<int64_t>             DrawTimeMax;
+
+   /* Sampling of the values, main thread only. */
+   double                           LastSampleTime;
+   int64_t                          LastFrameCount;
+   int64_t                          LastCorruptCount;
+   int64_t                          LastLatencyCount;
+   int64_t                          LastLatencySum;
+   } FrameOverlayStruct;
+
+FrameOverlayStruct* FrameOverlayAlloc(uint32_t FieldMask);
+void FrameOverlayFree(FrameOverlayStruct* OverlayPtr);
+bool FrameOverlayParseFields(const std::string& List, uint32_t* FieldMaskPtr);
+void FrameOverlaySetTarget(FrameOverlayStruct* OverlayPtr, uint32_t PixelFormat,
+                           uint8_t* Address, size_t Pitch, uint32_t SizeX, uint32_t SizeY);
+void FrameOverlaySetValue(FrameOverlayStruct* OverlayPtr, OverlayFieldType Field,
+                          double Value);
+uint32_t FrameOverlayCompose(FrameOverlayStruct* OverlayPtr, int64_t FrameCount);
+void FrameOverlayDrawRows(FrameOverlayStruct* OverlayPtr, uint32_t FirstRow, uint32_t RowCount);
+bool FrameOverlayDraw(FrameOverlayStruct* OverlayPtr, int64_t FrameCount);
+size_t FrameOverlayFormatLine(FrameOverlayStruct* OverlayPtr, OverlayFieldType Field,
+                              int64_t FrameCount, char* Text);
+
+#endif /* FRAME_OVERLAY_H */
@@ -0,0 +1,138 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameOverlayBench.cpp
+ *
+ * Synopsis:  Microbenchmark of the display overlay of FrameOverlay.h. Draws the
+ *            four lines of the overlay into display buffers of several sizes and
+ *            pixel layouts, and reports the time per frame: with the buffer in
+ *            the cache, after the whole buffer was written, and with the rows of
+ *            the overlay written along with the display copy, OVERLAY_ROW_STEP
+ *            rows at a time, as DisplayStageCopy() does.
+ *
+ *            Does not need MIL: make bench in the linux directory.
+ *
+ *            Usage: FrameOverlayBench [-iterations=<n>]
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "GvspProtocol.h"
+#include "FrameOverlay.h"
+
+typedef struct
+   {
+   const char* Name;
+   uint32_t    PixelFormat;   /* Of the stream; gives the display layout.      */
+   uint32_t    PixelBytes;    /* Of the display buffer.                        */
+   } BenchLayoutStruct;
+
+static const BenchLayoutStruct g_Layouts[] =
+   {
+   { "Mono8",   PFNC_MONO12P,    1 },
+   { "BGR24",   PFNC_RGB8,       3 },
+   { "BGRA32",  PFNC_BAYER_RG8,  4 },
+   { "YUV422",  PFNC_YUV422_8,   2 },
+   };
+
+static const uint32_t g_Sizes[][2] =
+   {
+   {  640,  480 },
+   { 1920, 1080 },
+   { 4096, 2160 },
+   { 7680, 4320 },
+   };
+
+int main(int argc, char* argv[])
+   {
+   int Iterations = 2000;
+
+   for(int i = 1; i < argc; i++)
+      {
+      if(strncmp(argv[i], "-iterations=", 12) == 0)
+         Iterations = atoi(argv[i] + 12);
+      else
+         {
+         printf("Usage: %s [-iterations=<n>]\n", argv[0]);
+         return 1;
+         }
+      }
+   if(Iterations <= 0)
+      {
+      printf("Invalid iteration count.\n");
+      return 1;
+      }
+
+   printf("Display overlay benchmark, 4 lines, %d frames per case.\n\n", Iterations);
+   printf("%-8s %11s %7s %10s %14s %10s %14s %10s\n", "Layout", "Size", "Cells", "Cached us",
+          "After copy us", "Max us", "With copy us", "Max us");
+
+   for(const BenchLayoutStruct& Layout : g_Layouts)
+      {
+      for(const auto& Size : g_Sizes)
+         {
+         FrameOverlayStruct*  OverlayPtr = FrameOverlayAlloc(OVERLAY_FIELDS_ALL);
+         size_t               Pitch = (size_t)Size[0] * Layout.PixelBytes;
+         std::vector<uint8_t> Buffer(Pitch * Size[1]);
+         std::vector<uint8_t> Source(Buffer.size(), 0x40);
+         double               Cached, Copied, Along;
+         int64_t              Max, AlongMax;
+
+         FrameOverlaySetTarget(OverlayPtr, Layout.PixelFormat, Buffer.data(), Pitch,
+                               Size[0], Size[1]);
+         FrameOverlaySetValue(OverlayPtr, eOverlayFrameRate, 29.97);
+         FrameOverlaySetValue(OverlayPtr, eOverlayLatency, 0.84);
+         FrameOverlaySetValue(OverlayPtr, eOverlayLoss, 0.0);
+
+         /* In the cache. */
+         for(int i = 0; i < Iterations; i++)
+            FrameOverlayDraw(OverlayPtr, 1000000 + i);
+         Cached = 1e-3 * OverlayPtr->DrawTime.load() / OverlayPtr->DrawCount.load();
+
+         /* After a copy of the whole frame. */
+         OverlayPtr->DrawCount   = 0;
+         OverlayPtr->DrawTime    = 0;
+         OverlayPtr->DrawTimeMax = 0;
+         for(int i = 0; i < Iterations / 10 + 1; i++)
+            {
+            memcpy(Buffer.data(), Source.data(), Buffer.size());
+            FrameOverlayDraw(OverlayPtr, 1000000 + i);
+            }
+         Copied = 1e-3 * OverlayPtr->DrawTime.load() / OverlayPtr->DrawCount.load();
+         Max    = OverlayPtr->DrawTimeMax.load();
+
+         /* Along with the copy: the rows below the overlay first, then the */
+         /* rows it covers, each step followed by the overlay rows on it.   */
+         OverlayPtr->DrawCount   = 0;
+         OverlayPtr->DrawTime    = 0;
+         OverlayPtr->DrawTimeMax = 0;
+         for(int i = 0; i < Iterations / 10 + 1; i++)
+            {
+            uint32_t BandRows = FrameOverlayCompose(OverlayPtr, 1000000 + i);
+
+            memcpy(Buffer.data() + BandRows * Pitch, Source.data() + BandRows * Pitch,
+                   (Size[1] - BandRows) * Pitch);
+            for(uint32_t Row = 0; Row < BandRows; Row += OVERLAY_ROW_STEP)
+               {
+               uint32_t Rows = BandRows - Row < OVERLAY_ROW_STEP ? BandRows - Row :
+                                                                   OVERLAY_ROW_STEP;
+
+               memcpy(Buffer.data() + Row * Pitch, Source.data() + Row * Pitch, Rows * Pitch);
+               FrameOverlayDrawRows(OverlayPtr, Row, Rows);
+               }
+            }
+         Along    = 1e-3 * OverlayPtr->DrawTime.load() / OverlayPtr->DrawCount.load();
+         AlongMax = OverlayPtr->DrawTimeMax.load();
+
+         printf("%-8s %5u x %-4u %3ux%-3u %10.2f %14.2f %10.2f %14.2f %10.2f\n", Layout.Name,
+                Size[0], Size[1], OverlayPtr->Atlas->CellWidth, OverlayPtr->Atlas->CellHeight,
+                Cached, Copied, 1e-3 * Max, Along, 1e-3 * AlongMax);
+         FrameOverlayFree(OverlayPtr);
+         }
+      }
+   return 0;
+   }
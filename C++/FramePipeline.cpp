@@ -0,0 +1,345 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FramePipeline.cpp
+ *
+ * Synopsis:  Worker pipeline that moves the per-frame processing out of the
+ *            acquisition hook.
+ *
+ *            A submitted grab buffer stays referenced until its worker is done
+ *            with it. The hook never waits for the workers: when the ring of
+ *            its lane is full, or the buffers the grab fills next are still
+ *            referenced (see NextGrabBuffersFree()), the frame is skipped and
+ *            counted as backpressure, and the grab queue grows.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#include <thread>
+#include "MulticastMonitor.h"
+
+static MIL_UINT32 MFTYPE PipelineWorkerThread(void* ThreadContext);
+
+/* Lock-free ring operations.                                                */
+/* -----------------------------------------------------------------------   */
+static void QueueInit(FrameQueueStruct* QueuePtr)
+   {
+   for(size_t i = 0; i < PIPELINE_QUEUE_SIZE; i++)
+      QueuePtr->Slots[i].Sequence.store(i, std::memory_order_relaxed);
+   QueuePtr->EnqueuePosition.store(0, std::memory_order_relaxed);
+   QueuePtr->DequeuePosition.store(0, std::memory_order_relaxed);
+   }
+
+static bool QueuePush(FrameQueueStruct* QueuePtr, const FrameWorkItemStruct* ItemPtr)
+   {
+   size_t Position = QueuePtr->EnqueuePosition.load(std::memory_order_relaxed);
+
+   for(;;)
+      {
+      FrameQueueSlotStruct* SlotPtr = &QueuePtr->Slots[Position & (PIPELINE_QUEUE_SIZE - 1)];
+      size_t Sequence = SlotPtr->Sequence.load(std::memory_order_acquire);
+      intptr_t Difference = (intptr_t)Sequence - (intptr_t)Position;
+
+      if(Difference == 0)
+         {
+         if(QueuePtr->EnqueuePosition.compare_exchange_weak(Position, Position + 1,
+                                                            std::memory_order_relaxed))
+            {
+            SlotPtr->Item = *ItemPtr;
+            SlotPtr->Sequence.store(Position + 1, std::memory_order_release);
+            return true;
+            }
+         }
+      else if(Difference < 0)
+         return false;
+      else
+         Position = QueuePtr->EnqueuePosition.load(std::memory_order_relaxed);
+      }
+   }
+
+static bool QueuePop(FrameQueueStruct* QueuePtr, FrameWorkItemStruct* ItemPtr)
+   {
+   size_t Position = QueuePtr->DequeuePosition.load(std::memory_order_relaxed);
+
+   for(;;)
+      {
+      FrameQueueSlotStruct* SlotPtr = &QueuePtr->Slots[Position & (PIPELINE_QUEUE_SIZE - 1)];
+      size_t Sequence = SlotPtr->Sequence.load(std::memory_order_acquire);
+      intptr_t Difference = (intptr_t)Sequence - (intptr_t)(Position + 1);
+
+      if(Difference == 0)
+         {
+         if(QueuePtr->DequeuePosition.compare_exchange_weak(Position, Position + 1,
+                                                            std::memory_order_relaxed))
+            {
+            *ItemPtr = SlotPtr->Item;
+            SlotPtr->Sequence.store(Position + PIPELINE_QUEUE_SIZE,
+                                    std::memory_order_release);
+            return true;
+            }
+         }
+      else if(Difference < 0)
+         return false;
+      else
+         Position = QueuePtr->DequeuePosition.load(std::memory_order_relaxed);
+      }
+   }
+
+/* Allocates the pipeline and starts its worker threads. WorkerNodes gives  */
+/* the NUMA node each worker is bound to; M_NULL leaves them unbound. The   */
+/* CPUs of PlacementPtr, if any, take precedence over the nodes.            */
+/* -----------------------------------------------------------------------   */
+FramePipelineStruct* PipelineAlloc(MIL_ID MilSystem, MIL_INT WorkerCount,
+                                   const MIL_INT* WorkerNodes,
+                                   const ThreadPlacementStruct* PlacementPtr)
+   {
+   FramePipelineStruct* PipelinePtr = new FramePipelineStruct;
+
+   PipelinePtr->LaneCount      = 0;
+   PipelinePtr->NextLane       = 0;
+   PipelinePtr->StopRequested  = false;
+   PipelinePtr->Placement      = *PlacementPtr;
+   PipelinePtr->WorkerCount    = WorkerCount < PIPELINE_WORKER_MAX ?
+                                 WorkerCount : PIPELINE_WORKER_MAX;
+
+   MthrAlloc(MilSystem, M_EVENT, M_NOT_SIGNALED+M_AUTO_RESET, M_NULL, M_NULL,
+      &PipelinePtr->WorkEvent);
+
+   /* Each worker draws with its own graphic context. */
+   for(MIL_INT i = 0; i < PipelinePtr->WorkerCount; i++)
+      {
+      PipelineWorkerStruct* WorkerPtr = &PipelinePtr->Workers[i];
+
+      WorkerPtr->PipelinePtr = PipelinePtr;
+      WorkerPtr->NumaNode    = WorkerNodes ? WorkerNodes[i] : CPU_NODE_UNKNOWN;
+      MgraAlloc(MilSystem, &WorkerPtr->GraphicContext);
+      MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, &PipelineWorkerThread, WorkerPtr,
+         &WorkerPtr->Thread);
+      }
+
+   return PipelinePtr;
+   }
+
+/* Adds the lane of a stream. Returns its index, or -1 if all are taken.    */
+/* -----------------------------------------------------------------------   */
+MIL_INT PipelineAddLane(FramePipelineStruct* PipelinePtr, void* HookDataPtr, MIL_INT NumaNode)
+   {
+   MIL_INT             Lane = PipelinePtr->LaneCount.load();
+   PipelineLaneStruct* LanePtr;
+
+   if(Lane >= PIPELINE_LANE_MAX)
+      return -1;
+
+   LanePtr = &PipelinePtr->Lanes[Lane];
+   QueueInit(&LanePtr->Queue);
+   LanePtr->HookDataPtr    = HookDataPtr;
+   LanePtr->NumaNode       = NumaNode;
+   LanePtr->SubmittedCount = 0;
+   LanePtr->QueueFullCount = 0;
+   LanePtr->MaxQueueDepth  = 0;
+   LanePtr->CompletedCount = 0;
+
+   /* Published to the workers once initialized. */
+   PipelinePtr->LaneCount.store(Lane + 1, std::memory_order_release);
+   return Lane;
+   }
+
+/* Stops the workers and frees the pipeline.                                 */
+/* -----------------------------------------------------------------------   */
+void PipelineFree(FramePipelineStruct* PipelinePtr)
+   {
+   if(!PipelinePtr)
+      return;
+
+   for(MIL_INT Lane = 0; Lane < PipelinePtr->LaneCount.load(); Lane++)
+      PipelineDrain(PipelinePtr, Lane);
+
+   PipelinePtr->StopRequested = true;
+   for(MIL_INT i = 0; i < PipelinePtr->WorkerCount; i++)
+      MthrControl(PipelinePtr->WorkEvent, M_EVENT_SET, M_SIGNALED);
+   for(MIL_INT i = 0; i < PipelinePtr->WorkerCount; i++)
+      {
+      MthrWait(PipelinePtr->Workers[i].Thread, M_THREAD_END_WAIT, M_NULL);
+      MthrFree(PipelinePtr->Workers[i].Thread);
+      MgraFree(PipelinePtr->Workers[i].GraphicContext);
+      }
+   MthrFree(PipelinePtr->WorkEvent);
+
+   delete PipelinePtr;
+   }
+
+/* Called from the hook: hands a grabbed frame to the workers and returns.   */
+/* Returns false, without waiting, if the ring of the lane is full.          */
+/* -----------------------------------------------------------------------   */
+bool PipelineSubmit(FramePipelineStruct* PipelinePtr, MIL_INT Lane,
+                    const FrameWorkItemStruct* ItemPtr)
+   {
+   PipelineLaneStruct* LanePtr = &PipelinePtr->Lanes[Lane];
+   MIL_INT    Depth;
+
+   AcquireGrabBuffer((HookDataStruct*)LanePtr->HookDataPtr, ItemPtr->BufferIndex);
+   if(!QueuePush(&LanePtr->Queue, ItemPtr))
+      {
+      ReleaseGrabBuffer((HookDataStruct*)LanePtr->HookDataPtr, ItemPtr->BufferIndex);
+      LanePtr->QueueFullCount++;
+      return false;
+      }
+   LanePtr->SubmittedCount.fetch_add(1, std::memory_order_release);
+   MthrControl(PipelinePtr->WorkEvent, M_EVENT_SET, M_SIGNALED);
+
+   Depth = PipelineQueueDepth(PipelinePtr, Lane);
+   if(Depth > LanePtr->MaxQueueDepth)
+      LanePtr->MaxQueueDepth = Depth;
+   return true;
+   }
+
+/* Waits until every frame submitted to a lane has been processed.          */
+/* -----------------------------------------------------------------------   */
+void PipelineDrain(FramePipelineStruct* PipelinePtr, MIL_INT Lane)
+   {
+   PipelineLaneStruct* LanePtr = &PipelinePtr->Lanes[Lane];
+
+   while(LanePtr->CompletedCount.load(std::memory_order_acquire) <
+         LanePtr->SubmittedCount.load(std::memory_order_acquire))
+      {
+      MthrControl(PipelinePtr->WorkEvent, M_EVENT_SET, M_SIGNALED);
+      MosSleep(1);
+      }
+   }
+
+/* Number of frames of a lane submitted but not yet processed.              */
+/* -----------------------------------------------------------------------   */
+MIL_INT PipelineQueueDepth(FramePipelineStruct* PipelinePtr, MIL_INT Lane)
+   {
+   PipelineLaneStruct* LanePtr = &PipelinePtr->Lanes[Lane];
+
+   return (MIL_INT)(LanePtr->SubmittedCount.load(std::memory_order_relaxed) -
+                    LanePtr->CompletedCount.load(std::memory_order_relaxed));
+   }
+
+/* Prints the backpressure counters, per lane if there are several.         */
+/* -----------------------------------------------------------------------   */
+void PipelinePrintStatistics(FramePipelineStruct* PipelinePtr)
+   {
+   MIL_INT    LaneCount = PipelinePtr->LaneCount.load();
+   MIL_INT64  Submitted = 0, Completed = 0, QueueFullCount = 0;
+   MIL_INT    MaxQueueDepth = 0;
+
+   for(MIL_INT Lane = 0; Lane < LaneCount; Lane++)
+      {
+      PipelineLaneStruct* LanePtr = &PipelinePtr->Lanes[Lane];
+
+      Submitted      += LanePtr->SubmittedCount.load();
+      Completed      += LanePtr->CompletedCount.load();
+      QueueFullCount += LanePtr->QueueFullCount;
+      if(LanePtr->MaxQueueDepth > MaxQueueDepth)
+         MaxQueueDepth = LanePtr->MaxQueueDepth;
+      }
+
+   MosPrintf(MIL_TEXT("\nWorker pipeline (%lld workers"), (long long)PipelinePtr->WorkerCount);
+   if(LaneCount > 1)
+      MosPrintf(MIL_TEXT(", %lld streams"), (long long)LaneCount);
+   MosPrintf(MIL_TEXT("):\n"));
+   MosPrintf(MIL_TEXT("  Frames submitted:        %lld\n"), (long long)Submitted);
+   MosPrintf(MIL_TEXT("  Frames processed:        %lld\n"), (long long)Completed);
+   MosPrintf(MIL_TEXT("  Max queue depth:         %lld\n"), (long long)MaxQueueDepth);
+   MosPrintf(MIL_TEXT("  Skipped, queue full:     %lld\n"), (long long)QueueFullCount);
+
+   if(LaneCount > 1)
+      {
+      MosPrintf(MIL_TEXT("  Stream  Node  Processed  Max depth  Queue full\n"));
+      for(MIL_INT Lane = 0; Lane < LaneCount; Lane++)
+         {
+         PipelineLaneStruct* LanePtr = &PipelinePtr->Lanes[Lane];
+
+         MosPrintf(MIL_TEXT("  %6lld  %4lld  %9lld  %9lld  %10lld\n"), (long long)Lane,
+            (long long)LanePtr->NumaNode, (long long)LanePtr->CompletedCount.load(),
+            (long long)LanePtr->MaxQueueDepth, (long long)LanePtr->QueueFullCount);
+         }
+      }
+   }
+
+/* Takes the next frame for a worker: the lanes are scanned from a start    */
+/* that moves one lane further at each call, those of the node of the      */
+/* worker first.                                                             */
+/* -----------------------------------------------------------------------   */
+static PipelineLaneStruct* PipelineTake(FramePipelineStruct* PipelinePtr,
+                                        const PipelineWorkerStruct* WorkerPtr,
+                                        FrameWorkItemStruct* ItemPtr)
+   {
+   MIL_INT LaneCount = PipelinePtr->LaneCount.load(std::memory_order_acquire);
+   size_t  Start;
+
+   if(LaneCount == 0)
+      return M_NULL;
+
+   Start = PipelinePtr->NextLane.fetch_add(1, std::memory_order_relaxed);
+   for(int Pass = 0; Pass < 2; Pass++)
+      {
+      /* A worker without a node has a single pass over all the lanes. */
+      bool LocalPass = (Pass == 0 && WorkerPtr->NumaNode != CPU_NODE_UNKNOWN);
+
+      if(Pass == 1 && WorkerPtr->NumaNode == CPU_NODE_UNKNOWN)
+         break;
+      for(MIL_INT i = 0; i < LaneCount; i++)
+         {
+         PipelineLaneStruct* LanePtr = &PipelinePtr->Lanes[(Start + i) % LaneCount];
+
+         if(LocalPass ? LanePtr->NumaNode != WorkerPtr->NumaNode :
+                        (Pass == 1 && LanePtr->NumaNode == WorkerPtr->NumaNode))
+            continue;
+         if(QueuePop(&LanePtr->Queue, ItemPtr))
+            return LanePtr;
+         }
+      }
+   return M_NULL;
+   }
+
+/* Frames submitted to all the lanes but not yet taken or processed.        */
+static MIL_INT PipelinePending(FramePipelineStruct* PipelinePtr)
+   {
+   MIL_INT LaneCount = PipelinePtr->LaneCount.load(std::memory_order_acquire);
+   MIL_INT Pending   = 0;
+
+   for(MIL_INT Lane = 0; Lane < LaneCount; Lane++)
+      Pending += PipelineQueueDepth(PipelinePtr, Lane);
+   return Pending;
+   }
+
+/* Worker thread: processes the frames pushed by the hooks.                  */
+/* -----------------------------------------------------------------------   */
+static MIL_UINT32 MFTYPE PipelineWorkerThread(void* ThreadContext)
+   {
+   PipelineWorkerStruct* WorkerPtr   = (PipelineWorkerStruct*)ThreadContext;
+   FramePipelineStruct*  PipelinePtr = WorkerPtr->PipelinePtr;
+   FrameWorkItemStruct   Item;
+
+   if(WorkerPtr->NumaNode != CPU_NODE_UNKNOWN && PipelinePtr->Placement.Cpus.empty())
+      CpuTopologyBindThread(WorkerPtr->NumaNode);
+   ThreadPlacementApply(&PipelinePtr->Placement, eThreadWorker,
+                        (int)(WorkerPtr - PipelinePtr->Workers));
+
+   while(!PipelinePtr->StopRequested)
+      {
+      PipelineLaneStruct* LanePtr = PipelineTake(PipelinePtr, WorkerPtr, &Item);
+      HookDataStruct*     HookDataPtr;
+
+      if(!LanePtr)
+         {
+         MthrWait(PipelinePtr->WorkEvent, M_EVENT_WAIT+M_EVENT_TIMEOUT(10), M_NULL);
+         continue;
+         }
+
+      /* More work pending: wake another worker. */
+      if(PipelinePending(PipelinePtr) > 1)
+         MthrControl(PipelinePtr->WorkEvent, M_EVENT_SET, M_SIGNALED);
+
+      HookDataPtr = (HookDataStruct*)LanePtr->HookDataPtr;
+      ProcessGrabbedBuffer(HookDataPtr, &Item, WorkerPtr->GraphicContext);
+
+      ReleaseGrabBuffer(HookDataPtr, Item.BufferIndex);
+      LanePtr->CompletedCount.fetch_add(1, std::memory_order_release);
+      }
+
+   return 0;
+   }
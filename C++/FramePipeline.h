@@ -0,0 +1,120 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FramePipeline.h
+ *
+ * Synopsis:  Worker pipeline that moves the per-frame processing out of the
+ *            acquisition hook. The hook only pushes the buffer and its hook
+ *            information into a lock-free ring; a pool of worker threads pops
+ *            the frames and performs the overlay, the display copy and any user
+ *            processing.
+ *
+ *            Several streams can share the workers: each one pushes into its own
+ *            lane, and the workers scan the lanes round robin, starting one lane
+ *            further at each frame, so that a high-rate stream cannot starve the
+ *            others. A worker bound to a NUMA node serves the lanes of its node
+ *            first and only takes frames of other nodes when those are empty.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <mil.h>
+#include <atomic>
+#include "CpuTopology.h"
+#include "ThreadPlacement.h"
+
+#define PIPELINE_WORKER_MAX      16
+#define PIPELINE_LANE_MAX        32    /* Streams sharing the workers.            */
+#define PIPELINE_QUEUE_SIZE      64    /* Power of 2, at least BUFFERING_SIZE_MAX. */
+#define CACHE_LINE_SIZE          64
+
+/* Work item: everything the workers need to know about a grabbed frame. */
+typedef struct
+   {
+   MIL_ID  BufferId;
+   MIL_INT BufferIndex;
+   MIL_INT IsFrameCorrupt;
+   MIL_INT FrameSizeX;
+   MIL_INT FrameSizeY;
+   MIL_INT FramePixelFormat;
+   MIL_INT FrameCount;
+   MIL_DOUBLE HookEntryTime;
+   MIL_DOUBLE DeviceTimestamp;
+   } FrameWorkItemStruct;
+
+/* Bounded multi-producer multi-consumer ring. Each slot carries a sequence  */
+/* number telling whether it is ready to be written or read.                 */
+typedef struct
+   {
+   std::atomic<size_t> Sequence;
+   FrameWorkItemStruct Item;
+   } FrameQueueSlotStruct;
+
+/* The positions are padded apart so that the hook and the workers do not    */
+/* share a cache line.                                                        */
+typedef struct
+   {
+   std::atomic<size_t>  EnqueuePosition;
+   char                 EnqueuePadding[CACHE_LINE_SIZE];
+   std::atomic<size_t>  DequeuePosition;
+   char                 DequeuePadding[CACHE_LINE_SIZE];
+   FrameQueueSlotStruct Slots[PIPELINE_QUEUE_SIZE];
+   } FrameQueueStruct;
+
+struct FramePipelineStruct;
+
+/* Frames of one stream. The hook of the stream is the only producer of its  */
+/* lane; the workers take turns between the lanes.                           */
+typedef struct
+   {
+   FrameQueueStruct       Queue;
+   void*                  HookDataPtr;
+   MIL_INT                NumaNode;         /* Of the NIC of the stream, or unknown. */
+
+   /* Written by the hook only. */
+   char                   HookPadding[CACHE_LINE_SIZE];
+   std::atomic<MIL_INT64> SubmittedCount;
+   MIL_INT64              QueueFullCount;   /* Frames skipped, the ring was full.    */
+   MIL_INT                MaxQueueDepth;
+
+   /* Written by the workers. */
+   char                   WorkerPadding[CACHE_LINE_SIZE];
+   std::atomic<MIL_INT64> CompletedCount;
+   } PipelineLaneStruct;
+
+/* Worker thread and the graphic context it draws with. */
+typedef struct
+   {
+   FramePipelineStruct* PipelinePtr;
+   MIL_ID               Thread;
+   MIL_ID               GraphicContext;
+   MIL_INT              NumaNode;           /* Node the worker is bound to, or unknown. */
+   } PipelineWorkerStruct;
+
+/* Workers shared by the lanes of all the streams, and the lanes. */
+typedef struct FramePipelineStruct
+   {
+   PipelineLaneStruct   Lanes[PIPELINE_LANE_MAX];
+   std::atomic<MIL_INT> LaneCount;
+   std::atomic<size_t>  NextLane;           /* First lane of the next worker scan.    */
+   PipelineWorkerStruct Workers[PIPELINE_WORKER_MAX];
+   MIL_INT              WorkerCount;
+   ThreadPlacementStruct Placement;         /* CPUs and priority of the workers.      */
+   MIL_ID               WorkEvent;
+   std::atomic<bool>    StopRequested;
+   } FramePipelineStruct;
+
+FramePipelineStruct* PipelineAlloc(MIL_ID MilSystem, MIL_INT WorkerCount,
+                                   const MIL_INT* WorkerNodes,
+                                   const ThreadPlacementStruct* PlacementPtr);
+MIL_INT PipelineAddLane(FramePipelineStruct* PipelinePtr, void* HookDataPtr, MIL_INT NumaNode);
+void PipelineFree(FramePipelineStruct* PipelinePtr);
+bool PipelineSubmit(FramePipelineStruct* PipelinePtr, MIL_INT Lane,
+                    const FrameWorkItemStruct* ItemPtr);
+void PipelineDrain(FramePipelineStruct* PipelinePtr, MIL_INT Lane);
+MIL_INT PipelineQueueDepth(FramePipelineStruct* PipelinePtr, MIL_INT Lane);
+void PipelinePrintStatistics(FramePipelineStruct* PipelinePtr);
+
+#endif /* FRAME_PIPELINE_H */
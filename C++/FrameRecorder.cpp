@@ -0,0 +1,517 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameRecorder.cpp
+ *
+ * Synopsis:  Record mode: hook-side copy into the ring and the writer thread.
+ *
+ *            The hook is the only producer. It appends the frames of the open
+ *            chunk to the ring and, when the chunk is closed, writes its index
+ *            and its header and publishes the end of the chunk in CommitPos.
+ *            The writer thread writes the committed part of the ring to the file
+ *            in large aligned writes and frees it by advancing ReadPos. Chunks
+ *            are padded to RECORDER_ALIGNMENT and the ring size is a multiple of
+ *            it, so every write is aligned both in memory and in the file, as
+ *            direct I/O requires.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#if M_MIL_USE_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#endif
+#include <string.h>
+#include <time.h>
+#include "MulticastMonitor.h"
+
+static MIL_UINT32 MFTYPE FrameRecorderThread(void* ThreadContext);
+
+static MIL_INT64 AlignUp(MIL_INT64 Value, MIL_INT64 Alignment)
+   {
+   return (Value + Alignment - 1) / Alignment * Alignment;
+   }
+
+/* Opens the file for direct I/O, or for buffered I/O if the file system    */
+/* does not support it.                                                      */
+/* -----------------------------------------------------------------------   */
+static bool OpenFile(FrameRecorderStruct* RecorderPtr)
+   {
+#if M_MIL_USE_WINDOWS
+   HANDLE File = CreateFileA(RecorderPtr->Path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, M_NULL,
+                             CREATE_ALWAYS, FILE_FLAG_NO_BUFFERING, M_NULL);
+
+   RecorderPtr->DirectIo = true;
+   if(File == INVALID_HANDLE_VALUE)
+      {
+      File = CreateFileA(RecorderPtr->Path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, M_NULL,
+                         CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, M_NULL);
+      RecorderPtr->DirectIo = false;
+      }
+   RecorderPtr->File = File;
+   return File != INVALID_HANDLE_VALUE;
+#else
+   int Flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+   RecorderPtr->DirectIo = true;
+   RecorderPtr->File     = open(RecorderPtr->Path.c_str(), Flags | O_DIRECT, 0644);
+   if(RecorderPtr->File < 0 && errno == EINVAL)
+      {
+      RecorderPtr->File     = open(RecorderPtr->Path.c_str(), Flags, 0644);
+      RecorderPtr->DirectIo = false;
+      }
+   return RecorderPtr->File >= 0;
+#endif
+   }
+
+static void CloseFile(FrameRecorderStruct* RecorderPtr)
+   {
+#if M_MIL_USE_WINDOWS
+   FlushFileBuffers((HANDLE)RecorderPtr->File);
+   CloseHandle((HANDLE)RecorderPtr->File);
+#else
+   fsync(RecorderPtr->File);
+   close(RecorderPtr->File);
+#endif
+   }
+
+/* Writes Size bytes at Offset of the file. Returns false on error.         */
+/* -----------------------------------------------------------------------   */
+static bool WriteAt(FrameRecorderStruct* RecorderPtr, const MIL_UINT8* Data, MIL_INT64 Size,
+                    MIL_INT64 Offset)
+   {
+   while(Size > 0)
+      {
+#if M_MIL_USE_WINDOWS
+      OVERLAPPED Overlapped;
+      DWORD      Written = 0;
+
+      memset(&Overlapped, 0, sizeof(Overlapped));
+      Overlapped.Offset     = (DWORD)Offset;
+      Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+      if(!WriteFile((HANDLE)RecorderPtr->File, Data, (DWORD)Size, &Written, &Overlapped) ||
+         Written == 0)
+         return false;
+#else
+      ssize_t Written = pwrite(RecorderPtr->File, Data, (size_t)Size, (off_t)Offset);
+
+      if(Written < 0 && errno == EINTR)
+         continue;
+      if(Written <= 0)
+         return false;
+#endif
+      Data   += Written;
+      Size   -= Written;
+      Offset += Written;
+      }
+   return true;
+   }
+
+/* Writes the file header, kept in the aligned page after the ring.         */
+/* -----------------------------------------------------------------------   */
+static bool WriteFileHeader(FrameRecorderStruct* RecorderPtr, bool Complete)
+   {
+   MIL_UINT8*                Page      = RecorderPtr->Ring + RecorderPtr->RingSize;
+   RecorderFileHeaderStruct* HeaderPtr = (RecorderFileHeaderStruct*)Page;
+
+   HeaderPtr->ChunkCount   = (uint64_t)RecorderPtr->ChunkCount;
+   HeaderPtr->FrameCount   = (uint64_t)RecorderPtr->FrameCount;
+   HeaderPtr->DataBytes    = (uint64_t)RecorderPtr->ReadPos.load();
+   HeaderPtr->SegmentCount = (uint32_t)RecorderPtr->SegmentCount;
+   HeaderPtr->Complete     = Complete ? 1 : 0;
+   return WriteAt(RecorderPtr, Page, RECORDER_ALIGNMENT, 0);
+   }
+
+/* Creates the recording and starts the writer thread. RingSize is rounded  */
+/* up to a multiple of RECORDER_ALIGNMENT. Returns M_NULL on failure.       */
+/* -----------------------------------------------------------------------   */
+FrameRecorderStruct* FrameRecorderAlloc(const std::string& Path, MIL_INT64 RingSize)
+   {
+   FrameRecorderStruct*      RecorderPtr = new FrameRecorderStruct;
+   RecorderFileHeaderStruct* HeaderPtr;
+   size_t                    MapSize;
+
+   /* The ring holds a few chunks so that the hook can fill one while the */
+   /* writer writes the others.                                            */
+   if(RingSize < 4 * (MIL_INT64)RECORDER_CHUNK_SIZE)
+      RingSize = 4 * (MIL_INT64)RECORDER_CHUNK_SIZE;
+   RingSize = AlignUp(RingSize, RECORDER_ALIGNMENT);
+   MapSize  = (size_t)RingSize + RECORDER_ALIGNMENT;
+
+   RecorderPtr->Path = Path;
+   if(!OpenFile(RecorderPtr))
+      {
+      MosPrintf(MIL_TEXT("Recorder: could not create %s.\n"),
+         MIL_STRING(Path.begin(), Path.end()).c_str());
+      delete RecorderPtr;
+      return M_NULL;
+      }
+
+#if M_MIL_USE_WINDOWS
+   RecorderPtr->Ring = (MIL_UINT8*)VirtualAlloc(M_NULL, MapSize, MEM_RESERVE | MEM_COMMIT,
+                                                PAGE_READWRITE);
+#else
+   RecorderPtr->Ring = (MIL_UINT8*)mmap(M_NULL, MapSize, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if(RecorderPtr->Ring == (MIL_UINT8*)MAP_FAILED)
+      RecorderPtr->Ring = M_NULL;
+#endif
+   if(!RecorderPtr->Ring)
+      {
+      MosPrintf(MIL_TEXT("Recorder: could not allocate a %lld MB ring.\n"),
+         (long long)(RingSize >> 20));
+      CloseFile(RecorderPtr);
+      delete RecorderPtr;
+      return M_NULL;
+      }
+
+   /* Fault the ring in now rather than page by page in the hook. */
+   memset(RecorderPtr->Ring, 0, MapSize);
+
+   RecorderPtr->RingSize          = RingSize;
+   RecorderPtr->StopRequested     = false;
+   RecorderPtr->Failed            = false;
+   RecorderPtr->ChunkFlags        = 0;
+   RecorderPtr->ReadPos           = 0;
+   RecorderPtr->CommitPos         = 0;
+   RecorderPtr->WritePos          = 0;
+   RecorderPtr->ChunkStart        = 0;
+   RecorderPtr->ChunkOpen         = false;
+   RecorderPtr->ChunkOpenTime     = 0;
+   memset(&RecorderPtr->Chunk, 0, sizeof(RecorderPtr->Chunk));
+   RecorderPtr->Index.reserve(RECORDER_CHUNK_FRAMES);
+   RecorderPtr->FrameCount        = 0;
+   RecorderPtr->DroppedFrameCount = 0;
+   RecorderPtr->ChunkCount        = 0;
+   RecorderPtr->SegmentCount      = 0;
+   RecorderPtr->FrameBytes        = 0;
+   RecorderPtr->MaxRingUsage      = 0;
+   RecorderPtr->CopyTime          = 0;
+   RecorderPtr->WriteCount        = 0;
+   RecorderPtr->WriteTime         = 0;
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &RecorderPtr->StartTime);
+
+   HeaderPtr = (RecorderFileHeaderStruct*)(RecorderPtr->Ring + RingSize);
+   memcpy(HeaderPtr->Magic, RECORDER_FILE_MAGIC, sizeof(HeaderPtr->Magic));
+   HeaderPtr->Version   = RECORDER_VERSION;
+   HeaderPtr->Alignment = RECORDER_ALIGNMENT;
+   HeaderPtr->StartTime = (int64_t)time(M_NULL);
+   WriteFileHeader(RecorderPtr, false);
+
+   MthrAlloc(M_DEFAULT_HOST, M_EVENT, M_NOT_SIGNALED+M_AUTO_RESET, M_NULL, M_NULL,
+      &RecorderPtr->WakeEvent);
+   MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, &FrameRecorderThread, RecorderPtr,
+      &RecorderPtr->Thread);
+
+   MosPrintf(MIL_TEXT("Recording to %s (%s I/O, %lld MB ring).\n"),
+      MIL_STRING(Path.begin(), Path.end()).c_str(),
+      RecorderPtr->DirectIo ? MIL_TEXT("direct") : MIL_TEXT("buffered"),
+      (long long)(RingSize >> 20));
+   return RecorderPtr;
+   }
+
+/* Copies into the ring at a stream position, wrapping around its end.      */
+/* -----------------------------------------------------------------------   */
+static void RingWrite(FrameRecorderStruct* RecorderPtr, MIL_INT64 Position, const void* Data,
+                      MIL_INT64 Size)
+   {
+   MIL_INT64 Offset = Position % RecorderPtr->RingSize;
+   MIL_INT64 First  = RecorderPtr->RingSize - Offset < Size ? RecorderPtr->RingSize - Offset : Size;
+
+   if(Data)
+      {
+      memcpy(RecorderPtr->Ring + Offset, Data, (size_t)First);
+      memcpy(RecorderPtr->Ring, (const MIL_UINT8*)Data + First, (size_t)(Size - First));
+      }
+   else
+      {
+      memset(RecorderPtr->Ring + Offset, 0, (size_t)First);
+      memset(RecorderPtr->Ring, 0, (size_t)(Size - First));
+      }
+   }
+
+/* Writes the index and the header of the open chunk and hands it to the   */
+/* writer thread.                                                            */
+/* -----------------------------------------------------------------------   */
+static void CloseChunk(FrameRecorderStruct* RecorderPtr)
+   {
+   RecorderChunkHeaderStruct* ChunkPtr   = &RecorderPtr->Chunk;
+   MIL_INT64                  IndexBytes = (MIL_INT64)(RecorderPtr->Index.size() *
+                                                       sizeof(RecorderIndexEntryStruct));
+   MIL_INT64                  ChunkBytes;
+
+   if(!RecorderPtr->ChunkOpen)
+      return;
+
+   ChunkPtr->FrameCount  = (uint32_t)RecorderPtr->Index.size();
+   ChunkPtr->IndexOffset = (uint64_t)(RecorderPtr->WritePos - RecorderPtr->ChunkStart);
+   RingWrite(RecorderPtr, RecorderPtr->WritePos, &RecorderPtr->Index[0], IndexBytes);
+   RecorderPtr->WritePos += IndexBytes;
+
+   ChunkBytes = AlignUp(RecorderPtr->WritePos - RecorderPtr->ChunkStart, RECORDER_ALIGNMENT);
+   RingWrite(RecorderPtr, RecorderPtr->WritePos, M_NULL,
+             RecorderPtr->ChunkStart + ChunkBytes - RecorderPtr->WritePos);
+   RecorderPtr->WritePos = RecorderPtr->ChunkStart + ChunkBytes;
+   ChunkPtr->ChunkBytes  = (uint64_t)ChunkBytes;
+   RingWrite(RecorderPtr, RecorderPtr->ChunkStart, ChunkPtr, sizeof(*ChunkPtr));
+
+   RecorderPtr->ChunkOpen = false;
+   RecorderPtr->ChunkCount++;
+   RecorderPtr->Index.clear();
+   RecorderPtr->CommitPos.store(RecorderPtr->WritePos, std::memory_order_release);
+   MthrControl(RecorderPtr->WakeEvent, M_EVENT_SET, M_SIGNALED);
+   }
+
+/* Ring space the open chunk would take up to its end with one more frame. */
+/* -----------------------------------------------------------------------   */
+static MIL_INT64 ChunkEndWith(const FrameRecorderStruct* RecorderPtr, MIL_INT64 FrameBytes)
+   {
+   MIL_INT64 ChunkStart = RecorderPtr->ChunkOpen ? RecorderPtr->ChunkStart : RecorderPtr->WritePos;
+   MIL_INT64 DataEnd    = AlignUp(RecorderPtr->ChunkOpen ? RecorderPtr->WritePos :
+                                  ChunkStart + (MIL_INT64)sizeof(RecorderChunkHeaderStruct),
+                                  RECORDER_FRAME_ALIGNMENT) + FrameBytes;
+   MIL_INT64 IndexBytes = (MIL_INT64)((RecorderPtr->Index.size() + 1) *
+                                      sizeof(RecorderIndexEntryStruct));
+
+   return ChunkStart + AlignUp(DataEnd + IndexBytes - ChunkStart, RECORDER_ALIGNMENT);
+   }
+
+/* Called by the hook: appends the frame in BufferId to the recording. The  */
+/* buffer is of the format of PoolPtr. EntryPtr gives the index entry of    */
+/* the frame; its offset and size are filled here. Never blocks: the frame  */
+/* is dropped if the ring is full.                                           */
+/* -----------------------------------------------------------------------   */
+void FrameRecorderAddFrame(FrameRecorderStruct* RecorderPtr, const BufferPoolStruct* PoolPtr,
+                           MIL_ID BufferId, const RecorderIndexEntryStruct* EntryPtr)
+   {
+   RecorderIndexEntryStruct Entry        = *EntryPtr;
+   MIL_UINT8*               HostAddress  = M_NULL;
+   MIL_INT                  Pitch        = 0;
+   MIL_INT64                Bytes;
+   MIL_INT64                Usage;
+   MIL_DOUBLE               Start, End;
+
+   if(RecorderPtr->Failed.load(std::memory_order_relaxed))
+      {
+      RecorderPtr->DroppedFrameCount++;
+      return;
+      }
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Start);
+
+   /* The buffer memory is stored as is, rows and pitch included, so that  */
+   /* the wire layout of the native receiver is kept. Buffers without a    */
+   /* single host address are stored densely.                               */
+   if(PoolPtr->SizeBand == 1 || PoolPtr->SourceDataFormat != 0)
+      MbufInquire(BufferId, M_HOST_ADDRESS, &HostAddress);
+   if(HostAddress)
+      {
+      Pitch = MbufInquire(BufferId, M_PITCH_BYTE, M_NULL);
+      Bytes = (MIL_INT64)Pitch * PoolPtr->FrameSizeY;
+      }
+   else
+      Bytes = (MIL_INT64)PoolPtr->FrameSizeX * PoolPtr->FrameSizeY * PoolPtr->SizeBand *
+              (((PoolPtr->Type & 0xFF) + 7) / 8);
+
+   /* A new data format starts a new segment; a chunk holds a single format. */
+   /* The format of the segment is set here, even if the frame is dropped,   */
+   /* so that the next frames of the format stay in the segment.             */
+   if(RecorderPtr->SegmentCount == 0 ||
+      RecorderPtr->Chunk.SizeX       != (uint32_t)PoolPtr->FrameSizeX ||
+      RecorderPtr->Chunk.SizeY       != (uint32_t)PoolPtr->FrameSizeY ||
+      RecorderPtr->Chunk.PixelFormat != (uint32_t)PoolPtr->FramePixelFormat ||
+      RecorderPtr->Chunk.Pitch       != (uint32_t)Pitch)
+      {
+      RecorderChunkHeaderStruct* ChunkPtr = &RecorderPtr->Chunk;
+
+      CloseChunk(RecorderPtr);
+      RecorderPtr->SegmentCount++;
+      ChunkPtr->SizeX            = (uint32_t)PoolPtr->FrameSizeX;
+      ChunkPtr->SizeY            = (uint32_t)PoolPtr->FrameSizeY;
+      ChunkPtr->PixelFormat      = (uint32_t)PoolPtr->FramePixelFormat;
+      ChunkPtr->SizeBand         = (uint32_t)PoolPtr->SizeBand;
+      ChunkPtr->Type             = (uint32_t)PoolPtr->Type;
+      ChunkPtr->Pitch            = (uint32_t)Pitch;
+      ChunkPtr->SourceDataFormat = (uint64_t)PoolPtr->SourceDataFormat;
+
+      /* Sized once per segment, so that the frames do not allocate. */
+      if(!HostAddress)
+         RecorderPtr->Staging.resize((size_t)Bytes);
+      }
+   else if(RecorderPtr->ChunkOpen &&
+           (RecorderPtr->Index.size() >= RECORDER_CHUNK_FRAMES ||
+            ChunkEndWith(RecorderPtr, Bytes) - RecorderPtr->ChunkStart > RECORDER_CHUNK_SIZE ||
+            Start - RecorderPtr->ChunkOpenTime > RECORDER_FLUSH_PERIOD))
+      CloseChunk(RecorderPtr);
+
+   /* Drop the frame rather than wait for the disk. The open chunk is       */
+   /* closed so that the writer can free the ring up to the last frame.     */
+   if(ChunkEndWith(RecorderPtr, Bytes) - RecorderPtr->ReadPos.load(std::memory_order_acquire) >
+      RecorderPtr->RingSize)
+      {
+      CloseChunk(RecorderPtr);
+      if(ChunkEndWith(RecorderPtr, Bytes) - RecorderPtr->ReadPos.load(std::memory_order_acquire) >
+         RecorderPtr->RingSize)
+         {
+         RecorderPtr->DroppedFrameCount++;
+         return;
+         }
+      }
+
+   if(!RecorderPtr->ChunkOpen)
+      {
+      RecorderChunkHeaderStruct* ChunkPtr = &RecorderPtr->Chunk;
+
+      ChunkPtr->Magic            = RECORDER_CHUNK_MAGIC;
+      ChunkPtr->SegmentIndex     = (uint32_t)(RecorderPtr->SegmentCount - 1);
+      ChunkPtr->FrameCount       = 0;
+      ChunkPtr->Flags            = RecorderPtr->ChunkFlags;
+      RecorderPtr->ChunkStart    = RecorderPtr->WritePos;
+      RecorderPtr->WritePos     += sizeof(RecorderChunkHeaderStruct);
+      RecorderPtr->ChunkOpen     = true;
+      RecorderPtr->ChunkOpenTime = Start;
+      }
+
+   /* Frame data, aligned. */
+   RingWrite(RecorderPtr, RecorderPtr->WritePos, M_NULL,
+             AlignUp(RecorderPtr->WritePos, RECORDER_FRAME_ALIGNMENT) - RecorderPtr->WritePos);
+   RecorderPtr->WritePos = AlignUp(RecorderPtr->WritePos, RECORDER_FRAME_ALIGNMENT);
+   if(HostAddress)
+      RingWrite(RecorderPtr, RecorderPtr->WritePos, HostAddress, Bytes);
+   else if(RecorderPtr->WritePos % RecorderPtr->RingSize + Bytes <= RecorderPtr->RingSize)
+      MbufGet(BufferId, RecorderPtr->Ring + RecorderPtr->WritePos % RecorderPtr->RingSize);
+   else
+      {
+      /* Across the end of the ring. */
+      MbufGet(BufferId, &RecorderPtr->Staging[0]);
+      RingWrite(RecorderPtr, RecorderPtr->WritePos, &RecorderPtr->Staging[0], Bytes);
+      }
+
+   Entry.Offset = (uint64_t)(RecorderPtr->WritePos - RecorderPtr->ChunkStart);
+   Entry.Size   = (uint32_t)Bytes;
+   RecorderPtr->Index.push_back(Entry);
+   RecorderPtr->WritePos += Bytes;
+   RecorderPtr->FrameCount++;
+   RecorderPtr->FrameBytes += Bytes;
+
+   Usage = RecorderPtr->WritePos - RecorderPtr->ReadPos.load(std::memory_order_relaxed);
+   if(Usage > RecorderPtr->MaxRingUsage)
+      RecorderPtr->MaxRingUsage = Usage;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &End);
+   RecorderPtr->CopyTime += End - Start;
+   }
+
+/* Writer thread: writes the committed chunks to the file.                  */
+/* -----------------------------------------------------------------------   */
+static MIL_UINT32 MFTYPE FrameRecorderThread(void* ThreadContext)
+   {
+   FrameRecorderStruct* RecorderPtr = (FrameRecorderStruct*)ThreadContext;
+
+   for(;;)
+      {
+      MIL_INT64 CommitPos = RecorderPtr->CommitPos.load(std::memory_order_acquire);
+      MIL_INT64 ReadPos   = RecorderPtr->ReadPos.load(std::memory_order_relaxed);
+
+      if(ReadPos == CommitPos)
+         {
+         if(RecorderPtr->StopRequested)
+            break;
+         MthrWait(RecorderPtr->WakeEvent, M_EVENT_WAIT+M_EVENT_TIMEOUT(100), M_NULL);
+         continue;
+         }
+
+      while(ReadPos < CommitPos && !RecorderPtr->Failed)
+         {
+         MIL_INT64  Offset = ReadPos % RecorderPtr->RingSize;
+         MIL_INT64  Size   = CommitPos - ReadPos;
+         MIL_DOUBLE Start, End;
+
+         if(Size > RecorderPtr->RingSize - Offset)
+            Size = RecorderPtr->RingSize - Offset;
+         if(Size > RECORDER_WRITE_SIZE)
+            Size = RECORDER_WRITE_SIZE;
+
+         MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Start);
+         if(!WriteAt(RecorderPtr, RecorderPtr->Ring + Offset, Size, RECORDER_ALIGNMENT + ReadPos))
+            {
+            MosPrintf(MIL_TEXT("Recorder: write failed, recording stopped.\n"));
+            RecorderPtr->Failed = true;
+            break;
+            }
+         MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &End);
+         RecorderPtr->WriteTime += End - Start;
+         RecorderPtr->WriteCount++;
+
+         ReadPos += Size;
+         RecorderPtr->ReadPos.store(ReadPos, std::memory_order_release);
+         }
+
+      if(RecorderPtr->Failed)
+         break;
+      }
+
+   return 0;
+   }
+
+/* Closes the open chunk and waits until everything is written. Called once */
+/* the acquisition is stopped.                                               */
+/* -----------------------------------------------------------------------   */
+void FrameRecorderFlush(FrameRecorderStruct* RecorderPtr)
+   {
+   CloseChunk(RecorderPtr);
+   while(!RecorderPtr->Failed &&
+         RecorderPtr->ReadPos.load(std::memory_order_acquire) <
+         RecorderPtr->CommitPos.load(std::memory_order_relaxed))
+      MosSleep(1);
+   }
+
+/* Stops the writer thread and completes the file header.                   */
+/* -----------------------------------------------------------------------   */
+void FrameRecorderFree(FrameRecorderStruct* RecorderPtr)
+   {
+   if(!RecorderPtr)
+      return;
+
+   CloseChunk(RecorderPtr);
+   RecorderPtr->StopRequested = true;
+   MthrControl(RecorderPtr->WakeEvent, M_EVENT_SET, M_SIGNALED);
+   MthrWait(RecorderPtr->Thread, M_THREAD_END_WAIT, M_NULL);
+   MthrFree(RecorderPtr->Thread);
+   MthrFree(RecorderPtr->WakeEvent);
+
+   if(!WriteFileHeader(RecorderPtr, !RecorderPtr->Failed))
+      MosPrintf(MIL_TEXT("Recorder: could not update the header of %s.\n"),
+         MIL_STRING(RecorderPtr->Path.begin(), RecorderPtr->Path.end()).c_str());
+   CloseFile(RecorderPtr);
+
+#if M_MIL_USE_WINDOWS
+   VirtualFree(RecorderPtr->Ring, 0, MEM_RELEASE);
+#else
+   munmap(RecorderPtr->Ring, (size_t)RecorderPtr->RingSize + RECORDER_ALIGNMENT);
+#endif
+   delete RecorderPtr;
+   }
+
+void FrameRecorderPrintStatistics(FrameRecorderStruct* RecorderPtr)
+   {
+   MIL_DOUBLE Now, MBytes = RecorderPtr->ReadPos.load() / 1048576.0;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Now);
+   MosPrintf(MIL_TEXT("\nRecorder (%s):\n"),
+      MIL_STRING(RecorderPtr->Path.begin(), RecorderPtr->Path.end()).c_str());
+   MosPrintf(MIL_TEXT("  Frames recorded:         %lld (%lld dropped), %lld chunks, ")
+             MIL_TEXT("%lld segments\n"),
+      (long long)RecorderPtr->FrameCount, (long long)RecorderPtr->DroppedFrameCount,
+      (long long)RecorderPtr->ChunkCount, (long long)RecorderPtr->SegmentCount);
+   MosPrintf(MIL_TEXT("  Written:                 %.1f MB, %.1f MB/s over the run, ")
+             MIL_TEXT("%.1f MB/s while writing\n"),
+      MBytes, MBytes / (Now - RecorderPtr->StartTime),
+      RecorderPtr->WriteTime > 0 ? MBytes / RecorderPtr->WriteTime : 0);
+   MosPrintf(MIL_TEXT("  Hook copy:               %.1f us per frame, ring peak %.1f%%\n"),
+      RecorderPtr->FrameCount ? 1e6 * RecorderPtr->CopyTime / RecorderPtr->FrameCount : 0,
+      100.0 * RecorderPtr->MaxRingUsage / RecorderPtr->RingSize);
+   }
@@ -0,0 +1,150 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameRecorder.h
+ *
+ * Synopsis:  Record mode. The hook copies every grabbed buffer into a ring of
+ *            aligned host memory and a writer thread streams the ring to disk
+ *            with direct (unbuffered) writes, so neither the page cache nor a
+ *            slow disk can stall the grab: when the ring is full, frames are
+ *            dropped and counted instead.
+ *
+ *            The recording is a chunked container: a file header, then chunks
+ *            of frames each followed by the index of its frames. A data format
+ *            change starts a new segment; the chunks of a segment share the
+ *            buffer format given in their header.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <mil.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define RECORDER_ALIGNMENT       4096        /* Direct I/O offset and size granularity.  */
+#define RECORDER_CHUNK_SIZE      (8 << 20)   /* Chunk closed once it holds this much.    */
+#define RECORDER_CHUNK_FRAMES    1024        /* Most frames in a chunk.                  */
+#define RECORDER_FLUSH_PERIOD    0.5         /* Sec before a chunk is closed anyway.     */
+#define RECORDER_WRITE_SIZE      (4 << 20)   /* Largest single write.                    */
+#define RECORDER_RING_DEFAULT    256         /* MB of ring between the hook and the disk. */
+#define RECORDER_FRAME_ALIGNMENT 64
+
+#define RECORDER_FILE_MAGIC      "MMONREC"
+#define RECORDER_CHUNK_MAGIC     0x4B4E4843  /* "CHNK" */
+#define RECORDER_VERSION         1
+
+/* Index entry flags. */
+#define RECORDER_FRAME_CORRUPT     0x1      /* The frame had missing packets.           */
+#define RECORDER_FRAME_MISMATCHED  0x2      /* Grabbed in a buffer of the previous data */
+                                            /* format, during a data format change.     */
+
+/* Chunk flags. */
+#define RECORDER_CHUNK_PACKED_ROWS 0x1      /* Packed pixel formats are stored as they */
+                                            /* came on the wire, not unpacked.         */
+
+/* At offset 0 of the file, padded to RECORDER_ALIGNMENT. Rewritten with the */
+/* totals when the recording is closed.                                      */
+typedef struct
+   {
+   char     Magic[8];
+   uint32_t Version;
+   uint32_t Alignment;
+   uint64_t ChunkCount;
+   uint64_t FrameCount;
+   uint64_t DataBytes;        /* Bytes of chunks after the file header.         */
+   uint32_t SegmentCount;
+   uint32_t Complete;         /* 0 if the recording was not closed.             */
+   int64_t  StartTime;        /* Unix time.                                     */
+   } RecorderFileHeaderStruct;
+
+/* At the start of each chunk. The frames follow, each aligned on            */
+/* RECORDER_FRAME_ALIGNMENT, then the index, then padding up to ChunkBytes.  */
+typedef struct
+   {
+   uint32_t Magic;
+   uint32_t SegmentIndex;
+   uint32_t FrameCount;
+   uint32_t Flags;
+   uint64_t ChunkBytes;       /* Multiple of RECORDER_ALIGNMENT.                */
+   uint64_t IndexOffset;      /* From the start of the chunk.                   */
+   uint32_t SizeX;            /* Data format of the buffers of the segment.     */
+   uint32_t SizeY;
+   uint32_t PixelFormat;
+   uint32_t SizeBand;
+   uint32_t Type;             /* MIL buffer type.                               */
+   uint32_t Pitch;            /* Bytes per row as stored, 0 if stored densely   */
+                              /* as MbufGet returns it.                         */
+   uint64_t SourceDataFormat;
+   } RecorderChunkHeaderStruct;
+
+typedef struct
+   {
+   uint64_t FrameNumber;
+   double   HostTimestamp;    /* Hook entry, sec.                               */
+   double   DeviceTimestamp;  /* Sec, 0 if unknown.                             */
+   uint64_t Offset;           /* Of the frame data, from the start of the chunk. */
+   uint32_t Size;
+   uint32_t PixelFormat;      /* Of the frame, as received.                     */
+   uint32_t BlockId;
+   uint32_t Flags;
+   } RecorderIndexEntryStruct;
+
+typedef struct
+   {
+   std::string            Path;
+#if M_MIL_USE_WINDOWS
+   void*                  File;
+#else
+   int                    File;
+#endif
+   bool                   DirectIo;
+   MIL_UINT8*             Ring;             /* RingSize bytes, then the file header. */
+   MIL_INT64              RingSize;
+   MIL_ID                 Thread;
+   MIL_ID                 WakeEvent;
+   std::atomic<bool>      StopRequested;
+   std::atomic<bool>      Failed;           /* A write failed; recording stopped.    */
+   uint32_t               ChunkFlags;       /* Of the chunks to come.                */
+
+   /* Stream positions: a position is its file offset past the file header,  */
+   /* and its ring offset modulo RingSize.                                    */
+   std::atomic<MIL_INT64> ReadPos;          /* Written to the file.                  */
+   char                   ReadPadding[CACHE_LINE_SIZE];
+   std::atomic<MIL_INT64> CommitPos;        /* End of the last closed chunk.         */
+   char                   CommitPadding[CACHE_LINE_SIZE];
+
+   /* Hook state. */
+   MIL_INT64              WritePos;         /* End of the open chunk so far.         */
+   MIL_INT64              ChunkStart;
+   bool                   ChunkOpen;
+   MIL_DOUBLE             ChunkOpenTime;
+   RecorderChunkHeaderStruct Chunk;
+   std::vector<RecorderIndexEntryStruct> Index;
+   std::vector<MIL_UINT8> Staging;          /* A frame without a host address that   */
+                                            /* wraps around the ring; segment size.  */
+   MIL_INT64              FrameCount;
+   MIL_INT64              DroppedFrameCount;
+   MIL_INT64              ChunkCount;
+   MIL_INT64              SegmentCount;
+   MIL_INT64              FrameBytes;
+   MIL_INT64              MaxRingUsage;
+   MIL_DOUBLE             CopyTime;
+
+   /* Writer statistics. */
+   MIL_INT64              WriteCount;
+   MIL_DOUBLE             WriteTime;
+   MIL_DOUBLE             StartTime;
+   } FrameRecorderStruct;
+
+FrameRecorderStruct* FrameRecorderAlloc(const std::string& Path, MIL_INT64 RingSize);
+void FrameRecorderFlush(FrameRecorderStruct* RecorderPtr);
+void FrameRecorderFree(FrameRecorderStruct* RecorderPtr);
+void FrameRecorderAddFrame(FrameRecorderStruct* RecorderPtr, const BufferPoolStruct* PoolPtr,
+                           MIL_ID BufferId, const RecorderIndexEntryStruct* EntryPtr);
+void FrameRecorderPrintStatistics(FrameRecorderStruct* RecorderPtr);
+
+#endif /* FRAME_RECORDER_H */
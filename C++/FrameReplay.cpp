@@ -0,0 +1,479 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameReplay.cpp
+ *
+ * Synopsis:  Replay backend: maps the recording, checks its chunks and feeds its
+ *            frames to ProcessFrame from a thread of its own.
+ *
+ *            The frames are copied from the mapping to the grab buffers before
+ *            the hook time starts, as a digitizer fills the buffer before calling
+ *            the hook. Each frame is announced in its own data format: a frame
+ *            recorded in a buffer of the previous format during a data format
+ *            change is announced in the format that followed, so the replay
+ *            raises the data format changes where the recorded stream did.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#if M_MIL_USE_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "MulticastMonitor.h"
+
+static MIL_UINT32 MFTYPE FrameReplayThread(void* ThreadContext);
+
+/* Maps the whole recording read-only. Returns false on failure.            */
+/* -----------------------------------------------------------------------   */
+static bool MapFile(FrameReplayStruct* ReplayPtr)
+   {
+#if M_MIL_USE_WINDOWS
+   LARGE_INTEGER Size;
+
+   ReplayPtr->File    = CreateFileA(ReplayPtr->Path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                                    M_NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, M_NULL);
+   ReplayPtr->Mapping = M_NULL;
+   if(ReplayPtr->File == INVALID_HANDLE_VALUE)
+      return false;
+   if(!GetFileSizeEx((HANDLE)ReplayPtr->File, &Size) || Size.QuadPart == 0)
+      {
+      CloseHandle((HANDLE)ReplayPtr->File);
+      return false;
+      }
+   ReplayPtr->MapSize = Size.QuadPart;
+   ReplayPtr->Mapping = CreateFileMappingA((HANDLE)ReplayPtr->File, M_NULL, PAGE_READONLY, 0, 0,
+                                           M_NULL);
+   if(ReplayPtr->Mapping)
+      ReplayPtr->Map = (const MIL_UINT8*)MapViewOfFile((HANDLE)ReplayPtr->Mapping, FILE_MAP_READ,
+                                                       0, 0, 0);
+   if(!ReplayPtr->Map)
+      {
+      if(ReplayPtr->Mapping)
+         CloseHandle((HANDLE)ReplayPtr->Mapping);
+      CloseHandle((HANDLE)ReplayPtr->File);
+      return false;
+      }
+   return true;
+#else
+   struct stat Status;
+   void*       Map;
+   int         File = open(ReplayPtr->Path.c_str(), O_RDONLY);
+
+   if(File < 0)
+      return false;
+   if(fstat(File, &Status) != 0 || Status.st_size == 0)
+      {
+      close(File);
+      return false;
+      }
+
+   /* The mapping outlives the descriptor. */
+   Map = mmap(M_NULL, (size_t)Status.st_size, PROT_READ, MAP_SHARED, File, 0);
+   close(File);
+   if(Map == MAP_FAILED)
+      return false;
+   madvise(Map, (size_t)Status.st_size, MADV_SEQUENTIAL);
+
+   ReplayPtr->Map     = (const MIL_UINT8*)Map;
+   ReplayPtr->MapSize = (MIL_INT64)Status.st_size;
+   return true;
+#endif
+   }
+
+static void UnmapFile(FrameReplayStruct* ReplayPtr)
+   {
+#if M_MIL_USE_WINDOWS
+   UnmapViewOfFile(ReplayPtr->Map);
+   CloseHandle((HANDLE)ReplayPtr->Mapping);
+   CloseHandle((HANDLE)ReplayPtr->File);
+#else
+   munmap((void*)ReplayPtr->Map, (size_t)ReplayPtr->MapSize);
+#endif
+   }
+
+/* Builds the frame list from the chunks of the recording. A recording that */
+/* was not closed is replayed up to its last complete chunk. Returns false  */
+/* if the file is not a recording.                                           */
+/* -----------------------------------------------------------------------   */
+static bool IndexFrames(FrameReplayStruct* ReplayPtr)
+   {
+   const RecorderFileHeaderStruct* HeaderPtr = (const RecorderFileHeaderStruct*)ReplayPtr->Map;
+   MIL_INT64 Offset, End = ReplayPtr->MapSize;
+   MIL_INT64 SegmentIndex = -1;
+   MIL_INT64 ChunkCount = 0;
+
+   if(ReplayPtr->MapSize < (MIL_INT64)sizeof(RecorderFileHeaderStruct) ||
+      memcmp(HeaderPtr->Magic, RECORDER_FILE_MAGIC, sizeof(HeaderPtr->Magic)) != 0 ||
+      HeaderPtr->Version != RECORDER_VERSION ||
+      HeaderPtr->Alignment < sizeof(RecorderFileHeaderStruct) ||
+      HeaderPtr->Alignment > ReplayPtr->MapSize)
+      return false;
+
+   Offset = HeaderPtr->Alignment;
+   if(HeaderPtr->Complete && Offset + (MIL_INT64)HeaderPtr->DataBytes < End)
+      End = Offset + (MIL_INT64)HeaderPtr->DataBytes;
+
+   while(Offset + (MIL_INT64)sizeof(RecorderChunkHeaderStruct) <= End)
+      {
+      const RecorderChunkHeaderStruct* ChunkPtr =
+         (const RecorderChunkHeaderStruct*)(ReplayPtr->Map + Offset);
+      const RecorderIndexEntryStruct*  IndexPtr;
+
+      if(ChunkPtr->Magic != RECORDER_CHUNK_MAGIC || ChunkPtr->ChunkBytes == 0 ||
+         ChunkPtr->ChunkBytes > (uint64_t)(End - Offset) ||
+         ChunkPtr->IndexOffset > ChunkPtr->ChunkBytes ||
+         ChunkPtr->FrameCount > (ChunkPtr->ChunkBytes - ChunkPtr->IndexOffset) /
+                                sizeof(RecorderIndexEntryStruct))
+         break;
+
+      IndexPtr = (const RecorderIndexEntryStruct*)((const MIL_UINT8*)ChunkPtr +
+                                                   ChunkPtr->IndexOffset);
+      for(uint32_t i = 0; i < ChunkPtr->FrameCount; i++)
+         {
+         ReplayFrameStruct Frame;
+
+         if(IndexPtr[i].Offset < sizeof(RecorderChunkHeaderStruct) ||
+            IndexPtr[i].Offset + IndexPtr[i].Size > ChunkPtr->IndexOffset)
+            break;
+         Frame.Chunk       = ChunkPtr;
+         Frame.Entry       = &IndexPtr[i];
+         Frame.Data        = (const MIL_UINT8*)ChunkPtr + IndexPtr[i].Offset;
+         Frame.SizeX       = ChunkPtr->SizeX;
+         Frame.SizeY       = ChunkPtr->SizeY;
+         Frame.PixelFormat = ChunkPtr->PixelFormat;
+         ReplayPtr->Frames.push_back(Frame);
+         }
+
+      if(ChunkPtr->SegmentIndex != SegmentIndex)
+         {
+         SegmentIndex = ChunkPtr->SegmentIndex;
+         ReplayPtr->SegmentCount++;
+         }
+      ChunkCount++;
+      Offset += (MIL_INT64)ChunkPtr->ChunkBytes;
+      }
+
+   if(!HeaderPtr->Complete || ChunkCount != (MIL_INT64)HeaderPtr->ChunkCount)
+      MosPrintf(MIL_TEXT("Replay: %s is incomplete, %lld complete chunks replayed.\n"),
+         MIL_STRING(ReplayPtr->Path.begin(), ReplayPtr->Path.end()).c_str(),
+         (long long)ChunkCount);
+
+   /* The frames recorded in buffers of the previous format only tell their  */
+   /* pixel format; they take the size of the next frame stored in a buffer  */
+   /* of their own format.                                                    */
+   for(size_t i = ReplayPtr->Frames.size(); i-- > 0; )
+      {
+      ReplayFrameStruct* FramePtr = &ReplayPtr->Frames[i];
+
+      if(FramePtr->Entry->Flags & RECORDER_FRAME_MISMATCHED)
+         {
+         FramePtr->PixelFormat = FramePtr->Entry->PixelFormat;
+         if(i + 1 < ReplayPtr->Frames.size() &&
+            ReplayPtr->Frames[i + 1].PixelFormat == FramePtr->PixelFormat)
+            {
+            FramePtr->SizeX = ReplayPtr->Frames[i + 1].SizeX;
+            FramePtr->SizeY = ReplayPtr->Frames[i + 1].SizeY;
+            }
+         }
+      }
+
+   if(ReplayPtr->Frames.size() > 1)
+      ReplayPtr->RecordedDuration = ReplayPtr->Frames.back().Entry->HostTimestamp -
+                                    ReplayPtr->Frames.front().Entry->HostTimestamp;
+   return true;
+   }
+
+/* Maps a recording for replay. Returns M_NULL if it cannot be read or     */
+/* holds no frame.                                                           */
+/* -----------------------------------------------------------------------   */
+FrameReplayStruct* FrameReplayAlloc(const std::string& Path, ReplayPacingType Pacing,
+                                    MIL_DOUBLE FrameRate, void* HookDataPtr)
+   {
+   FrameReplayStruct* ReplayPtr = new FrameReplayStruct;
+
+   ReplayPtr->Path             = Path;
+   ReplayPtr->Map              = M_NULL;
+   ReplayPtr->MapSize          = 0;
+   ReplayPtr->SegmentCount     = 0;
+   ReplayPtr->RecordedDuration = 0;
+   ReplayPtr->Pacing           = Pacing;
+   ReplayPtr->FrameRate        = FrameRate;
+   ReplayPtr->HookDataPtr      = HookDataPtr;
+   ReplayPtr->Thread           = M_NULL;
+   ReplayPtr->StopRequested    = false;
+   ReplayPtr->Ended            = false;
+   ReplayPtr->NextFrame        = 0;
+   ReplayPtr->FrameCount       = 0;
+   ReplayPtr->ByteCount        = 0;
+   ReplayPtr->TruncatedCount   = 0;
+   ReplayPtr->LateCount        = 0;
+   ReplayPtr->CopyTime         = 0;
+   ReplayPtr->HookTimeTotal    = 0;
+   ReplayPtr->HookTimeMax      = 0;
+   ReplayPtr->RunTime          = 0;
+
+   if(!MapFile(ReplayPtr))
+      {
+      MosPrintf(MIL_TEXT("Replay: could not map %s.\n"),
+         MIL_STRING(Path.begin(), Path.end()).c_str());
+      delete ReplayPtr;
+      return M_NULL;
+      }
+
+   if(!IndexFrames(ReplayPtr) || ReplayPtr->Frames.empty())
+      {
+      MosPrintf(MIL_TEXT("Replay: %s is not a recording or holds no frame.\n"),
+         MIL_STRING(Path.begin(), Path.end()).c_str());
+      UnmapFile(ReplayPtr);
+      delete ReplayPtr;
+      return M_NULL;
+      }
+
+   MosPrintf(MIL_TEXT("Replaying %s: %lld frames in %lld segments, %.1f sec recorded.\n"),
+      MIL_STRING(Path.begin(), Path.end()).c_str(), (long long)ReplayPtr->Frames.size(),
+      (long long)ReplayPtr->SegmentCount, ReplayPtr->RecordedDuration);
+   return ReplayPtr;
+   }
+
+void FrameReplayFree(FrameReplayStruct* ReplayPtr)
+   {
+   if(!ReplayPtr)
+      return;
+
+   FrameReplayStop(ReplayPtr);
+   UnmapFile(ReplayPtr);
+   delete ReplayPtr;
+   }
+
+void FrameReplayStart(FrameReplayStruct* ReplayPtr)
+   {
+   ReplayPtr->StopRequested = false;
+   MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, &FrameReplayThread, ReplayPtr,
+      &ReplayPtr->Thread);
+   }
+
+void FrameReplayStop(FrameReplayStruct* ReplayPtr)
+   {
+   if(ReplayPtr->Thread == M_NULL)
+      return;
+
+   ReplayPtr->StopRequested = true;
+   MthrWait(ReplayPtr->Thread, M_THREAD_END_WAIT, M_NULL);
+   MthrFree(ReplayPtr->Thread);
+   ReplayPtr->Thread = M_NULL;
+   }
+
+/* Copies a recorded frame to a grab buffer. The rows are copied as stored, */
+/* so the packed formats stay packed as the native receiver leaves them. A  */
+/* buffer of another format only gets the part of the frame it can hold.    */
+/* Returns the bytes copied.                                                 */
+/* -----------------------------------------------------------------------   */
+static MIL_INT64 CopyFrame(FrameReplayStruct* ReplayPtr, const ReplayFrameStruct* FramePtr,
+                           const BufferPoolStruct* PoolPtr, MIL_ID BufferId)
+   {
+   const RecorderChunkHeaderStruct* ChunkPtr = FramePtr->Chunk;
+   MIL_UINT8* HostAddress = M_NULL;
+   bool       Matches     = PoolPtr && BufferPoolMatches(PoolPtr, ChunkPtr->SizeX,
+                                                         ChunkPtr->SizeY, ChunkPtr->PixelFormat);
+   MIL_INT    Pitch, RowCount, RowBytes;
+
+   if(ChunkPtr->Pitch == 0)
+      {
+      /* Stored densely from a buffer without host address. */
+      if(!Matches)
+         {
+         ReplayPtr->TruncatedCount++;
+         return 0;
+         }
+      MbufPut(BufferId, FramePtr->Data);
+      return FramePtr->Entry->Size;
+      }
+
+   MbufInquire(BufferId, M_HOST_ADDRESS, &HostAddress);
+   if(HostAddress == M_NULL)
+      {
+      ReplayPtr->TruncatedCount++;
+      return 0;
+      }
+   Pitch    = MbufInquire(BufferId, M_PITCH_BYTE, M_NULL);
+   RowCount = MbufInquire(BufferId, M_SIZE_Y, M_NULL);
+   RowBytes = Pitch < (MIL_INT)ChunkPtr->Pitch ? Pitch : (MIL_INT)ChunkPtr->Pitch;
+   if(RowCount > (MIL_INT)ChunkPtr->SizeY)
+      RowCount = (MIL_INT)ChunkPtr->SizeY;
+   if(!Matches)
+      ReplayPtr->TruncatedCount++;
+
+   if(Pitch == (MIL_INT)ChunkPtr->Pitch)
+      memcpy(HostAddress, FramePtr->Data, (size_t)(Pitch * RowCount));
+   else
+      {
+      for(MIL_INT y = 0; y < RowCount; y++)
+         memcpy(HostAddress + y * Pitch, FramePtr->Data + y * ChunkPtr->Pitch, (size_t)RowBytes);
+      }
+   return (MIL_INT64)RowBytes * RowCount;
+   }
+
+/* Asks the kernel to read the chunk that follows ahead of the replay.      */
+/* -----------------------------------------------------------------------   */
+static void PrefetchNextChunk(FrameReplayStruct* ReplayPtr,
+                              const RecorderChunkHeaderStruct* ChunkPtr)
+   {
+#if !M_MIL_USE_WINDOWS
+   const MIL_UINT8* Next = (const MIL_UINT8*)ChunkPtr + ChunkPtr->ChunkBytes;
+   const RecorderChunkHeaderStruct* NextPtr = (const RecorderChunkHeaderStruct*)Next;
+
+   if(Next + sizeof(RecorderChunkHeaderStruct) <= ReplayPtr->Map + ReplayPtr->MapSize &&
+      NextPtr->Magic == RECORDER_CHUNK_MAGIC &&
+      NextPtr->ChunkBytes <= (uint64_t)(ReplayPtr->Map + ReplayPtr->MapSize - Next))
+      madvise((void*)Next, (size_t)NextPtr->ChunkBytes, MADV_WILLNEED);
+#endif
+   }
+
+/* Replay thread. Emulates MdigProcess as the synthetic source does: fills  */
+/* the grab buffers in turn at the selected pace and calls the processing    */
+/* code. The pace restarts from the next frame after a data format change,   */
+/* so the frames due while the grab was stopped are not fed in a burst.      */
+/* -----------------------------------------------------------------------   */
+static MIL_UINT32 MFTYPE FrameReplayThread(void* ThreadContext)
+   {
+   FrameReplayStruct* ReplayPtr   = (FrameReplayStruct*)ThreadContext;
+   HookDataStruct*    HookDataPtr = (HookDataStruct*)ReplayPtr->HookDataPtr;
+   const RecorderChunkHeaderStruct* ChunkPtr = M_NULL;
+   MIL_INT            BufferIndex = 0;
+   MIL_INT64          PacedCount  = 0;
+   MIL_DOUBLE         StartTime, CopyStart, HookStart, HookEnd;
+   MIL_DOUBLE         AnchorTimestamp = 0;
+   auto               Anchor      = std::chrono::steady_clock::now();
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &StartTime);
+   HookEnd = StartTime;
+
+   while(!ReplayPtr->StopRequested && HookDataPtr->MilGrabBufferListSize > 0)
+      {
+      const ReplayFrameStruct* FramePtr;
+      FrameInfoStruct          FrameInfo;
+      auto                     Due = std::chrono::steady_clock::now();
+      auto                     Now = Due;
+
+      if(ReplayPtr->NextFrame >= ReplayPtr->Frames.size())
+         {
+         /* Let the main thread end the run. */
+         ReplayPtr->Ended = true;
+         MthrControl(HookDataPtr->Event, M_EVENT_SET, M_SIGNALED);
+         break;
+         }
+      FramePtr = &ReplayPtr->Frames[ReplayPtr->NextFrame];
+
+      /* When the frame is due. */
+      if(PacedCount == 0)
+         {
+         Anchor          = Now;
+         AnchorTimestamp = FramePtr->Entry->HostTimestamp;
+         }
+      else if(ReplayPtr->Pacing == eReplayOriginal)
+         Due = Anchor + std::chrono::nanoseconds(
+            (long long)(1e9 * (FramePtr->Entry->HostTimestamp - AnchorTimestamp)));
+      else if(ReplayPtr->Pacing == eReplayFixedRate)
+         Due = Anchor + std::chrono::nanoseconds(
+            (long long)(1e9 * PacedCount / ReplayPtr->FrameRate));
+
+      if(Now > Due)
+         {
+         if(ReplayPtr->Pacing != eReplayMax)
+            ReplayPtr->LateCount++;
+         }
+      else if(Due > Now)
+         std::this_thread::sleep_until(Due);
+      PacedCount++;
+
+      if(FramePtr->Chunk != ChunkPtr)
+         {
+         ChunkPtr = FramePtr->Chunk;
+         PrefetchNextChunk(ReplayPtr, ChunkPtr);
+         }
+
+      /* Never fill a buffer still in use: the frame is skipped instead. */
+      if(!GrabBufferFree(HookDataPtr, BufferIndex))
+         {
+         HookDataPtr->GrabQueue.SkipCount.fetch_add(1, std::memory_order_relaxed);
+         ReplayPtr->NextFrame++;
+         BufferIndex = (BufferIndex + 1) % HookDataPtr->MilGrabBufferListSize;
+         continue;
+         }
+
+      FrameInfo.BufferIndex        = BufferIndex;
+      FrameInfo.BufferId           = HookDataPtr->MilGrabBufferList[BufferIndex];
+      FrameInfo.FrameSizeX         = FramePtr->SizeX;
+      FrameInfo.FrameSizeY         = FramePtr->SizeY;
+      FrameInfo.FramePixelFormat   = FramePtr->PixelFormat;
+      FrameInfo.FramePacketSize    = 0;
+      FrameInfo.IsFrameCorrupt     = (FramePtr->Entry->Flags & RECORDER_FRAME_CORRUPT) ?
+                                     M_TRUE : M_FALSE;
+      FrameInfo.BlockId            = FramePtr->Entry->BlockId;
+      FrameInfo.ReceivedPackets    = M_NULL;
+      FrameInfo.PayloadPacketCount = 0;
+
+      /* The latency is measured from when the frame was due. */
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &CopyStart);
+      FrameInfo.DeviceTimestamp = CopyStart - (Now > Due ?
+         std::chrono::duration<double>(Now - Due).count() : 0.0);
+
+      ReplayPtr->ByteCount += CopyFrame(ReplayPtr, FramePtr, HookDataPtr->ActivePool,
+                                        FrameInfo.BufferId);
+
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &HookStart);
+      FrameInfo.HookEntryTime = HookStart;
+      ProcessFrame(HookDataPtr, &FrameInfo);
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &HookEnd);
+
+      ReplayPtr->NextFrame++;
+      ReplayPtr->FrameCount++;
+      ReplayPtr->CopyTime      += HookStart - CopyStart;
+      ReplayPtr->HookTimeTotal += HookEnd - HookStart;
+      if(HookEnd - HookStart > ReplayPtr->HookTimeMax)
+         ReplayPtr->HookTimeMax = HookEnd - HookStart;
+
+      BufferIndex = (BufferIndex + 1) % HookDataPtr->MilGrabBufferListSize;
+      }
+
+   ReplayPtr->RunTime += HookEnd - StartTime;
+   return 0;
+   }
+
+void FrameReplayPrintStatistics(FrameReplayStruct* ReplayPtr)
+   {
+   MIL_INT64  FrameCount = ReplayPtr->FrameCount;
+   MIL_DOUBLE RunTime    = ReplayPtr->RunTime;
+
+   MosPrintf(MIL_TEXT("\nReplay (%s):\n"),
+      MIL_STRING(ReplayPtr->Path.begin(), ReplayPtr->Path.end()).c_str());
+   MosPrintf(MIL_TEXT("  Frames replayed:         %lld of %lld, "), (long long)FrameCount,
+      (long long)ReplayPtr->Frames.size());
+   if(ReplayPtr->Pacing == eReplayOriginal)
+      MosPrintf(MIL_TEXT("original timing"));
+   else if(ReplayPtr->Pacing == eReplayFixedRate)
+      MosPrintf(MIL_TEXT("%.1f frames/s"), ReplayPtr->FrameRate);
+   else
+      MosPrintf(MIL_TEXT("as fast as possible"));
+   MosPrintf(MIL_TEXT(", %lld late\n"), (long long)ReplayPtr->LateCount);
+   MosPrintf(MIL_TEXT("  Throughput:              %.1f frames/s, %.1f MB/s (recorded at ")
+             MIL_TEXT("%.1f frames/s)\n"),
+      RunTime > 0 ? FrameCount / RunTime : 0,
+      RunTime > 0 ? ReplayPtr->ByteCount / 1048576.0 / RunTime : 0,
+      ReplayPtr->RecordedDuration > 0 ?
+         (ReplayPtr->Frames.size() - 1) / ReplayPtr->RecordedDuration : 0);
+   MosPrintf(MIL_TEXT("  Copy to grab buffer:     %.1f us per frame, %lld frames truncated\n"),
+      FrameCount ? 1e6 * ReplayPtr->CopyTime / FrameCount : 0,
+      (long long)ReplayPtr->TruncatedCount);
+   MosPrintf(MIL_TEXT("  Hook time:               %.1f us average, %.1f us max\n"),
+      FrameCount ? 1e6 * ReplayPtr->HookTimeTotal / FrameCount : 0,
+      1e6 * ReplayPtr->HookTimeMax);
+   }
@@ -0,0 +1,87 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameReplay.h
+ *
+ * Synopsis:  Replay backend. Maps a recording made in record mode (see
+ *            FrameRecorder.h) and feeds its frames to the processing code the
+ *            MdigProcess hook calls, in turn in the grab buffers, as the synthetic
+ *            source does. The data format of the recording segments is announced
+ *            frame by frame, so that its changes go through the same recovery as
+ *            a live stream.
+ *
+ *            The frames are replayed at the pace they were recorded, at a fixed
+ *            rate or as fast as possible, which makes a recording a repeatable
+ *            benchmark of the hook and of the processing.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef FRAME_REPLAY_H
+#define FRAME_REPLAY_H
+
+#include <mil.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "FrameRecorder.h"
+
+/* Pace of the replayed frames. */
+typedef enum
+   {
+   eReplayOriginal = 0,       /* Host timestamps of the recording.                */
+   eReplayFixedRate,          /* Given frame rate.                                */
+   eReplayMax                 /* As fast as the hook returns.                     */
+   } ReplayPacingType;
+
+/* Recorded frame, in the mapped file. */
+typedef struct
+   {
+   const RecorderChunkHeaderStruct* Chunk;  /* Buffer format the data was stored in. */
+   const RecorderIndexEntryStruct*  Entry;
+   const MIL_UINT8*                 Data;
+   MIL_INT                          SizeX;  /* Data format of the frame itself.      */
+   MIL_INT                          SizeY;
+   MIL_INT                          PixelFormat;
+   } ReplayFrameStruct;
+
+typedef struct
+   {
+   std::string            Path;
+   const MIL_UINT8*       Map;
+   MIL_INT64              MapSize;
+#if M_MIL_USE_WINDOWS
+   void*                  File;
+   void*                  Mapping;
+#endif
+   std::vector<ReplayFrameStruct> Frames;
+   MIL_INT64              SegmentCount;
+   MIL_DOUBLE             RecordedDuration;
+   ReplayPacingType       Pacing;
+   MIL_DOUBLE             FrameRate;       /* eReplayFixedRate only.                */
+   void*                  HookDataPtr;
+   MIL_ID                 Thread;
+   std::atomic<bool>      StopRequested;
+   std::atomic<bool>      Ended;           /* All the frames were replayed.         */
+
+   /* Replay thread state. */
+   size_t                 NextFrame;       /* Kept across restarts.                 */
+
+   /* Statistics, written by the replay thread. */
+   MIL_INT64              FrameCount;
+   MIL_INT64              ByteCount;       /* Frame data copied to the buffers.     */
+   MIL_INT64              TruncatedCount;  /* Did not fit in the grab buffer.        */
+   MIL_INT64              LateCount;       /* Fed after the next one was due.        */
+   MIL_DOUBLE             CopyTime;
+   MIL_DOUBLE             HookTimeTotal;
+   MIL_DOUBLE             HookTimeMax;
+   MIL_DOUBLE             RunTime;
+   } FrameReplayStruct;
+
+FrameReplayStruct* FrameReplayAlloc(const std::string& Path, ReplayPacingType Pacing,
+                                    MIL_DOUBLE FrameRate, void* HookDataPtr);
+void FrameReplayFree(FrameReplayStruct* ReplayPtr);
+void FrameReplayStart(FrameReplayStruct* ReplayPtr);
+void FrameReplayStop(FrameReplayStruct* ReplayPtr);
+void FrameReplayPrintStatistics(FrameReplayStruct* ReplayPtr);
+
+#endif /* FRAME_REPLAY_H */
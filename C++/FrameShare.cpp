@@ -0,0 +1,324 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameShare.cpp
+ *
+ * Synopsis:  Producer side of the shared-memory frame ring.
+ *
+ *            The workers publish concurrently: each claims the next frame number
+ *            of the ring, waits for a previous writer of the same slot to be done,
+ *            copies the frame and releases the slot lock. A frame whose slot was
+ *            meanwhile taken by a newer frame is dropped, as its readers would see
+ *            it overwritten anyway. Readers waiting for a frame sleep on a futex
+ *            in the ring header, which is only woken when some are waiting.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#if !M_MIL_USE_WINDOWS
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#endif
+#include <string.h>
+#include <limits.h>
+#include <chrono>
+#include <thread>
+#include "MulticastMonitor.h"
+
+#if !M_MIL_USE_WINDOWS
+
+static size_t AlignUp(size_t Value, size_t Alignment)
+   {
+   return (Value + Alignment - 1) / Alignment * Alignment;
+   }
+
+FrameShareStruct* FrameShareAlloc(const std::string& Name, MIL_INT SlotCount,
+                                  MIL_INT64 FrameBytes)
+   {
+   FrameShareStruct*       SharePtr;
+   FrameShareHeaderStruct* HeaderPtr;
+   size_t                  HeaderSize = AlignUp(sizeof(FrameShareHeaderStruct),
+                                                FRAME_SHARE_ALIGNMENT);
+   size_t                  DataOffset = AlignUp(sizeof(FrameShareSlotStruct),
+                                                FRAME_SHARE_ALIGNMENT);
+   size_t                  SlotSize   = DataOffset + AlignUp((size_t)FrameBytes,
+                                                             FRAME_SHARE_ALIGNMENT);
+   size_t                  MappedSize = HeaderSize + (size_t)SlotCount * SlotSize;
+   MIL_DOUBLE              Now;
+   timespec                UnixTime;
+   void*                   Address;
+   int                     Descriptor;
+
+   /* A ring left by a monitor that did not exit cleanly is replaced. The */
+   /* pages of tmpfs are only allocated as the frames are written.        */
+   shm_unlink(Name.c_str());
+   Descriptor = shm_open(Name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+   if(Descriptor < 0 || ftruncate(Descriptor, (off_t)MappedSize) != 0)
+      {
+      std::string Error = strerror(errno);
+
+      MosPrintf(MIL_TEXT("Frame share: could not create %s (%s).\n"),
+         MIL_STRING(Name.begin(), Name.end()).c_str(),
+         MIL_STRING(Error.begin(), Error.end()).c_str());
+      if(Descriptor >= 0)
+         {
+         close(Descriptor);
+         shm_unlink(Name.c_str());
+         }
+      return M_NULL;
+      }
+   Address = mmap(M_NULL, MappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, Descriptor, 0);
+   if(Address == MAP_FAILED)
+      {
+      MosPrintf(MIL_TEXT("Frame share: could not map %s.\n"),
+         MIL_STRING(Name.begin(), Name.end()).c_str());
+      close(Descriptor);
+      shm_unlink(Name.c_str());
+      return M_NULL;
+      }
+
+   /* The object is zero-filled: the slot locks, the counters and the      */
+   /* reader entries start at 0. The magic is written last.                 */
+   HeaderPtr = (FrameShareHeaderStruct*)Address;
+   HeaderPtr->Version      = FRAME_SHARE_VERSION;
+   HeaderPtr->SlotCount    = (uint32_t)SlotCount;
+   HeaderPtr->ProducerId   = (uint32_t)getpid();
+   HeaderPtr->SlotSize     = SlotSize;
+   HeaderPtr->SlotDataSize = (uint64_t)FrameBytes;
+   HeaderPtr->DataOffset   = DataOffset;
+   std::atomic_thread_fence(std::memory_order_release);
+   HeaderPtr->Magic        = FRAME_SHARE_MAGIC;
+
+   SharePtr = new FrameShareStruct;
+   SharePtr->Name            = Name;
+   SharePtr->Descriptor      = Descriptor;
+   SharePtr->Header          = HeaderPtr;
+   SharePtr->Slots           = (MIL_UINT8*)Address + HeaderSize;
+   SharePtr->MappedSize      = MappedSize;
+   SharePtr->PublishedCount  = 0;
+   SharePtr->DroppedCount    = 0;
+   SharePtr->StaleCount      = 0;
+   SharePtr->ByteCount       = 0;
+   SharePtr->CopyTime        = 0;
+   SharePtr->SlowReaderCount = 0;
+   for(MIL_INT i = 0; i < FRAME_SHARE_READER_MAX; i++)
+      SharePtr->LastSkipCount[i] = 0;
+
+   /* The slots carry Unix times, which the consumers can relate to theirs. */
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Now);
+   clock_gettime(CLOCK_REALTIME, &UnixTime);
+   SharePtr->ClockOffset = UnixTime.tv_sec + 1e-9 * UnixTime.tv_nsec - Now;
+
+   MosPrintf(MIL_TEXT("Frame share: %s, %lld slots of up to %.1f MB.\n"),
+      MIL_STRING(Name.begin(), Name.end()).c_str(), (long long)SlotCount, FrameBytes / 1048576.0);
+   return SharePtr;
+   }
+
+/* Tells the readers the ring is closed and removes its name. Mapped readers */
+/* keep the memory until they close it.                                      */
+/* -----------------------------------------------------------------------   */
+void FrameShareFree(FrameShareStruct* SharePtr)
+   {
+   if(!SharePtr)
+      return;
+
+   SharePtr->Header->Closed.store(1);
+   SharePtr->Header->PublishCount.fetch_add(1);
+   syscall(SYS_futex, (uint32_t*)&SharePtr->Header->PublishCount, FUTEX_WAKE, INT_MAX,
+      M_NULL, M_NULL, 0);
+
+   munmap(SharePtr->Header, SharePtr->MappedSize);
+   close(SharePtr->Descriptor);
+   shm_unlink(SharePtr->Name.c_str());
+   delete SharePtr;
+   }
+
+/* Copies a processed frame into the ring. Called by the workers, or by the  */
+/* hook without workers.                                                     */
+/* -----------------------------------------------------------------------   */
+void FrameSharePublish(FrameShareStruct* SharePtr, MIL_ID BufferId,
+                       const FrameWorkItemStruct* ItemPtr, MIL_UINT32 Flags)
+   {
+   FrameShareHeaderStruct* HeaderPtr = SharePtr->Header;
+   FrameShareSlotStruct*   SlotPtr;
+   MIL_UINT8*              HostAddress = M_NULL;
+   MIL_INT                 SizeX    = MbufInquire(BufferId, M_SIZE_X, M_NULL);
+   MIL_INT                 SizeY    = MbufInquire(BufferId, M_SIZE_Y, M_NULL);
+   MIL_INT                 SizeBand = MbufInquire(BufferId, M_SIZE_BAND, M_NULL);
+   MIL_INT                 SizeBit  = MbufInquire(BufferId, M_SIZE_BIT, M_NULL);
+   MIL_INT                 Pitch;
+   MIL_INT64               Bytes;
+   uint64_t                Frame, Lock;
+   auto                    Start = std::chrono::steady_clock::now();
+
+   /* Frames grabbed in a buffer of the previous format are not shared. */
+   if(SizeX != ItemPtr->FrameSizeX || SizeY != ItemPtr->FrameSizeY)
+      {
+      SharePtr->DroppedCount.fetch_add(1, std::memory_order_relaxed);
+      return;
+      }
+
+   /* As in the recordings: the rows with their pitch if the buffer has a */
+   /* single host address, else dense, one band after the other.          */
+   if(SizeBand == 1 || (MbufInquire(BufferId, M_DATA_FORMAT, M_NULL) & M_PACKED))
+      MbufInquire(BufferId, M_HOST_ADDRESS, &HostAddress);
+   if(HostAddress)
+      {
+      Pitch = MbufInquire(BufferId, M_PITCH_BYTE, M_NULL);
+      Bytes = (MIL_INT64)Pitch * SizeY;
+      }
+   else
+      {
+      Pitch = SizeX * ((SizeBit + 7) / 8);
+      Bytes = (MIL_INT64)Pitch * SizeY * SizeBand;
+      if(SizeBand > 1)
+         Flags |= FRAME_SHARE_FRAME_PLANAR;
+      }
+   if(Bytes > (MIL_INT64)HeaderPtr->SlotDataSize)
+      {
+      SharePtr->DroppedCount.fetch_add(1, std::memory_order_relaxed);
+      return;
+      }
+
+   /* Take the slot from the frame that last held it, once its writer is   */
+   /* done, unless a newer frame took it first.                             */
+   Frame   = HeaderPtr->ClaimCount.fetch_add(1);
+   SlotPtr = (FrameShareSlotStruct*)(SharePtr->Slots +
+                                     (Frame % HeaderPtr->SlotCount) * HeaderPtr->SlotSize);
+   Lock    = SlotPtr->Lock.load(std::memory_order_relaxed);
+   for(;;)
+      {
+      if(Lock > 2 * Frame)
+         {
+         SharePtr->StaleCount.fetch_add(1, std::memory_order_relaxed);
+         return;
+         }
+      if(Lock & 1)
+         {
+         std::this_thread::yield();
+         Lock = SlotPtr->Lock.load(std::memory_order_relaxed);
+         }
+      else if(SlotPtr->Lock.compare_exchange_weak(Lock, 2 * Frame + 1,
+                                                  std::memory_order_relaxed))
+         break;
+      }
+   std::atomic_thread_fence(std::memory_order_release);
+
+   SlotPtr->FrameNumber = (uint64_t)ItemPtr->FrameCount;
+   SlotPtr->Size        = (uint64_t)Bytes;
+   SlotPtr->HostTime    = (int64_t)(1e9 * (ItemPtr->HookEntryTime + SharePtr->ClockOffset));
+   SlotPtr->DeviceTime  = ItemPtr->DeviceTimestamp;
+   SlotPtr->PixelFormat = (uint32_t)ItemPtr->FramePixelFormat;
+   SlotPtr->SizeX       = (uint32_t)SizeX;
+   SlotPtr->SizeY       = (uint32_t)SizeY;
+   SlotPtr->Pitch       = (uint32_t)Pitch;
+   SlotPtr->SizeBand    = (uint32_t)SizeBand;
+   SlotPtr->SizeBit     = (uint32_t)SizeBit;
+   SlotPtr->Flags       = Flags;
+   if(HostAddress)
+      memcpy((MIL_UINT8*)SlotPtr + HeaderPtr->DataOffset, HostAddress, (size_t)Bytes);
+   else
+      MbufGet(BufferId, (MIL_UINT8*)SlotPtr + HeaderPtr->DataOffset);
+
+   SlotPtr->Lock.store(2 * Frame + 2, std::memory_order_release);
+
+   /* Wake up the readers waiting for a frame, if any. */
+   HeaderPtr->PublishCount.fetch_add(1);
+   if(HeaderPtr->WaiterCount.load() > 0)
+      syscall(SYS_futex, (uint32_t*)&HeaderPtr->PublishCount, FUTEX_WAKE, INT_MAX,
+         M_NULL, M_NULL, 0);
+
+   SharePtr->PublishedCount.fetch_add(1, std::memory_order_relaxed);
+   SharePtr->ByteCount.fetch_add(Bytes, std::memory_order_relaxed);
+   SharePtr->CopyTime.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - Start).count(), std::memory_order_relaxed);
+   }
+
+/* Frees the entries of the readers that exited without closing the ring   */
+/* and reports the readers that are being overrun.                           */
+/* -----------------------------------------------------------------------   */
+void FrameShareReviewReaders(FrameShareStruct* SharePtr)
+   {
+   FrameShareHeaderStruct* HeaderPtr = SharePtr->Header;
+   uint64_t                Claimed   = HeaderPtr->ClaimCount.load();
+
+   for(MIL_INT i = 0; i < FRAME_SHARE_READER_MAX; i++)
+      {
+      FrameShareReaderStruct* ReaderPtr = &HeaderPtr->Readers[i];
+      uint32_t                ProcessId = ReaderPtr->ProcessId.load();
+      MIL_INT64               SkipCount;
+
+      if(ProcessId == 0)
+         {
+         SharePtr->LastSkipCount[i] = 0;
+         continue;
+         }
+      if(kill((pid_t)ProcessId, 0) != 0 && errno == ESRCH)
+         {
+         MosPrintf(MIL_TEXT("Frame share: reader %u is gone.\n"), ProcessId);
+         ReaderPtr->ProcessId.compare_exchange_strong(ProcessId, 0);
+         continue;
+         }
+
+      SkipCount = (MIL_INT64)ReaderPtr->SkipCount.load();
+      if(SkipCount > SharePtr->LastSkipCount[i])
+         {
+         MosPrintf(MIL_TEXT("Frame share: reader %u too slow, %lld frames skipped ")
+                   MIL_TEXT("(%lld behind).\n"), ProcessId,
+                   (long long)(SkipCount - SharePtr->LastSkipCount[i]),
+                   (long long)(Claimed - ReaderPtr->Cursor.load()));
+         SharePtr->SlowReaderCount++;
+         }
+      SharePtr->LastSkipCount[i] = SkipCount;
+      }
+   }
+
+void FrameSharePrintStatistics(FrameShareStruct* SharePtr)
+   {
+   FrameShareHeaderStruct* HeaderPtr = SharePtr->Header;
+   MIL_INT64               Published = SharePtr->PublishedCount.load();
+   MIL_INT                 Readers   = 0;
+
+   for(MIL_INT i = 0; i < FRAME_SHARE_READER_MAX; i++)
+      {
+      if(HeaderPtr->Readers[i].ProcessId.load() != 0)
+         Readers++;
+      }
+
+   MosPrintf(MIL_TEXT("\nFrame share (%s):\n"),
+      MIL_STRING(SharePtr->Name.begin(), SharePtr->Name.end()).c_str());
+   MosPrintf(MIL_TEXT("  Frames published:        %lld\n"), (long long)Published);
+   MosPrintf(MIL_TEXT("  Frames not shared:       %lld (%lld overtaken)\n"),
+      (long long)(SharePtr->DroppedCount.load() + SharePtr->StaleCount.load()),
+      (long long)SharePtr->StaleCount.load());
+   MosPrintf(MIL_TEXT("  Average copy:            %.1f us, %.2f GB/s\n"),
+      Published ? 1e-3 * SharePtr->CopyTime.load() / Published : 0.0,
+      SharePtr->CopyTime.load() ? (MIL_DOUBLE)SharePtr->ByteCount.load() /
+                                  SharePtr->CopyTime.load() : 0.0);
+   MosPrintf(MIL_TEXT("  Readers attached:        %lld (%lld slow reader reports)\n"),
+      (long long)Readers, (long long)SharePtr->SlowReaderCount);
+   }
+
+#else
+
+FrameShareStruct* FrameShareAlloc(const std::string& Name, MIL_INT SlotCount,
+                                  MIL_INT64 FrameBytes)
+   {
+   MosPrintf(MIL_TEXT("The frame share is only available on Linux.\n"));
+   return M_NULL;
+   }
+
+void FrameShareFree(FrameShareStruct* SharePtr) {}
+void FrameSharePublish(FrameShareStruct* SharePtr, MIL_ID BufferId,
+                       const FrameWorkItemStruct* ItemPtr, MIL_UINT32 Flags) {}
+void FrameShareReviewReaders(FrameShareStruct* SharePtr) {}
+void FrameSharePrintStatistics(FrameShareStruct* SharePtr) {}
+
+#endif
@@ -0,0 +1,61 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameShare.h
+ *
+ * Synopsis:  Share mode. Every processed frame is published into a POSIX
+ *            shared-memory ring (see FrameShareProtocol.h) from which local
+ *            consumer processes read it in place, so that the analysis tools of
+ *            the host do not each join the multicast group. The frame is copied
+ *            once, by the worker that processes it, and the producer never waits
+ *            for the readers: a reader that falls behind has its frames
+ *            overwritten and skips them. The consumer side is in
+ *            FrameShareConsumer.h, which does not depend on MIL.
+ *
+ *            Linux only.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef FRAME_SHARE_H
+#define FRAME_SHARE_H
+
+#include <mil.h>
+#include <atomic>
+#include <string>
+#include "FrameShareProtocol.h"
+#include "FramePipeline.h"
+
+#define FRAME_SHARE_SLOTS_DEFAULT   8
+#define FRAME_SHARE_FRAME_DEFAULT   64     /* MB, largest frame shared.             */
+#define FRAME_SHARE_REVIEW_PERIOD   1.0    /* Seconds between reviews of the readers. */
+
+typedef struct
+   {
+   std::string             Name;
+   int                     Descriptor;
+   FrameShareHeaderStruct* Header;
+   MIL_UINT8*              Slots;
+   size_t                  MappedSize;
+   MIL_DOUBLE              ClockOffset;    /* Unix time minus MappTimer time, sec.  */
+
+   /* Updated by the workers. */
+   std::atomic<MIL_INT64>  PublishedCount;
+   std::atomic<MIL_INT64>  DroppedCount;   /* Too large, or in another format.      */
+   std::atomic<MIL_INT64>  StaleCount;     /* Slot taken by a newer frame first.    */
+   std::atomic<MIL_INT64>  ByteCount;
+   std::atomic<MIL_INT64>  CopyTime;       /* Nanoseconds.                          */
+
+   /* Reader review, main thread only. */
+   MIL_INT64               LastSkipCount[FRAME_SHARE_READER_MAX];
+   MIL_INT64               SlowReaderCount;
+   } FrameShareStruct;
+
+FrameShareStruct* FrameShareAlloc(const std::string& Name, MIL_INT SlotCount,
+                                  MIL_INT64 FrameBytes);
+void FrameShareFree(FrameShareStruct* SharePtr);
+void FrameSharePublish(FrameShareStruct* SharePtr, MIL_ID BufferId,
+                       const FrameWorkItemStruct* ItemPtr, MIL_UINT32 Flags);
+void FrameShareReviewReaders(FrameShareStruct* SharePtr);
+void FrameSharePrintStatistics(FrameShareStruct* SharePtr);
+
+#endif /* FRAME_SHARE_H */
@@ -0,0 +1,158 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameShareClient.cpp
+ *
+ * Synopsis:  Test client of the frame share of the monitor (-share=<name>). Reads
+ *            the frames of the ring, sums their bytes as an analysis tool would
+ *            read them, and reports every second the frames read, skipped and
+ *            overwritten while being read, and the latency from the hook of the
+ *            monitor to the client. -delay makes it a slow reader, to see the
+ *            monitor go on without it.
+ *
+ *            Does not need MIL: make client in the linux directory. Consumers
+ *            of their own link with libFrameShare.a and include
+ *            FrameShareConsumer.h.
+ *
+ *            Usage: FrameShareClient -name=<name> [-duration=<seconds>]
+ *                                    [-delay=<ms>]
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FrameShareConsumer.h"
+
+static int64_t UnixTimeNs(void)
+   {
+   timespec Time;
+   clock_gettime(CLOCK_REALTIME, &Time);
+   return (int64_t)Time.tv_sec * 1000000000 + Time.tv_nsec;
+   }
+
+/* Reads the whole frame, 8 bytes at a time. */
+static uint64_t SumFrame(const FrameShareFrameStruct& Frame)
+   {
+   const uint64_t* Words = (const uint64_t*)Frame.Data;
+   uint64_t        Sum   = 0;
+
+   for(uint64_t i = 0; i < Frame.Size / sizeof(uint64_t); i++)
+      Sum += Words[i];
+   return Sum;
+   }
+
+static double Percentile(std::vector<double>& Values, double Fraction)
+   {
+   size_t Index;
+
+   if(Values.empty())
+      return 0.0;
+   Index = (size_t)(Fraction * (Values.size() - 1));
+   std::nth_element(Values.begin(), Values.begin() + Index, Values.end());
+   return Values[Index];
+   }
+
+int main(int argc, char* argv[])
+   {
+   FrameShareConsumerStruct* ConsumerPtr;
+   FrameShareFrameStruct     Frame;
+   std::string               Name;
+   double                    Duration = 0.0;
+   int                       Delay    = 0;
+   std::vector<double>       Latencies;
+   uint64_t                  ReadCount = 0, LastReadCount = 0;
+   uint64_t                  LastSkipCount = 0, LastTornCount = 0, CorruptCount = 0;
+   uint64_t                  CheckSum = 0;
+
+   for(int i = 1; i < argc; i++)
+      {
+      if(strncmp(argv[i], "-name=", 6) == 0)
+         Name = argv[i] + 6;
+      else if(strncmp(argv[i], "-duration=", 10) == 0)
+         Duration = atof(argv[i] + 10);
+      else if(strncmp(argv[i], "-delay=", 7) == 0)
+         Delay = atoi(argv[i] + 7);
+      else
+         {
+         printf("Usage: %s -name=<name> [-duration=<seconds>] [-delay=<ms>]\n", argv[0]);
+         return 1;
+         }
+      }
+   if(Name.empty())
+      {
+      printf("Usage: %s -name=<name> [-duration=<seconds>] [-delay=<ms>]\n", argv[0]);
+      return 1;
+      }
+   if(Name[0] != '/')
+      Name = "/" + Name;
+
+   ConsumerPtr = FrameShareOpen(Name.c_str());
+   if(!ConsumerPtr)
+      return 1;
+   printf("Reading %s, %u slots of up to %.1f MB.\n", Name.c_str(),
+          ConsumerPtr->Header->SlotCount, ConsumerPtr->Header->SlotDataSize / 1048576.0);
+   printf("%8s %8s %8s %8s %10s %10s %10s\n", "Time", "Frames", "Skipped", "Torn",
+          "Lat. p50", "Lat. p99", "Lat. max");
+
+   auto Start     = std::chrono::steady_clock::now();
+   auto LastPrint = Start;
+   for(;;)
+      {
+      int    Result = FrameShareNext(ConsumerPtr, &Frame, 200);
+      auto   Now    = std::chrono::steady_clock::now();
+      double Elapsed = std::chrono::duration<double>(Now - Start).count();
+
+      if(Result < 0)
+         {
+         printf("The monitor closed the frame share.\n");
+         break;
+         }
+      if(Result > 0)
+         {
+         Latencies.push_back(1e-6 * (UnixTimeNs() - Frame.HostTime));
+         CheckSum += SumFrame(Frame);
+         if(Delay > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(Delay));
+
+         /* What was read counts only if the frame is still there. */
+         if(FrameShareValid(ConsumerPtr, &Frame))
+            {
+            ReadCount++;
+            if(Frame.Flags & FRAME_SHARE_FRAME_CORRUPT)
+               CorruptCount++;
+            }
+         }
+
+      if(std::chrono::duration<double>(Now - LastPrint).count() >= 1.0)
+         {
+         printf("%7.1fs %8llu %8llu %8llu %8.2fms %8.2fms %8.2fms\n", Elapsed,
+                (unsigned long long)(ReadCount - LastReadCount),
+                (unsigned long long)(ConsumerPtr->SkipCount - LastSkipCount),
+                (unsigned long long)(ConsumerPtr->TornCount - LastTornCount),
+                Percentile(Latencies, 0.5), Percentile(Latencies, 0.99),
+                Latencies.empty() ? 0.0 : *std::max_element(Latencies.begin(),
+                                                            Latencies.end()));
+         LastReadCount = ReadCount;
+         LastSkipCount = ConsumerPtr->SkipCount;
+         LastTornCount = ConsumerPtr->TornCount;
+         Latencies.clear();
+         LastPrint = Now;
+         }
+      if(Duration > 0 && Elapsed >= Duration)
+         break;
+      }
+
+   printf("\n%llu frames read (%llu corrupt), %llu skipped, %llu overwritten while read "
+          "(checksum %016llx).\n", (unsigned long long)ReadCount,
+          (unsigned long long)CorruptCount, (unsigned long long)ConsumerPtr->SkipCount,
+          (unsigned long long)ConsumerPtr->TornCount, (unsigned long long)CheckSum);
+   FrameShareClose(ConsumerPtr);
+   return 0;
+   }
@@ -0,0 +1,238 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameShareConsumer.cpp
+ *
+ * Synopsis:  Consumer side of the shared-memory frame ring.
+ *
+ *            A consumer takes a free reader entry of the ring header, or the
+ *            entry of a reader that exited without closing the ring, and
+ *            starts with the next frame the monitor publishes. Its cursor is
+ *            written there for the monitor to report the slow readers; the
+ *            monitor never reads it to decide anything.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include "FrameShareConsumer.h"
+
+static double MonotonicTime(void)
+   {
+   timespec Time;
+   clock_gettime(CLOCK_MONOTONIC, &Time);
+   return Time.tv_sec + 1e-9 * Time.tv_nsec;
+   }
+
+/* Takes a reader entry: a free one, else one of a process that is gone.   */
+/* -----------------------------------------------------------------------   */
+static FrameShareReaderStruct* TakeReaderEntry(FrameShareHeaderStruct* HeaderPtr)
+   {
+   uint32_t ProcessId = (uint32_t)getpid();
+
+   for(int Pass = 0; Pass < 2; Pass++)
+      {
+      for(int i = 0; i < FRAME_SHARE_READER_MAX; i++)
+         {
+         FrameShareReaderStruct* ReaderPtr = &HeaderPtr->Readers[i];
+         uint32_t                Owner     = ReaderPtr->ProcessId.load();
+
+         if(Pass == 1 && (Owner == 0 || kill((pid_t)Owner, 0) == 0 || errno != ESRCH))
+            continue;
+         if(Pass == 0 && Owner != 0)
+            continue;
+         if(ReaderPtr->ProcessId.compare_exchange_strong(Owner, ProcessId))
+            return ReaderPtr;
+         }
+      }
+   return NULL;
+   }
+
+FrameShareConsumerStruct* FrameShareOpen(const char* Name)
+   {
+   FrameShareConsumerStruct* ConsumerPtr;
+   FrameShareHeaderStruct*   HeaderPtr;
+   FrameShareReaderStruct*   ReaderPtr;
+   struct stat               Status;
+   size_t                    HeaderSize;
+   void*                     Address;
+   int                       Descriptor;
+
+   Descriptor = shm_open(Name, O_RDWR, 0);
+   if(Descriptor < 0 || fstat(Descriptor, &Status) != 0 ||
+      (size_t)Status.st_size < sizeof(FrameShareHeaderStruct))
+      {
+      fprintf(stderr, "Frame share: could not open %s (%s).\n", Name, strerror(errno));
+      if(Descriptor >= 0)
+         close(Descriptor);
+      return NULL;
+      }
+   Address = mmap(NULL, (size_t)Status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  Descriptor, 0);
+   if(Address == MAP_FAILED)
+      {
+      fprintf(stderr, "Frame share: could not map %s.\n", Name);
+      close(Descriptor);
+      return NULL;
+      }
+
+   HeaderPtr = (FrameShareHeaderStruct*)Address;
+   if(HeaderPtr->Magic != FRAME_SHARE_MAGIC || HeaderPtr->Version != FRAME_SHARE_VERSION)
+      {
+      fprintf(stderr, "Frame share: %s is not a frame ring of this version.\n", Name);
+      munmap(Address, (size_t)Status.st_size);
+      close(Descriptor);
+      return NULL;
+      }
+   std::atomic_thread_fence(std::memory_order_acquire);
+
+   ReaderPtr = TakeReaderEntry(HeaderPtr);
+   if(!ReaderPtr)
+      {
+      fprintf(stderr, "Frame share: %s already has %d readers.\n", Name,
+              FRAME_SHARE_READER_MAX);
+      munmap(Address, (size_t)Status.st_size);
+      close(Descriptor);
+      return NULL;
+      }
+
+   HeaderSize = (sizeof(FrameShareHeaderStruct) + FRAME_SHARE_ALIGNMENT - 1) /
+                FRAME_SHARE_ALIGNMENT * FRAME_SHARE_ALIGNMENT;
+
+   ConsumerPtr = new FrameShareConsumerStruct;
+   ConsumerPtr->Descriptor = Descriptor;
+   ConsumerPtr->Header     = HeaderPtr;
+   ConsumerPtr->Slots      = (uint8_t*)Address + HeaderSize;
+   ConsumerPtr->MappedSize = (size_t)Status.st_size;
+   ConsumerPtr->Reader     = ReaderPtr;
+   ConsumerPtr->Cursor     = HeaderPtr->ClaimCount.load();
+   ConsumerPtr->SkipCount  = 0;
+   ConsumerPtr->TornCount  = 0;
+
+   ReaderPtr->ReadCount.store(0);
+   ReaderPtr->SkipCount.store(0);
+   ReaderPtr->Cursor.store(ConsumerPtr->Cursor);
+   return ConsumerPtr;
+   }
+
+void FrameShareClose(FrameShareConsumerStruct* ConsumerPtr)
+   {
+   if(!ConsumerPtr)
+      return;
+
+   ConsumerPtr->Reader->ProcessId.store(0);
+   munmap(ConsumerPtr->Header, ConsumerPtr->MappedSize);
+   close(ConsumerPtr->Descriptor);
+   delete ConsumerPtr;
+   }
+
+/* Moves the cursor past the frames the monitor overwrote or dropped.      */
+/* -----------------------------------------------------------------------   */
+static void SkipFrames(FrameShareConsumerStruct* ConsumerPtr, uint64_t Count)
+   {
+   ConsumerPtr->Cursor    += Count;
+   ConsumerPtr->SkipCount += Count;
+   ConsumerPtr->Reader->SkipCount.store(ConsumerPtr->SkipCount, std::memory_order_relaxed);
+   ConsumerPtr->Reader->Cursor.store(ConsumerPtr->Cursor, std::memory_order_relaxed);
+   }
+
+int FrameShareNext(FrameShareConsumerStruct* ConsumerPtr, FrameShareFrameStruct* FramePtr,
+                   int TimeoutMs)
+   {
+   FrameShareHeaderStruct* HeaderPtr = ConsumerPtr->Header;
+   uint64_t                SlotCount = HeaderPtr->SlotCount;
+   double                  Deadline  = MonotonicTime() + 1e-3 * TimeoutMs;
+
+   for(;;)
+      {
+      /* Read first: a frame published after this wakes up the wait below. */
+      uint32_t Published = HeaderPtr->PublishCount.load();
+      uint64_t Claimed   = HeaderPtr->ClaimCount.load();
+      double   Remaining;
+      timespec Timeout;
+
+      if(HeaderPtr->Closed.load())
+         return -1;
+
+      /* The frames more than a ring behind are gone. */
+      if(ConsumerPtr->Cursor + SlotCount < Claimed)
+         SkipFrames(ConsumerPtr, Claimed - SlotCount - ConsumerPtr->Cursor);
+
+      if(ConsumerPtr->Cursor < Claimed)
+         {
+         uint64_t              Cursor  = ConsumerPtr->Cursor;
+         FrameShareSlotStruct* SlotPtr = (FrameShareSlotStruct*)(ConsumerPtr->Slots +
+                                         (Cursor % SlotCount) * HeaderPtr->SlotSize);
+         uint64_t              Lock    = SlotPtr->Lock.load(std::memory_order_acquire);
+
+         if(Lock == 2 * Cursor + 2)
+            {
+            FramePtr->Data        = (const uint8_t*)SlotPtr + HeaderPtr->DataOffset;
+            FramePtr->Sequence    = Cursor;
+            FramePtr->FrameNumber = SlotPtr->FrameNumber;
+            FramePtr->Size        = SlotPtr->Size;
+            FramePtr->HostTime    = SlotPtr->HostTime;
+            FramePtr->DeviceTime  = SlotPtr->DeviceTime;
+            FramePtr->PixelFormat = SlotPtr->PixelFormat;
+            FramePtr->SizeX       = SlotPtr->SizeX;
+            FramePtr->SizeY       = SlotPtr->SizeY;
+            FramePtr->Pitch       = SlotPtr->Pitch;
+            FramePtr->SizeBand    = SlotPtr->SizeBand;
+            FramePtr->SizeBit     = SlotPtr->SizeBit;
+            FramePtr->Flags       = SlotPtr->Flags;
+            FramePtr->Slot        = SlotPtr;
+
+            /* The header must not have been overwritten while copied. */
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(SlotPtr->Lock.load(std::memory_order_relaxed) != Lock)
+               {
+               SkipFrames(ConsumerPtr, 1);
+               continue;
+               }
+
+            ConsumerPtr->Cursor++;
+            ConsumerPtr->Reader->Cursor.store(ConsumerPtr->Cursor, std::memory_order_relaxed);
+            ConsumerPtr->Reader->ReadCount.fetch_add(1, std::memory_order_relaxed);
+            return 1;
+            }
+         if(Lock > 2 * Cursor + 2)
+            {
+            /* Overwritten by a newer frame, or dropped by the monitor. */
+            SkipFrames(ConsumerPtr, 1);
+            continue;
+            }
+         }
+
+      /* The frame is not there yet: sleep until the next one is published. */
+      Remaining = Deadline - MonotonicTime();
+      if(Remaining <= 0)
+         return 0;
+
+      Timeout.tv_sec  = (time_t)Remaining;
+      Timeout.tv_nsec = (long)((Remaining - Timeout.tv_sec) * 1e9);
+      HeaderPtr->WaiterCount.fetch_add(1);
+      syscall(SYS_futex, (uint32_t*)&HeaderPtr->PublishCount, FUTEX_WAIT, Published,
+              &Timeout, NULL, 0);
+      HeaderPtr->WaiterCount.fetch_sub(1);
+      }
+   }
+
+bool FrameShareValid(FrameShareConsumerStruct* ConsumerPtr,
+                     const FrameShareFrameStruct* FramePtr)
+   {
+   std::atomic_thread_fence(std::memory_order_acquire);
+   if(FramePtr->Slot->Lock.load(std::memory_order_relaxed) == 2 * FramePtr->Sequence + 2)
+      return true;
+
+   ConsumerPtr->TornCount++;
+   return false;
+   }
@@ -0,0 +1,77 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameShareConsumer.h
+ *
+ * Synopsis:  Consumer side of the shared-memory frame ring of the monitor (see
+ *            FrameShare.h). A consumer maps the ring read-only but for its
+ *            cursor, and reads the frames in place:
+ *
+ *               FrameShareConsumerStruct* ConsumerPtr = FrameShareOpen("/name");
+ *               FrameShareFrameStruct     Frame;
+ *
+ *               while(FrameShareNext(ConsumerPtr, &Frame, 1000) >= 0)
+ *                  {
+ *                  ... use Frame.Data ...
+ *                  if(!FrameShareValid(ConsumerPtr, &Frame))
+ *                     ... the frame was overwritten while in use ...
+ *                  }
+ *               FrameShareClose(ConsumerPtr);
+ *
+ *            The monitor never waits for its consumers: a consumer that keeps
+ *            a frame longer than the ring takes to wrap around sees it
+ *            overwritten, and one that falls behind skips to the oldest frame
+ *            left. Both are counted. Does not depend on MIL; Linux only.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef FRAME_SHARE_CONSUMER_H
+#define FRAME_SHARE_CONSUMER_H
+
+#include <stddef.h>
+#include "FrameShareProtocol.h"
+
+typedef struct
+   {
+   int                     Descriptor;
+   FrameShareHeaderStruct* Header;
+   uint8_t*                Slots;
+   size_t                  MappedSize;
+   FrameShareReaderStruct* Reader;       /* Entry of this consumer in the header. */
+   uint64_t                Cursor;       /* Next frame to read.                   */
+   uint64_t                SkipCount;
+   uint64_t                TornCount;    /* Frames overwritten while being read.  */
+   } FrameShareConsumerStruct;
+
+/* A frame of the ring, valid until FrameShareValid() says otherwise. */
+typedef struct
+   {
+   const uint8_t* Data;
+   uint64_t       Sequence;              /* Frame number in the ring.             */
+   uint64_t       FrameNumber;           /* Frame count of the monitor.           */
+   uint64_t       Size;
+   int64_t        HostTime;              /* Hook entry, ns since the Unix epoch.  */
+   double         DeviceTime;
+   uint32_t       PixelFormat;
+   uint32_t       SizeX;
+   uint32_t       SizeY;
+   uint32_t       Pitch;
+   uint32_t       SizeBand;
+   uint32_t       SizeBit;
+   uint32_t       Flags;                 /* FRAME_SHARE_FRAME_...                 */
+   const FrameShareSlotStruct* Slot;
+   } FrameShareFrameStruct;
+
+FrameShareConsumerStruct* FrameShareOpen(const char* Name);
+void FrameShareClose(FrameShareConsumerStruct* ConsumerPtr);
+
+/* Waits up to TimeoutMs for the next frame. Returns 1 with a frame, 0 on   */
+/* timeout and -1 once the monitor closed the ring.                          */
+int FrameShareNext(FrameShareConsumerStruct* ConsumerPtr, FrameShareFrameStruct* FramePtr,
+                   int TimeoutMs);
+
+/* Tells whether the data of the frame read so far was not overwritten. */
+bool FrameShareValid(FrameShareConsumerStruct* ConsumerPtr,
+                     const FrameShareFrameStruct* FramePtr);
+
+#endif /* FRAME_SHARE_CONSUMER_H */
@@ -0,0 +1,91 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameShareProtocol.h
+ *
+ * Synopsis:  Layout of the shared-memory frame ring the monitor publishes its
+ *            frames into, shared by the producer and the consumer library. It
+ *            does not depend on MIL.
+ *
+ *            The ring is a POSIX shared-memory object: a header, then a fixed
+ *            number of slots, each a slot header followed by the frame data.
+ *            Frame n of the ring goes in slot n % SlotCount. The slot header
+ *            starts with a sequence lock: 2n+1 while frame n is being written,
+ *            2n+2 once it is complete. A reader reads a frame in place and then
+ *            checks that the lock did not move, so the producer never waits for
+ *            the readers; a reader that falls more than SlotCount frames behind
+ *            has its frames overwritten and skips to the oldest one left.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef FRAME_SHARE_PROTOCOL_H
+#define FRAME_SHARE_PROTOCOL_H
+
+#include <stdint.h>
+#include <atomic>
+
+#define FRAME_SHARE_MAGIC         0x52484D4D  /* "MMHR" */
+#define FRAME_SHARE_VERSION       1
+#define FRAME_SHARE_READER_MAX    16
+#define FRAME_SHARE_ALIGNMENT     4096        /* Of the frame data in each slot.  */
+#define FRAME_SHARE_CACHE_LINE    64
+
+/* Slot flags. */
+#define FRAME_SHARE_FRAME_CORRUPT   0x1       /* The frame had missing packets.    */
+#define FRAME_SHARE_FRAME_UNPACKED  0x2       /* A packed pixel format unpacked to */
+                                              /* 16 bits per pixel.                */
+#define FRAME_SHARE_FRAME_PLANAR    0x4       /* Bands one after the other, else   */
+                                              /* interleaved in each pixel.        */
+
+/* Cursor of a reader, written by the reader only. */
+typedef struct
+   {
+   std::atomic<uint32_t> ProcessId;     /* 0 if the entry is free.                 */
+   uint32_t              Reserved;
+   std::atomic<uint64_t> Cursor;        /* Next frame the reader will read.        */
+   std::atomic<uint64_t> ReadCount;
+   std::atomic<uint64_t> SkipCount;     /* Frames overwritten before being read.   */
+   char                  Padding[FRAME_SHARE_CACHE_LINE - 32];
+   } FrameShareReaderStruct;
+
+/* At offset 0 of the shared-memory object. */
+typedef struct
+   {
+   uint32_t              Magic;
+   uint32_t              Version;
+   uint32_t              SlotCount;
+   uint32_t              ProducerId;    /* Process ID of the monitor.              */
+   uint64_t              SlotSize;      /* Slot header and data, aligned.          */
+   uint64_t              SlotDataSize;  /* Largest frame a slot holds.             */
+   uint64_t              DataOffset;    /* Of the frame data in a slot.            */
+   std::atomic<uint32_t> Closed;        /* Set when the monitor stops publishing.  */
+   char                  Padding0[FRAME_SHARE_CACHE_LINE - 44];
+
+   /* Written by the producer. */
+   std::atomic<uint64_t> ClaimCount;    /* Frames claimed by the producer.         */
+   std::atomic<uint32_t> PublishCount;  /* Frames published, futex word.           */
+   std::atomic<uint32_t> WaiterCount;   /* Readers waiting on PublishCount.        */
+   char                  Padding1[FRAME_SHARE_CACHE_LINE - 16];
+
+   FrameShareReaderStruct Readers[FRAME_SHARE_READER_MAX];
+   } FrameShareHeaderStruct;
+
+/* At the start of each slot. */
+typedef struct
+   {
+   std::atomic<uint64_t> Lock;          /* 2n+1 writing frame n, 2n+2 holding it.  */
+   uint64_t              FrameNumber;   /* Frame count of the monitor.             */
+   uint64_t              Size;          /* Bytes of frame data.                    */
+   int64_t               HostTime;      /* Hook entry, ns since the Unix epoch.    */
+   double                DeviceTime;    /* Device timestamp in sec, 0 if unknown.  */
+   uint32_t              PixelFormat;   /* GenICam PFNC code of the stream.        */
+   uint32_t              SizeX;
+   uint32_t              SizeY;
+   uint32_t              Pitch;         /* Bytes from one row to the next.         */
+   uint32_t              SizeBand;
+   uint32_t              SizeBit;       /* Bits per band as stored.                */
+   uint32_t              Flags;
+   uint32_t              Reserved;
+   } FrameShareSlotStruct;
+
+#endif /* FRAME_SHARE_PROTOCOL_H */
@@ -0,0 +1,584 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameStats.cpp
+ *
+ * Synopsis:  Per-frame instrumentation and its export.
+ *
+ *            Recording a value costs a few relaxed atomic increments, so the hook
+ *            and the workers can record without locks while the main thread reads
+ *            the histograms. The device clock is not synchronized with the host
+ *            clock, so the transport latency is reported relative to the fastest
+ *            frame seen: it shows the jitter added by the network and the driver,
+ *            not the absolute delay.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#include <stdio.h>
+#include <string>
+#include "MulticastMonitor.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define STATS_METRIC_PREFIX "multicast_monitor_"
+
+static const MIL_DOUBLE ExportedPercentiles[] = { 50.0, 99.0, 99.9 };
+#define EXPORTED_PERCENTILE_COUNT (sizeof(ExportedPercentiles) / sizeof(ExportedPercentiles[0]))
+
+/* Histogram bucket of a value and the value a bucket stands for.           */
+/* -----------------------------------------------------------------------   */
+static MIL_INT MostSignificantBit(MIL_UINT64 Value)
+   {
+#if defined(_MSC_VER)
+   unsigned long Index;
+   _BitScanReverse64(&Index, Value);
+   return (MIL_INT)Index;
+#else
+   return 63 - __builtin_clzll(Value);
+#endif
+   }
+
+static MIL_INT LeastSignificantBit(MIL_UINT64 Value)
+   {
+#if defined(_MSC_VER)
+   unsigned long Index;
+   _BitScanForward64(&Index, Value);
+   return (MIL_INT)Index;
+#else
+   return __builtin_ctzll(Value);
+#endif
+   }
+
+static MIL_INT BucketIndex(MIL_UINT64 Value)
+   {
+   MIL_INT Magnitude;
+
+   if(Value < STATS_SUB_BUCKET_COUNT)
+      return (MIL_INT)Value;
+
+   Magnitude = MostSignificantBit(Value);
+   return (Magnitude - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKET_COUNT +
+          (MIL_INT)((Value >> (Magnitude - STATS_SUB_BUCKET_BITS)) & (STATS_SUB_BUCKET_COUNT - 1));
+   }
+
+static MIL_DOUBLE BucketValue(MIL_INT Index)
+   {
+   MIL_INT    Magnitude, SubBucket;
+   MIL_DOUBLE Width;
+
+   if(Index < STATS_SUB_BUCKET_COUNT)
+      return (MIL_DOUBLE)Index;
+
+   Magnitude = Index / STATS_SUB_BUCKET_COUNT + STATS_SUB_BUCKET_BITS - 1;
+   SubBucket = Index % STATS_SUB_BUCKET_COUNT;
+   Width     = (MIL_DOUBLE)(1ULL << (Magnitude - STATS_SUB_BUCKET_BITS));
+   return (MIL_DOUBLE)(1ULL << Magnitude) + SubBucket * Width + (Width - 1) / 2;
+   }
+
+static void InitHistogram(StatsHistogramStruct* HistogramPtr, const char* Name,
+                          const char* Help, MIL_DOUBLE Scale)
+   {
+   HistogramPtr->Name        = Name;
+   HistogramPtr->Help        = Help;
+   HistogramPtr->Scale       = Scale;
+   HistogramPtr->Count.Value = 0;
+   HistogramPtr->Sum.Value   = 0;
+   HistogramPtr->Max.Value   = 0;
+   for(MIL_INT i = 0; i < STATS_BUCKET_COUNT; i++)
+      HistogramPtr->Buckets[i].store(0, std::memory_order_relaxed);
+   }
+
+/* Allocates the statistics. ExportPath is the path of the exported files  */
+/* without extension; empty for no export.                                  */
+/* -----------------------------------------------------------------------   */
+FrameStatsStruct* FrameStatsAlloc(const std::string& ExportPath, MIL_DOUBLE ExportPeriod)
+   {
+   FrameStatsStruct* StatsPtr = new FrameStatsStruct;
+
+   StatsPtr->FrameCount.Value        = 0;
+   StatsPtr->CorruptCount.Value      = 0;
+   StatsPtr->MissingBlockCount.Value  = 0;
+   StatsPtr->MissingPacketCount.Value = 0;
+   StatsPtr->LatePacketCount.Value    = 0;
+   InitHistogram(&StatsPtr->Histograms[eStatsFrameInterval], "frame_interval_seconds",
+      "Time between two frames entering the grab hook.", 1e-9);
+   InitHistogram(&StatsPtr->Histograms[eStatsTransportLatency], "transport_latency_seconds",
+      "Device timestamp to hook entry, relative to the fastest frame.", 1e-9);
+   InitHistogram(&StatsPtr->Histograms[eStatsHookTime], "hook_duration_seconds",
+      "Time spent in the grab hook.", 1e-9);
+   InitHistogram(&StatsPtr->Histograms[eStatsQueueDepth], "queue_depth",
+      "Frames waiting for the workers, or grab buffers in use, when the hook returns.", 1.0);
+   InitHistogram(&StatsPtr->Histograms[eStatsBlockGap], "block_gap_blocks",
+      "Consecutive block IDs never received.", 1.0);
+   InitHistogram(&StatsPtr->Histograms[eStatsLossBurst], "loss_burst_packets",
+      "Consecutive packets missing in a frame.", 1.0);
+   InitHistogram(&StatsPtr->Histograms[eStatsLatePacketDelay], "late_packet_delay_seconds",
+      "Time from a hole seen in a frame to the resent or reordered packet filling it.", 1e-9);
+   InitHistogram(&StatsPtr->Histograms[eStatsFormatChangeGap], "format_change_gap_seconds",
+      "Time from the first frame in a new data format to the first one grabbed into buffers "
+      "of that format.", 1e-9);
+   for(MIL_INT i = 0; i < STATS_LOSS_POSITION_BINS; i++)
+      StatsPtr->LossPosition[i].store(0, std::memory_order_relaxed);
+
+   StatsPtr->LaunchTime           = 0;
+   StatsPtr->AcquisitionStartTime = 0;
+   StatsPtr->FirstFrameTime       = 0;
+   StatsPtr->LastHookTime       = 0;
+   StatsPtr->LastBlockId        = 0;
+   StatsPtr->MinTransportOffset = 1e300;
+   StatsPtr->ExportPath         = ExportPath;
+   StatsPtr->ExportPeriod       = ExportPeriod;
+   StatsPtr->Health             = M_NULL;
+   StatsPtr->CsvHeaderWritten   = false;
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &StatsPtr->StartTime);
+   StatsPtr->LastExportTime     = StatsPtr->StartTime;
+
+   return StatsPtr;
+   }
+
+void FrameStatsFree(FrameStatsStruct* StatsPtr)
+   {
+   delete StatsPtr;
+   }
+
+/* Records a value. Safe to call from any thread.                            */
+/* -----------------------------------------------------------------------   */
+void StatsHistogramRecord(StatsHistogramStruct* HistogramPtr, MIL_INT64 Value)
+   {
+   MIL_INT64 Max;
+
+   if(Value < 0)
+      Value = 0;
+
+   HistogramPtr->Buckets[BucketIndex((MIL_UINT64)Value)].fetch_add(1, std::memory_order_relaxed);
+   HistogramPtr->Count.Value.fetch_add(1, std::memory_order_relaxed);
+   HistogramPtr->Sum.Value.fetch_add(Value, std::memory_order_relaxed);
+
+   Max = HistogramPtr->Max.Value.load(std::memory_order_relaxed);
+   while(Value > Max &&
+         !HistogramPtr->Max.Value.compare_exchange_weak(Max, Value, std::memory_order_relaxed))
+      ;
+   }
+
+/* Percentile in the exported unit, within the 3% width of a bucket.        */
+/* -----------------------------------------------------------------------   */
+MIL_DOUBLE StatsHistogramPercentile(const StatsHistogramStruct* HistogramPtr,
+                                    MIL_DOUBLE Percentile)
+   {
+   MIL_INT64 Count = HistogramPtr->Count.Value.load(std::memory_order_relaxed);
+   MIL_INT64 Rank  = (MIL_INT64)(Percentile / 100.0 * Count + 0.5);
+   MIL_INT64 Seen  = 0;
+   MIL_INT64 Max   = HistogramPtr->Max.Value.load(std::memory_order_relaxed);
+
+   if(Count == 0)
+      return 0;
+   if(Rank < 1)
+      Rank = 1;
+
+   for(MIL_INT i = 0; i < STATS_BUCKET_COUNT; i++)
+      {
+      Seen += HistogramPtr->Buckets[i].load(std::memory_order_relaxed);
+      if(Seen >= Rank)
+         {
+         MIL_DOUBLE Value = BucketValue(i);
+         return (Value < Max ? Value : Max) * HistogramPtr->Scale;
+         }
+      }
+   return Max * HistogramPtr->Scale;
+   }
+
+/* Number of blocks missing between two GVSP block IDs. Version 1 block IDs */
+/* are 16 bits and skip 0 when they wrap around.                            */
+/* -----------------------------------------------------------------------   */
+static MIL_INT64 BlockIdGap(MIL_INT64 LastBlockId, MIL_INT64 BlockId)
+   {
+   if(BlockId > LastBlockId)
+      return BlockId - LastBlockId - 1;
+   if(LastBlockId <= 0xFFFF && LastBlockId - BlockId > 0x8000)
+      return (0xFFFF - LastBlockId) + (BlockId - 1);
+
+   /* Restarted or out of order. */
+   return 0;
+   }
+
+/* Called by the hook when it gets a frame. Returns the frame count.        */
+/* -----------------------------------------------------------------------   */
+MIL_INT64 FrameStatsFrameStart(FrameStatsStruct* StatsPtr, MIL_DOUBLE HookEntryTime,
+                               MIL_DOUBLE DeviceTimestamp, MIL_INT64 BlockId,
+                               bool IsFrameCorrupt)
+   {
+   MIL_INT64 FrameCount = StatsPtr->FrameCount.Value.fetch_add(1, std::memory_order_relaxed) + 1;
+
+   if(FrameCount == 1)
+      StatsPtr->FirstFrameTime.store(HookEntryTime, std::memory_order_release);
+   if(IsFrameCorrupt)
+      StatsPtr->CorruptCount.Value.fetch_add(1, std::memory_order_relaxed);
+
+   if(StatsPtr->LastHookTime > 0)
+      StatsHistogramRecord(&StatsPtr->Histograms[eStatsFrameInterval],
+                           (MIL_INT64)(1e9 * (HookEntryTime - StatsPtr->LastHookTime)));
+   StatsPtr->LastHookTime = HookEntryTime;
+
+   if(DeviceTimestamp > 0)
+      {
+      MIL_DOUBLE Offset = HookEntryTime - DeviceTimestamp;
+
+      if(Offset < StatsPtr->MinTransportOffset)
+         StatsPtr->MinTransportOffset = Offset;
+      StatsHistogramRecord(&StatsPtr->Histograms[eStatsTransportLatency],
+                           (MIL_INT64)(1e9 * (Offset - StatsPtr->MinTransportOffset)));
+      }
+
+   if(BlockId != 0)
+      {
+      if(StatsPtr->LastBlockId != 0)
+         {
+         MIL_INT64 Missing = BlockIdGap(StatsPtr->LastBlockId, BlockId);
+         if(Missing > 0)
+            {
+            StatsPtr->MissingBlockCount.Value.fetch_add(Missing, std::memory_order_relaxed);
+            StatsHistogramRecord(&StatsPtr->Histograms[eStatsBlockGap], Missing);
+            }
+         }
+      StatsPtr->LastBlockId = BlockId;
+      }
+
+   return FrameCount;
+   }
+
+/* Counts a burst of Length packets missing from packet index Start.      */
+/* -----------------------------------------------------------------------   */
+static void RecordLossBurst(FrameStatsStruct* StatsPtr, MIL_INT Start, MIL_INT Length,
+                            MIL_INT PacketCount)
+   {
+   MIL_INT End = Start + Length;
+
+   StatsHistogramRecord(&StatsPtr->Histograms[eStatsLossBurst], Length);
+   StatsPtr->MissingPacketCount.Value.fetch_add(Length, std::memory_order_relaxed);
+
+   /* Spread the burst over the parts of the frame it covers. */
+   for(MIL_INT Bin = Start * STATS_LOSS_POSITION_BINS / PacketCount;
+       Bin < STATS_LOSS_POSITION_BINS && Bin * PacketCount < End * STATS_LOSS_POSITION_BINS; Bin++)
+      {
+      MIL_INT BinStart = (Bin * PacketCount + STATS_LOSS_POSITION_BINS - 1) / STATS_LOSS_POSITION_BINS;
+      MIL_INT BinEnd   = ((Bin + 1) * PacketCount + STATS_LOSS_POSITION_BINS - 1) / STATS_LOSS_POSITION_BINS;
+      MIL_INT Covered  = (End < BinEnd ? End : BinEnd) - (Start > BinStart ? Start : BinStart);
+
+      if(Covered > 0)
+         StatsPtr->LossPosition[Bin].fetch_add(Covered, std::memory_order_relaxed);
+      }
+   }
+
+/* Called by the hook for a frame with missing packets when the backend     */
+/* knows which packets arrived: bit n of ReceivedBitmap is set if packet    */
+/* n + 1 of the block was received. The bitmap is scanned a word at a time, */
+/* so the cost is in the number of bursts, not of packets.                  */
+/* -----------------------------------------------------------------------   */
+void FrameStatsPacketLoss(FrameStatsStruct* StatsPtr, const MIL_UINT64* ReceivedBitmap,
+                          MIL_INT PacketCount)
+   {
+   MIL_INT RunStart  = 0;
+   MIL_INT RunLength = 0;
+
+   for(MIL_INT Word = 0; Word * 64 < PacketCount; Word++)
+      {
+      MIL_UINT64 Missing = ~ReceivedBitmap[Word];
+
+      if(PacketCount - Word * 64 < 64)
+         Missing &= (1ULL << (PacketCount - Word * 64)) - 1;
+
+      while(Missing)
+         {
+         MIL_INT    First = LeastSignificantBit(Missing);
+         MIL_UINT64 Rest  = ~(Missing >> First);
+         MIL_INT    Count = Rest ? LeastSignificantBit(Rest) : 64 - First;
+         MIL_INT    Start = Word * 64 + First;
+
+         if(RunLength > 0 && RunStart + RunLength == Start)
+            RunLength += Count;
+         else
+            {
+            if(RunLength > 0)
+               RecordLossBurst(StatsPtr, RunStart, RunLength, PacketCount);
+            RunStart  = Start;
+            RunLength = Count;
+            }
+         Missing = First + Count >= 64 ? 0 : Missing & (~0ULL << (First + Count));
+         }
+      }
+
+   if(RunLength > 0)
+      RecordLossBurst(StatsPtr, RunStart, RunLength, PacketCount);
+   }
+
+/* Called by the hook thread when a packet fills a hole of its block, Delay */
+/* seconds after the hole was seen: the packet was resent or reordered.      */
+/* -----------------------------------------------------------------------   */
+void FrameStatsLatePacket(FrameStatsStruct* StatsPtr, MIL_DOUBLE Delay)
+   {
+   StatsPtr->LatePacketCount.Value.fetch_add(1, std::memory_order_relaxed);
+   StatsHistogramRecord(&StatsPtr->Histograms[eStatsLatePacketDelay], (MIL_INT64)(1e9 * Delay));
+   }
+
+/* Called by the main thread when a data format change is completed.        */
+/* -----------------------------------------------------------------------   */
+void FrameStatsFormatChange(FrameStatsStruct* StatsPtr, MIL_DOUBLE Gap)
+   {
+   StatsHistogramRecord(&StatsPtr->Histograms[eStatsFormatChangeGap], (MIL_INT64)(1e9 * Gap));
+   }
+
+/* Called by the hook before it returns.                                     */
+/* -----------------------------------------------------------------------   */
+void FrameStatsFrameEnd(FrameStatsStruct* StatsPtr, MIL_DOUBLE HookEntryTime,
+                        MIL_INT64 QueueDepth)
+   {
+   MIL_DOUBLE Now;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Now);
+   StatsHistogramRecord(&StatsPtr->Histograms[eStatsHookTime],
+                        (MIL_INT64)(1e9 * (Now - HookEntryTime)));
+   StatsHistogramRecord(&StatsPtr->Histograms[eStatsQueueDepth], QueueDepth);
+   }
+
+/* Figures of the image health analysis, as gauges and counters.          */
+/* -----------------------------------------------------------------------   */
+static void WriteHealthPrometheus(FILE* File, const FrameHealthStruct* HealthPtr)
+   {
+   static const char* const LevelQuantiles[eHealthLevelCount] = { "0.01", "0.5", "0.99" };
+   uint32_t                 ActiveAlerts = HealthPtr->ActiveAlerts.load();
+
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "health_frames_total Frames analysed.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "health_frames_total counter\n");
+   fprintf(File, STATS_METRIC_PREFIX "health_frames_total %lld\n",
+      (long long)HealthPtr->FrameCount.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "repeated_frames_total Frames analysed with the "
+                 "content of the one before.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "repeated_frames_total counter\n");
+   fprintf(File, STATS_METRIC_PREFIX "repeated_frames_total %lld\n",
+      (long long)HealthPtr->RepeatCount.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "image_mean_level Mean 8-bit level of the last "
+                 "frame analysed.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "image_mean_level gauge\n");
+   fprintf(File, STATS_METRIC_PREFIX "image_mean_level %.3f\n", HealthPtr->Mean.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "image_level 8-bit level percentiles of the last "
+                 "frame analysed.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "image_level gauge\n");
+   for(int i = 0; i < eHealthLevelCount; i++)
+      fprintf(File, STATS_METRIC_PREFIX "image_level{quantile=\"%s\"} %.0f\n", LevelQuantiles[i],
+         HealthPtr->Levels[i].load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "image_dark_ratio Dark pixels in the last frame "
+                 "analysed.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "image_dark_ratio gauge\n");
+   fprintf(File, STATS_METRIC_PREFIX "image_dark_ratio %.6f\n", HealthPtr->DarkRatio.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "image_saturated_ratio Saturated pixels in the last "
+                 "frame analysed.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "image_saturated_ratio gauge\n");
+   fprintf(File, STATS_METRIC_PREFIX "image_saturated_ratio %.6f\n",
+      HealthPtr->SaturatedRatio.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "image_sharpness Mean horizontal gradient of the "
+                 "last frame analysed, in percent of its mean level.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "image_sharpness gauge\n");
+   fprintf(File, STATS_METRIC_PREFIX "image_sharpness %.3f\n", HealthPtr->Sharpness.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "health_alert Image health alerts raised.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "health_alert gauge\n");
+   for(int i = 0; i < eHealthAlertCount; i++)
+      fprintf(File, STATS_METRIC_PREFIX "health_alert{alert=\"%s\"} %d\n",
+         FrameHealthAlertName((HealthAlertType)i), (ActiveAlerts >> i) & 1 ? 1 : 0);
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "health_alerts_total Image health alerts raised "
+                 "since the start.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "health_alerts_total counter\n");
+   for(int i = 0; i < eHealthAlertCount; i++)
+      fprintf(File, STATS_METRIC_PREFIX "health_alerts_total{alert=\"%s\"} %lld\n",
+         FrameHealthAlertName((HealthAlertType)i), (long long)HealthPtr->AlertCounts[i].load());
+   }
+
+/* Prometheus text format, for the node exporter textfile collector. The   */
+/* file is written aside and renamed so that it is never read half written. */
+/* -----------------------------------------------------------------------   */
+static void WritePrometheus(FrameStatsStruct* StatsPtr)
+   {
+   std::string Path    = StatsPtr->ExportPath + ".prom";
+   std::string TmpPath = Path + ".tmp";
+   FILE*       File    = fopen(TmpPath.c_str(), "w");
+
+   if(!File)
+      return;
+
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "frames_total Frames grabbed.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "frames_total counter\n");
+   fprintf(File, STATS_METRIC_PREFIX "frames_total %lld\n",
+      (long long)StatsPtr->FrameCount.Value.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "corrupt_frames_total Frames with missing packets.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "corrupt_frames_total counter\n");
+   fprintf(File, STATS_METRIC_PREFIX "corrupt_frames_total %lld\n",
+      (long long)StatsPtr->CorruptCount.Value.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "missing_blocks_total Block IDs never received.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "missing_blocks_total counter\n");
+   fprintf(File, STATS_METRIC_PREFIX "missing_blocks_total %lld\n",
+      (long long)StatsPtr->MissingBlockCount.Value.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "missing_packets_total Packets missing from the frames received.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "missing_packets_total counter\n");
+   fprintf(File, STATS_METRIC_PREFIX "missing_packets_total %lld\n",
+      (long long)StatsPtr->MissingPacketCount.Value.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "late_packets_total Packets that filled a hole: resent or reordered.\n");
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "late_packets_total counter\n");
+   fprintf(File, STATS_METRIC_PREFIX "late_packets_total %lld\n",
+      (long long)StatsPtr->LatePacketCount.Value.load());
+   fprintf(File, "# HELP " STATS_METRIC_PREFIX "missing_packets_by_position_total Missing packets by "
+                 "position in the frame, in %dths.\n", STATS_LOSS_POSITION_BINS);
+   fprintf(File, "# TYPE " STATS_METRIC_PREFIX "missing_packets_by_position_total counter\n");
+   for(MIL_INT i = 0; i < STATS_LOSS_POSITION_BINS; i++)
+      fprintf(File, STATS_METRIC_PREFIX "missing_packets_by_position_total{position=\"%d\"} %lld\n",
+         (int)i, (long long)StatsPtr->LossPosition[i].load());
+
+   for(MIL_INT h = 0; h < eStatsHistogramCount; h++)
+      {
+      const StatsHistogramStruct* HistogramPtr = &StatsPtr->Histograms[h];
+
+      fprintf(File, "# HELP " STATS_METRIC_PREFIX "%s %s\n", HistogramPtr->Name, HistogramPtr->Help);
+      fprintf(File, "# TYPE " STATS_METRIC_PREFIX "%s summary\n", HistogramPtr->Name);
+      for(size_t p = 0; p < EXPORTED_PERCENTILE_COUNT; p++)
+         fprintf(File, STATS_METRIC_PREFIX "%s{quantile=\"%g\"} %.9g\n", HistogramPtr->Name,
+            ExportedPercentiles[p] / 100.0,
+            StatsHistogramPercentile(HistogramPtr, ExportedPercentiles[p]));
+      fprintf(File, STATS_METRIC_PREFIX "%s_sum %.9g\n", HistogramPtr->Name,
+         HistogramPtr->Sum.Value.load() * HistogramPtr->Scale);
+      fprintf(File, STATS_METRIC_PREFIX "%s_count %lld\n", HistogramPtr->Name,
+         (long long)HistogramPtr->Count.Value.load());
+      }
+   if(StatsPtr->FirstFrameTime.load() > 0)
+      {
+      fprintf(File, "# HELP " STATS_METRIC_PREFIX "startup_seconds Time from the start of the "
+                    "monitor to a startup stage.\n");
+      fprintf(File, "# TYPE " STATS_METRIC_PREFIX "startup_seconds gauge\n");
+      fprintf(File, STATS_METRIC_PREFIX "startup_seconds{stage=\"acquisition_start\"} %.6f\n",
+         StatsPtr->AcquisitionStartTime - StatsPtr->LaunchTime);
+      fprintf(File, STATS_METRIC_PREFIX "startup_seconds{stage=\"first_frame\"} %.6f\n",
+         StatsPtr->FirstFrameTime.load() - StatsPtr->LaunchTime);
+      }
+   if(StatsPtr->Health)
+      WriteHealthPrometheus(File, StatsPtr->Health);
+   fclose(File);
+
+#if M_MIL_USE_WINDOWS
+   remove(Path.c_str());
+#endif
+   rename(TmpPath.c_str(), Path.c_str());
+   }
+
+/* One CSV row per export.                                                   */
+/* -----------------------------------------------------------------------   */
+static void AppendCsv(FrameStatsStruct* StatsPtr, MIL_DOUBLE ElapsedTime)
+   {
+   std::string Path = StatsPtr->ExportPath + ".csv";
+   FILE*       File = fopen(Path.c_str(), StatsPtr->CsvHeaderWritten ? "a" : "w");
+
+   if(!File)
+      return;
+
+   if(!StatsPtr->CsvHeaderWritten)
+      {
+      fprintf(File, "elapsed_seconds,frames,corrupt_frames,missing_blocks,missing_packets,late_packets");
+      for(MIL_INT h = 0; h < eStatsHistogramCount; h++)
+         {
+         const char* Name = StatsPtr->Histograms[h].Name;
+         fprintf(File, ",%s_p50,%s_p99,%s_p999,%s_max", Name, Name, Name, Name);
+         }
+      if(StatsPtr->Health)
+         fprintf(File, ",image_mean_level,image_dark_ratio,image_saturated_ratio,"
+                       "image_sharpness,repeated_frames,health_alert_mask");
+      fprintf(File, "\n");
+      StatsPtr->CsvHeaderWritten = true;
+      }
+
+   fprintf(File, "%.3f,%lld,%lld,%lld,%lld,%lld", ElapsedTime,
+      (long long)StatsPtr->FrameCount.Value.load(),
+      (long long)StatsPtr->CorruptCount.Value.load(),
+      (long long)StatsPtr->MissingBlockCount.Value.load(),
+      (long long)StatsPtr->MissingPacketCount.Value.load(),
+      (long long)StatsPtr->LatePacketCount.Value.load());
+   for(MIL_INT h = 0; h < eStatsHistogramCount; h++)
+      {
+      const StatsHistogramStruct* HistogramPtr = &StatsPtr->Histograms[h];
+
+      for(size_t p = 0; p < EXPORTED_PERCENTILE_COUNT; p++)
+         fprintf(File, ",%.9g", StatsHistogramPercentile(HistogramPtr, ExportedPercentiles[p]));
+      fprintf(File, ",%.9g", HistogramPtr->Max.Value.load() * HistogramPtr->Scale);
+      }
+   if(StatsPtr->Health)
+      {
+      const FrameHealthStruct* HealthPtr = StatsPtr->Health;
+
+      fprintf(File, ",%.3f,%.6f,%.6f,%.3f,%lld,%u", HealthPtr->Mean.load(),
+         HealthPtr->DarkRatio.load(), HealthPtr->SaturatedRatio.load(),
+         HealthPtr->Sharpness.load(), (long long)HealthPtr->RepeatCount.load(),
+         (unsigned)HealthPtr->ActiveAlerts.load());
+      }
+   fprintf(File, "\n");
+   fclose(File);
+   }
+
+/* Exports the statistics if the export period has elapsed, or right away  */
+/* if Force is set. Called by the main thread.                               */
+/* -----------------------------------------------------------------------   */
+void FrameStatsExport(FrameStatsStruct* StatsPtr, bool Force)
+   {
+   MIL_DOUBLE Now;
+
+   if(StatsPtr->ExportPath.empty())
+      return;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Now);
+   if(!Force && Now - StatsPtr->LastExportTime < StatsPtr->ExportPeriod)
+      return;
+   StatsPtr->LastExportTime = Now;
+
+   WritePrometheus(StatsPtr);
+   AppendCsv(StatsPtr, Now - StatsPtr->StartTime);
+   }
+
+/* Time the next export is due, 0 if the statistics are not exported.      */
+/* -----------------------------------------------------------------------   */
+MIL_DOUBLE FrameStatsNextExport(const FrameStatsStruct* StatsPtr)
+   {
+   if(StatsPtr->ExportPath.empty())
+      return 0;
+   return StatsPtr->LastExportTime + StatsPtr->ExportPeriod;
+   }
+
+/* Prints the percentiles of all the histograms.                             */
+/* -----------------------------------------------------------------------   */
+void FrameStatsPrint(FrameStatsStruct* StatsPtr)
+   {
+   MosPrintf(MIL_TEXT("\nFrame statistics:             p50         p99       p99.9         max\n"));
+   for(MIL_INT h = 0; h < eStatsHistogramCount; h++)
+      {
+      const StatsHistogramStruct* HistogramPtr = &StatsPtr->Histograms[h];
+      std::string Name(HistogramPtr->Name);
+      MIL_DOUBLE Unit = HistogramPtr->Scale < 1.0 ? 1000.0 : 1.0;
+
+      MosPrintf(MIL_TEXT("  %-26s"), MIL_STRING(Name.begin(), Name.end()).c_str());
+      for(size_t p = 0; p < EXPORTED_PERCENTILE_COUNT; p++)
+         MosPrintf(MIL_TEXT(" %11.3f"), Unit * StatsHistogramPercentile(HistogramPtr,
+                                                                      ExportedPercentiles[p]));
+      MosPrintf(MIL_TEXT(" %11.3f%s\n"), Unit * HistogramPtr->Max.Value.load() * HistogramPtr->Scale,
+         Unit > 1.0 ? MIL_TEXT(" ms") : MIL_TEXT(""));
+      }
+   MosPrintf(MIL_TEXT("  Missing blocks:        %lld\n"),
+      (long long)StatsPtr->MissingBlockCount.Value.load());
+   MosPrintf(MIL_TEXT("  Missing packets:       %lld\n"),
+      (long long)StatsPtr->MissingPacketCount.Value.load());
+   MosPrintf(MIL_TEXT("  Late packets:          %lld\n"),
+      (long long)StatsPtr->LatePacketCount.Value.load());
+
+   if(StatsPtr->MissingPacketCount.Value.load() > 0)
+      {
+      MosPrintf(MIL_TEXT("  Missing packets by position in the frame (%%):\n   "));
+      for(MIL_INT i = 0; i < STATS_LOSS_POSITION_BINS; i++)
+         MosPrintf(MIL_TEXT(" %4.1f"), 100.0 * StatsPtr->LossPosition[i].load() /
+                                       StatsPtr->MissingPacketCount.Value.load());
+      MosPrintf(MIL_TEXT("\n"));
+      }
+   }
@@ -0,0 +1,126 @@
+﻿/*************************************************************************************/
+/*
+ * File name: FrameStats.h
+ *
+ * Synopsis:  Per-frame instrumentation. The hook records the inter-frame interval,
+ *            the device timestamp to hook entry latency, its own execution time and
+ *            the queue depth into lock-free log-linear (HDR-style) histograms, and
+ *            counts the corrupt frames and the missing blocks. The main thread
+ *            exports the percentiles periodically in the Prometheus text format and
+ *            as CSV.
+ *
+ *            When the backend knows which packets of a frame arrived, the loss is
+ *            also broken down by burst length and by position in the frame, and the
+ *            packets that filled a hole late are counted with their delay. Whole
+ *            blocks missing or long bursts point to the switch or to the multicast
+ *            group membership (IGMP); short bursts scattered over the frame point to
+ *            the receive ring of the NIC or the socket buffer overflowing.
+ *
+ *            The figures of the image health analysis, if any, are exported
+ *            with the statistics.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <mil.h>
+#include <atomic>
+#include <string>
+#include "FramePipeline.h"
+#include "FrameHealth.h"
+
+/* Histogram buckets: values below 2^STATS_SUB_BUCKET_BITS are exact, larger  */
+/* ones are split in 2^STATS_SUB_BUCKET_BITS buckets per power of 2 (3% wide).  */
+#define STATS_SUB_BUCKET_BITS    5
+#define STATS_SUB_BUCKET_COUNT   (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_BUCKET_COUNT       ((64 - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKET_COUNT)
+
+/* Device timestamps are in device ticks; GigE Vision devices commonly tick at 1 GHz. */
+#define DEVICE_TIMESTAMP_FREQUENCY 1e9
+
+/* Parts of the frame the lost packets are counted in. */
+#define STATS_LOSS_POSITION_BINS 16
+
+/* Counter alone on its cache line. */
+typedef struct
+   {
+   std::atomic<MIL_INT64> Value;
+   char                   Padding[CACHE_LINE_SIZE - sizeof(std::atomic<MIL_INT64>)];
+   } PaddedCounterStruct;
+
+typedef struct
+   {
+   const char*            Name;          /* Exported metric name, without prefix.  */
+   const char*            Help;
+   MIL_DOUBLE             Scale;         /* Exported unit per recorded unit.       */
+   PaddedCounterStruct    Count;
+   PaddedCounterStruct    Sum;
+   PaddedCounterStruct    Max;
+   std::atomic<MIL_INT64> Buckets[STATS_BUCKET_COUNT];
+   } StatsHistogramStruct;
+
+typedef enum
+   {
+   eStatsFrameInterval = 0,   /* Nanoseconds between hook entries.                */
+   eStatsTransportLatency,    /* Nanoseconds from device timestamp to hook entry. */
+   eStatsHookTime,            /* Nanoseconds in the hook.                         */
+   eStatsQueueDepth,          /* Frames waiting for the workers, or buffers held. */
+   eStatsBlockGap,            /* Blocks missing in a row.                         */
+   eStatsLossBurst,           /* Packets missing in a row within a frame.         */
+   eStatsLatePacketDelay,     /* Nanoseconds from a hole seen to it being filled. */
+   eStatsFormatChangeGap,     /* Nanoseconds without a usable frame on a change.  */
+   eStatsHistogramCount
+   } StatsHistogramType;
+
+typedef struct
+   {
+   PaddedCounterStruct  FrameCount;
+   PaddedCounterStruct  CorruptCount;
+   PaddedCounterStruct  MissingBlockCount;
+   PaddedCounterStruct  MissingPacketCount;
+   PaddedCounterStruct  LatePacketCount;    /* Resent or reordered packets.       */
+   StatsHistogramStruct Histograms[eStatsHistogramCount];
+   std::atomic<MIL_INT64> LossPosition[STATS_LOSS_POSITION_BINS];
+
+   /* Hook state. */
+   char                 HookPadding[CACHE_LINE_SIZE];
+   MIL_DOUBLE           LastHookTime;
+   MIL_INT64            LastBlockId;
+   MIL_DOUBLE           MinTransportOffset;
+
+   /* Startup, in the time of MappTimer. */
+   MIL_DOUBLE           LaunchTime;      /* Start of the monitor.                   */
+   MIL_DOUBLE           AcquisitionStartTime;   /* 0 until the acquisition starts. */
+   std::atomic<MIL_DOUBLE> FirstFrameTime;      /* Hook entry of the first frame,  */
+                                                /* 0 until it is grabbed.          */
+
+   /* Export state, main thread only. */
+   const FrameHealthStruct* Health;      /* Exported too, or M_NULL.              */
+   std::string          ExportPath;      /* Without extension, empty for no export. */
+   MIL_DOUBLE           ExportPeriod;
+   MIL_DOUBLE           StartTime;
+   MIL_DOUBLE           LastExportTime;
+   bool                 CsvHeaderWritten;
+   } FrameStatsStruct;
+
+FrameStatsStruct* FrameStatsAlloc(const std::string& ExportPath, MIL_DOUBLE ExportPeriod);
+void FrameStatsFree(FrameStatsStruct* StatsPtr);
+void StatsHistogramRecord(StatsHistogramStruct* HistogramPtr, MIL_INT64 Value);
+MIL_DOUBLE StatsHistogramPercentile(const StatsHistogramStruct* HistogramPtr,
+                                    MIL_DOUBLE Percentile);
+MIL_INT64 FrameStatsFrameStart(FrameStatsStruct* StatsPtr, MIL_DOUBLE HookEntryTime,
+                               MIL_DOUBLE DeviceTimestamp, MIL_INT64 BlockId,
+                               bool IsFrameCorrupt);
+void FrameStatsPacketLoss(FrameStatsStruct* StatsPtr, const MIL_UINT64* ReceivedBitmap,
+                          MIL_INT PacketCount);
+void FrameStatsLatePacket(FrameStatsStruct* StatsPtr, MIL_DOUBLE Delay);
+void FrameStatsFormatChange(FrameStatsStruct* StatsPtr, MIL_DOUBLE Gap);
+void FrameStatsFrameEnd(FrameStatsStruct* StatsPtr, MIL_DOUBLE HookEntryTime,
+                        MIL_INT64 QueueDepth);
+void FrameStatsExport(FrameStatsStruct* StatsPtr, bool Force);
+MIL_DOUBLE FrameStatsNextExport(const FrameStatsStruct* StatsPtr);
+void FrameStatsPrint(FrameStatsStruct* StatsPtr);
+
+#endif /* FRAME_STATS_H */
@@ -0,0 +1,312 @@
+﻿/*************************************************************************************/
+/*
+ * File name: GrabQueue.cpp
+ *
+ * Synopsis:  Grab queue sizing and periodic review.
+ *
+ *            The buffers needed follow Little's law: the frame rate times the
+ *            time a buffer stays in use after the hook (in the workers and the
+ *            display), plus the frames that arrive while the processing stalls
+ *            for the tolerated latency, plus the buffers kept free ahead of the
+ *            grab. The queue grows when the hook had to wait for buffers or the
+ *            usage gets close to the queue size, and shrinks after a few reviews
+ *            of low usage. Each change is logged with the figures it is based on.
+ *
+ *            A new pool is built while the current one is still grabbed into,
+ *            so it is sized within the memory the other live pools leave, the
+ *            idle ones aside since they are freed to make room for it.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#include <math.h>
+#include "MulticastMonitor.h"
+
+/* Memory the pools of the queue may use in all: its own budget, or what  */
+/* the other streams leave of the shared one, the shares of those without  */
+/* a pool yet aside. 0 for no limit.                                         */
+/* -----------------------------------------------------------------------   */
+static MIL_INT64 BudgetLimit(const GrabQueueStruct* QueuePtr)
+   {
+   const GrabBudgetStruct* BudgetPtr = QueuePtr->SharedBudget;
+   MIL_INT64 Share, Free;
+   MIL_INT   Waiting;
+
+   if(!BudgetPtr || BudgetPtr->Total <= 0)
+      return QueuePtr->MemoryBudget;
+
+   Share   = BudgetPtr->Total / (BudgetPtr->StreamCount > 0 ? BudgetPtr->StreamCount : 1);
+   Waiting = BudgetPtr->WaitingCount.load() - (QueuePtr->Charged ? 0 : 1);
+   Free    = BudgetPtr->Total - (BudgetPtr->Reserved.load() - QueuePtr->ReservedBytes.load()) -
+             Waiting * Share;
+   return Free > 1 ? Free : 1;
+   }
+
+/* Memory left for a new pool, that of the idle pools included.             */
+/* -----------------------------------------------------------------------   */
+static MIL_INT64 AvailableBudget(const GrabQueueStruct* QueuePtr)
+   {
+   MIL_INT64 Available = BudgetLimit(QueuePtr) -
+                         (QueuePtr->ReservedBytes.load() - QueuePtr->IdleBytes);
+
+   return Available > 0 ? Available : 0;
+   }
+
+/* Largest queue whose pool fits in the memory budget. May be less than the */
+/* minimum queue size.                                                       */
+/* -----------------------------------------------------------------------   */
+static MIL_INT BudgetSize(const GrabQueueStruct* QueuePtr, MIL_INT64 BufferBytes,
+                          MIL_INT64 DisplayBytes)
+   {
+   MIL_INT64 Size = BUFFERING_SIZE_MAX;
+
+   if(BudgetLimit(QueuePtr) > 0 && BufferBytes > 0)
+      {
+      Size = (AvailableBudget(QueuePtr) - DisplayBytes) / BufferBytes;
+      if(Size < 0)
+         Size = 0;
+      }
+   if(Size > BUFFERING_SIZE_MAX)
+      Size = BUFFERING_SIZE_MAX;
+   return (MIL_INT)Size;
+   }
+
+/* Size within the budget. The grab needs GRAB_GUARD_DISTANCE+1 buffers,    */
+/* even if the budget is exceeded.                                           */
+/* -----------------------------------------------------------------------   */
+static MIL_INT ClampSize(const GrabQueueStruct* QueuePtr, MIL_INT Size, MIL_INT64 BufferBytes,
+                         MIL_INT64 DisplayBytes)
+   {
+   MIL_INT Limit = BudgetSize(QueuePtr, BufferBytes, DisplayBytes);
+
+   if(Size < GRAB_QUEUE_SIZE_MIN)
+      Size = GRAB_QUEUE_SIZE_MIN;
+   if(Size > Limit)
+      Size = Limit;
+   if(Size < GRAB_GUARD_DISTANCE + 1)
+      {
+      Size = GRAB_GUARD_DISTANCE + 1;
+      MosPrintf(MIL_TEXT("Warning: the memory budget leaves room for %lld buffers of %.2f MB; ")
+                MIL_TEXT("%lld are allocated, %.1f MB over the budget.\n"), (long long)Limit,
+                BufferBytes / 1048576.0, (long long)Size,
+                (Size * BufferBytes + DisplayBytes - AvailableBudget(QueuePtr)) / 1048576.0);
+      }
+   return Size;
+   }
+
+void GrabQueueInit(GrabQueueStruct* QueuePtr, MIL_INT64 MemoryBudget,
+                   MIL_DOUBLE LatencyTolerance)
+   {
+   QueuePtr->MemoryBudget       = MemoryBudget;
+   QueuePtr->LatencyTolerance   = LatencyTolerance;
+   QueuePtr->SharedBudget       = M_NULL;
+   QueuePtr->Charged            = false;
+   QueuePtr->ReservedBytes      = 0;
+   QueuePtr->IdleBytes          = 0;
+   QueuePtr->FrameCount         = 0;
+   QueuePtr->SkipCount          = 0;
+   QueuePtr->BuffersInUse       = 0;
+   QueuePtr->MaxBuffersInUse    = 0;
+   QueuePtr->HoldTimeTotal      = 0;
+   QueuePtr->HoldCount          = 0;
+   QueuePtr->LastReviewTime     = 0;
+   QueuePtr->LastFrameCount     = 0;
+   QueuePtr->LastSkipCount      = 0;
+   QueuePtr->LowUsageReviews    = 0;
+   QueuePtr->GrowCount          = 0;
+   QueuePtr->ShrinkCount        = 0;
+   for(MIL_INT i = 0; i < BUFFERING_SIZE_MAX; i++)
+      QueuePtr->BusyTime[i] = 0;
+   }
+
+/* Makes the queue draw from a budget shared with other streams.            */
+/* -----------------------------------------------------------------------   */
+void GrabQueueShareBudget(GrabQueueStruct* QueuePtr, GrabBudgetStruct* BudgetPtr)
+   {
+   QueuePtr->SharedBudget = BudgetPtr;
+   QueuePtr->MemoryBudget = BudgetPtr->Total;
+   }
+
+/* Charges the memory of a pool to the budget of the queue, or releases it */
+/* if Bytes is negative. Called from any thread.                             */
+/* -----------------------------------------------------------------------   */
+void GrabQueueCharge(GrabQueueStruct* QueuePtr, MIL_INT64 Bytes)
+   {
+   QueuePtr->ReservedBytes.fetch_add(Bytes);
+   if(QueuePtr->SharedBudget)
+      {
+      QueuePtr->SharedBudget->Reserved.fetch_add(Bytes);
+      if(!QueuePtr->Charged && Bytes > 0)
+         QueuePtr->SharedBudget->WaitingCount.fetch_sub(1);
+      }
+   if(Bytes > 0)
+      QueuePtr->Charged = true;
+   }
+
+/* Memory to free before Bytes more can be charged within the budget.      */
+/* -----------------------------------------------------------------------   */
+MIL_INT64 GrabQueueOverBudget(const GrabQueueStruct* QueuePtr, MIL_INT64 Bytes)
+   {
+   MIL_INT64 Limit = BudgetLimit(QueuePtr);
+   MIL_INT64 Over  = QueuePtr->ReservedBytes.load() + Bytes - Limit;
+
+   return (Limit > 0 && Over > 0) ? Over : 0;
+   }
+
+/* Queue size before any frame has been grabbed. FrameRate is 0 if unknown. */
+/* -----------------------------------------------------------------------   */
+MIL_INT GrabQueueInitialSize(GrabQueueStruct* QueuePtr, MIL_INT64 BufferBytes,
+                             MIL_INT64 DisplayBytes, MIL_DOUBLE FrameRate)
+   {
+   MIL_INT Size = GRAB_QUEUE_SIZE_DEFAULT;
+
+   if(FrameRate > 0)
+      Size = (MIL_INT)ceil(FrameRate * QueuePtr->LatencyTolerance) + GRAB_GUARD_DISTANCE + 1;
+   Size = ClampSize(QueuePtr, Size, BufferBytes, DisplayBytes);
+
+   MosPrintf(MIL_TEXT("Grab queue: %lld buffers of %.2f MB (%.0f ms latency tolerance"),
+      (long long)Size, BufferBytes / 1048576.0, 1000.0 * QueuePtr->LatencyTolerance);
+   if(QueuePtr->SharedBudget && QueuePtr->MemoryBudget > 0)
+      MosPrintf(MIL_TEXT(", %.1f MB available of a %.1f MB shared budget"),
+         AvailableBudget(QueuePtr) / 1048576.0, QueuePtr->MemoryBudget / 1048576.0);
+   else if(QueuePtr->MemoryBudget > 0)
+      MosPrintf(MIL_TEXT(", %.1f MB budget"), QueuePtr->MemoryBudget / 1048576.0);
+   MosPrintf(MIL_TEXT(").\n"));
+
+   return Size;
+   }
+
+/* Queue size for a new data format: the current size, within the budget.  */
+/* -----------------------------------------------------------------------   */
+MIL_INT GrabQueueFitBudget(GrabQueueStruct* QueuePtr, MIL_INT Size, MIL_INT64 BufferBytes,
+                           MIL_INT64 DisplayBytes)
+   {
+   MIL_INT FitSize = ClampSize(QueuePtr, Size, BufferBytes, DisplayBytes);
+
+   if(FitSize != Size)
+      MosPrintf(MIL_TEXT("Grab queue: %lld -> %lld buffers of %.2f MB for the new data ")
+                MIL_TEXT("format.\n"), (long long)Size, (long long)FitSize,
+                BufferBytes / 1048576.0);
+   return FitSize;
+   }
+
+/* Called when a grab buffer gets its first reference.                       */
+/* -----------------------------------------------------------------------   */
+void GrabQueueBufferBusy(GrabQueueStruct* QueuePtr, MIL_INT BufferIndex)
+   {
+   MIL_INT InUse = QueuePtr->BuffersInUse.fetch_add(1, std::memory_order_relaxed) + 1;
+   MIL_INT Max   = QueuePtr->MaxBuffersInUse.load(std::memory_order_relaxed);
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &QueuePtr->BusyTime[BufferIndex]);
+   while(InUse > Max &&
+         !QueuePtr->MaxBuffersInUse.compare_exchange_weak(Max, InUse, std::memory_order_relaxed))
+      ;
+   }
+
+/* Called when the last reference of a grab buffer is released, with the   */
+/* time it got its first one.                                                */
+/* -----------------------------------------------------------------------   */
+void GrabQueueBufferFree(GrabQueueStruct* QueuePtr, MIL_DOUBLE BusyTime)
+   {
+   MIL_DOUBLE Now;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Now);
+   QueuePtr->HoldTimeTotal.fetch_add((MIL_INT64)(1e6 * (Now - BusyTime)),
+                                     std::memory_order_relaxed);
+   QueuePtr->HoldCount.fetch_add(1, std::memory_order_relaxed);
+   QueuePtr->BuffersInUse.fetch_sub(1, std::memory_order_relaxed);
+   }
+
+/* Reviews the queue size from the statistics gathered since the last      */
+/* review. Returns the new size, which is CurrentSize if it should not      */
+/* change.                                                                   */
+/* -----------------------------------------------------------------------   */
+MIL_INT GrabQueueReview(GrabQueueStruct* QueuePtr, MIL_INT CurrentSize,
+                        MIL_INT64 BufferBytes, MIL_INT64 DisplayBytes)
+   {
+   MIL_INT64  FrameCount = QueuePtr->FrameCount.load();
+   MIL_INT64  SkipCount  = QueuePtr->SkipCount.load();
+   MIL_INT64  HoldCount  = QueuePtr->HoldCount.exchange(0);
+   MIL_INT64  HoldTotal  = QueuePtr->HoldTimeTotal.exchange(0);
+   MIL_INT    MaxInUse   = QueuePtr->MaxBuffersInUse.exchange(QueuePtr->BuffersInUse.load());
+   MIL_INT64  Frames     = FrameCount - QueuePtr->LastFrameCount;
+   MIL_INT64  Skips      = SkipCount - QueuePtr->LastSkipCount;
+   MIL_DOUBLE HoldTime   = HoldCount ? 1e-6 * HoldTotal / HoldCount : 0;
+   MIL_DOUBLE Now, FrameInterval;
+   MIL_INT    Needed, Wanted, Limit, Size = CurrentSize;
+   const MIL_TEXT_CHAR* Reason = M_NULL;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Now);
+   FrameInterval = (QueuePtr->LastReviewTime > 0 && Frames > 0) ?
+                   (Now - QueuePtr->LastReviewTime) / Frames : 0;
+   QueuePtr->LastReviewTime    = Now;
+   QueuePtr->LastFrameCount    = FrameCount;
+   QueuePtr->LastSkipCount     = SkipCount;
+   if(FrameInterval <= 0)
+      return CurrentSize;
+
+   Needed = (MIL_INT)ceil((HoldTime + QueuePtr->LatencyTolerance) / FrameInterval) +
+            GRAB_GUARD_DISTANCE + 1;
+
+   if(Skips > 0 || MaxInUse + GRAB_GUARD_DISTANCE >= CurrentSize)
+      {
+      QueuePtr->LowUsageReviews = 0;
+      Size   = Needed > CurrentSize + CurrentSize / 2 ? Needed : CurrentSize + CurrentSize / 2;
+      Reason = Skips > 0 ? MIL_TEXT("frames skipped, buffers in use") :
+                           MIL_TEXT("buffers nearly all in use");
+      }
+   else if(Needed < CurrentSize && 2 * (MaxInUse + GRAB_GUARD_DISTANCE) < CurrentSize)
+      {
+      if(++QueuePtr->LowUsageReviews >= GRAB_QUEUE_SHRINK_REVIEWS)
+         {
+         QueuePtr->LowUsageReviews = 0;
+         Size   = Needed > MaxInUse + GRAB_GUARD_DISTANCE + 1 ?
+                  Needed : MaxInUse + GRAB_GUARD_DISTANCE + 1;
+         Reason = MIL_TEXT("low usage");
+         }
+      }
+   else
+      QueuePtr->LowUsageReviews = 0;
+
+   if(!Reason)
+      return CurrentSize;
+
+   /* The new pool is built next to the current one: a queue that would not */
+   /* fit alongside it is kept as is until the memory is freed.             */
+   Wanted = Size;
+   Limit  = BudgetSize(QueuePtr, BufferBytes, DisplayBytes);
+   if(Wanted > Limit)
+      {
+      if(Wanted > CurrentSize && Limit > CurrentSize)
+         Size = Limit;
+      else
+         {
+         MosPrintf(MIL_TEXT("Grab queue: kept at %lld buffers (%s), limited by %s.\n"),
+                   (long long)CurrentSize, Reason, Limit < BUFFERING_SIZE_MAX ?
+                   MIL_TEXT("the memory budget") : MIL_TEXT("BUFFERING_SIZE_MAX"));
+         return CurrentSize;
+         }
+      }
+   Size = ClampSize(QueuePtr, Size, BufferBytes, DisplayBytes);
+   if(Size == CurrentSize)
+      return CurrentSize;
+
+   if(Size > CurrentSize)
+      QueuePtr->GrowCount++;
+   else
+      QueuePtr->ShrinkCount++;
+
+   MosPrintf(MIL_TEXT("Grab queue: %lld -> %lld buffers (%s; %.1f fps, %.1f ms held, ")
+             MIL_TEXT("%lld max in use, %lld skipped, %.1f MB).\n"),
+             (long long)CurrentSize, (long long)Size, Reason, 1.0 / FrameInterval,
+             1000.0 * HoldTime, (long long)MaxInUse, (long long)Skips,
+             Size * BufferBytes / 1048576.0);
+   return Size;
+   }
+
+void GrabQueuePrintStatistics(GrabQueueStruct* QueuePtr)
+   {
+   MosPrintf(MIL_TEXT("Grab queue grown %lld times, shrunk %lld times.\n"),
+      (long long)QueuePtr->GrowCount, (long long)QueuePtr->ShrinkCount);
+   }
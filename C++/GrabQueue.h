@@ -0,0 +1,87 @@
+﻿/*************************************************************************************/
+/*
+ * File name: GrabQueue.h
+ *
+ * Synopsis:  Grab queue sizing. The number of grab buffers is derived from the
+ *            frame size, the frame rate, the time the buffers stay in use after
+ *            the hook and a latency tolerance, within a memory budget. It is then
+ *            reviewed periodically from the buffer usage statistics, and the queue
+ *            is grown or shrunk by swapping in a buffer pool of another size.
+ *
+ *            The budget covers all the live pools of the stream: the active one,
+ *            the idle ones kept in the cache and the one being built, with their
+ *            display buffers. The idle pools are freed to make room for a new one.
+ *
+ *            The streams of a multi-stream monitor share one budget: the share of
+ *            each stream is kept for it until it has its first pool, and it may
+ *            then use what the others leave free.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef GRAB_QUEUE_H
+#define GRAB_QUEUE_H
+
+#include <mil.h>
+#include <atomic>
+
+#define GRAB_QUEUE_SIZE_MIN        4
+#define GRAB_QUEUE_SIZE_DEFAULT    20     /* When the frame rate is not known yet.  */
+#define GRAB_QUEUE_REVIEW_PERIOD   1.0    /* Seconds between reviews.               */
+#define GRAB_QUEUE_SHRINK_REVIEWS  5      /* Low usage reviews in a row to shrink.  */
+
+/* Memory budget shared by the grab queues of several streams. */
+typedef struct
+   {
+   MIL_INT64              Total;               /* Bytes, 0 for no limit.              */
+   MIL_INT                StreamCount;
+   std::atomic<MIL_INT64> Reserved;            /* Bytes of the live pools.            */
+   std::atomic<MIL_INT>   WaitingCount;        /* Streams without a pool yet.         */
+   } GrabBudgetStruct;
+
+typedef struct
+   {
+   /* Settings. */
+   MIL_INT64              MemoryBudget;        /* Bytes of all pools, 0 for no limit. */
+   MIL_DOUBLE             LatencyTolerance;    /* Processing stall to absorb, in sec. */
+   GrabBudgetStruct*      SharedBudget;        /* M_NULL for a budget of its own.     */
+   bool                   Charged;             /* Has had a pool.                     */
+
+   /* Memory of the live pools; charged by the builder thread too. */
+   std::atomic<MIL_INT64> ReservedBytes;       /* Active, idle and being built.       */
+   MIL_INT64              IdleBytes;           /* Idle pools, main thread only.       */
+
+   /* Updated by the hook and as buffers are referenced and released. */
+   std::atomic<MIL_INT64> FrameCount;
+   std::atomic<MIL_INT64> SkipCount;           /* Frames skipped, buffers in use.     */
+   std::atomic<MIL_INT>   BuffersInUse;
+   std::atomic<MIL_INT>   MaxBuffersInUse;
+   std::atomic<MIL_INT64> HoldTimeTotal;       /* Microseconds.                       */
+   std::atomic<MIL_INT64> HoldCount;
+   MIL_DOUBLE             BusyTime[BUFFERING_SIZE_MAX];
+
+   /* Review state, main thread only. */
+   MIL_DOUBLE             LastReviewTime;
+   MIL_INT64              LastFrameCount;
+   MIL_INT64              LastSkipCount;
+   MIL_INT                LowUsageReviews;
+   MIL_INT64              GrowCount;
+   MIL_INT64              ShrinkCount;
+   } GrabQueueStruct;
+
+void GrabQueueInit(GrabQueueStruct* QueuePtr, MIL_INT64 MemoryBudget,
+                   MIL_DOUBLE LatencyTolerance);
+void GrabQueueShareBudget(GrabQueueStruct* QueuePtr, GrabBudgetStruct* BudgetPtr);
+void GrabQueueCharge(GrabQueueStruct* QueuePtr, MIL_INT64 Bytes);
+MIL_INT64 GrabQueueOverBudget(const GrabQueueStruct* QueuePtr, MIL_INT64 Bytes);
+MIL_INT GrabQueueInitialSize(GrabQueueStruct* QueuePtr, MIL_INT64 BufferBytes,
+                             MIL_INT64 DisplayBytes, MIL_DOUBLE FrameRate);
+MIL_INT GrabQueueFitBudget(GrabQueueStruct* QueuePtr, MIL_INT Size, MIL_INT64 BufferBytes,
+                           MIL_INT64 DisplayBytes);
+void GrabQueueBufferBusy(GrabQueueStruct* QueuePtr, MIL_INT BufferIndex);
+void GrabQueueBufferFree(GrabQueueStruct* QueuePtr, MIL_DOUBLE BusyTime);
+MIL_INT GrabQueueReview(GrabQueueStruct* QueuePtr, MIL_INT CurrentSize,
+                        MIL_INT64 BufferBytes, MIL_INT64 DisplayBytes);
+void GrabQueuePrintStatistics(GrabQueueStruct* QueuePtr);
+
+#endif /* GRAB_QUEUE_H */
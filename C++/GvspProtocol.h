@@ -0,0 +1,127 @@
+﻿/*************************************************************************************/
+/*
+ * File name: GvspProtocol.h
+ *
+ * Synopsis:  GigE Vision Streaming Protocol (GVSP) packet layout and the GenICam
+ *            pixel format (PFNC) codes used by the MulticastMonitor example.
+ *
+ *            Only the standard-ID (16-bit block ID) image payload is described,
+ *            which is what a multicast master streams by default.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef GVSP_PROTOCOL_H
+#define GVSP_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* IPv4 + UDP + GVSP header bytes included in the GigE Vision packet size. */
+#define GVSP_IP_UDP_HEADER_SIZE     28
+#define GVSP_HEADER_SIZE            8
+#define GVSP_PACKET_OVERHEAD        (GVSP_IP_UDP_HEADER_SIZE + GVSP_HEADER_SIZE)
+#define GVSP_PACKET_SIZE_MAX        9216
+
+/* Packet formats (low nibble of the format byte). */
+#define GVSP_FORMAT_LEADER          1
+#define GVSP_FORMAT_TRAILER         2
+#define GVSP_FORMAT_PAYLOAD         3
+
+/* Set in the format byte when the packet uses 64-bit block IDs (GVSP 2.0). */
+#define GVSP_FORMAT_EXTENDED_ID     0x80
+
+/* Payload types. */
+#define GVSP_PAYLOAD_TYPE_IMAGE     0x0001
+
+/* GenICam PFNC pixel formats. */
+#define PFNC_MONO8                  0x01080001
+#define PFNC_MONO10                 0x01100003
+#define PFNC_MONO10_PACKED          0x010C0004
+#define PFNC_MONO12                 0x01100005
+#define PFNC_MONO12_PACKED          0x010C0006
+#define PFNC_MONO16                 0x01100007
+#define PFNC_MONO10P                0x010A0046
+#define PFNC_MONO12P                0x010C0047
+#define PFNC_BAYER_GR8              0x01080008
+#define PFNC_BAYER_RG8              0x01080009
+#define PFNC_BAYER_GB8              0x0108000A
+#define PFNC_BAYER_BG8              0x0108000B
+#define PFNC_RGB8                   0x02180014
+#define PFNC_BGR8                   0x02180015
+#define PFNC_BGRA8                  0x02200017
+#define PFNC_YUV422_8               0x02100032
+
+/* Bits per pixel are encoded in bits 16..23 of every PFNC code. */
+#define PFNC_BITS_PER_PIXEL(Format) ((((uint32_t)(Format)) >> 16) & 0xFF)
+
+/* Number of bytes of a SizeX x SizeY frame in the given pixel format. */
+inline size_t GvspFrameBytes(uint32_t PixelFormat, uint32_t SizeX, uint32_t SizeY)
+   {
+   return ((size_t)SizeX * SizeY * PFNC_BITS_PER_PIXEL(PixelFormat) + 7) / 8;
+   }
+
+/* Common 8 bytes GVSP header, all fields in network byte order. */
+#pragma pack(push, 1)
+typedef struct
+   {
+   uint16_t Status;
+   uint16_t BlockId;
+   uint8_t  PacketFormat;
+   uint8_t  PacketId[3];
+   } GvspHeaderStruct;
+
+/* Image leader, follows the GVSP header. */
+typedef struct
+   {
+   uint16_t Reserved;
+   uint16_t PayloadType;
+   uint32_t TimestampHigh;
+   uint32_t TimestampLow;
+   uint32_t PixelFormat;
+   uint32_t SizeX;
+   uint32_t SizeY;
+   uint32_t OffsetX;
+   uint32_t OffsetY;
+   uint16_t PaddingX;
+   uint16_t PaddingY;
+   } GvspImageLeaderStruct;
+
+/* Image trailer, follows the GVSP header. */
+typedef struct
+   {
+   uint16_t Reserved;
+   uint16_t PayloadType;
+   uint32_t SizeY;
+   } GvspImageTrailerStruct;
+#pragma pack(pop)
+
+/* Bytes on the wire, IP and UDP headers included, of an image block sent in */
+/* packets of PacketSize bytes, and the number of packets.                  */
+inline size_t GvspBlockWireBytes(uint32_t PixelFormat, uint32_t SizeX, uint32_t SizeY,
+                                 size_t PacketSize, size_t* PacketCountPtr)
+   {
+   size_t FrameBytes   = GvspFrameBytes(PixelFormat, SizeX, SizeY);
+   size_t PayloadSize  = PacketSize - GVSP_PACKET_OVERHEAD;
+   size_t PacketCount  = (FrameBytes + PayloadSize - 1) / PayloadSize + 2;
+
+   *PacketCountPtr = PacketCount;
+   return FrameBytes + PacketCount * GVSP_PACKET_OVERHEAD +
+          sizeof(GvspImageLeaderStruct) + sizeof(GvspImageTrailerStruct);
+   }
+
+inline uint32_t GvspPacketId(const GvspHeaderStruct* HeaderPtr)
+   {
+   return ((uint32_t)HeaderPtr->PacketId[0] << 16) |
+          ((uint32_t)HeaderPtr->PacketId[1] << 8)  |
+           (uint32_t)HeaderPtr->PacketId[2];
+   }
+
+inline void GvspSetPacketId(GvspHeaderStruct* HeaderPtr, uint32_t PacketId)
+   {
+   HeaderPtr->PacketId[0] = (uint8_t)(PacketId >> 16);
+   HeaderPtr->PacketId[1] = (uint8_t)(PacketId >> 8);
+   HeaderPtr->PacketId[2] = (uint8_t)PacketId;
+   }
+
+#endif /* GVSP_PROTOCOL_H */
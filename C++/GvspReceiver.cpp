@@ -0,0 +1,765 @@
+﻿/*************************************************************************************/
+/*
+ * File name: GvspReceiver.cpp
+ *
+ * Synopsis:  Native GVSP receiver (Linux).
+ *
+ *            Before each recvmmsg call, every slot of the batch is given the packet
+ *            it should receive if the stream arrives in order: the rest of the
+ *            current block, its trailer, then the leader and the payload of the
+ *            next block in the next grab buffer. The payload iovecs of a slot point
+ *            into the grab buffer rows that packet covers, followed by a bounce
+ *            buffer for whatever does not fit. When a packet lands in a slot that
+ *            expected another one, its payload is first gathered into the bounce
+ *            buffer of the slot, for the whole batch, and only then copied to its
+ *            place, so that no misplaced payload overwrites another one.
+ *
+ *            A grab buffer still referenced by a worker or the display is never
+ *            written: the packets of a block whose buffer is in use when the
+ *            block starts only go to the bounce buffers, and the block is
+ *            skipped. The receive thread plays the role of the MdigProcess
+ *            hook: it calls ProcessFrame for each block completed.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#if !M_MIL_USE_WINDOWS
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <time.h>
+#endif
+#include <string.h>
+#include <string>
+#include "MulticastMonitor.h"
+
+#if !M_MIL_USE_WINDOWS
+
+static MIL_UINT32 MFTYPE ReceiverThread(void* ThreadContext);
+
+static MIL_DOUBLE ThreadCpuTime(void)
+   {
+   timespec Time;
+
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Time);
+   return Time.tv_sec + 1e-9 * Time.tv_nsec;
+   }
+
+/* Standard block IDs are 16 bits and skip 0 when they wrap around.          */
+/* -----------------------------------------------------------------------   */
+static MIL_INT64 NextBlockId(MIL_INT64 BlockId)
+   {
+   return BlockId % 0xFFFF + 1;
+   }
+
+static bool IsNewerBlock(MIL_INT64 BlockId, MIL_INT64 CurrentBlockId)
+   {
+   MIL_INT64 Distance = (BlockId - CurrentBlockId + 0xFFFF) % 0xFFFF;
+
+   return Distance > 0 && Distance < 0x8000;
+   }
+
+/* Opens the socket and joins the multicast group.                           */
+/* -----------------------------------------------------------------------   */
+GvspReceiverStruct* GvspReceiverAlloc(const MIL_STRING& MulticastAddress, MIL_INT UdpPort,
+                                      void* HookDataPtr)
+   {
+   std::string         Address(MulticastAddress.begin(), MulticastAddress.end());
+   GvspReceiverStruct* ReceiverPtr;
+   sockaddr_in         GroupAddress;
+   ip_mreq             Membership;
+   timeval             Timeout    = { 0, RECEIVER_POLL_PERIOD * 1000 };
+   int                 Reuse      = 1;
+   int                 BufferSize = RECEIVER_SOCKET_BUFFER;
+   socklen_t           OptionSize = sizeof(BufferSize);
+   int                 Socket     = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+   if(Socket < 0)
+      {
+      MosPrintf(MIL_TEXT("Native receiver: could not open a socket.\n"));
+      return M_NULL;
+      }
+
+   memset(&GroupAddress, 0, sizeof(GroupAddress));
+   GroupAddress.sin_family = AF_INET;
+   GroupAddress.sin_port   = htons((unsigned short)UdpPort);
+   if(inet_pton(AF_INET, Address.c_str(), &GroupAddress.sin_addr) != 1 ||
+      !IN_MULTICAST(ntohl(GroupAddress.sin_addr.s_addr)))
+      {
+      MosPrintf(MIL_TEXT("Native receiver: %s is not a multicast address.\n"),
+         MulticastAddress.c_str());
+      close(Socket);
+      return M_NULL;
+      }
+   Membership.imr_multiaddr        = GroupAddress.sin_addr;
+   Membership.imr_interface.s_addr = htonl(INADDR_ANY);
+
+   /* Other monitors of this host may receive the same stream. */
+   setsockopt(Socket, SOL_SOCKET, SO_REUSEADDR, &Reuse, sizeof(Reuse));
+
+   /* Absorb the stream while the hook runs. SO_RCVBUFFORCE goes beyond       */
+   /* net.core.rmem_max when the process is allowed to.                       */
+   if(setsockopt(Socket, SOL_SOCKET, SO_RCVBUFFORCE, &BufferSize, sizeof(BufferSize)) != 0)
+      setsockopt(Socket, SOL_SOCKET, SO_RCVBUF, &BufferSize, sizeof(BufferSize));
+   getsockopt(Socket, SOL_SOCKET, SO_RCVBUF, &BufferSize, &OptionSize);
+
+   /* Wake up periodically to check for stop requests. */
+   setsockopt(Socket, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+
+   /* Bound to the group address, to receive no other group on this port. */
+   if(bind(Socket, (const sockaddr*)&GroupAddress, sizeof(GroupAddress)) != 0 ||
+      setsockopt(Socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &Membership, sizeof(Membership)) != 0)
+      {
+      MosPrintf(MIL_TEXT("Native receiver: could not join %s:%lld.\n"),
+         MulticastAddress.c_str(), (long long)UdpPort);
+      close(Socket);
+      return M_NULL;
+      }
+
+   ReceiverPtr = new GvspReceiverStruct;
+   ReceiverPtr->Socket               = Socket;
+   ReceiverPtr->MulticastAddress     = MulticastAddress;
+   ReceiverPtr->UdpPort              = UdpPort;
+   ReceiverPtr->HookDataPtr          = HookDataPtr;
+   ReceiverPtr->NumaNode             = CPU_NODE_UNKNOWN;
+   ReceiverPtr->Thread               = M_NULL;
+   ReceiverPtr->StopRequested        = false;
+   ReceiverPtr->Block.BlockId        = 0;
+   ReceiverPtr->LastBlockId          = 0;
+   ReceiverPtr->NextPacketId         = 0;
+   ReceiverPtr->NextBufferIndex      = 0;
+   ReceiverPtr->PayloadSize          = 0;
+   ReceiverPtr->SizeX                = 0;
+   ReceiverPtr->SizeY                = 0;
+   ReceiverPtr->PixelFormat          = 0;
+   ReceiverPtr->BatchTime            = 0;
+   ReceiverPtr->CallCount            = 0;
+   ReceiverPtr->PacketCount          = 0;
+   ReceiverPtr->ByteCount            = 0;
+   ReceiverPtr->CopiedPacketCount    = 0;
+   ReceiverPtr->DiscardedPacketCount = 0;
+   ReceiverPtr->FrameCount           = 0;
+   ReceiverPtr->CorruptFrameCount    = 0;
+   ReceiverPtr->LatePacketCount      = 0;
+   ReceiverPtr->RunTime              = 0;
+   ReceiverPtr->CpuTime              = 0;
+
+   MosPrintf(MIL_TEXT("Native receiver joined %s:%lld (%d KB socket buffer).\n"),
+      MulticastAddress.c_str(), (long long)UdpPort, BufferSize / 1024);
+
+   return ReceiverPtr;
+   }
+
+void GvspReceiverFree(GvspReceiverStruct* ReceiverPtr)
+   {
+   if(!ReceiverPtr)
+      return;
+
+   GvspReceiverStop(ReceiverPtr);
+   close(ReceiverPtr->Socket);
+   delete ReceiverPtr;
+   }
+
+/* Starts receiving into the current grab buffers. Like MdigProcess, the    */
+/* first block goes to the first grab buffer.                                */
+/* -----------------------------------------------------------------------   */
+void GvspReceiverStart(GvspReceiverStruct* ReceiverPtr)
+   {
+   ReceiverPtr->StopRequested = false;
+   MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, &ReceiverThread, ReceiverPtr,
+      &ReceiverPtr->Thread);
+   }
+
+void GvspReceiverStop(GvspReceiverStruct* ReceiverPtr)
+   {
+   if(ReceiverPtr->Thread == M_NULL)
+      return;
+
+   ReceiverPtr->StopRequested = true;
+   MthrWait(ReceiverPtr->Thread, M_THREAD_END_WAIT, M_NULL);
+   MthrFree(ReceiverPtr->Thread);
+   ReceiverPtr->Thread = M_NULL;
+   }
+
+/* Placement of a frame of the given format in a grab buffer.                */
+/* -----------------------------------------------------------------------   */
+static void GetLayout(const GvspReceiverStruct* ReceiverPtr, MIL_INT BufferIndex,
+                      MIL_INT SizeX, MIL_INT SizeY, MIL_INT PixelFormat,
+                      ReceiverLayoutStruct* LayoutPtr)
+   {
+   MIL_INT64 RowBits    = (MIL_INT64)SizeX * PFNC_BITS_PER_PIXEL(PixelFormat);
+   MIL_INT64 FrameBytes = (MIL_INT64)GvspFrameBytes((uint32_t)PixelFormat, (uint32_t)SizeX,
+                                                    (uint32_t)SizeY);
+   MIL_INT   Pitch      = ReceiverPtr->BufferPitch[BufferIndex];
+   MIL_INT   Rows       = ReceiverPtr->BufferRows[BufferIndex];
+
+   const HookDataStruct* HookDataPtr = (const HookDataStruct*)ReceiverPtr->HookDataPtr;
+
+   /* A buffer still referenced gets no rows: its packets go nowhere. */
+   LayoutPtr->Address = HookDataPtr->BufferRefCount[BufferIndex].load(std::memory_order_acquire) ?
+                        M_NULL : ReceiverPtr->BufferAddress[BufferIndex];
+   if(RowBits % 8 == 0)
+      {
+      LayoutPtr->RowBytes = (MIL_INT)(RowBits / 8);
+      LayoutPtr->RowPitch = Pitch;
+      LayoutPtr->RowCount = LayoutPtr->RowBytes > Pitch ? 0 : (SizeY < Rows ? SizeY : Rows);
+      }
+   else
+      {
+      /* Rows do not end on a byte boundary: the frame is kept contiguous. */
+      LayoutPtr->RowBytes = (MIL_INT)FrameBytes;
+      LayoutPtr->RowPitch = (MIL_INT)FrameBytes;
+      LayoutPtr->RowCount = FrameBytes <= (MIL_INT64)Pitch * Rows ? 1 : 0;
+      }
+   if(LayoutPtr->Address == M_NULL || LayoutPtr->RowBytes == 0)
+      LayoutPtr->RowCount = 0;
+   }
+
+/* Builds the iovecs placing the wire bytes [Offset, Offset + Size) of a     */
+/* frame into the rows of its grab buffer. Returns the number of iovecs; the */
+/* bytes they cover are returned in CoveredPtr.                              */
+/* -----------------------------------------------------------------------   */
+static MIL_INT MapPayload(const ReceiverLayoutStruct* LayoutPtr, MIL_INT64 Offset,
+                          MIL_INT Size, iovec* IovPtr, MIL_INT IovMax, MIL_INT* CoveredPtr)
+   {
+   MIL_INT Count = 0;
+
+   *CoveredPtr = 0;
+   while(Size > 0 && LayoutPtr->RowCount > 0)
+      {
+      MIL_INT64  Row    = Offset / LayoutPtr->RowBytes;
+      MIL_INT    Column = (MIL_INT)(Offset % LayoutPtr->RowBytes);
+      MIL_INT    Length = LayoutPtr->RowBytes - Column < Size ? LayoutPtr->RowBytes - Column : Size;
+      MIL_UINT8* Address;
+
+      if(Row >= LayoutPtr->RowCount)
+         break;
+
+      Address = LayoutPtr->Address + Row * LayoutPtr->RowPitch + Column;
+      if(Count > 0 && (MIL_UINT8*)IovPtr[Count - 1].iov_base + IovPtr[Count - 1].iov_len == Address)
+         IovPtr[Count - 1].iov_len += Length;
+      else if(Count < IovMax)
+         {
+         IovPtr[Count].iov_base = Address;
+         IovPtr[Count].iov_len  = (size_t)Length;
+         Count++;
+         }
+      else
+         break;
+
+      Offset      += Length;
+      Size        -= Length;
+      *CoveredPtr += Length;
+      }
+   return Count;
+   }
+
+/* Copies payload bytes to their place in the grab buffer.                   */
+/* -----------------------------------------------------------------------   */
+static void CopyPayload(const ReceiverLayoutStruct* LayoutPtr, MIL_INT64 Offset,
+                        const MIL_UINT8* DataPtr, MIL_INT Size)
+   {
+   iovec   Segments[RECEIVER_IOV_MAX];
+   MIL_INT Covered;
+
+   while(Size > 0)
+      {
+      MIL_INT Count = MapPayload(LayoutPtr, Offset, Size, Segments, RECEIVER_IOV_MAX, &Covered);
+
+      if(Covered == 0)
+         return;
+      for(MIL_INT i = 0; i < Count; i++)
+         {
+         memcpy(Segments[i].iov_base, DataPtr, Segments[i].iov_len);
+         DataPtr += Segments[i].iov_len;
+         }
+      Offset += Covered;
+      Size   -= Covered;
+      }
+   }
+
+/* Sets the data format of the block being reassembled.                      */
+/* -----------------------------------------------------------------------   */
+static void SetBlockFormat(GvspReceiverStruct* ReceiverPtr, MIL_INT SizeX, MIL_INT SizeY,
+                           MIL_INT PixelFormat)
+   {
+   ReceiverBlockStruct* BlockPtr = &ReceiverPtr->Block;
+
+   BlockPtr->SizeX       = SizeX;
+   BlockPtr->SizeY       = SizeY;
+   BlockPtr->PixelFormat = PixelFormat;
+   BlockPtr->FrameBytes  = (MIL_INT64)GvspFrameBytes((uint32_t)PixelFormat, (uint32_t)SizeX,
+                                                     (uint32_t)SizeY);
+   BlockPtr->PacketCount = ReceiverPtr->PayloadSize > 0 ?
+      (MIL_INT)((BlockPtr->FrameBytes + ReceiverPtr->PayloadSize - 1) / ReceiverPtr->PayloadSize) : 0;
+   GetLayout(ReceiverPtr, BlockPtr->BufferIndex, SizeX, SizeY, PixelFormat, &BlockPtr->Layout);
+   if(BlockPtr->Skipped)
+      BlockPtr->Layout.RowCount = 0;
+
+   if(BlockPtr->ReceivedCount > 0)
+      BlockPtr->LayoutChanged = true;
+   BlockPtr->ReceivedCount   = 0;
+   BlockPtr->HighestPacketId = 0;
+   BlockPtr->Received.assign((size_t)(BlockPtr->PacketCount + 63) / 64, 0);
+   BlockPtr->HoleTime.resize((size_t)BlockPtr->PacketCount + 1);
+   }
+
+static void StartBlock(GvspReceiverStruct* ReceiverPtr, MIL_INT64 BlockId)
+   {
+   ReceiverBlockStruct* BlockPtr = &ReceiverPtr->Block;
+
+   BlockPtr->BlockId         = BlockId;
+   BlockPtr->BufferIndex     = ReceiverPtr->NextBufferIndex;
+   BlockPtr->ReceivedCount   = 0;
+   BlockPtr->LeaderReceived  = false;
+   BlockPtr->LayoutChanged   = false;
+   BlockPtr->DeviceTimestamp = 0;
+   BlockPtr->Skipped         = !GrabBufferFree((HookDataStruct*)ReceiverPtr->HookDataPtr,
+                                               BlockPtr->BufferIndex);
+   SetBlockFormat(ReceiverPtr, ReceiverPtr->SizeX, ReceiverPtr->SizeY, ReceiverPtr->PixelFormat);
+   ReceiverPtr->NextPacketId = 0;
+   }
+
+/* Hands the block over to the processing, as the MdigProcess hook would.   */
+/* -----------------------------------------------------------------------   */
+static void CompleteBlock(GvspReceiverStruct* ReceiverPtr)
+   {
+   HookDataStruct*      HookDataPtr = (HookDataStruct*)ReceiverPtr->HookDataPtr;
+   ReceiverBlockStruct* BlockPtr    = &ReceiverPtr->Block;
+   FrameInfoStruct      FrameInfo;
+   bool                 IsCorrupt   = !BlockPtr->LeaderReceived || BlockPtr->LayoutChanged ||
+                                      BlockPtr->PacketCount == 0 ||
+                                      BlockPtr->ReceivedCount < BlockPtr->PacketCount;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &FrameInfo.HookEntryTime);
+   FrameInfo.BufferIndex      = BlockPtr->BufferIndex;
+   FrameInfo.BufferId         = HookDataPtr->MilGrabBufferList[BlockPtr->BufferIndex];
+   FrameInfo.IsFrameCorrupt   = IsCorrupt ? M_TRUE : M_FALSE;
+   FrameInfo.FrameSizeX       = BlockPtr->SizeX;
+   FrameInfo.FrameSizeY       = BlockPtr->SizeY;
+   FrameInfo.FramePixelFormat = BlockPtr->PixelFormat;
+   FrameInfo.FramePacketSize  = ReceiverPtr->PayloadSize + GVSP_PACKET_OVERHEAD;
+   FrameInfo.DeviceTimestamp  = BlockPtr->DeviceTimestamp / DEVICE_TIMESTAMP_FREQUENCY;
+   FrameInfo.BlockId          = BlockPtr->BlockId;
+   FrameInfo.ReceivedPackets    = BlockPtr->PacketCount > 0 ? &BlockPtr->Received[0] : M_NULL;
+   FrameInfo.PayloadPacketCount = BlockPtr->PacketCount;
+
+   ReceiverPtr->LastBlockId     = BlockPtr->BlockId;
+   ReceiverPtr->NextBufferIndex = (BlockPtr->BufferIndex + 1) %
+                                  (MIL_INT)ReceiverPtr->BufferAddress.size();
+   BlockPtr->BlockId            = 0;
+   if(BlockPtr->Skipped)
+      {
+      HookDataPtr->GrabQueue.SkipCount.fetch_add(1, std::memory_order_relaxed);
+      return;
+      }
+
+   ReceiverPtr->FrameCount++;
+   if(IsCorrupt)
+      ReceiverPtr->CorruptFrameCount++;
+   ProcessFrame(HookDataPtr, &FrameInfo);
+   }
+
+/* Gives each slot of the batch the packet it should receive next.          */
+/* -----------------------------------------------------------------------   */
+static void PredictBatch(GvspReceiverStruct* ReceiverPtr, mmsghdr* MessagesPtr,
+                         iovec (*IovecsPtr)[RECEIVER_IOV_MAX])
+   {
+   const ReceiverBlockStruct* BlockPtr = &ReceiverPtr->Block;
+   MIL_INT              BufferCount = (MIL_INT)ReceiverPtr->BufferAddress.size();
+   MIL_INT64            BlockId     = 0;
+   MIL_INT              PacketId    = 0;
+   MIL_INT              BufferIndex = 0;
+   MIL_INT64            FrameBytes  = 0;
+   MIL_INT              PacketCount = 0;
+   MIL_INT              BlocksAhead = 0;
+   ReceiverLayoutStruct Layout      = { M_NULL, 0, 0, 0 };
+
+   /* The rest of the current block, or the block after the last one. */
+   if(BlockPtr->BlockId)
+      {
+      BlockId     = BlockPtr->BlockId;
+      PacketId    = ReceiverPtr->NextPacketId;
+      BufferIndex = BlockPtr->BufferIndex;
+      FrameBytes  = BlockPtr->FrameBytes;
+      PacketCount = BlockPtr->PacketCount;
+      Layout      = BlockPtr->Layout;
+      }
+   else if(ReceiverPtr->LastBlockId && ReceiverPtr->PayloadSize > 0)
+      {
+      BlockId     = NextBlockId(ReceiverPtr->LastBlockId);
+      BufferIndex = ReceiverPtr->NextBufferIndex;
+      FrameBytes  = (MIL_INT64)GvspFrameBytes((uint32_t)ReceiverPtr->PixelFormat,
+                                              (uint32_t)ReceiverPtr->SizeX,
+                                              (uint32_t)ReceiverPtr->SizeY);
+      PacketCount = (MIL_INT)((FrameBytes + ReceiverPtr->PayloadSize - 1) /
+                              ReceiverPtr->PayloadSize);
+      GetLayout(ReceiverPtr, BufferIndex, ReceiverPtr->SizeX, ReceiverPtr->SizeY,
+                ReceiverPtr->PixelFormat, &Layout);
+      }
+
+   for(MIL_INT k = 0; k < RECEIVER_BATCH_SIZE; k++)
+      {
+      ReceiverSlotStruct* SlotPtr  = &ReceiverPtr->Slots[k];
+      iovec*              IovPtr   = IovecsPtr[k];
+      MIL_INT             IovCount = 1;
+
+      IovPtr[0].iov_base   = ReceiverPtr->Headers[k];
+      IovPtr[0].iov_len    = GVSP_HEADER_SIZE;
+      SlotPtr->BlockId     = BlockId;
+      SlotPtr->PacketId    = PacketId;
+      SlotPtr->BufferBytes = 0;
+      if(BlockId && PacketId >= 1 && PacketId <= PacketCount)
+         {
+         MIL_INT64 Offset = (MIL_INT64)(PacketId - 1) * ReceiverPtr->PayloadSize;
+         MIL_INT   Size   = FrameBytes - Offset < ReceiverPtr->PayloadSize ?
+                            (MIL_INT)(FrameBytes - Offset) : ReceiverPtr->PayloadSize;
+
+         IovCount += MapPayload(&Layout, Offset, Size, &IovPtr[1], RECEIVER_IOV_MAX - 2,
+                                &SlotPtr->BufferBytes);
+         }
+      SlotPtr->InBuffer    = SlotPtr->BufferBytes > 0;
+      SlotPtr->Layout      = Layout;
+      SlotPtr->PayloadSize = ReceiverPtr->PayloadSize;
+      IovPtr[IovCount].iov_base = ReceiverPtr->Bounce[k];
+      IovPtr[IovCount].iov_len  = GVSP_PACKET_SIZE_MAX - GVSP_HEADER_SIZE - SlotPtr->BufferBytes;
+      IovCount++;
+
+      memset(&MessagesPtr[k], 0, sizeof(MessagesPtr[k]));
+      MessagesPtr[k].msg_hdr.msg_iov    = IovPtr;
+      MessagesPtr[k].msg_hdr.msg_iovlen = (size_t)IovCount;
+
+      /* Then the trailer, and the next block in the next grab buffer. Only  */
+      /* the next one: the grab buffers further ahead may still be in use.   */
+      if(BlockId == 0 || PacketCount == 0)
+         BlockId = 0;
+      else if(PacketId <= PacketCount)
+         PacketId++;
+      else if(++BlocksAhead < 2 && BufferCount > GRAB_GUARD_DISTANCE)
+         {
+         BlockId     = NextBlockId(BlockId);
+         PacketId    = 0;
+         BufferIndex = (BufferIndex + 1) % BufferCount;
+         GetLayout(ReceiverPtr, BufferIndex, ReceiverPtr->SizeX, ReceiverPtr->SizeY,
+                   ReceiverPtr->PixelFormat, &Layout);
+         FrameBytes  = (MIL_INT64)GvspFrameBytes((uint32_t)ReceiverPtr->PixelFormat,
+                                                 (uint32_t)ReceiverPtr->SizeX,
+                                                 (uint32_t)ReceiverPtr->SizeY);
+         PacketCount = (MIL_INT)((FrameBytes + ReceiverPtr->PayloadSize - 1) /
+                                 ReceiverPtr->PayloadSize);
+         }
+      else
+         BlockId = 0;
+      }
+   }
+
+/* Payload size of a packet of the current block at the current payload   */
+/* size, 0 if the packet is beyond the block.                               */
+/* -----------------------------------------------------------------------   */
+static MIL_INT PacketBodySize(const GvspReceiverStruct* ReceiverPtr, MIL_INT PacketId)
+   {
+   const ReceiverBlockStruct* BlockPtr = &ReceiverPtr->Block;
+   MIL_INT64                  Offset   = (MIL_INT64)(PacketId - 1) * ReceiverPtr->PayloadSize;
+
+   if(PacketId < 1 || PacketId > BlockPtr->PacketCount)
+      return 0;
+   return BlockPtr->FrameBytes - Offset < ReceiverPtr->PayloadSize ?
+          (MIL_INT)(BlockPtr->FrameBytes - Offset) : ReceiverPtr->PayloadSize;
+   }
+
+static bool SameLayout(const ReceiverLayoutStruct* Layout1Ptr,
+                       const ReceiverLayoutStruct* Layout2Ptr)
+   {
+   return Layout1Ptr->Address  == Layout2Ptr->Address  &&
+          Layout1Ptr->RowBytes == Layout2Ptr->RowBytes &&
+          Layout1Ptr->RowPitch == Layout2Ptr->RowPitch &&
+          Layout1Ptr->RowCount == Layout2Ptr->RowCount;
+   }
+
+/* Processes one packet. BodyPtr is the payload in the bounce buffer; the   */
+/* first InPlaceBytes bytes of it were received in place, in the grab      */
+/* buffer, as predicted by SlotPtr.                                          */
+/* -----------------------------------------------------------------------   */
+static void HandlePacket(GvspReceiverStruct* ReceiverPtr, const GvspHeaderStruct* HeaderPtr,
+                         const MIL_UINT8* BodyPtr, MIL_INT BodySize,
+                         const ReceiverSlotStruct* SlotPtr)
+   {
+   MIL_INT              InPlaceBytes = SlotPtr ? SlotPtr->BufferBytes : 0;
+   ReceiverBlockStruct* BlockPtr     = &ReceiverPtr->Block;
+   MIL_INT64            BlockId      = ntohs(HeaderPtr->BlockId);
+   MIL_INT              Format       = HeaderPtr->PacketFormat & 0x0F;
+   MIL_INT              PacketId     = (MIL_INT)GvspPacketId(HeaderPtr);
+
+   if((HeaderPtr->PacketFormat & GVSP_FORMAT_EXTENDED_ID) || BlockId == 0)
+      {
+      ReceiverPtr->DiscardedPacketCount++;
+      return;
+      }
+
+   if(BlockPtr->BlockId != BlockId)
+      {
+      /* A late packet of a block already delivered, unless it is a leader:  */
+      /* the device may have restarted its block IDs.                         */
+      MIL_INT64 CurrentBlockId = BlockPtr->BlockId ? BlockPtr->BlockId : ReceiverPtr->LastBlockId;
+
+      if(Format != GVSP_FORMAT_LEADER && CurrentBlockId &&
+         !IsNewerBlock(BlockId, CurrentBlockId))
+         {
+         ReceiverPtr->DiscardedPacketCount++;
+         return;
+         }
+
+      /* The trailer of the current block was lost. */
+      if(BlockPtr->BlockId)
+         CompleteBlock(ReceiverPtr);
+      StartBlock(ReceiverPtr, BlockId);
+      }
+
+   switch(Format)
+      {
+      case GVSP_FORMAT_LEADER:
+         {
+         const GvspImageLeaderStruct* LeaderPtr = (const GvspImageLeaderStruct*)BodyPtr;
+         MIL_INT SizeX, SizeY, PixelFormat;
+
+         if(BodySize < (MIL_INT)sizeof(GvspImageLeaderStruct) ||
+            ntohs(LeaderPtr->PayloadType) != GVSP_PAYLOAD_TYPE_IMAGE)
+            {
+            ReceiverPtr->DiscardedPacketCount++;
+            return;
+            }
+         SizeX       = (MIL_INT)ntohl(LeaderPtr->SizeX);
+         SizeY       = (MIL_INT)ntohl(LeaderPtr->SizeY);
+         PixelFormat = (MIL_INT)ntohl(LeaderPtr->PixelFormat);
+         if(SizeX != BlockPtr->SizeX || SizeY != BlockPtr->SizeY ||
+            PixelFormat != BlockPtr->PixelFormat)
+            SetBlockFormat(ReceiverPtr, SizeX, SizeY, PixelFormat);
+         ReceiverPtr->SizeX          = SizeX;
+         ReceiverPtr->SizeY          = SizeY;
+         ReceiverPtr->PixelFormat    = PixelFormat;
+         BlockPtr->DeviceTimestamp   = ((MIL_UINT64)ntohl(LeaderPtr->TimestampHigh) << 32) |
+                                       ntohl(LeaderPtr->TimestampLow);
+         BlockPtr->LeaderReceived    = true;
+         }
+         break;
+
+      case GVSP_FORMAT_PAYLOAD:
+         /* All the payload packets of a block but the last have the payload */
+         /* size. A packet of another size that is not the last of the block  */
+         /* gives the new packet size of the device, larger or smaller.       */
+         if(PacketId >= 1 && BodySize != PacketBodySize(ReceiverPtr, PacketId) &&
+            (BlockPtr->FrameBytes == 0 || (MIL_INT64)PacketId * BodySize < BlockPtr->FrameBytes))
+            {
+            ReceiverPtr->PayloadSize = BodySize;
+            SetBlockFormat(ReceiverPtr, BlockPtr->SizeX, BlockPtr->SizeY, BlockPtr->PixelFormat);
+            }
+         if(PacketId < 1 || PacketId > BlockPtr->PacketCount)
+            {
+            ReceiverPtr->DiscardedPacketCount++;
+            return;
+            }
+         if(SlotPtr && (SlotPtr->PayloadSize != ReceiverPtr->PayloadSize ||
+                        !SameLayout(&SlotPtr->Layout, &BlockPtr->Layout)))
+            {
+            /* Placed for a data format the leader of the block changed. */
+            BlockPtr->LayoutChanged = true;
+            break;
+            }
+         if(!SlotPtr)
+            ReceiverPtr->CopiedPacketCount++;
+
+         /* The part beyond the iovecs of the slot went to its bounce buffer. */
+         if(BodySize > InPlaceBytes)
+            CopyPayload(&BlockPtr->Layout,
+                        (MIL_INT64)(PacketId - 1) * ReceiverPtr->PayloadSize + InPlaceBytes,
+                        BodyPtr, BodySize - InPlaceBytes);
+         if(!(BlockPtr->Received[(PacketId - 1) / 64] & (1ULL << ((PacketId - 1) % 64))))
+            {
+            BlockPtr->Received[(PacketId - 1) / 64] |= 1ULL << ((PacketId - 1) % 64);
+            BlockPtr->ReceivedCount++;
+
+            /* A packet behind the highest one received fills a hole; one  */
+            /* beyond it opens the holes in between.                        */
+            if(PacketId < BlockPtr->HighestPacketId)
+               {
+               ReceiverPtr->LatePacketCount++;
+               FrameStatsLatePacket(((HookDataStruct*)ReceiverPtr->HookDataPtr)->Stats,
+                                    ReceiverPtr->BatchTime - BlockPtr->HoleTime[PacketId]);
+               }
+            else
+               {
+               for(MIL_INT Hole = BlockPtr->HighestPacketId + 1; Hole < PacketId; Hole++)
+                  BlockPtr->HoleTime[Hole] = ReceiverPtr->BatchTime;
+               BlockPtr->HighestPacketId = PacketId;
+               }
+            }
+         break;
+
+      case GVSP_FORMAT_TRAILER:
+         CompleteBlock(ReceiverPtr);
+         return;
+
+      default:
+         ReceiverPtr->DiscardedPacketCount++;
+         return;
+      }
+
+   ReceiverPtr->NextPacketId = PacketId + 1;
+   }
+
+/* Processes the packets of a batch.                                         */
+/* -----------------------------------------------------------------------   */
+static void ProcessBatch(GvspReceiverStruct* ReceiverPtr, const mmsghdr* MessagesPtr,
+                         MIL_INT Count)
+   {
+   bool InPlace[RECEIVER_BATCH_SIZE];
+
+   /* Gather the payloads that did not land where expected before anything */
+   /* is copied into the grab buffers.                                       */
+   for(MIL_INT k = 0; k < Count; k++)
+      {
+      const GvspHeaderStruct*   HeaderPtr = (const GvspHeaderStruct*)ReceiverPtr->Headers[k];
+      const ReceiverSlotStruct* SlotPtr   = &ReceiverPtr->Slots[k];
+      MIL_INT                   BodySize  = (MIL_INT)MessagesPtr[k].msg_len - GVSP_HEADER_SIZE;
+
+      ReceiverPtr->PacketCount++;
+      ReceiverPtr->ByteCount += MessagesPtr[k].msg_len + GVSP_IP_UDP_HEADER_SIZE;
+
+      InPlace[k] = BodySize >= 0 && SlotPtr->InBuffer &&
+                   (HeaderPtr->PacketFormat & 0x0F) == GVSP_FORMAT_PAYLOAD &&
+                   !(HeaderPtr->PacketFormat & GVSP_FORMAT_EXTENDED_ID) &&
+                   ntohs(HeaderPtr->BlockId) == SlotPtr->BlockId &&
+                   (MIL_INT)GvspPacketId(HeaderPtr) == SlotPtr->PacketId;
+
+      if(!InPlace[k] && BodySize > 0 && SlotPtr->BufferBytes > 0)
+         {
+         const iovec* IovPtr     = MessagesPtr[k].msg_hdr.msg_iov;
+         MIL_INT      InBuffer   = BodySize < SlotPtr->BufferBytes ? BodySize : SlotPtr->BufferBytes;
+         MIL_UINT8*   BouncePtr  = ReceiverPtr->Bounce[k];
+
+         memmove(BouncePtr + InBuffer, BouncePtr, (size_t)(BodySize - InBuffer));
+         for(MIL_INT i = 1; InBuffer > 0; i++)
+            {
+            size_t Length = IovPtr[i].iov_len < (size_t)InBuffer ? IovPtr[i].iov_len : (size_t)InBuffer;
+            memcpy(BouncePtr, IovPtr[i].iov_base, Length);
+            BouncePtr += Length;
+            InBuffer  -= (MIL_INT)Length;
+            }
+         }
+      }
+
+   for(MIL_INT k = 0; k < Count; k++)
+      {
+      const GvspHeaderStruct* HeaderPtr = (const GvspHeaderStruct*)ReceiverPtr->Headers[k];
+      MIL_INT                 BodySize  = (MIL_INT)MessagesPtr[k].msg_len - GVSP_HEADER_SIZE;
+
+      if(BodySize < 0)
+         {
+         ReceiverPtr->DiscardedPacketCount++;
+         continue;
+         }
+      HandlePacket(ReceiverPtr, HeaderPtr, ReceiverPtr->Bounce[k], BodySize,
+                   InPlace[k] ? &ReceiverPtr->Slots[k] : M_NULL);
+      }
+   }
+
+/* Receive thread.                                                           */
+/* -----------------------------------------------------------------------   */
+static MIL_UINT32 MFTYPE ReceiverThread(void* ThreadContext)
+   {
+   GvspReceiverStruct* ReceiverPtr = (GvspReceiverStruct*)ThreadContext;
+   HookDataStruct*     HookDataPtr = (HookDataStruct*)ReceiverPtr->HookDataPtr;
+   MIL_INT             BufferCount = HookDataPtr->MilGrabBufferListSize;
+   MIL_DOUBLE          StartTime, EndTime;
+   MIL_DOUBLE          CpuStartTime = ThreadCpuTime();
+   mmsghdr             Messages[RECEIVER_BATCH_SIZE];
+   iovec               Iovecs[RECEIVER_BATCH_SIZE][RECEIVER_IOV_MAX];
+
+   /* Receive on the node of the NIC, as the workers of the stream. */
+   if(ReceiverPtr->NumaNode != CPU_NODE_UNKNOWN)
+      CpuTopologyBindThread(ReceiverPtr->NumaNode);
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &StartTime);
+
+   /* Host addresses of the grab buffers. */
+   ReceiverPtr->BufferAddress.assign((size_t)BufferCount, M_NULL);
+   ReceiverPtr->BufferPitch.assign((size_t)BufferCount, 0);
+   ReceiverPtr->BufferRows.assign((size_t)BufferCount, 0);
+   for(MIL_INT i = 0; i < BufferCount; i++)
+      {
+      MIL_ID BufferId = HookDataPtr->MilGrabBufferList[i];
+
+      MbufInquire(BufferId, M_HOST_ADDRESS, &ReceiverPtr->BufferAddress[i]);
+      ReceiverPtr->BufferPitch[i] = MbufInquire(BufferId, M_PITCH_BYTE, M_NULL);
+      ReceiverPtr->BufferRows[i]  = MbufInquire(BufferId, M_SIZE_Y, M_NULL);
+      }
+
+   /* Blocks in progress were abandoned when the receiver stopped. */
+   ReceiverPtr->Block.BlockId   = 0;
+   ReceiverPtr->LastBlockId     = 0;
+   ReceiverPtr->NextBufferIndex = 0;
+   ReceiverPtr->SizeX           = HookDataPtr->FrameSizeX;
+   ReceiverPtr->SizeY           = HookDataPtr->FrameSizeY;
+   ReceiverPtr->PixelFormat     = HookDataPtr->FramePixelFormat;
+
+   while(!ReceiverPtr->StopRequested && BufferCount > 0)
+      {
+      int Count;
+
+      PredictBatch(ReceiverPtr, Messages, Iovecs);
+      Count = recvmmsg(ReceiverPtr->Socket, Messages, RECEIVER_BATCH_SIZE, MSG_WAITFORONE,
+                       M_NULL);
+      if(Count <= 0)
+         continue;
+
+      ReceiverPtr->CallCount++;
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &ReceiverPtr->BatchTime);
+      ProcessBatch(ReceiverPtr, Messages, Count);
+      }
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &EndTime);
+   ReceiverPtr->RunTime += EndTime - StartTime;
+   ReceiverPtr->CpuTime += ThreadCpuTime() - CpuStartTime;
+   return 0;
+   }
+
+void GvspReceiverPrintStatistics(GvspReceiverStruct* ReceiverPtr)
+   {
+   MIL_DOUBLE RunTime = ReceiverPtr->RunTime > 0 ? ReceiverPtr->RunTime : 1;
+   MIL_DOUBLE Gbits   = 8e-9 * ReceiverPtr->ByteCount;
+
+   MosPrintf(MIL_TEXT("\nNative receiver:\n"));
+   MosPrintf(MIL_TEXT("  Packets:                 %lld in %lld calls (%.1f per call), ")
+             MIL_TEXT("%.0f packets/s, %.3f Gbit/s\n"),
+      (long long)ReceiverPtr->PacketCount, (long long)ReceiverPtr->CallCount,
+      ReceiverPtr->CallCount ? (MIL_DOUBLE)ReceiverPtr->PacketCount / ReceiverPtr->CallCount : 0,
+      ReceiverPtr->PacketCount / RunTime, Gbits / RunTime);
+   MosPrintf(MIL_TEXT("  Copied out of order:     %lld packets (%.2f%%), %lld discarded\n"),
+      (long long)ReceiverPtr->CopiedPacketCount,
+      ReceiverPtr->PacketCount ? 100.0 * ReceiverPtr->CopiedPacketCount / ReceiverPtr->PacketCount : 0,
+      (long long)ReceiverPtr->DiscardedPacketCount);
+   MosPrintf(MIL_TEXT("  Late (resent/reordered): %lld packets\n"),
+      (long long)ReceiverPtr->LatePacketCount);
+   MosPrintf(MIL_TEXT("  Frames:                  %lld (%lld corrupt)\n"),
+      (long long)ReceiverPtr->FrameCount, (long long)ReceiverPtr->CorruptFrameCount);
+   MosPrintf(MIL_TEXT("  Receive thread CPU:      %.1f%%, %.3f CPU sec per Gbit\n"),
+      100.0 * ReceiverPtr->CpuTime / RunTime, Gbits > 0 ? ReceiverPtr->CpuTime / Gbits : 0);
+   }
+
+#else
+
+GvspReceiverStruct* GvspReceiverAlloc(const MIL_STRING& MulticastAddress, MIL_INT UdpPort,
+                                      void* HookDataPtr)
+   {
+   MosPrintf(MIL_TEXT("The native receiver is only available on Linux.\n"));
+   return M_NULL;
+   }
+
+void GvspReceiverFree(GvspReceiverStruct* ReceiverPtr) {}
+void GvspReceiverStart(GvspReceiverStruct* ReceiverPtr) {}
+void GvspReceiverStop(GvspReceiverStruct* ReceiverPtr) {}
+void GvspReceiverPrintStatistics(GvspReceiverStruct* ReceiverPtr) {}
+
+#endif
@@ -0,0 +1,127 @@
+﻿/*************************************************************************************/
+/*
+ * File name: GvspReceiver.h
+ *
+ * Synopsis:  Native GVSP receiver (Linux). Joins the multicast group of the stream
+ *            and receives the GVSP packets in batches with recvmmsg, instead of
+ *            going through the MIL monitor digitizer.
+ *
+ *            Each packet is scattered by the socket layer: its GVSP header goes
+ *            to a scratch area and its payload straight to where the packet is
+ *            expected to go in the grab buffer, row by row. Only the packets that
+ *            do not arrive in the predicted order are copied.
+ *
+ *            The frames are delivered in the wire layout: the packed pixel formats
+ *            are left packed at the start of each row of the grab buffer.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef GVSP_RECEIVER_H
+#define GVSP_RECEIVER_H
+
+#include <mil.h>
+#include <atomic>
+#include <vector>
+#include "GvspProtocol.h"
+
+#define RECEIVER_BATCH_SIZE       64          /* Packets per recvmmsg call.              */
+#define RECEIVER_IOV_MAX          32          /* Header, buffer rows and overflow.       */
+#define RECEIVER_SOCKET_BUFFER    (64 << 20)  /* Requested socket receive buffer.        */
+#define RECEIVER_POLL_PERIOD      100         /* ms between stop request checks.         */
+
+/* Where the wire bytes of a block go in its grab buffer. */
+typedef struct
+   {
+   MIL_UINT8* Address;
+   MIL_INT    RowBytes;          /* Wire bytes per row.                                */
+   MIL_INT    RowPitch;          /* Buffer bytes per row.                              */
+   MIL_INT    RowCount;          /* Rows that fit in the buffer, 0 if it cannot hold   */
+                                 /* the frame.                                         */
+   } ReceiverLayoutStruct;
+
+/* Block being reassembled. */
+typedef struct
+   {
+   MIL_INT64            BlockId;          /* 0 when no block is in progress.           */
+   MIL_INT              BufferIndex;
+   MIL_INT              SizeX;
+   MIL_INT              SizeY;
+   MIL_INT              PixelFormat;
+   MIL_INT64            FrameBytes;
+   MIL_INT              PacketCount;      /* Payload packets, 0 until the payload size */
+                                          /* is known.                                 */
+   MIL_INT              ReceivedCount;
+   bool                 LeaderReceived;
+   bool                 LayoutChanged;    /* Packets placed before the leader moved    */
+                                          /* the block to another layout.              */
+   bool                 Skipped;          /* Its grab buffer was in use: received into */
+                                          /* the bounce buffers only, not delivered.   */
+   MIL_UINT64           DeviceTimestamp;
+   ReceiverLayoutStruct Layout;
+   std::vector<MIL_UINT64> Received;      /* Bit n set if packet n + 1 arrived.        */
+   MIL_INT              HighestPacketId;
+   std::vector<MIL_DOUBLE> HoleTime;      /* Batch time a missing packet was first     */
+                                          /* passed by a later one, by packet ID.      */
+   } ReceiverBlockStruct;
+
+/* Expected packet of a batch slot. */
+typedef struct
+   {
+   MIL_INT64 BlockId;
+   MIL_INT   PacketId;
+   bool      InBuffer;           /* The payload is scattered into the grab buffer.    */
+   MIL_INT   BufferBytes;        /* Payload bytes scattered into the grab buffer.     */
+   ReceiverLayoutStruct Layout;  /* Placement the iovecs were built for.              */
+   MIL_INT   PayloadSize;
+   } ReceiverSlotStruct;
+
+typedef struct
+   {
+   int                  Socket;
+   MIL_STRING           MulticastAddress;
+   MIL_INT              UdpPort;
+   void*                HookDataPtr;
+   MIL_INT              NumaNode;         /* Node the receive thread is bound to, */
+                                          /* CPU_NODE_UNKNOWN for none.           */
+   MIL_ID               Thread;
+   std::atomic<bool>    StopRequested;
+
+   /* Receive thread state. */
+   ReceiverBlockStruct  Block;
+   MIL_INT64            LastBlockId;      /* Last block delivered.                     */
+   MIL_INT              NextPacketId;
+   MIL_INT              NextBufferIndex;
+   MIL_INT              PayloadSize;      /* Of the packets of a block but the last.   */
+   MIL_INT              SizeX;            /* Data format of the last leader.           */
+   MIL_INT              SizeY;
+   MIL_INT              PixelFormat;
+   MIL_DOUBLE           BatchTime;        /* When the current batch was received.      */
+   std::vector<MIL_UINT8*> BufferAddress;
+   std::vector<MIL_INT>    BufferPitch;
+   std::vector<MIL_INT>    BufferRows;
+   ReceiverSlotStruct   Slots[RECEIVER_BATCH_SIZE];
+   MIL_UINT8            Headers[RECEIVER_BATCH_SIZE][GVSP_HEADER_SIZE];
+   MIL_UINT8            Bounce[RECEIVER_BATCH_SIZE][GVSP_PACKET_SIZE_MAX];
+
+   /* Statistics, written by the receive thread. */
+   MIL_INT64            CallCount;
+   MIL_INT64            PacketCount;
+   MIL_INT64            ByteCount;        /* IP and UDP headers included.              */
+   MIL_INT64            CopiedPacketCount;
+   MIL_INT64            DiscardedPacketCount;
+   MIL_INT64            LatePacketCount;  /* Filled a hole: resent or reordered.       */
+   MIL_INT64            FrameCount;
+   MIL_INT64            CorruptFrameCount;
+   MIL_DOUBLE           RunTime;
+   MIL_DOUBLE           CpuTime;
+   } GvspReceiverStruct;
+
+GvspReceiverStruct* GvspReceiverAlloc(const MIL_STRING& MulticastAddress, MIL_INT UdpPort,
+                                      void* HookDataPtr);
+void GvspReceiverFree(GvspReceiverStruct* ReceiverPtr);
+void GvspReceiverStart(GvspReceiverStruct* ReceiverPtr);
+void GvspReceiverStop(GvspReceiverStruct* ReceiverPtr);
+void GvspReceiverPrintStatistics(GvspReceiverStruct* ReceiverPtr);
+
+#endif /* GVSP_RECEIVER_H */
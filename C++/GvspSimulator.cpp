@@ -0,0 +1,348 @@
+﻿/*************************************************************************************/
+/*
+ * File name: GvspSimulator.cpp
+ *
+ * Synopsis:  Local GVSP stream simulator. A thread paces frames at the configured
+ *            rate and sends each one as a leader, a series of payload packets and a
+ *            trailer to the multicast group. The multicast TTL is 0 and loopback is
+ *            enabled, so the packets never leave the host.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+#include <mil.h>
+#if !M_MIL_USE_WINDOWS
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "GvspSimulator.h"
+
+#if M_MIL_USE_WINDOWS
+typedef SOCKET SimSocket;
+#define SIM_INVALID_SOCKET INVALID_SOCKET
+#define SimCloseSocket     closesocket
+#else
+typedef int SimSocket;
+#define SIM_INVALID_SOCKET (-1)
+#define SimCloseSocket     close
+#endif
+
+static MIL_UINT32 MFTYPE SimulatorThread(void* ThreadContext);
+static SimSocket OpenSenderSocket(const SimulatorConfigStruct* ConfigPtr,
+                                  sockaddr_in* DestinationPtr);
+
+/* Default simulated stream: the same 640x480 Mono8 the monitor DCF starts with. */
+/* -----------------------------------------------------------------------   */
+void SimulatorDefaultConfig(SimulatorConfigStruct* ConfigPtr)
+   {
+   ConfigPtr->MulticastAddress   = MIL_TEXT("239.255.0.1");
+   ConfigPtr->UdpPort            = 20202;
+   ConfigPtr->SizeX              = 640;
+   ConfigPtr->SizeY              = 480;
+   ConfigPtr->PixelFormat        = PFNC_MONO8;
+   ConfigPtr->FrameRate          = 30.0;
+   ConfigPtr->PacketSize         = 1500;
+   ConfigPtr->PacketLossPercent  = 0.0;
+   ConfigPtr->ReorderPercent     = 0.0;
+   ConfigPtr->FormatChangePeriod = 0;
+   }
+
+/* AOI of a given frame. When format changes are enabled the AOI toggles    */
+/* between the configured size and half of it every FormatChangePeriod.     */
+/* -----------------------------------------------------------------------   */
+void SimulatorFrameSize(const SimulatorConfigStruct* ConfigPtr, MIL_INT64 FrameIndex,
+                        MIL_INT* SizeXPtr, MIL_INT* SizeYPtr)
+   {
+   bool Reduced = ConfigPtr->FormatChangePeriod > 0 &&
+                  ((FrameIndex / ConfigPtr->FormatChangePeriod) & 1);
+
+   *SizeXPtr = Reduced ? (ConfigPtr->SizeX / 2) & ~(MIL_INT)3 : ConfigPtr->SizeX;
+   *SizeYPtr = Reduced ? ConfigPtr->SizeY / 2 : ConfigPtr->SizeY;
+   }
+
+/* Number of payload packets needed to carry one frame.                      */
+/* -----------------------------------------------------------------------   */
+MIL_INT SimulatorPacketCount(const SimulatorConfigStruct* ConfigPtr, MIL_INT SizeX,
+                             MIL_INT SizeY)
+   {
+   MIL_INT PayloadSize = ConfigPtr->PacketSize - GVSP_PACKET_OVERHEAD;
+   MIL_INT FrameBytes  = (MIL_INT)GvspFrameBytes((uint32_t)ConfigPtr->PixelFormat,
+                                                 (uint32_t)SizeX, (uint32_t)SizeY);
+
+   return (FrameBytes + PayloadSize - 1) / PayloadSize;
+   }
+
+/* Draws whether a packet is lost, using a xorshift generator so that the    */
+/* injected loss costs a few cycles per packet.                             */
+/* -----------------------------------------------------------------------   */
+bool SimulatorPacketLost(MIL_UINT64* RandomStatePtr, MIL_DOUBLE LossPercent)
+   {
+   MIL_UINT64 x = *RandomStatePtr;
+
+   if(LossPercent <= 0.0)
+      return false;
+
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   *RandomStatePtr = x;
+
+   return (MIL_DOUBLE)(x % 1000000) < LossPercent * 10000.0;
+   }
+
+/* Opens the sending socket and starts the simulator thread. Fails, with no */
+/* thread started, when the socket or the address cannot be used.           */
+/* -----------------------------------------------------------------------   */
+bool GvspSimulatorStart(GvspSimulatorStruct* SimulatorPtr,
+                        const SimulatorConfigStruct* ConfigPtr)
+   {
+   if(ConfigPtr->PacketSize <= GVSP_PACKET_OVERHEAD ||
+      ConfigPtr->PacketSize > GVSP_PACKET_SIZE_MAX)
+      {
+      MosPrintf(MIL_TEXT("Invalid simulator packet size %lld.\n"),
+         (long long)ConfigPtr->PacketSize);
+      return false;
+      }
+
+#if M_MIL_USE_WINDOWS
+   WSADATA WsaData;
+   WSAStartup(MAKEWORD(2, 2), &WsaData);
+#endif
+
+   sockaddr_in Destination;
+   SimSocket   Socket = OpenSenderSocket(ConfigPtr, &Destination);
+
+   SimulatorPtr->Thread = M_NULL;
+   if(Socket == SIM_INVALID_SOCKET)
+      {
+      MosPrintf(MIL_TEXT("Simulator could not open a socket to %s:%lld.\n"),
+         ConfigPtr->MulticastAddress.c_str(), (long long)ConfigPtr->UdpPort);
+#if M_MIL_USE_WINDOWS
+      WSACleanup();
+#endif
+      return false;
+      }
+
+   SimulatorPtr->Config             = *ConfigPtr;
+   SimulatorPtr->Socket             = (MIL_UINT64)Socket;
+   SimulatorPtr->DestinationAddress = (MIL_UINT32)Destination.sin_addr.s_addr;
+   SimulatorPtr->FramesSent         = 0;
+   SimulatorPtr->PacketsSent        = 0;
+   SimulatorPtr->PacketsDropped     = 0;
+   SimulatorPtr->PacketsReordered   = 0;
+   SimulatorPtr->StopRequested      = false;
+   MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, &SimulatorThread, SimulatorPtr,
+      &SimulatorPtr->Thread);
+
+   if(SimulatorPtr->Thread == M_NULL)
+      {
+      SimCloseSocket(Socket);
+#if M_MIL_USE_WINDOWS
+      WSACleanup();
+#endif
+      return false;
+      }
+   return true;
+   }
+
+/* Stops the simulator thread.                                               */
+/* -----------------------------------------------------------------------   */
+void GvspSimulatorStop(GvspSimulatorStruct* SimulatorPtr)
+   {
+   if(SimulatorPtr->Thread == M_NULL)
+      return;
+
+   SimulatorPtr->StopRequested = true;
+   MthrWait(SimulatorPtr->Thread, M_THREAD_END_WAIT, M_NULL);
+   MthrFree(SimulatorPtr->Thread);
+   SimulatorPtr->Thread = M_NULL;
+
+#if M_MIL_USE_WINDOWS
+   WSACleanup();
+#endif
+
+   MosPrintf(MIL_TEXT("Simulator sent %lld frames, %lld packets (%lld dropped, %lld reordered).\n"),
+      (long long)SimulatorPtr->FramesSent, (long long)SimulatorPtr->PacketsSent,
+      (long long)SimulatorPtr->PacketsDropped, (long long)SimulatorPtr->PacketsReordered);
+   }
+
+/* Opens the multicast sending socket.                                       */
+/* -----------------------------------------------------------------------   */
+static SimSocket OpenSenderSocket(const SimulatorConfigStruct* ConfigPtr,
+                                  sockaddr_in* DestinationPtr)
+   {
+   std::string Address(ConfigPtr->MulticastAddress.begin(),
+                       ConfigPtr->MulticastAddress.end());
+   unsigned char Ttl  = 0;
+   unsigned char Loop = 1;
+   SimSocket Socket   = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+   if(Socket == SIM_INVALID_SOCKET)
+      return SIM_INVALID_SOCKET;
+
+   /* Keep the stream on this host and deliver it to local receivers. */
+   setsockopt(Socket, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&Ttl, sizeof(Ttl));
+   setsockopt(Socket, IPPROTO_IP, IP_MULTICAST_LOOP, (const char*)&Loop, sizeof(Loop));
+
+   memset(DestinationPtr, 0, sizeof(*DestinationPtr));
+   DestinationPtr->sin_family = AF_INET;
+   DestinationPtr->sin_port   = htons((unsigned short)ConfigPtr->UdpPort);
+   if(inet_pton(AF_INET, Address.c_str(), &DestinationPtr->sin_addr) != 1)
+      {
+      SimCloseSocket(Socket);
+      return SIM_INVALID_SOCKET;
+      }
+
+   return Socket;
+   }
+
+/* Simulator thread: sends one GVSP block per frame period.                  */
+/* -----------------------------------------------------------------------   */
+static MIL_UINT32 MFTYPE SimulatorThread(void* ThreadContext)
+   {
+   GvspSimulatorStruct*         SimulatorPtr = (GvspSimulatorStruct*)ThreadContext;
+   const SimulatorConfigStruct* ConfigPtr    = &SimulatorPtr->Config;
+   sockaddr_in                  Destination;
+   SimSocket                    Socket = (SimSocket)SimulatorPtr->Socket;
+   std::vector<uint8_t>         Packet((size_t)ConfigPtr->PacketSize);
+   std::vector<uint8_t>         Frame;
+   std::vector<uint8_t>         Held((size_t)ConfigPtr->PacketSize);
+   size_t                       HeldSize  = 0;
+   GvspHeaderStruct*            HeaderPtr = (GvspHeaderStruct*)&Packet[0];
+   uint8_t*                     BodyPtr   = &Packet[GVSP_HEADER_SIZE];
+   size_t                       PayloadSize = (size_t)ConfigPtr->PacketSize -
+                                              GVSP_PACKET_OVERHEAD;
+   MIL_UINT64                   RandomState = 0x9E3779B97F4A7C15ULL;
+   MIL_INT64                    FrameIndex  = 0;
+   auto                         StartTime   = std::chrono::steady_clock::now();
+   auto                         NextFrame   = StartTime;
+   auto                         Period      = std::chrono::nanoseconds(
+      ConfigPtr->FrameRate > 0 ? (long long)(1e9 / ConfigPtr->FrameRate) : 0);
+
+   memset(&Destination, 0, sizeof(Destination));
+   Destination.sin_family      = AF_INET;
+   Destination.sin_port        = htons((unsigned short)ConfigPtr->UdpPort);
+   Destination.sin_addr.s_addr = SimulatorPtr->DestinationAddress;
+
+   while(!SimulatorPtr->StopRequested)
+      {
+      MIL_INT SizeX, SizeY;
+      SimulatorFrameSize(ConfigPtr, FrameIndex, &SizeX, &SizeY);
+
+      size_t FrameBytes = GvspFrameBytes((uint32_t)ConfigPtr->PixelFormat,
+                                         (uint32_t)SizeX, (uint32_t)SizeY);
+      if(Frame.size() != FrameBytes)
+         {
+         /* Diagonal ramp, redrawn only when the AOI changes. */
+         Frame.resize(FrameBytes);
+         for(size_t i = 0; i < FrameBytes; i++)
+            Frame[i] = (uint8_t)(i / (size_t)SizeX + i % (size_t)SizeX);
+         }
+
+      /* Make every frame different by stamping its index in the first row. */
+      memcpy(&Frame[0], &FrameIndex, sizeof(FrameIndex) < FrameBytes ?
+             sizeof(FrameIndex) : FrameBytes);
+
+      uint16_t BlockId   = (uint16_t)((FrameIndex % 0xFFFF) + 1);
+      uint64_t Timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::steady_clock::now() - StartTime).count();
+      uint32_t PacketId  = 0;
+
+      HeaderPtr->Status  = 0;
+      HeaderPtr->BlockId = htons(BlockId);
+
+      /* Leader. */
+      GvspImageLeaderStruct* LeaderPtr = (GvspImageLeaderStruct*)BodyPtr;
+      memset(LeaderPtr, 0, sizeof(*LeaderPtr));
+      HeaderPtr->PacketFormat    = GVSP_FORMAT_LEADER;
+      GvspSetPacketId(HeaderPtr, PacketId++);
+      LeaderPtr->PayloadType     = htons(GVSP_PAYLOAD_TYPE_IMAGE);
+      LeaderPtr->TimestampHigh   = htonl((uint32_t)(Timestamp >> 32));
+      LeaderPtr->TimestampLow    = htonl((uint32_t)Timestamp);
+      LeaderPtr->PixelFormat     = htonl((uint32_t)ConfigPtr->PixelFormat);
+      LeaderPtr->SizeX           = htonl((uint32_t)SizeX);
+      LeaderPtr->SizeY           = htonl((uint32_t)SizeY);
+      if(!SimulatorPacketLost(&RandomState, ConfigPtr->PacketLossPercent))
+         {
+         sendto(Socket, (const char*)&Packet[0], GVSP_HEADER_SIZE + sizeof(*LeaderPtr), 0,
+                (const sockaddr*)&Destination, sizeof(Destination));
+         SimulatorPtr->PacketsSent++;
+         }
+      else
+         SimulatorPtr->PacketsDropped++;
+
+      /* Payload. */
+      HeaderPtr->PacketFormat = GVSP_FORMAT_PAYLOAD;
+      for(size_t Offset = 0; Offset < FrameBytes; Offset += PayloadSize)
+         {
+         size_t Size = FrameBytes - Offset < PayloadSize ? FrameBytes - Offset : PayloadSize;
+
+         GvspSetPacketId(HeaderPtr, PacketId++);
+         if(SimulatorPacketLost(&RandomState, ConfigPtr->PacketLossPercent))
+            {
+            SimulatorPtr->PacketsDropped++;
+            continue;
+            }
+         memcpy(BodyPtr, &Frame[Offset], Size);
+         if(HeldSize == 0 && SimulatorPacketLost(&RandomState, ConfigPtr->ReorderPercent))
+            {
+            /* Sent after the next packet. */
+            HeldSize = GVSP_HEADER_SIZE + Size;
+            memcpy(&Held[0], &Packet[0], HeldSize);
+            SimulatorPtr->PacketsReordered++;
+            continue;
+            }
+         sendto(Socket, (const char*)&Packet[0], (int)(GVSP_HEADER_SIZE + Size), 0,
+                (const sockaddr*)&Destination, sizeof(Destination));
+         SimulatorPtr->PacketsSent++;
+         if(HeldSize > 0)
+            {
+            sendto(Socket, (const char*)&Held[0], (int)HeldSize, 0,
+                   (const sockaddr*)&Destination, sizeof(Destination));
+            SimulatorPtr->PacketsSent++;
+            HeldSize = 0;
+            }
+         }
+      if(HeldSize > 0)
+         {
+         sendto(Socket, (const char*)&Held[0], (int)HeldSize, 0,
+                (const sockaddr*)&Destination, sizeof(Destination));
+         SimulatorPtr->PacketsSent++;
+         HeldSize = 0;
+         }
+
+      /* Trailer. */
+      GvspImageTrailerStruct* TrailerPtr = (GvspImageTrailerStruct*)BodyPtr;
+      HeaderPtr->PacketFormat = GVSP_FORMAT_TRAILER;
+      GvspSetPacketId(HeaderPtr, PacketId);
+      TrailerPtr->Reserved    = 0;
+      TrailerPtr->PayloadType = htons(GVSP_PAYLOAD_TYPE_IMAGE);
+      TrailerPtr->SizeY       = htonl((uint32_t)SizeY);
+      sendto(Socket, (const char*)&Packet[0], GVSP_HEADER_SIZE + sizeof(*TrailerPtr), 0,
+             (const sockaddr*)&Destination, sizeof(Destination));
+      SimulatorPtr->PacketsSent++;
+
+      SimulatorPtr->FramesSent++;
+      FrameIndex++;
+
+      if(Period.count() > 0)
+         {
+         NextFrame += Period;
+         std::this_thread::sleep_until(NextFrame);
+         }
+      }
+
+   SimCloseSocket(Socket);
+   return 0;
+   }
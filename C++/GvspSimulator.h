@@ -0,0 +1,61 @@
+﻿/*************************************************************************************/
+/*
+ * File name: GvspSimulator.h
+ *
+ * Synopsis:  Local GVSP stream simulator. Emulates a multicast master by sending
+ *            leader, payload and trailer packets to a multicast group on the local
+ *            host, so that the monitor can be exercised without a GigE Vision
+ *            device or a second PC.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef GVSP_SIMULATOR_H
+#define GVSP_SIMULATOR_H
+
+#include <mil.h>
+#include <atomic>
+#include "GvspProtocol.h"
+
+/* Description of the simulated stream. Also drives the synthetic acquisition source. */
+typedef struct
+   {
+   MIL_STRING MulticastAddress;
+   MIL_INT    UdpPort;
+   MIL_INT    SizeX;
+   MIL_INT    SizeY;
+   MIL_INT    PixelFormat;
+   MIL_DOUBLE FrameRate;            /* Frames/sec, 0 to run as fast as possible.     */
+   MIL_INT    PacketSize;           /* GigE Vision packet size, headers included.    */
+   MIL_DOUBLE PacketLossPercent;    /* Probability of dropping each packet.          */
+   MIL_DOUBLE ReorderPercent;       /* Probability of sending a payload packet after */
+                                    /* the next one, as a resend would arrive.       */
+   MIL_INT    FormatChangePeriod;   /* Frames between AOI changes, 0 to disable.     */
+   } SimulatorConfigStruct;
+
+/* Simulator state. */
+typedef struct
+   {
+   SimulatorConfigStruct Config;
+   MIL_ID                Thread;
+   MIL_UINT64            Socket;             /* Sending socket, opened by the start. */
+   MIL_UINT32            DestinationAddress; /* Group address, network byte order.   */
+   std::atomic<bool>     StopRequested;
+   MIL_INT64             FramesSent;
+   MIL_INT64             PacketsSent;
+   MIL_INT64             PacketsDropped;
+   MIL_INT64             PacketsReordered;
+   } GvspSimulatorStruct;
+
+void SimulatorDefaultConfig(SimulatorConfigStruct* ConfigPtr);
+void SimulatorFrameSize(const SimulatorConfigStruct* ConfigPtr, MIL_INT64 FrameIndex,
+                        MIL_INT* SizeXPtr, MIL_INT* SizeYPtr);
+MIL_INT SimulatorPacketCount(const SimulatorConfigStruct* ConfigPtr, MIL_INT SizeX,
+                             MIL_INT SizeY);
+bool SimulatorPacketLost(MIL_UINT64* RandomStatePtr, MIL_DOUBLE LossPercent);
+
+bool GvspSimulatorStart(GvspSimulatorStruct* SimulatorPtr,
+                        const SimulatorConfigStruct* ConfigPtr);
+void GvspSimulatorStop(GvspSimulatorStruct* SimulatorPtr);
+
+#endif /* GVSP_SIMULATOR_H */
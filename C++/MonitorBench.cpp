@@ -0,0 +1,385 @@
+﻿/*************************************************************************************/
+/*
+ * File name: MonitorBench.cpp
+ *
+ * Synopsis:  Benchmark suite of the hot paths of the monitor, run with
+ *            -bench=<file.json> against the synthetic source, without a device or
+ *            a display window. The figures are printed and written as JSON to
+ *            compare builds (make monitorbench in the linux directory).
+ *
+ *            Microbenchmarks, on the calling thread:
+ *              hook           ProcessFrame(), the body of ProcessingFunction()
+ *                             that every backend calls, without a display.
+ *              hook_display   The same, with the display buffer updated on
+ *                             every frame (-displayrate=0).
+ *              display_copy   DisplayStageCopy(): conversion and overlay.
+ *              grab_buffers   A FreeGrabBuffers()/AllocateGrabBuffers() cycle.
+ *            End-to-end runs, with the workers and the display stage of the
+ *            options:
+ *              end_to_end     The synthetic source at its maximum rate.
+ *              format_change  The AOI toggled every BENCH_SWITCH_PERIOD frames
+ *                             at BENCH_SWITCH_RATE; the latency is the gap from
+ *                             the first frame in the new format to the first one
+ *                             grabbed into a pool of that format.
+ *
+ *            Each result has the rate (frames, or cycles, per second), the
+ *            latency percentiles in microseconds (time in the hook for the
+ *            end_to_end run) and the bytes read from a grab buffer per frame
+ *            (the size of a grab buffer for grab_buffers).
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "MulticastMonitor.h"
+
+#define BENCH_FRAMES        2000    /* Iterations of the hook and copy benchmarks.  */
+#define BENCH_ALLOC_CYCLES  50      /* Grab buffer allocation cycles.                */
+#define BENCH_RUN_DURATION  3.0     /* Seconds per end-to-end run, unless -duration. */
+#define BENCH_SWITCH_RATE   200.0   /* Frames/sec of the format change run.          */
+#define BENCH_SWITCH_PERIOD 100     /* Frames between two format changes.            */
+
+/* Latency percentiles reported, and their JSON names. */
+static const MIL_DOUBLE  BenchPercentiles[]     = { 50.0, 90.0, 99.0, 99.9 };
+static const char* const BenchPercentileNames[] = { "p50", "p90", "p99", "p99.9" };
+#define BENCH_PERCENTILE_COUNT (sizeof(BenchPercentiles) / sizeof(BenchPercentiles[0]))
+
+typedef struct
+   {
+   const char* Name;
+   MIL_INT64   Iterations;
+   MIL_DOUBLE  Rate;                                    /* Per second.            */
+   MIL_DOUBLE  Latencies[BENCH_PERCENTILE_COUNT];       /* Microseconds.          */
+   MIL_DOUBLE  LatencyMax;
+   MIL_DOUBLE  BytesPerFrame;
+   } BenchResultStruct;
+
+static MIL_DOUBLE BenchTime(void)
+   {
+   MIL_DOUBLE Time;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Time);
+   return Time;
+   }
+
+/* Sets the latencies of a result from the samples, in seconds.              */
+/* -----------------------------------------------------------------------   */
+static void SetLatencies(BenchResultStruct* ResultPtr, std::vector<MIL_DOUBLE>& Samples)
+   {
+   std::sort(Samples.begin(), Samples.end());
+   for(size_t p = 0; p < BENCH_PERCENTILE_COUNT; p++)
+      {
+      size_t Index = (size_t)(BenchPercentiles[p] / 100.0 * (Samples.size() - 1) + 0.5);
+
+      ResultPtr->Latencies[p] = Samples.empty() ? 0 : 1e6 * Samples[Index];
+      }
+   ResultPtr->LatencyMax = Samples.empty() ? 0 : 1e6 * Samples.back();
+   }
+
+/* Opens a synthetic stream as MosMain() does, without starting it; the     */
+/* display buffer is allocated if Display, but no display window.           */
+/* -----------------------------------------------------------------------   */
+static void BenchOpen(MIL_ID MilSystem, const MonitorOptionsStruct* OptionsPtr, bool Display,
+                      PixelConvertPoolStruct* ConverterPtr, HookDataStruct* HookDataPtr)
+   {
+   MonitorOptionsStruct Options = *OptionsPtr;
+
+   Options.Headless = !Display;
+   Options.Daemon   = true;
+   InitHookData(HookDataPtr, &Options, std::string());
+   MthrAlloc(MilSystem, M_EVENT, M_NOT_SIGNALED+M_AUTO_RESET, M_NULL, M_NULL,
+      &HookDataPtr->Event);
+   HookDataPtr->PoolCache = PoolCacheAlloc(MilSystem,
+      (Display ? POOL_DISPLAY_BUFFER : 0) +
+      (Options.HugePages ? POOL_HUGE_PAGES : 0) +
+      (Options.LockMemory ? POOL_LOCKED_MEMORY : 0), CPU_NODE_UNKNOWN, HookDataPtr->Event,
+      &HookDataPtr->GrabQueue);
+   HookDataPtr->Converter        = ConverterPtr;
+   HookDataPtr->FrameSizeX       = Options.SourceConfig.SizeX;
+   HookDataPtr->FrameSizeY       = Options.SourceConfig.SizeY;
+   HookDataPtr->FramePixelFormat = Options.SourceConfig.PixelFormat;
+   HookDataPtr->DeviceVendor     = MIL_TEXT("Synthetic");
+   HookDataPtr->DeviceModel      = MIL_TEXT("benchmark");
+   AllocateGrabBuffers(MilSystem, HookDataPtr);
+   }
+
+static void BenchClose(HookDataStruct* HookDataPtr)
+   {
+   /* The workers go first: they hold references to the grab buffers. */
+   PipelineFree(HookDataPtr->Pipeline);
+   DisplayStageFree(HookDataPtr->Display);
+   FreeGrabBuffers(HookDataPtr);
+   FrameOverlayFree(HookDataPtr->Overlay);
+   FrameHealthFree(HookDataPtr->Health);
+   PoolCacheFree(HookDataPtr->PoolCache);
+   FrameStatsFree(HookDataPtr->Stats);
+   MthrFree(HookDataPtr->Event);
+   }
+
+/* Calls the hook body on frames of the current format, in turn in the grab */
+/* buffers, as the synthetic source does but without filling them.          */
+/* -----------------------------------------------------------------------   */
+static void BenchHook(HookDataStruct* HookDataPtr, BenchResultStruct* ResultPtr)
+   {
+   std::vector<MIL_DOUBLE> Samples;
+   MIL_DOUBLE              StartTime = BenchTime();
+
+   for(MIL_INT64 i = 0; i < BENCH_FRAMES; i++)
+      {
+      FrameInfoStruct FrameInfo;
+      MIL_INT         BufferIndex = (MIL_INT)(i % HookDataPtr->MilGrabBufferListSize);
+      MIL_DOUBLE      EndTime;
+
+      FrameInfo.BufferIndex        = BufferIndex;
+      FrameInfo.BufferId           = HookDataPtr->MilGrabBufferList[BufferIndex];
+      FrameInfo.IsFrameCorrupt     = M_FALSE;
+      FrameInfo.FrameSizeX         = HookDataPtr->FrameSizeX;
+      FrameInfo.FrameSizeY         = HookDataPtr->FrameSizeY;
+      FrameInfo.FramePixelFormat   = HookDataPtr->FramePixelFormat;
+      FrameInfo.FramePacketSize    = HookDataPtr->SourceConfig.PacketSize;
+      FrameInfo.BlockId            = i % 0xFFFF + 1;
+      FrameInfo.ReceivedPackets    = M_NULL;
+      FrameInfo.PayloadPacketCount = 0;
+      FrameInfo.HookEntryTime      = BenchTime();
+      FrameInfo.DeviceTimestamp    = FrameInfo.HookEntryTime;
+
+      ProcessFrame(HookDataPtr, &FrameInfo);
+
+      EndTime = BenchTime();
+      Samples.push_back(EndTime - FrameInfo.HookEntryTime);
+      }
+
+   ResultPtr->Iterations = BENCH_FRAMES;
+   ResultPtr->Rate       = BENCH_FRAMES / (BenchTime() - StartTime);
+   SetLatencies(ResultPtr, Samples);
+   }
+
+static void BenchDisplayCopy(HookDataStruct* HookDataPtr, BenchResultStruct* ResultPtr)
+   {
+   std::vector<MIL_DOUBLE> Samples;
+   MIL_INT64               Bytes     = 0;
+   MIL_DOUBLE              StartTime = BenchTime();
+
+   for(MIL_INT64 i = 0; i < BENCH_FRAMES; i++)
+      {
+      MIL_INT    BufferIndex = (MIL_INT)(i % HookDataPtr->MilGrabBufferListSize);
+      MIL_DOUBLE CopyStart   = BenchTime();
+
+      HookDataPtr->BufferFrameCount[BufferIndex] = i + 1;
+      Bytes += DisplayStageCopy(HookDataPtr, HookDataPtr->MilGrabBufferList[BufferIndex],
+                                BufferIndex, M_DEFAULT);
+      Samples.push_back(BenchTime() - CopyStart);
+      }
+
+   ResultPtr->Iterations    = BENCH_FRAMES;
+   ResultPtr->Rate          = BENCH_FRAMES / (BenchTime() - StartTime);
+   ResultPtr->BytesPerFrame = (MIL_DOUBLE)Bytes / BENCH_FRAMES;
+   SetLatencies(ResultPtr, Samples);
+   }
+
+static void BenchGrabBuffers(MIL_ID MilSystem, HookDataStruct* HookDataPtr,
+                             BenchResultStruct* ResultPtr)
+   {
+   std::vector<MIL_DOUBLE> Samples;
+   MIL_DOUBLE              StartTime = BenchTime();
+
+   for(MIL_INT64 i = 0; i < BENCH_ALLOC_CYCLES; i++)
+      {
+      MIL_DOUBLE CycleStart = BenchTime();
+
+      FreeGrabBuffers(HookDataPtr);
+      AllocateGrabBuffers(MilSystem, HookDataPtr);
+      Samples.push_back(BenchTime() - CycleStart);
+      }
+
+   ResultPtr->Iterations    = BENCH_ALLOC_CYCLES;
+   ResultPtr->Rate          = BENCH_ALLOC_CYCLES / (BenchTime() - StartTime);
+   ResultPtr->BytesPerFrame = (MIL_DOUBLE)HookDataPtr->ActivePool->BufferBytes;
+   SetLatencies(ResultPtr, Samples);
+   }
+
+/* Runs the synthetic source with the workers and the display stage of the  */
+/* options, serviced as by AdaptToDataFormatChange(). The latencies come   */
+/* from the histogram of the data format change gaps for format_change, of */
+/* the hook time otherwise.                                                  */
+/* -----------------------------------------------------------------------   */
+static void BenchRun(MIL_ID MilSystem, const MonitorOptionsStruct* OptionsPtr,
+                     PixelConvertPoolStruct* ConverterPtr, bool FormatChange,
+                     BenchResultStruct* ResultPtr)
+   {
+   MonitorOptionsStruct        Options  = *OptionsPtr;
+   HookDataStruct              HookData;
+   const StatsHistogramStruct* HistogramPtr;
+   MIL_DOUBLE                  Duration = Options.RunDuration > 0 ? Options.RunDuration :
+                                                                    BENCH_RUN_DURATION;
+   MIL_DOUBLE                  EndTime;
+   MIL_INT64                   FrameCount;
+
+   Options.SourceConfig.FrameRate          = FormatChange ? BENCH_SWITCH_RATE : 0;
+   Options.SourceConfig.FormatChangePeriod = FormatChange ? BENCH_SWITCH_PERIOD : 0;
+   BenchOpen(MilSystem, &Options, !Options.Headless, ConverterPtr, &HookData);
+   if(Options.WorkerCount > 0)
+      {
+      HookData.Pipeline     = PipelineAlloc(MilSystem, Options.WorkerCount, M_NULL,
+                                            &Options.ThreadPlacements[eThreadWorker]);
+      HookData.PipelineLane = PipelineAddLane(HookData.Pipeline, &HookData, CPU_NODE_UNKNOWN);
+      }
+   if(!Options.Headless && Options.DisplayRate > 0)
+      HookData.Display = DisplayStageAlloc(Options.DisplayRate,
+                                           &Options.ThreadPlacements[eThreadDisplay], &HookData);
+
+   StartAcquisition(&HookData);
+   EndTime = BenchTime() + Duration;
+   for(MIL_DOUBLE Now = BenchTime(); Now < EndTime; Now = BenchTime())
+      {
+      MIL_DOUBLE WakeTime = NextServiceTime(&HookData);
+
+      if(WakeTime == 0 || WakeTime > EndTime)
+         WakeTime = EndTime;
+      if(WakeTime > Now)
+         MthrWait(HookData.Event, M_EVENT_WAIT +
+                  M_EVENT_TIMEOUT((MIL_INT)(1000.0 * (WakeTime - Now)) + 1), M_NULL);
+      ServiceDataFormatChange(MilSystem, &HookData);
+      }
+   if(IsAcquisitionInProgress(&HookData))
+      StopAcquisition(&HookData);
+
+   FrameCount        = HookData.Synthetic.HookCallCount;
+   ResultPtr->Rate   = HookData.Synthetic.RunTime > 0 ? FrameCount / HookData.Synthetic.RunTime : 0;
+   ResultPtr->BytesPerFrame = HookData.Display && FrameCount > 0 ?
+                              (MIL_DOUBLE)HookData.Display->BytesCopied / FrameCount : 0;
+   HistogramPtr = &HookData.Stats->Histograms[FormatChange ? eStatsFormatChangeGap :
+                                                             eStatsHookTime];
+   ResultPtr->Iterations = FormatChange ? HistogramPtr->Count.Value.load() : FrameCount;
+   for(size_t p = 0; p < BENCH_PERCENTILE_COUNT; p++)
+      ResultPtr->Latencies[p] = 1e6 * StatsHistogramPercentile(HistogramPtr, BenchPercentiles[p]);
+   ResultPtr->LatencyMax = 1e6 * HistogramPtr->Max.Value.load() * HistogramPtr->Scale;
+
+   BenchClose(&HookData);
+   }
+
+/* Writes the results as JSON. Returns false if the file cannot be written. */
+/* -----------------------------------------------------------------------   */
+static bool WriteBenchJson(const std::string& Path, const MonitorOptionsStruct* OptionsPtr,
+                           MIL_INT64 FrameBytes, const std::vector<BenchResultStruct>& Results)
+   {
+   FILE* File = fopen(Path.c_str(), "w");
+
+   if(!File)
+      return false;
+
+   fprintf(File, "{\n  \"benchmark\": \"MulticastMonitor\",\n");
+   fprintf(File, "  \"frame\": { \"size_x\": %lld, \"size_y\": %lld, \"pixel_format\": %lld, "
+                 "\"bytes\": %lld },\n", (long long)OptionsPtr->SourceConfig.SizeX,
+                 (long long)OptionsPtr->SourceConfig.SizeY,
+                 (long long)OptionsPtr->SourceConfig.PixelFormat, (long long)FrameBytes);
+   fprintf(File, "  \"workers\": %lld,\n  \"display_rate\": %g,\n  \"headless\": %s,\n",
+           (long long)OptionsPtr->WorkerCount, OptionsPtr->DisplayRate,
+           OptionsPtr->Headless ? "true" : "false");
+   fprintf(File, "  \"results\": [\n");
+   for(size_t i = 0; i < Results.size(); i++)
+      {
+      const BenchResultStruct* ResultPtr = &Results[i];
+
+      fprintf(File, "    { \"name\": \"%s\", \"iterations\": %lld, \"fps\": %.3f,\n",
+              ResultPtr->Name, (long long)ResultPtr->Iterations, ResultPtr->Rate);
+      fprintf(File, "      \"latency_us\": {");
+      for(size_t p = 0; p < BENCH_PERCENTILE_COUNT; p++)
+         fprintf(File, " \"%s\": %.3f,", BenchPercentileNames[p], ResultPtr->Latencies[p]);
+      fprintf(File, " \"max\": %.3f },\n", ResultPtr->LatencyMax);
+      fprintf(File, "      \"bytes_per_frame\": %.0f }%s\n", ResultPtr->BytesPerFrame,
+              i + 1 < Results.size() ? "," : "");
+      }
+   fprintf(File, "  ]\n}\n");
+
+   return fclose(File) == 0;
+   }
+
+/* Runs the benchmark suite. Returns the exit status of the monitor.        */
+/* -----------------------------------------------------------------------   */
+int MonitorBenchRun(MIL_ID MilSystem, MonitorOptionsStruct* OptionsPtr)
+   {
+   std::vector<BenchResultStruct> Results;
+   PixelConvertPoolStruct*        ConverterPtr;
+   HookDataStruct                 HookData;
+   BenchResultStruct              Result;
+   MIL_INT                        SizeBand, Type;
+   MIL_INT64                      SourceDataFormat, FrameBytes;
+   MIL_STRING                     BenchPath;
+
+   GetBufferFormat(OptionsPtr->SourceConfig.PixelFormat, &SizeBand, &Type, &SourceDataFormat);
+   FrameBytes = BufferPoolBufferBytes(SizeBand, OptionsPtr->SourceConfig.SizeX,
+                                      OptionsPtr->SourceConfig.SizeY, Type, SourceDataFormat);
+   MosPrintf(MIL_TEXT("Monitor benchmark: %lld x %lld frames, pixel format 0x%x, %lld bytes.\n\n"),
+      (long long)OptionsPtr->SourceConfig.SizeX, (long long)OptionsPtr->SourceConfig.SizeY,
+      (int)OptionsPtr->SourceConfig.PixelFormat, (long long)FrameBytes);
+
+   PixelConvertSetIsa(OptionsPtr->ConvertIsa);
+   ConverterPtr = PixelConvertPoolAlloc((uint32_t)OptionsPtr->ConvertThreadCount);
+
+   /* The hook alone, then with the display copy and the copy alone. */
+   Result = BenchResultStruct();
+   Result.Name = "hook";
+   BenchOpen(MilSystem, OptionsPtr, false, ConverterPtr, &HookData);
+   BenchHook(&HookData, &Result);
+   BenchClose(&HookData);
+   Results.push_back(Result);
+
+   BenchOpen(MilSystem, OptionsPtr, true, ConverterPtr, &HookData);
+   Result = BenchResultStruct();
+   Result.Name = "hook_display";
+   BenchHook(&HookData, &Result);
+   Result.BytesPerFrame = (MIL_DOUBLE)DisplayStageCopy(&HookData, HookData.MilGrabBufferList[0],
+                                                       0, M_DEFAULT);
+   Results.push_back(Result);
+
+   Result = BenchResultStruct();
+   Result.Name = "display_copy";
+   BenchDisplayCopy(&HookData, &Result);
+   Results.push_back(Result);
+
+   Result = BenchResultStruct();
+   Result.Name = "grab_buffers";
+   BenchGrabBuffers(MilSystem, &HookData, &Result);
+   Results.push_back(Result);
+   BenchClose(&HookData);
+
+   Result = BenchResultStruct();
+   Result.Name = "end_to_end";
+   BenchRun(MilSystem, OptionsPtr, ConverterPtr, false, &Result);
+   Results.push_back(Result);
+
+   Result = BenchResultStruct();
+   Result.Name = "format_change";
+   BenchRun(MilSystem, OptionsPtr, ConverterPtr, true, &Result);
+   Results.push_back(Result);
+
+   PixelConvertPoolFree(ConverterPtr);
+
+   MosPrintf(MIL_TEXT("\n%-14s %8s %12s %10s %10s %10s %10s %10s %12s\n"), MIL_TEXT("Benchmark"),
+      MIL_TEXT("Count"), MIL_TEXT("Rate/s"), MIL_TEXT("p50 us"), MIL_TEXT("p90 us"),
+      MIL_TEXT("p99 us"), MIL_TEXT("p99.9 us"), MIL_TEXT("Max us"), MIL_TEXT("Bytes/frame"));
+   for(size_t i = 0; i < Results.size(); i++)
+      {
+      std::string Name(Results[i].Name);
+
+      MosPrintf(MIL_TEXT("%-14s %8lld %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f %12.0f\n"),
+         MIL_STRING(Name.begin(), Name.end()).c_str(), (long long)Results[i].Iterations,
+         Results[i].Rate, Results[i].Latencies[0], Results[i].Latencies[1],
+         Results[i].Latencies[2], Results[i].Latencies[3], Results[i].LatencyMax,
+         Results[i].BytesPerFrame);
+      }
+
+   BenchPath = MIL_STRING(OptionsPtr->BenchPath.begin(), OptionsPtr->BenchPath.end());
+   if(!WriteBenchJson(OptionsPtr->BenchPath, OptionsPtr, FrameBytes, Results))
+      {
+      MosPrintf(MIL_TEXT("\nCould not write %s.\n"), BenchPath.c_str());
+      return 1;
+      }
+   MosPrintf(MIL_TEXT("\nResults written to %s.\n"), BenchPath.c_str());
+   return 0;
+   }
@@ -0,0 +1,285 @@
+﻿/*************************************************************************************/
+/*
+ * File name: MonitorControl.cpp
+ *
+ * Synopsis:  Control thread of the main thread: stop signals and <Enter>.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#if M_MIL_USE_WINDOWS
+#include <windows.h>
+#else
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <mutex>
+#endif
+#include <signal.h>
+#include <stdint.h>
+#include <math.h>
+#include "MonitorControl.h"
+
+static MIL_UINT32 MFTYPE ControlThread(void* ThreadContext);
+
+/* Sets StopRequested and wakes up the main thread. Signal is the signal    */
+/* that asked for it, 0 for <Enter>.                                         */
+/* -----------------------------------------------------------------------   */
+void ControlRequestStop(ControlStruct* ControlPtr, int Signal)
+   {
+   ControlPtr->StopSignal    = Signal;
+   ControlPtr->StopRequested = true;
+   MthrControl(ControlPtr->WakeEvent, M_EVENT_SET, M_SIGNALED);
+   }
+
+/* Sleeps until the wake event is set or WakeTime (MappTimer time) is       */
+/* reached; 0 for no time limit.                                             */
+/* -----------------------------------------------------------------------   */
+void ControlWait(ControlStruct* ControlPtr, MIL_DOUBLE WakeTime)
+   {
+   MIL_DOUBLE Now;
+   MIL_INT    Timeout;
+
+   if(WakeTime <= 0)
+      {
+      MthrWait(ControlPtr->WakeEvent, M_EVENT_WAIT, M_NULL);
+      return;
+      }
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Now);
+   Timeout = (MIL_INT)ceil(1000.0 * (WakeTime - Now));
+   if(Timeout > 0)
+      MthrWait(ControlPtr->WakeEvent, M_EVENT_WAIT+M_EVENT_TIMEOUT(Timeout), M_NULL);
+   }
+
+#if !M_MIL_USE_WINDOWS
+
+/* Control the stop signals are handed to; none outside of ControlAlloc()  */
+/* and ControlFree().                                                        */
+static std::mutex     g_ControlLock;
+static ControlStruct* g_ControlPtr = M_NULL;
+
+static void SetControl(ControlStruct* ControlPtr)
+   {
+   std::lock_guard<std::mutex> Lock(g_ControlLock);
+   g_ControlPtr = ControlPtr;
+   }
+
+/* Signal thread: a stop signal requests the stop while a control thread is */
+/* allocated. Otherwise the signal is raised again with its default action */
+/* and unblocked in this thread, which ends the process.                     */
+/* -----------------------------------------------------------------------   */
+static void* SignalThread(void* ThreadContext)
+   {
+   int SignalFd = (int)(intptr_t)ThreadContext;
+
+   for(;;)
+      {
+      signalfd_siginfo Info;
+
+      if(read(SignalFd, &Info, sizeof(Info)) != sizeof(Info))
+         continue;
+
+      std::lock_guard<std::mutex> Lock(g_ControlLock);
+      if(g_ControlPtr)
+         ControlRequestStop(g_ControlPtr, (int)Info.ssi_signo);
+      else
+         {
+         sigset_t Signal;
+
+         sigemptyset(&Signal);
+         sigaddset(&Signal, (int)Info.ssi_signo);
+         signal((int)Info.ssi_signo, SIG_DFL);
+         raise((int)Info.ssi_signo);
+         pthread_sigmask(SIG_UNBLOCK, &Signal, M_NULL);
+         }
+      }
+
+   return M_NULL;
+   }
+
+/* Blocks the stop signals in the calling thread and the threads it creates */
+/* afterwards, and starts the signal thread that reads them. Called first, */
+/* before any thread is created.                                             */
+/* -----------------------------------------------------------------------   */
+void ControlInitSignals(void)
+   {
+   sigset_t  Signals;
+   pthread_t Thread;
+   int       SignalFd;
+
+   sigemptyset(&Signals);
+   sigaddset(&Signals, SIGINT);
+   sigaddset(&Signals, SIGTERM);
+   pthread_sigmask(SIG_BLOCK, &Signals, M_NULL);
+
+   SignalFd = signalfd(-1, &Signals, SFD_CLOEXEC);
+   if(SignalFd < 0 || pthread_create(&Thread, M_NULL, &SignalThread,
+                                     (void*)(intptr_t)SignalFd) != 0)
+      {
+      /* Nobody would read them: leave the signals to their default action. */
+      if(SignalFd >= 0)
+         close(SignalFd);
+      pthread_sigmask(SIG_UNBLOCK, &Signals, M_NULL);
+      return;
+      }
+   pthread_detach(Thread);
+   }
+
+/* Starts the control thread and hands it the stop signals.                 */
+/* -----------------------------------------------------------------------   */
+ControlStruct* ControlAlloc(MIL_ID WakeEvent, bool WatchKeyboard)
+   {
+   ControlStruct* ControlPtr = new ControlStruct;
+
+   ControlPtr->WakeEvent     = WakeEvent;
+   ControlPtr->WatchKeyboard = WatchKeyboard;
+   ControlPtr->StopRequested = false;
+   ControlPtr->StopSignal    = 0;
+   ControlPtr->QuitFd        = eventfd(0, EFD_CLOEXEC);
+
+   MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, &ControlThread, ControlPtr,
+      &ControlPtr->Thread);
+
+   SetControl(ControlPtr);
+   return ControlPtr;
+   }
+
+void ControlFree(ControlStruct* ControlPtr)
+   {
+   uint64_t One = 1;
+
+   if(!ControlPtr)
+      return;
+
+   SetControl(M_NULL);
+   if(write(ControlPtr->QuitFd, &One, sizeof(One)) != sizeof(One))
+      MosPrintf(MIL_TEXT("Could not stop the control thread.\n"));
+   MthrWait(ControlPtr->Thread, M_THREAD_END_WAIT, M_NULL);
+   MthrFree(ControlPtr->Thread);
+   close(ControlPtr->QuitFd);
+
+   delete ControlPtr;
+   }
+
+/* Control thread: waits for a line on the standard input or the end of   */
+/* the monitor.                                                              */
+/* -----------------------------------------------------------------------   */
+static MIL_UINT32 MFTYPE ControlThread(void* ThreadContext)
+   {
+   ControlStruct* ControlPtr = (ControlStruct*)ThreadContext;
+   bool           Keyboard   = ControlPtr->WatchKeyboard;
+
+   for(;;)
+      {
+      pollfd Fds[2];
+
+      Fds[0].fd     = ControlPtr->QuitFd;
+      Fds[1].fd     = STDIN_FILENO;
+      Fds[0].events = Fds[1].events = POLLIN;
+
+      if(poll(Fds, Keyboard ? 2 : 1, -1) < 0)
+         continue;
+      if(Fds[0].revents)
+         break;
+
+      if(Keyboard && Fds[1].revents)
+         {
+         char    Line[256];
+         ssize_t Size = read(STDIN_FILENO, Line, sizeof(Line));
+
+         /* No terminal after all: the standard input is closed. */
+         if(Size <= 0)
+            Keyboard = false;
+         else
+            ControlRequestStop(ControlPtr, 0);
+         }
+      }
+
+   return 0;
+   }
+
+#else
+
+static ControlStruct* g_ControlPtr = M_NULL;
+
+/* Ctrl+C stands for SIGINT, Ctrl+Break, closing the console, logging off */
+/* and shutting down for SIGTERM.                                            */
+/* -----------------------------------------------------------------------   */
+static BOOL WINAPI ConsoleHandler(DWORD ControlType)
+   {
+   if(!g_ControlPtr)
+      return FALSE;
+   ControlRequestStop(g_ControlPtr, ControlType == CTRL_C_EVENT ? SIGINT : SIGTERM);
+   return TRUE;
+   }
+
+void ControlInitSignals(void)
+   {
+   }
+
+ControlStruct* ControlAlloc(MIL_ID WakeEvent, bool WatchKeyboard)
+   {
+   ControlStruct* ControlPtr = new ControlStruct;
+
+   ControlPtr->WakeEvent     = WakeEvent;
+   ControlPtr->WatchKeyboard = WatchKeyboard;
+   ControlPtr->StopRequested = false;
+   ControlPtr->StopSignal    = 0;
+   ControlPtr->QuitEvent     = CreateEvent(M_NULL, TRUE, FALSE, M_NULL);
+
+   g_ControlPtr = ControlPtr;
+   SetConsoleCtrlHandler(ConsoleHandler, TRUE);
+   MthrAlloc(M_DEFAULT_HOST, M_THREAD, M_DEFAULT, &ControlThread, ControlPtr,
+      &ControlPtr->Thread);
+
+   return ControlPtr;
+   }
+
+void ControlFree(ControlStruct* ControlPtr)
+   {
+   if(!ControlPtr)
+      return;
+
+   SetConsoleCtrlHandler(ConsoleHandler, FALSE);
+   g_ControlPtr = M_NULL;
+   SetEvent((HANDLE)ControlPtr->QuitEvent);
+   MthrWait(ControlPtr->Thread, M_THREAD_END_WAIT, M_NULL);
+   MthrFree(ControlPtr->Thread);
+   CloseHandle((HANDLE)ControlPtr->QuitEvent);
+
+   delete ControlPtr;
+   }
+
+/* Control thread: the console input is signaled by any input event; the   */
+/* events other than a key are discarded.                                   */
+/* -----------------------------------------------------------------------   */
+static MIL_UINT32 MFTYPE ControlThread(void* ThreadContext)
+   {
+   ControlStruct* ControlPtr = (ControlStruct*)ThreadContext;
+   HANDLE         Handles[2] = { (HANDLE)ControlPtr->QuitEvent,
+                                 GetStdHandle(STD_INPUT_HANDLE) };
+
+   for(;;)
+      {
+      DWORD Result = WaitForMultipleObjects(ControlPtr->WatchKeyboard ? 2 : 1, Handles, FALSE,
+                                            INFINITE);
+
+      if(Result != WAIT_OBJECT_0 + 1)
+         break;
+      if(MosKbhit())
+         {
+         MosGetch();
+         ControlRequestStop(ControlPtr, 0);
+         }
+      else
+         FlushConsoleInputBuffer(Handles[1]);
+      }
+
+   return 0;
+   }
+
+#endif
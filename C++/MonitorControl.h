@@ -0,0 +1,52 @@
+﻿/*************************************************************************************/
+/*
+ * File name: MonitorControl.h
+ *
+ * Synopsis:  Stop requests of the main thread. A control thread waits for the
+ *            stop signals (SIGINT, SIGTERM) and, when the monitor runs in a
+ *            terminal, for <Enter>; it sets StopRequested and the event the main
+ *            thread sleeps on, so that the main thread never polls: it is woken
+ *            up by the hooks (data format change, pool built, first frame), by
+ *            the control thread, or when its next periodic task is due (see
+ *            ControlWait()).
+ *
+ *            Linux: the stop signals are blocked in every thread by
+ *            ControlInitSignals(), called before any thread is created, and
+ *            read from a signalfd by a signal thread that lasts as long as the
+ *            process. While a control thread is allocated, they request the
+ *            stop; before and after, they end the process as they would by
+ *            default, so that Ctrl+C still works during the setup and the
+ *            prompts.
+ *            Windows: the console control handler stands for the signals, and
+ *            is only installed while a control thread is allocated.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef MONITOR_CONTROL_H
+#define MONITOR_CONTROL_H
+
+#include <mil.h>
+#include <atomic>
+
+typedef struct
+   {
+   MIL_ID            WakeEvent;        /* Event the main thread waits on.          */
+   bool              WatchKeyboard;    /* <Enter> stops the monitor.               */
+   std::atomic<bool> StopRequested;
+   std::atomic<int>  StopSignal;       /* Signal that stopped the monitor, or 0.   */
+   MIL_ID            Thread;
+#if M_MIL_USE_WINDOWS
+   void*             QuitEvent;        /* Ends the control thread.                 */
+#else
+   int               QuitFd;           /* eventfd, ends the control thread.        */
+#endif
+   } ControlStruct;
+
+void ControlInitSignals(void);
+ControlStruct* ControlAlloc(MIL_ID WakeEvent, bool WatchKeyboard);
+void ControlFree(ControlStruct* ControlPtr);
+void ControlRequestStop(ControlStruct* ControlPtr, int Signal);
+void ControlWait(ControlStruct* ControlPtr, MIL_DOUBLE WakeTime);
+
+#endif /* MONITOR_CONTROL_H */
@@ -0,0 +1,482 @@
+﻿/*************************************************************************************/
+/*
+ * File name: MultiStream.cpp
+ *
+ * Synopsis:  Multi-stream mode: monitors several multicast streams from one
+ *            process. Each stream has its own acquisition (digitizer, native
+ *            receiver or synthetic source), grab buffers, statistics and display;
+ *            the streams share the worker pipeline, in which each has a lane the
+ *            workers take the frames from in turn so that a high-rate stream does
+ *            not starve the others, the pixel conversion threads and the memory
+ *            budget of the grab queues.
+ *
+ *            The node of the NIC each stream is received on is looked up, the
+ *            receive thread of the native backend is bound to it, and the workers
+ *            are spread over the nodes of the streams and take the frames of the
+ *            streams of their node first.
+ *
+ *            The streams run without prompts until the run duration elapses or a
+ *            key is pressed, and a table of the streams is printed periodically.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <mil.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "MulticastMonitor.h"
+
+/* Per-stream state of the run, besides its hook data. */
+typedef struct
+   {
+   HookDataStruct*      HookDataPtr;
+   GvspSimulatorStruct* SimulatorPtr;
+   MIL_INT              NumaNode;
+   std::string          Interface;
+   MIL_INT64            LastFrameCount;
+   } StreamStateStruct;
+
+/* Parses <ip>:<port>[:<device>[:<dcf>]]. The device is the number n of    */
+/* M_DEV0 + n, empty for the position of the stream. The DCF is the rest of */
+/* the entry, which may hold colons of its own.                              */
+/* -----------------------------------------------------------------------   */
+bool ParseStreamEntry(const MIL_STRING& Value, StreamEntryStruct* EntryPtr)
+   {
+   size_t PortStart = Value.find(MIL_TEXT(':'));
+   size_t DeviceStart, DcfStart;
+
+   if(PortStart == MIL_STRING::npos || PortStart == 0)
+      return false;
+   DeviceStart = Value.find(MIL_TEXT(':'), PortStart + 1);
+   DcfStart    = DeviceStart == MIL_STRING::npos ? MIL_STRING::npos :
+                                                   Value.find(MIL_TEXT(':'), DeviceStart + 1);
+
+   EntryPtr->MulticastAddress = Value.substr(0, PortStart);
+   EntryPtr->UdpPort          = (MIL_INT)std::stoll(Value.substr(PortStart + 1,
+                                   DeviceStart == MIL_STRING::npos ? MIL_STRING::npos :
+                                   DeviceStart - PortStart - 1));
+   EntryPtr->DeviceNumber     = -1;
+   if(DeviceStart != MIL_STRING::npos && DeviceStart + 1 != DcfStart &&
+      DeviceStart + 1 < Value.size())
+      {
+      MIL_STRING Device = Value.substr(DeviceStart + 1, DcfStart == MIL_STRING::npos ?
+                                       MIL_STRING::npos : DcfStart - DeviceStart - 1);
+
+      if(Device.find_first_not_of(MIL_TEXT("0123456789")) != MIL_STRING::npos)
+         return false;
+      EntryPtr->DeviceNumber = (MIL_INT)std::stoll(Device);
+      if(EntryPtr->DeviceNumber >= STREAM_DEVICE_MAX)
+         return false;
+      }
+   EntryPtr->DcfName          = DcfStart == MIL_STRING::npos ? MIL_STRING() :
+                                                              Value.substr(DcfStart + 1);
+   return EntryPtr->UdpPort > 0 && EntryPtr->UdpPort < 65536;
+   }
+
+/* Gives the streams without a device the one of their position, and checks */
+/* that no two streams of the MIL backend are on the same device.            */
+/* -----------------------------------------------------------------------   */
+bool AssignStreamDevices(std::vector<StreamEntryStruct>* StreamsPtr, bool MilBackend)
+   {
+   std::vector<StreamEntryStruct>& Streams = *StreamsPtr;
+
+   for(size_t i = 0; i < Streams.size(); i++)
+      {
+      if(Streams[i].DeviceNumber < 0)
+         Streams[i].DeviceNumber = (MIL_INT)i;
+      }
+   for(size_t i = 0; MilBackend && i < Streams.size(); i++)
+      {
+      for(size_t j = 0; j < i; j++)
+         {
+         if(Streams[j].DeviceNumber == Streams[i].DeviceNumber)
+            {
+            MosPrintf(MIL_TEXT("Streams %lld and %lld are both on device %lld.\n"),
+               (long long)j, (long long)i, (long long)Streams[i].DeviceNumber);
+            return false;
+            }
+         }
+      }
+   return true;
+   }
+
+/* Reads a stream list: one entry per line, blank lines and # comments     */
+/* ignored.                                                                  */
+/* -----------------------------------------------------------------------   */
+bool LoadStreamList(const MIL_STRING& Path, std::vector<StreamEntryStruct>* StreamsPtr)
+   {
+   std::string FilePath(Path.begin(), Path.end());
+   FILE*       File = fopen(FilePath.c_str(), "r");
+   char        Line[1024];
+   bool        Valid = true;
+
+   if(!File)
+      {
+      MosPrintf(MIL_TEXT("Could not open the stream list %s.\n"), Path.c_str());
+      return false;
+      }
+
+   while(Valid && fgets(Line, sizeof(Line), File))
+      {
+      std::string       Text(Line);
+      size_t            Comment = Text.find('#');
+      size_t            First, Last;
+      StreamEntryStruct Entry;
+
+      if(Comment != std::string::npos)
+         Text.resize(Comment);
+      First = Text.find_first_not_of(" \t\r\n");
+      if(First == std::string::npos)
+         continue;
+      Last = Text.find_last_not_of(" \t\r\n");
+      Text = Text.substr(First, Last - First + 1);
+
+      try
+         {
+         Valid = ParseStreamEntry(MIL_STRING(Text.begin(), Text.end()), &Entry);
+         }
+      catch(...)
+         {
+         Valid = false;
+         }
+      if(Valid)
+         StreamsPtr->push_back(Entry);
+      else
+         MosPrintf(MIL_TEXT("Invalid stream in %s: %s\n"), Path.c_str(),
+            MIL_STRING(Text.begin(), Text.end()).c_str());
+      }
+
+   fclose(File);
+   return Valid;
+   }
+
+/* Allocates the acquisition and the buffers of a stream. Returns false if  */
+/* the stream cannot be received.                                            */
+/* -----------------------------------------------------------------------   */
+static bool OpenStream(MIL_ID MilSystem, const MonitorOptionsStruct* OptionsPtr,
+                       const StreamEntryStruct* EntryPtr, StreamStateStruct* StatePtr)
+   {
+   HookDataStruct* HookDataPtr = StatePtr->HookDataPtr;
+   MIL_STRING      MulticastAddr = EntryPtr->MulticastAddress;
+   MIL_INT         PortNumber    = EntryPtr->UdpPort;
+
+   if(!HookDataPtr->Headless)
+      MdispAlloc(MilSystem, M_DEFAULT, MIL_TEXT("M_DEFAULT"), M_DEFAULT,
+         &HookDataPtr->MilDisplay);
+
+   HookDataPtr->MulticastAddress = MulticastAddr;
+   if(HookDataPtr->Backend == eAcquisitionSynthetic)
+      {
+      HookDataPtr->FrameSizeX       = OptionsPtr->SourceConfig.SizeX;
+      HookDataPtr->FrameSizeY       = OptionsPtr->SourceConfig.SizeY;
+      HookDataPtr->FramePixelFormat = OptionsPtr->SourceConfig.PixelFormat;
+      HookDataPtr->DeviceVendor     = MIL_TEXT("Synthetic");
+      HookDataPtr->DeviceModel      = MIL_TEXT("source");
+      }
+   else if(HookDataPtr->Backend == eAcquisitionNative)
+      {
+      HookDataPtr->Receiver = GvspReceiverAlloc(MulticastAddr, PortNumber, HookDataPtr);
+      if(!HookDataPtr->Receiver)
+         return false;
+      HookDataPtr->Receiver->NumaNode = StatePtr->NumaNode;
+
+      HookDataPtr->FrameSizeX       = OptionsPtr->SourceConfig.SizeX;
+      HookDataPtr->FrameSizeY       = OptionsPtr->SourceConfig.SizeY;
+      HookDataPtr->FramePixelFormat = OptionsPtr->SourceConfig.PixelFormat;
+      HookDataPtr->DeviceVendor     = MIL_TEXT("GVSP");
+      HookDataPtr->DeviceModel      = MIL_TEXT("native receiver");
+      HookDataPtr->PackedRows       = true;
+      }
+   else
+      {
+      /* One monitor digitizer per device; the multicast info of the entry */
+      /* overrides that of the DCF.                                         */
+      MappControl(M_DEFAULT, M_ERROR, M_PRINT_DISABLE);
+      MdigAlloc(MilSystem, M_DEV0 + EntryPtr->DeviceNumber,
+         EntryPtr->DcfName.empty() ? MIL_TEXT("gigevision_multicast_monitor.dcf") :
+                                     EntryPtr->DcfName.c_str(),
+         M_GC_MULTICAST_MONITOR, &HookDataPtr->MilDigitizer);
+      MappControl(M_DEFAULT, M_ERROR, M_PRINT_ENABLE);
+      if(!HookDataPtr->MilDigitizer)
+         {
+         MosPrintf(MIL_TEXT("Stream %lld: could not allocate the monitor digitizer of ")
+                   MIL_TEXT("device %lld.\n"), (long long)HookDataPtr->StreamIndex,
+                   (long long)EntryPtr->DeviceNumber);
+         return false;
+         }
+
+      MdigControl(HookDataPtr->MilDigitizer, M_GC_PACKET_RESEND, M_ENABLE);
+      MdigInquire(HookDataPtr->MilDigitizer, M_GC_PIXEL_FORMAT, &HookDataPtr->FramePixelFormat);
+      MdigControl(HookDataPtr->MilDigitizer, M_GC_STREAM_CHANNEL_MULTICAST_ADDRESS_STRING,
+         MulticastAddr);
+      MdigControl(HookDataPtr->MilDigitizer, M_GC_LOCAL_STREAM_PORT, PortNumber);
+      MdigControl(HookDataPtr->MilDigitizer, M_GC_UPDATE_MULTICAST_INFO, M_DEFAULT);
+      MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_X, &HookDataPtr->FrameSizeX);
+      MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_Y, &HookDataPtr->FrameSizeY);
+      }
+
+   AllocateGrabBuffers(MilSystem, HookDataPtr);
+   if(HookDataPtr->MilDisplay)
+      MdispSelect(HookDataPtr->MilDisplay, HookDataPtr->MilImageDisp);
+
+   /* Play the role of the multicast master of each stream. */
+   if(OptionsPtr->Simulate && HookDataPtr->Backend != eAcquisitionSynthetic)
+      {
+      SimulatorConfigStruct Config = OptionsPtr->SourceConfig;
+
+      Config.MulticastAddress = MulticastAddr;
+      Config.UdpPort          = PortNumber;
+      StatePtr->SimulatorPtr  = new GvspSimulatorStruct;
+      StatePtr->SimulatorPtr->Thread = M_NULL;
+      if(!GvspSimulatorStart(StatePtr->SimulatorPtr, &Config))
+         {
+         MosPrintf(MIL_TEXT("Stream %lld: could not start the GVSP simulator.\n"),
+                   (long long)HookDataPtr->StreamIndex);
+         return false;
+         }
+      }
+
+   if(!HookDataPtr->Headless && OptionsPtr->DisplayRate > 0)
+      HookDataPtr->Display = DisplayStageAlloc(OptionsPtr->DisplayRate,
+                                               &OptionsPtr->ThreadPlacements[eThreadDisplay],
+                                               HookDataPtr);
+
+   PrintCameraInfo(HookDataPtr);
+   return true;
+   }
+
+/* Frees what OpenStream() allocated.                                        */
+/* -----------------------------------------------------------------------   */
+static void CloseStream(StreamStateStruct* StatePtr)
+   {
+   HookDataStruct* HookDataPtr = StatePtr->HookDataPtr;
+
+   if(StatePtr->SimulatorPtr)
+      {
+      GvspSimulatorStop(StatePtr->SimulatorPtr);
+      delete StatePtr->SimulatorPtr;
+      StatePtr->SimulatorPtr = M_NULL;
+      }
+   FreeHookData(HookDataPtr);
+   delete HookDataPtr;
+   }
+
+/* Prints one line per stream. The frame rate is over the period since the */
+/* last call.                                                                */
+/* -----------------------------------------------------------------------   */
+static void PrintStreamTable(std::vector<StreamStateStruct>& Streams, MIL_DOUBLE Period)
+   {
+   MosPrintf(MIL_TEXT("\nStream  Address               Node    Frames     fps  Corrupt")
+             MIL_TEXT("  Lost pkts  Queue  Buffers\n"));
+   for(size_t i = 0; i < Streams.size(); i++)
+      {
+      HookDataStruct*   HookDataPtr = Streams[i].HookDataPtr;
+      FrameStatsStruct* StatsPtr    = HookDataPtr->Stats;
+      MIL_INT64         FrameCount  = StatsPtr->FrameCount.Value.load();
+      MIL_TEXT_CHAR     Address[IPV4_ADDRESS_SIZE + 8];
+
+      MosSprintf(Address, IPV4_ADDRESS_SIZE + 8, MIL_TEXT("%s:%lld"),
+         HookDataPtr->MulticastAddress.c_str(), (long long)HookDataPtr->SourceConfig.UdpPort);
+      MosPrintf(MIL_TEXT("%6lld  %-21s %4lld %9lld %7.1f %8lld %10lld %6lld %8lld\n"),
+         (long long)i, Address, (long long)Streams[i].NumaNode, (long long)FrameCount,
+         Period > 0 ? (FrameCount - Streams[i].LastFrameCount) / Period : 0.0,
+         (long long)StatsPtr->CorruptCount.Value.load(),
+         (long long)StatsPtr->MissingPacketCount.Value.load(),
+         (long long)(HookDataPtr->Pipeline ?
+                     PipelineQueueDepth(HookDataPtr->Pipeline, HookDataPtr->PipelineLane) :
+                     HookDataPtr->GrabQueue.BuffersInUse.load()),
+         (long long)HookDataPtr->MilGrabBufferListSize);
+      Streams[i].LastFrameCount = FrameCount;
+      }
+   }
+
+/* Monitors all the streams of the options until the run duration elapses  */
+/* or a key is pressed. Returns the exit code of the program.               */
+/* -----------------------------------------------------------------------   */
+int MultiStreamRun(MIL_ID MilSystem, MonitorOptionsStruct* OptionsPtr)
+   {
+   MIL_INT                        StreamCount = (MIL_INT)OptionsPtr->Streams.size();
+   std::vector<StreamStateStruct> Streams((size_t)StreamCount);
+   std::vector<MIL_INT>           WorkerNodes;
+   FramePipelineStruct*           PipelinePtr;
+   PixelConvertPoolStruct*        ConverterPtr;
+   GrabBudgetStruct               Budget;
+   MIL_ID                         Event = M_NULL;
+   ControlStruct*                 ControlPtr;
+   MIL_INT                        WorkerCount = OptionsPtr->WorkerCount;
+   MIL_DOUBLE                     StartTime, LastPrintTime, CurrentTime;
+   bool                           NodesKnown = false;
+   bool                           Opened = true;
+   bool                           Done = false;
+
+   /* Node of the NIC each stream comes in on. */
+   MosPrintf(MIL_TEXT("Monitoring %lld streams (%lld NUMA node(s)).\n"),
+      (long long)StreamCount, (long long)CpuTopologyNodeCount());
+   for(MIL_INT i = 0; i < StreamCount; i++)
+      {
+      const StreamEntryStruct* EntryPtr = &OptionsPtr->Streams[(size_t)i];
+      StreamStateStruct*       StatePtr = &Streams[(size_t)i];
+
+      StatePtr->HookDataPtr    = M_NULL;
+      StatePtr->SimulatorPtr   = M_NULL;
+      StatePtr->LastFrameCount = 0;
+      StatePtr->NumaNode       = CPU_NODE_UNKNOWN;
+      if(OptionsPtr->Backend != eAcquisitionSynthetic)
+         {
+         StatePtr->Interface = CpuTopologyRouteInterface(EntryPtr->MulticastAddress,
+                                                         EntryPtr->UdpPort);
+         StatePtr->NumaNode  = CpuTopologyInterfaceNode(StatePtr->Interface);
+         }
+      NodesKnown = NodesKnown || StatePtr->NumaNode != CPU_NODE_UNKNOWN;
+      MosPrintf(MIL_TEXT("Stream %lld: %s:%lld, interface %s, node %lld.\n"), (long long)i,
+         EntryPtr->MulticastAddress.c_str(), (long long)EntryPtr->UdpPort,
+         StatePtr->Interface.empty() ? MIL_TEXT("?") :
+            MIL_STRING(StatePtr->Interface.begin(), StatePtr->Interface.end()).c_str(),
+         (long long)StatePtr->NumaNode);
+      }
+
+   /* The workers are shared; by default one per stream, spread over the   */
+   /* nodes as the streams are.                                             */
+   if(WorkerCount <= 0)
+      WorkerCount = StreamCount < PIPELINE_WORKER_MAX ? StreamCount : PIPELINE_WORKER_MAX;
+   for(MIL_INT i = 0; i < WorkerCount; i++)
+      WorkerNodes.push_back(Streams[(size_t)(i % StreamCount)].NumaNode);
+   PipelinePtr = PipelineAlloc(MilSystem, WorkerCount, NodesKnown ? &WorkerNodes[0] : M_NULL,
+                               &OptionsPtr->ThreadPlacements[eThreadWorker]);
+
+   PixelConvertSetIsa(OptionsPtr->ConvertIsa);
+   ConverterPtr = PixelConvertPoolAlloc((uint32_t)OptionsPtr->ConvertThreadCount);
+
+   /* A single budget for the grab buffers of all the streams. */
+   Budget.Total        = OptionsPtr->MemoryBudget;
+   Budget.StreamCount  = StreamCount;
+   Budget.Reserved     = 0;
+   Budget.WaitingCount = StreamCount;
+
+   /* A single event wakes up the main thread for all the streams. */
+   MthrAlloc(MilSystem, M_EVENT, M_NOT_SIGNALED+M_AUTO_RESET, M_NULL, M_NULL, &Event);
+
+   for(MIL_INT i = 0; i < StreamCount && Opened; i++)
+      {
+      StreamStateStruct* StatePtr = &Streams[(size_t)i];
+      HookDataStruct*    HookDataPtr = new HookDataStruct;
+      std::string        StatsPath = OptionsPtr->StatsPath;
+
+      if(!StatsPath.empty())
+         StatsPath += "-" + std::to_string((long long)i);
+      InitHookData(HookDataPtr, OptionsPtr, StatsPath);
+      HookDataPtr->StreamIndex             = i;
+      HookDataPtr->Interactive             = false;
+      HookDataPtr->SourceConfig.UdpPort    = OptionsPtr->Streams[(size_t)i].UdpPort;
+      HookDataPtr->Event                   = Event;
+      HookDataPtr->Converter               = ConverterPtr;
+      HookDataPtr->Pipeline                = PipelinePtr;
+      HookDataPtr->PipelineLane            = PipelineAddLane(PipelinePtr, HookDataPtr,
+                                                             StatePtr->NumaNode);
+      if(Budget.Total > 0)
+         GrabQueueShareBudget(&HookDataPtr->GrabQueue, &Budget);
+      HookDataPtr->PoolCache = PoolCacheAlloc(MilSystem,
+         (HookDataPtr->Headless ? 0 : POOL_DISPLAY_BUFFER) +
+         (OptionsPtr->HugePages ? POOL_HUGE_PAGES : 0) +
+         (OptionsPtr->LockMemory ? POOL_LOCKED_MEMORY : 0), StatePtr->NumaNode, Event,
+         &HookDataPtr->GrabQueue);
+      StatePtr->HookDataPtr = HookDataPtr;
+
+      /* One frame share per stream, named after it. */
+      if(!OptionsPtr->SharePath.empty())
+         {
+         HookDataPtr->Share = FrameShareAlloc(OptionsPtr->SharePath + "-" +
+                                              std::to_string((long long)i),
+                                              OptionsPtr->ShareSlotCount,
+                                              OptionsPtr->ShareFrameBytes);
+         if(!HookDataPtr->Share)
+            {
+            Opened = false;
+            break;
+            }
+         }
+
+      Opened = OpenStream(MilSystem, OptionsPtr, &OptionsPtr->Streams[(size_t)i], StatePtr);
+      }
+
+   if(Opened)
+      {
+      ControlPtr = ControlAlloc(Event, !OptionsPtr->Daemon);
+      for(MIL_INT i = 0; i < StreamCount; i++)
+         StartAcquisition(Streams[(size_t)i].HookDataPtr);
+      if(!OptionsPtr->Daemon)
+         MosPrintf(MIL_TEXT("\nPress <Enter> to stop.\n"));
+
+      /* As AdaptToDataFormatChange(), the loop sleeps until an event or the */
+      /* next periodic task of a stream, the table or the end of the run.   */
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &StartTime);
+      LastPrintTime = StartTime;
+      do
+         {
+         MIL_DOUBLE WakeTime = LastPrintTime + OptionsPtr->StatsPeriod;
+
+         for(MIL_INT i = 0; i < StreamCount; i++)
+            {
+            MIL_DOUBLE StreamTime = NextServiceTime(Streams[(size_t)i].HookDataPtr);
+
+            if(StreamTime > 0 && StreamTime < WakeTime)
+               WakeTime = StreamTime;
+            }
+         if(OptionsPtr->RunDuration > 0 && StartTime + OptionsPtr->RunDuration < WakeTime)
+            WakeTime = StartTime + OptionsPtr->RunDuration;
+         ControlWait(ControlPtr, WakeTime);
+
+         for(MIL_INT i = 0; i < StreamCount; i++)
+            ServiceDataFormatChange(MilSystem, Streams[(size_t)i].HookDataPtr);
+
+         MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &CurrentTime);
+         if(CurrentTime - LastPrintTime >= OptionsPtr->StatsPeriod)
+            {
+            PrintStreamTable(Streams, CurrentTime - LastPrintTime);
+            LastPrintTime = CurrentTime;
+            }
+
+         if(OptionsPtr->RunDuration > 0)
+            Done = (CurrentTime - StartTime) >= OptionsPtr->RunDuration;
+         if(ControlPtr->StopRequested)
+            Done = true;
+         }
+      while(!Done);
+      ControlFree(ControlPtr);
+
+      for(MIL_INT i = 0; i < StreamCount; i++)
+         {
+         if(IsAcquisitionInProgress(Streams[(size_t)i].HookDataPtr))
+            StopAcquisition(Streams[(size_t)i].HookDataPtr);
+         }
+
+      /* Final figures: the frame rates are over the whole run. */
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &CurrentTime);
+      for(MIL_INT i = 0; i < StreamCount; i++)
+         Streams[(size_t)i].LastFrameCount = 0;
+      PrintStreamTable(Streams, CurrentTime - StartTime);
+      PipelinePrintStatistics(PipelinePtr);
+      PrintConversionStatistics(Streams[0].HookDataPtr);
+      for(MIL_INT i = 0; i < StreamCount; i++)
+         {
+         if(Streams[(size_t)i].HookDataPtr->Share)
+            FrameSharePrintStatistics(Streams[(size_t)i].HookDataPtr->Share);
+         PrintOverlayStatistics(Streams[(size_t)i].HookDataPtr);
+         PrintHealthStatistics(Streams[(size_t)i].HookDataPtr);
+         FrameStatsExport(Streams[(size_t)i].HookDataPtr->Stats, true);
+         }
+      }
+
+   /* The workers go first: they hold references to the grab buffers. */
+   PipelineFree(PipelinePtr);
+   for(MIL_INT i = 0; i < StreamCount; i++)
+      {
+      if(Streams[(size_t)i].HookDataPtr)
+         CloseStream(&Streams[(size_t)i]);
+      }
+   PixelConvertPoolFree(ConverterPtr);
+   MthrFree(Event);
+
+   return Opened ? 0 : 1;
+   }
@@ -14,6 +14,12 @@
  *      Note: This example must be used along with the MulticastMaster program
  *            connected to the same GigE Vision device and running on another PC.
  *
+ *            Without a device, -simulate plays the role of the master by sending
+ *            a GVSP stream to the multicast group on the local host, and
+ *            -backend=synthetic generates the frames in-process. A recording made
+ *            with -record can be replayed with -replay. Run with an unknown
+ *            option to list the available options.
+ *
  * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
  * All Rights Reserved
  */
@@ -22,43 +28,25 @@
 #if M_MIL_USE_WINDOWS
 #include <windows.h>
 #endif
-
- /* Number of images in the buffering grab queue.
-    Generally, increasing this number gives better real-time grab.
-  */
-#define BUFFERING_SIZE_MAX 20
-#define IPV4_ADDRESS_SIZE  20
-
-/* User's processing function hook data structure. */
-typedef struct
-   {
-   MIL_ID  MilDigitizer;
-   MIL_ID  MilDisplay;
-   MIL_ID  MilImageDisp;
-   MIL_ID  MilGrabBufferList[BUFFERING_SIZE_MAX];
-   MIL_INT MilGrabBufferListSize;
-   MIL_INT ProcessedImageCount;
-   MIL_INT CorruptImageCount;
-   MIL_INT FrameSizeX;
-   MIL_INT FrameSizeY;
-   MIL_INT FramePixelFormat;
-   bool DataFormatChanged;
-   MIL_INT64 SourceDataFormat;
-   MIL_STRING MulticastAddress;
-   MIL_ID Event;
-   MIL_STRING DeviceVendor;
-   MIL_STRING DeviceModel;
-   } HookDataStruct;
+#include <math.h>
+#include <signal.h>
+#include <chrono>
+#include <string>
+#include "MulticastMonitor.h"
 
 /* Function prototypes.                  */
-void AllocateGrabBuffers(MIL_INT MilSystem, HookDataStruct* HookDataPtr);
-void FreeGrabBuffers(HookDataStruct* HookDataPtr);
-void AdaptToDataFormatChange(MIL_INT MilSystem, HookDataStruct* HookDataPtr);
-void PrintCameraInfo(HookDataStruct* HookDataPtr);
-MIL_INT MFTYPE ProcessingFunction(MIL_INT HookType,
-                                  MIL_ID HookId,
-                                  void* HookDataPtr);
+void AdaptToDataFormatChange(MIL_INT MilSystem, HookDataStruct* HookDataPtr,
+                             ControlStruct* ControlPtr);
+void SwitchBufferPool(MIL_INT MilSystem, HookDataStruct* HookDataPtr,
+                      BufferPoolStruct* PoolPtr, bool FromCache);
+void PrintFormatSwitch(HookDataStruct* HookDataPtr);
+void FreeMonitor(MIL_ID MilApplication, MIL_ID MilSystem, HookDataStruct* HookDataPtr);
 void GetMulticastInfo(MIL_STRING& oMulticastAddress, MIL_INT& oUdpPort);
+void GetNativeMulticastInfo(MIL_ID MilSystem, MIL_INT SystemType,
+                            const MonitorOptionsStruct* OptionsPtr, bool Interactive,
+                            MIL_STRING& oMulticastAddress, MIL_INT& oUdpPort);
+bool ParseCommandLine(int argc, MIL_TEXT_CHAR* argv[], MonitorOptionsStruct* OptionsPtr);
+void PrintUsage(void);
 
 // need link with Ws2_32.lib
 #pragma comment(lib, "Ws2_32.lib")
@@ -66,156 +54,965 @@ void GetMulticastInfo(MIL_STRING& oMulticastAddress, MIL_INT& oUdpPort);
 /* Main function. */
 /* ---------------*/
 
-int MosMain(void)
+int MosMain(int argc, MIL_TEXT_CHAR* argv[])
 {
    MIL_ID MilApplication;
    MIL_ID MilSystem     ;
    MIL_INT ProcessFrameCount  = 0;
-   MIL_INT DigProcessInProgress = M_FALSE;
    MIL_INT SystemType = 0;
    MIL_DOUBLE ProcessFrameRate= 0;
    HookDataStruct UserHookData;
+   MonitorOptionsStruct Options;
+   GvspSimulatorStruct Simulator;
+   bool SimulatorStarted = true;
    MIL_STRING MulticastAddr;
    MIL_INT PortNumber = 0;
+   MIL_INT NumaNode = CPU_NODE_UNKNOWN;
+   ControlStruct* Control;
+   int StopSignal;
+   std::chrono::steady_clock::time_point LaunchClock = std::chrono::steady_clock::now();
+
+   /* The stop signals are read by the signal thread, see MonitorControl.h. */
+   ControlInitSignals();
+
+   /* Parse the command line. */
+   if(!ParseCommandLine(argc, argv, &Options))
+      {
+      PrintUsage();
+      return 1;
+      }
 
    /* Allocate defaults. */
    MappAllocDefault(M_DEFAULT, &MilApplication, &MilSystem, M_NULL, M_NULL, M_NULL);
 
-   /* This example only runs on a MIL GigE Vision system type. */
+   /* The start of the monitor in the time of MappTimer, for the time to first frame. */
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &Options.LaunchTime);
+   Options.LaunchTime -= std::chrono::duration<MIL_DOUBLE>(std::chrono::steady_clock::now() -
+                                                           LaunchClock).count();
+
+   /* This example only runs on a MIL GigE Vision system type, unless the frames */
+   /* come from another backend than the MIL digitizer.                          */
    MsysInquire(MilSystem, M_SYSTEM_TYPE, &SystemType);
-   if(SystemType != M_SYSTEM_GIGE_VISION_TYPE)
+   if(SystemType != M_SYSTEM_GIGE_VISION_TYPE && Options.Backend == eAcquisitionMil)
       {
       MosPrintf(MIL_TEXT("This example requires a M_GIGE_VISION system type.\n"));
       MosPrintf(MIL_TEXT("Please change system type in milconfig.\n"));
-      MosPrintf(MIL_TEXT("\nPress <Enter> to quit.\n"));
-      MosGetch();
-      MappFreeDefault(MilApplication, MilSystem, M_NULL, M_NULL, M_NULL);
+      if(Options.RunDuration == 0 && !Options.Daemon)
+         {
+         MosPrintf(MIL_TEXT("\nPress <Enter> to quit.\n"));
+         MosGetch();
+         }
+      FreeMonitor(MilApplication, MilSystem, M_NULL);
       return 0;
       }
       
-   /* Print message and instructions. */
-   MosPrintf(MIL_TEXT("This example demonstrates the use of IP Multicast with GigE Vision "));
-   MosPrintf(MIL_TEXT("devices.\n"));
-   MosPrintf(MIL_TEXT("It allocates a monitor digitizer that can grab from a GigE Vision\n"));
-   MosPrintf(MIL_TEXT("device provided a Multicast master digitizer is allocated on the "));
-   MosPrintf(MIL_TEXT("same device.\n\n"));
-   MosPrintf(MIL_TEXT("This example must be used along with MulticastMaster.cpp connected "));
-   MosPrintf(MIL_TEXT("to the same\n"));
-   MosPrintf(MIL_TEXT("GigE Vision device and running on another PC.\n\n"));   
-   MosPrintf(MIL_TEXT("A monitor Multicast digitizer does not have read access to the GigE "));
-   MosPrintf(MIL_TEXT("Vision\n"));   
-   MosPrintf(MIL_TEXT("device. Because of this some manual configuration of the digitizer "));
-   MosPrintf(MIL_TEXT("is required.\n\n"));
-   MosPrintf(MIL_TEXT("Press <Enter> to continue.\n"));
-   MosGetch();
+   /* The benchmark suite runs on its own synthetic streams. */
+   if(!Options.BenchPath.empty())
+      {
+      int Status = MonitorBenchRun(MilSystem, &Options);
+
+      FreeMonitor(MilApplication, MilSystem, M_NULL);
+      return Status;
+      }
+
+   /* Several streams are monitored by MultiStreamRun(). */
+   if(!Options.Streams.empty())
+      {
+      int Status = MultiStreamRun(MilSystem, &Options);
+
+      FreeMonitor(MilApplication, MilSystem, M_NULL);
+      return Status;
+      }
+
+   /* Initialize the User's processing function data structure. */
+   InitHookData(&UserHookData, &Options, Options.StatsPath);
+   Simulator.Thread = M_NULL;
+
+   /* Print message and instructions, unless in daemon mode. */
+   if(!Options.Daemon)
+      {
+      MosPrintf(MIL_TEXT("This example demonstrates the use of IP Multicast with GigE Vision "));
+      MosPrintf(MIL_TEXT("devices.\n"));
+      MosPrintf(MIL_TEXT("It allocates a monitor digitizer that can grab from a GigE Vision\n"));
+      MosPrintf(MIL_TEXT("device provided a Multicast master digitizer is allocated on the "));
+      MosPrintf(MIL_TEXT("same device.\n\n"));
+      MosPrintf(MIL_TEXT("This example must be used along with MulticastMaster.cpp connected "));
+      MosPrintf(MIL_TEXT("to the same\n"));
+      MosPrintf(MIL_TEXT("GigE Vision device and running on another PC.\n\n"));
+      MosPrintf(MIL_TEXT("A monitor Multicast digitizer does not have read access to the GigE "));
+      MosPrintf(MIL_TEXT("Vision\n"));
+      MosPrintf(MIL_TEXT("device. Because of this some manual configuration of the digitizer "));
+      MosPrintf(MIL_TEXT("is required.\n\n"));
+      }
+   if(UserHookData.Interactive)
+      {
+      MosPrintf(MIL_TEXT("Press <Enter> to continue.\n"));
+      MosGetch();
+      }
+
+   /* The native receiver joins the multicast group itself. */
+   if(UserHookData.Backend == eAcquisitionNative)
+      {
+      GetNativeMulticastInfo(MilSystem, SystemType, &Options, UserHookData.Interactive,
+         MulticastAddr, PortNumber);
+      UserHookData.Receiver = GvspReceiverAlloc(MulticastAddr, PortNumber, &UserHookData);
+      if(!UserHookData.Receiver)
+         {
+         FreeMonitor(MilApplication, MilSystem, &UserHookData);
+         return 1;
+         }
+      }
+
+   /* The replay source maps the recording. */
+   if(UserHookData.Backend == eAcquisitionReplay)
+      {
+      UserHookData.Replay = FrameReplayAlloc(Options.ReplayPath, Options.ReplayPacing,
+                                             Options.ReplayRate, &UserHookData);
+      if(!UserHookData.Replay)
+         {
+         FreeMonitor(MilApplication, MilSystem, &UserHookData);
+         return 1;
+         }
+      }
+
+   /* Record mode: every grabbed frame is streamed to disk. */
+   if(!Options.RecordPath.empty())
+      {
+      UserHookData.Recorder = FrameRecorderAlloc(Options.RecordPath, Options.RecordRingSize);
+      if(!UserHookData.Recorder)
+         {
+         FreeMonitor(MilApplication, MilSystem, &UserHookData);
+         return 1;
+         }
+      }
+
+   /* Share mode: the processed frames are published to local consumers. */
+   if(!Options.SharePath.empty())
+      {
+      UserHookData.Share = FrameShareAlloc(Options.SharePath, Options.ShareSlotCount,
+                                           Options.ShareFrameBytes);
+      if(!UserHookData.Share)
+         {
+         FreeMonitor(MilApplication, MilSystem, &UserHookData);
+         return 1;
+         }
+      }
 
    /* Allocate synchronization event. */
    MthrAlloc(MilSystem, M_EVENT, M_NOT_SIGNALED+M_AUTO_RESET, M_NULL, M_NULL,
       &UserHookData.Event);
 
+   /* The grab buffers, and the native receiver, are placed on the node of */
+   /* the NIC of the stream, if its multicast address is known by now.     */
+   if(UserHookData.Backend == eAcquisitionNative)
+      NumaNode = CpuTopologyInterfaceNode(CpuTopologyRouteInterface(MulticastAddr, PortNumber));
+   else if(UserHookData.Backend == eAcquisitionMil && !Options.MulticastAddress.empty())
+      NumaNode = CpuTopologyInterfaceNode(CpuTopologyRouteInterface(Options.MulticastAddress,
+                                                                    Options.UdpPort));
+   if(UserHookData.Receiver)
+      UserHookData.Receiver->NumaNode = NumaNode;
+   if(NumaNode != CPU_NODE_UNKNOWN)
+      MosPrintf(MIL_TEXT("The stream is received on NUMA node %lld.\n\n"), (long long)NumaNode);
+
+   /* Buffer pools of new data formats are built in the background. */
+   UserHookData.PoolCache = PoolCacheAlloc(MilSystem,
+      (UserHookData.Headless ? 0 : POOL_DISPLAY_BUFFER) +
+      (Options.HugePages ? POOL_HUGE_PAGES : 0) +
+      (Options.LockMemory ? POOL_LOCKED_MEMORY : 0), NumaNode, UserHookData.Event,
+      &UserHookData.GrabQueue);
+
+   /* Start the worker threads that process the frames outside of the hook. */
+   if(Options.WorkerCount > 0)
+      {
+      UserHookData.Pipeline     = PipelineAlloc(MilSystem, Options.WorkerCount, M_NULL,
+                                                &Options.ThreadPlacements[eThreadWorker]);
+      UserHookData.PipelineLane = PipelineAddLane(UserHookData.Pipeline, &UserHookData,
+                                                  NumaNode);
+      }
+
+   /* Pixel conversion kernels and the threads that share their rows. */
+   PixelConvertSetIsa(Options.ConvertIsa);
+   UserHookData.Converter = PixelConvertPoolAlloc((uint32_t)Options.ConvertThreadCount);
+
    /* Allocate a display and buffers. */
-   MdispAlloc(MilSystem, M_DEFAULT, MIL_TEXT("M_DEFAULT"), M_DEFAULT,
-      &UserHookData.MilDisplay);
-
-   /* Allocate a monitor Multicast digitizer.                                        */
-   /* The default gigevision_multicast_monitor.dcf sets the following parameters:    */
-   /* SizeX: 640                                                                     */
-   /* SizeY: 480                                                                     */
-   /* PixelFormat: Mono8                                                             */
-   /*                                                                                */
-   /* This example will override these default setting after the first grab has been */
-   /* made. The MdigProcess hook function will compare these default settings with   */
-   /* the settings of the currently grabbed frame. If needed an event will be set    */
-   /* will momentarily stop the grab apply the new settings, re-allocate grab buffers*/
-   /* and resume grabbing.                                                           */
-   MdigAlloc(MilSystem, M_DEFAULT, MIL_TEXT("gigevision_multicast_monitor.dcf"),
-      M_GC_MULTICAST_MONITOR, &UserHookData.MilDigitizer);
-
-   /* Allocate buffers. */
-   AllocateGrabBuffers(MilSystem, &UserHookData);
-   MdispSelect(UserHookData.MilDisplay, UserHookData.MilImageDisp);
-
-   /* Manual digitizer configuration */
-   
-   /* If the GigE Vision device supports packet resends and the user wants to use      */
-   /* packet resends on the monitor enable it manually.                                */
-   MdigControl(UserHookData.MilDigitizer, M_GC_PACKET_RESEND, M_ENABLE);
-
-   /* Inquire the pixel format as specified from the DCF. */
-   MdigInquire(UserHookData.MilDigitizer, M_GC_PIXEL_FORMAT, &UserHookData.FramePixelFormat);
-
-   /* Validate if the gigevision_multicast_monitor.dcf has multicast parameters set.   */
-   MdigInquire(UserHookData.MilDigitizer, M_GC_STREAM_CHANNEL_MULTICAST_ADDRESS_STRING,
-      MulticastAddr);
-   MdigInquire(UserHookData.MilDigitizer, M_GC_LOCAL_STREAM_PORT, &PortNumber);
-   if(MulticastAddr == MIL_TEXT("0.0.0.0") || PortNumber == 0)
-      {
-      /* No multicast info found. Ask the user for the Multicast IP address and UDP    */
-      /* port number to use.                                                           */
-      GetMulticastInfo(MulticastAddr, PortNumber);   
-      /* Pass the Multicast IP addresss and UDP port number to MIL and apply the settings.*/
-      MdigControl(UserHookData.MilDigitizer, M_GC_STREAM_CHANNEL_MULTICAST_ADDRESS_STRING,
+   if(!UserHookData.Headless)
+      MdispAlloc(MilSystem, M_DEFAULT, MIL_TEXT("M_DEFAULT"), M_DEFAULT,
+         &UserHookData.MilDisplay);
+
+   if(UserHookData.Backend == eAcquisitionSynthetic)
+      {
+      /* The synthetic source has no digitizer; the buffers follow the simulated */
+      /* stream format.                                                          */
+      UserHookData.FrameSizeX       = Options.SourceConfig.SizeX;
+      UserHookData.FrameSizeY       = Options.SourceConfig.SizeY;
+      UserHookData.FramePixelFormat = Options.SourceConfig.PixelFormat;
+      UserHookData.DeviceVendor     = MIL_TEXT("Synthetic");
+      UserHookData.DeviceModel      = MIL_TEXT("source");
+      AllocateGrabBuffers(MilSystem, &UserHookData);
+      if(!UserHookData.Headless)
+         MdispSelect(UserHookData.MilDisplay, UserHookData.MilImageDisp);
+      }
+   else if(UserHookData.Backend == eAcquisitionNative)
+      {
+      /* As with the monitor digitizer, the buffers start in the format of the */
+      /* DCF and follow the format of the stream from its first leader.        */
+      UserHookData.FrameSizeX       = Options.SourceConfig.SizeX;
+      UserHookData.FrameSizeY       = Options.SourceConfig.SizeY;
+      UserHookData.FramePixelFormat = Options.SourceConfig.PixelFormat;
+      UserHookData.DeviceVendor     = MIL_TEXT("GVSP");
+      UserHookData.DeviceModel      = MIL_TEXT("native receiver");
+      UserHookData.MulticastAddress = MulticastAddr;
+      UserHookData.PackedRows       = true;
+      AllocateGrabBuffers(MilSystem, &UserHookData);
+      if(!UserHookData.Headless)
+         MdispSelect(UserHookData.MilDisplay, UserHookData.MilImageDisp);
+
+      if(Options.Simulate)
+         {
+         Options.SourceConfig.MulticastAddress = MulticastAddr;
+         Options.SourceConfig.UdpPort          = PortNumber;
+         SimulatorStarted = GvspSimulatorStart(&Simulator, &Options.SourceConfig);
+         }
+      }
+   else if(UserHookData.Backend == eAcquisitionReplay)
+      {
+      /* The buffers start in the data format of the first recorded frame. */
+      const ReplayFrameStruct* FirstFramePtr = &UserHookData.Replay->Frames[0];
+
+      UserHookData.FrameSizeX       = FirstFramePtr->SizeX;
+      UserHookData.FrameSizeY       = FirstFramePtr->SizeY;
+      UserHookData.FramePixelFormat = FirstFramePtr->PixelFormat;
+      UserHookData.DeviceVendor     = MIL_TEXT("Replay");
+      UserHookData.DeviceModel      = MIL_STRING(Options.ReplayPath.begin(),
+                                                 Options.ReplayPath.end());
+      UserHookData.PackedRows       = (FirstFramePtr->Chunk->Flags &
+                                       RECORDER_CHUNK_PACKED_ROWS) != 0;
+      AllocateGrabBuffers(MilSystem, &UserHookData);
+      if(!UserHookData.Headless)
+         MdispSelect(UserHookData.MilDisplay, UserHookData.MilImageDisp);
+      }
+   else
+      {
+      /* Allocate a monitor Multicast digitizer.                                        */
+      /* The default gigevision_multicast_monitor.dcf sets the following parameters:    */
+      /* SizeX: 640                                                                     */
+      /* SizeY: 480                                                                     */
+      /* PixelFormat: Mono8                                                             */
+      /*                                                                                */
+      /* This example will override these default setting after the first grab has been */
+      /* made. The MdigProcess hook function will compare these default settings with   */
+      /* the settings of the currently grabbed frame. If needed an event will be set    */
+      /* will momentarily stop the grab apply the new settings, re-allocate grab buffers*/
+      /* and resume grabbing.                                                           */
+      MdigAlloc(MilSystem, M_DEFAULT, MIL_TEXT("gigevision_multicast_monitor.dcf"),
+         M_GC_MULTICAST_MONITOR, &UserHookData.MilDigitizer);
+
+      /* Allocate buffers. */
+      AllocateGrabBuffers(MilSystem, &UserHookData);
+      if(!UserHookData.Headless)
+         MdispSelect(UserHookData.MilDisplay, UserHookData.MilImageDisp);
+
+      /* Manual digitizer configuration */
+      
+      /* If the GigE Vision device supports packet resends and the user wants to use      */
+      /* packet resends on the monitor enable it manually.                                */
+      MdigControl(UserHookData.MilDigitizer, M_GC_PACKET_RESEND, M_ENABLE);
+
+      /* Inquire the pixel format as specified from the DCF. */
+      MdigInquire(UserHookData.MilDigitizer, M_GC_PIXEL_FORMAT, &UserHookData.FramePixelFormat);
+
+      /* Validate if the gigevision_multicast_monitor.dcf has multicast parameters set.   */
+      MdigInquire(UserHookData.MilDigitizer, M_GC_STREAM_CHANNEL_MULTICAST_ADDRESS_STRING,
          MulticastAddr);
-      MdigControl(UserHookData.MilDigitizer, M_GC_LOCAL_STREAM_PORT, PortNumber);
-      MdigControl(UserHookData.MilDigitizer, M_GC_UPDATE_MULTICAST_INFO, M_DEFAULT);
+      MdigInquire(UserHookData.MilDigitizer, M_GC_LOCAL_STREAM_PORT, &PortNumber);
+      if(!Options.MulticastAddress.empty())
+         {
+         /* Multicast info given on the command line. */
+         MulticastAddr = Options.MulticastAddress;
+         PortNumber    = Options.UdpPort;
+         MdigControl(UserHookData.MilDigitizer, M_GC_STREAM_CHANNEL_MULTICAST_ADDRESS_STRING,
+            MulticastAddr);
+         MdigControl(UserHookData.MilDigitizer, M_GC_LOCAL_STREAM_PORT, PortNumber);
+         MdigControl(UserHookData.MilDigitizer, M_GC_UPDATE_MULTICAST_INFO, M_DEFAULT);
+         }
+      else if(MulticastAddr == MIL_TEXT("0.0.0.0") || PortNumber == 0)
+         {
+         /* No multicast info found. Ask the user for the Multicast IP address and UDP    */
+         /* port number to use, or use the default group of the simulator without prompts. */
+         if(UserHookData.Interactive)
+            GetMulticastInfo(MulticastAddr, PortNumber);
+         else
+            {
+            MulticastAddr = Options.SourceConfig.MulticastAddress;
+            PortNumber    = Options.SourceConfig.UdpPort;
+            MosPrintf(MIL_TEXT("No multicast address in the DCF, %s:%lld is used.\n"),
+               MulticastAddr.c_str(), (long long)PortNumber);
+            }
+         /* Pass the Multicast IP addresss and UDP port number to MIL and apply the settings.*/
+         MdigControl(UserHookData.MilDigitizer, M_GC_STREAM_CHANNEL_MULTICAST_ADDRESS_STRING,
+            MulticastAddr);
+         MdigControl(UserHookData.MilDigitizer, M_GC_LOCAL_STREAM_PORT, PortNumber);
+         MdigControl(UserHookData.MilDigitizer, M_GC_UPDATE_MULTICAST_INFO, M_DEFAULT);
+         }
+
+      /* Get default ROI parameters. They will get updated from the MdigProcess() hook    */
+      /* function if needed when the first grab is performed.                             */
+      MdigInquire(UserHookData.MilDigitizer, M_SIZE_X, &UserHookData.FrameSizeX);
+      MdigInquire(UserHookData.MilDigitizer, M_SIZE_Y, &UserHookData.FrameSizeY);
+
+      /* Play the role of the multicast master with the local GVSP simulator. */
+      if(Options.Simulate)
+         {
+         Options.SourceConfig.MulticastAddress = MulticastAddr;
+         Options.SourceConfig.UdpPort          = PortNumber;
+         SimulatorStarted = GvspSimulatorStart(&Simulator, &Options.SourceConfig);
+         }
       }
 
-   /* Initialize the User's processing function data structure. */
-   UserHookData.ProcessedImageCount = 0;
-   UserHookData.CorruptImageCount   = 0;
-   UserHookData.FrameSizeX          = 0;
-   UserHookData.FrameSizeY          = 0;
-   UserHookData.DataFormatChanged   = false;
+   /* Nothing would be received without the multicast master. */
+   if(!SimulatorStarted)
+      {
+      MosPrintf(MIL_TEXT("Could not start the GVSP simulator.\n"));
+      FreeMonitor(MilApplication, MilSystem, &UserHookData);
+      return 1;
+      }
 
-   /* Get default ROI parameters. They will get updated from the MdigProcess() hook    */
-   /* function if needed when the first grab is performed.                             */
-   MdigInquire(UserHookData.MilDigitizer, M_SIZE_X, &UserHookData.FrameSizeX);
-   MdigInquire(UserHookData.MilDigitizer, M_SIZE_Y, &UserHookData.FrameSizeY);
+   /* Update the display at the display rate rather than at the grab rate. */
+   if(!UserHookData.Headless && Options.DisplayRate > 0)
+      UserHookData.Display = DisplayStageAlloc(Options.DisplayRate,
+                                               &Options.ThreadPlacements[eThreadDisplay],
+                                               &UserHookData);
 
    /* Print info related to the device we are connected to. */
    PrintCameraInfo(&UserHookData);
 
+   if(UserHookData.Recorder)
+      UserHookData.Recorder->ChunkFlags = UserHookData.PackedRows ? RECORDER_CHUNK_PACKED_ROWS : 0;
+
+   /* Stop requests come from now on: the standard input is no longer read */
+   /* by the prompts.                                                       */
+   Control = ControlAlloc(UserHookData.Event, UserHookData.Interactive);
+
    /* Start the processing. The processing function is called for every frame grabbed. */
-   MdigProcess(UserHookData.MilDigitizer, UserHookData.MilGrabBufferList,
-      UserHookData.MilGrabBufferListSize, M_START, M_DEFAULT, ProcessingFunction,
-      &UserHookData);
+   StartAcquisition(&UserHookData);
 
    /* NOTE: Now the main() is free to perform other tasks 
                                                     while the processing is executing. */
    /* -------------------------------------------------------------------------------- */
 
    /* Adjust the monitor digitizer according to received image information. */
-   AdaptToDataFormatChange(MilSystem, &UserHookData);
+   AdaptToDataFormatChange(MilSystem, &UserHookData, Control);
+   StopSignal = Control->StopSignal;
+   ControlFree(Control);
 
-   MdigInquire(UserHookData.MilDigitizer, M_DIG_PROCESS_IN_PROGRESS, &DigProcessInProgress);
-   if(DigProcessInProgress == M_TRUE)
+   if(IsAcquisitionInProgress(&UserHookData))
       {
       /* Stop the processing. */
-      MdigProcess(UserHookData.MilDigitizer, UserHookData.MilGrabBufferList,
-         UserHookData.MilGrabBufferListSize, M_STOP, M_DEFAULT, ProcessingFunction,
-         &UserHookData);
+      StopAcquisition(&UserHookData);
       }
 
+   GvspSimulatorStop(&Simulator);
+   if(UserHookData.Recorder)
+      FrameRecorderFlush(UserHookData.Recorder);
+
    /* Print statistics. */
-   MdigInquire(UserHookData.MilDigitizer, M_PROCESS_FRAME_COUNT,  &ProcessFrameCount);
-   MdigInquire(UserHookData.MilDigitizer, M_PROCESS_FRAME_RATE,   &ProcessFrameRate);
+   GetAcquisitionStatistics(&UserHookData, &ProcessFrameCount, &ProcessFrameRate);
    MosPrintf(MIL_TEXT("\n\n%lld frames grabbed at %.1f frames/sec (%.1f ms/frame).\n"),
       (long long)ProcessFrameCount, ProcessFrameRate, 1000.0/ProcessFrameRate);
-   MosPrintf(MIL_TEXT("Press <Enter> to end.\n\n"));
-   MosGetch();
-
-   FreeGrabBuffers(&UserHookData);
+   MosPrintf(MIL_TEXT("%lld corrupt frames.\n"),
+      (long long)UserHookData.Stats->CorruptCount.Value.load());
+   MosPrintf(MIL_TEXT("%lld frames skipped for grab buffers in use.\n"),
+      (long long)UserHookData.GrabQueue.SkipCount.load());
+   MosPrintf(MIL_TEXT("%lld buffer pools built in the background, %lld reused from the cache, ")
+             MIL_TEXT("%lld freed for memory, %lld freed when idle.\n"),
+      (long long)UserHookData.PoolCache->BuildCount,
+      (long long)UserHookData.PoolCache->HitCount,
+      (long long)UserHookData.PoolCache->EvictCount,
+      (long long)UserHookData.PoolCache->ExpireCount);
+   if(UserHookData.PoolCache->BuildCount > 0)
+      MosPrintf(MIL_TEXT("Pool build time: %.1f ms average, %.1f ms max.\n"),
+         1000.0 * UserHookData.PoolCache->BuildTimeSum / UserHookData.PoolCache->BuildCount,
+         1000.0 * UserHookData.PoolCache->BuildTimeMax);
+   if(UserHookData.ActivePool && UserHookData.ActivePool->Arena)
+      {
+      MosPrintf(MIL_TEXT("Grab buffers on a %.1f MB arena of %s pages, %s"),
+         UserHookData.ActivePool->ArenaSize / 1048576.0,
+         UserHookData.ActivePool->ArenaHugePages ? MIL_TEXT("huge") : MIL_TEXT("regular"),
+         UserHookData.ActivePool->ArenaLocked ? MIL_TEXT("locked") : MIL_TEXT("pageable"));
+      if(UserHookData.ActivePool->ArenaNode != CPU_NODE_UNKNOWN)
+         MosPrintf(MIL_TEXT(", on NUMA node %lld"), (long long)UserHookData.ActivePool->ArenaNode);
+      MosPrintf(MIL_TEXT(".\n"));
+      }
+   GrabQueuePrintStatistics(&UserHookData.GrabQueue);
+   if(UserHookData.Pipeline)
+      PipelinePrintStatistics(UserHookData.Pipeline);
+   if(UserHookData.Display)
+      DisplayStagePrintStatistics(UserHookData.Display);
+   if(UserHookData.Receiver)
+      GvspReceiverPrintStatistics(UserHookData.Receiver);
+   if(UserHookData.Replay)
+      FrameReplayPrintStatistics(UserHookData.Replay);
+   if(UserHookData.Recorder)
+      FrameRecorderPrintStatistics(UserHookData.Recorder);
+   if(UserHookData.Share)
+      FrameSharePrintStatistics(UserHookData.Share);
+   PrintConversionStatistics(&UserHookData);
+   PrintOverlayStatistics(&UserHookData);
+   PrintHealthStatistics(&UserHookData);
+   FrameStatsPrint(UserHookData.Stats);
+   FrameStatsExport(UserHookData.Stats, true);
+   if(UserHookData.Interactive && StopSignal == 0)
+      {
+      MosPrintf(MIL_TEXT("Press <Enter> to end.\n\n"));
+      MosGetch();
+      }
 
-   MdispFree(UserHookData.MilDisplay);
-   MdigFree(UserHookData.MilDigitizer);
+   /* Release the monitor and the defaults. */
+   FreeMonitor(MilApplication, MilSystem, &UserHookData);
 
-   MthrFree(UserHookData.Event);
+   return 0;
+}
 
-   /* Release defaults. */
+/* Frees whatever of the monitor is allocated, then the defaults. Every    */
+/* exit of MosMain() goes through here, HookDataPtr is M_NULL before       */
+/* InitHookData().                                                         */
+/* -----------------------------------------------------------------------   */
+void FreeMonitor(MIL_ID MilApplication, MIL_ID MilSystem, HookDataStruct* HookDataPtr)
+   {
+   if(HookDataPtr)
+      {
+      /* The workers go first: they hold references to the grab buffers. */
+      PipelineFree(HookDataPtr->Pipeline);
+      HookDataPtr->Pipeline = M_NULL;
+      FreeHookData(HookDataPtr);
+      PixelConvertPoolFree(HookDataPtr->Converter);
+      HookDataPtr->Converter = M_NULL;
+      if(HookDataPtr->Event)
+         MthrFree(HookDataPtr->Event);
+      HookDataPtr->Event = M_NULL;
+      }
    MappFreeDefault(MilApplication, MilSystem, M_NULL, M_NULL, M_NULL);
+   }
 
-   return 0;
-}
+/* Initializes the hook data of a stream from the options.                 */
+/* -----------------------------------------------------------------------   */
+void InitHookData(HookDataStruct* HookDataPtr, const MonitorOptionsStruct* OptionsPtr,
+                  const std::string& StatsPath)
+   {
+   HookDataPtr->MilDigitizer        = M_NULL;
+   HookDataPtr->Event               = M_NULL;
+   HookDataPtr->FrameSizeX          = 0;
+   HookDataPtr->FrameSizeY          = 0;
+   HookDataPtr->FramePixelFormat    = 0;
+   HookDataPtr->DataFormatChanged   = false;
+   HookDataPtr->Backend             = OptionsPtr->Backend;
+   HookDataPtr->SourceConfig        = OptionsPtr->SourceConfig;
+   HookDataPtr->Interactive         = (OptionsPtr->RunDuration == 0 && !OptionsPtr->Daemon);
+   HookDataPtr->RunDuration         = OptionsPtr->RunDuration;
+   HookDataPtr->Pipeline            = M_NULL;
+   HookDataPtr->PipelineLane        = 0;
+   HookDataPtr->StreamIndex         = -1;
+   HookDataPtr->AcquisitionPlacement = OptionsPtr->ThreadPlacements[eThreadAcquisition];
+   HookDataPtr->AcquisitionPlaced   = false;
+   HookDataPtr->Display             = M_NULL;
+   HookDataPtr->Headless            = OptionsPtr->Headless;
+   HookDataPtr->MilDisplay          = M_NULL;
+   HookDataPtr->MilImageDisp        = M_NULL;
+   for(MIL_INT i = 0; i < BUFFERING_SIZE_MAX; i++)
+      HookDataPtr->BufferRefCount[i] = 0;
+   GrabQueueInit(&HookDataPtr->GrabQueue, OptionsPtr->MemoryBudget,
+      OptionsPtr->LatencyTolerance);
+   HookDataPtr->ActivePool          = M_NULL;
+   HookDataPtr->PoolCache           = M_NULL;
+   HookDataPtr->Switch              = FormatSwitchStruct();
+   HookDataPtr->LastSwitch          = FormatSwitchStruct();
+   HookDataPtr->PoolNeeded          = false;
+   HookDataPtr->SwitchPending       = false;
+   HookDataPtr->SwitchCompleted     = false;
+   HookDataPtr->SwitchStopDuration  = 0;
+   HookDataPtr->LastFrameTime       = 0;
+   HookDataPtr->FrameInterval       = 0;
+   HookDataPtr->FirstFrameReported  = false;
+   HookDataPtr->LastShareReviewTime = 0;
+   HookDataPtr->Stats               = FrameStatsAlloc(StatsPath, OptionsPtr->StatsPeriod);
+   HookDataPtr->Stats->LaunchTime   = OptionsPtr->LaunchTime;
+   HookDataPtr->Receiver            = M_NULL;
+   HookDataPtr->Recorder            = M_NULL;
+   HookDataPtr->Replay              = M_NULL;
+   HookDataPtr->Share               = M_NULL;
+   HookDataPtr->Overlay             = (OptionsPtr->Headless || !OptionsPtr->OverlayFields) ?
+                                      M_NULL : FrameOverlayAlloc(OptionsPtr->OverlayFields);
+   HookDataPtr->DisplayedFrameCount = -1;
+   HookDataPtr->Health              = OptionsPtr->HealthPeriod ?
+                                      FrameHealthAlloc(OptionsPtr->HealthPeriod) : M_NULL;
+   HookDataPtr->Stats->Health       = HookDataPtr->Health;
+   HookDataPtr->Converter           = M_NULL;
+   HookDataPtr->PackedRows          = false;
+   HookDataPtr->AcquisitionCpuStart = 0;
+   HookDataPtr->AcquisitionCpuTime  = 0;
+   HookDataPtr->Synthetic.Thread        = M_NULL;
+   HookDataPtr->Synthetic.StopRequested = false;
+   HookDataPtr->Synthetic.FrameIndex    = 0;
+   HookDataPtr->Synthetic.RandomState   = 0x2545F4914F6CDD1DULL;
+   HookDataPtr->Synthetic.HookCallCount = 0;
+   HookDataPtr->Synthetic.HookTimeTotal = 0;
+   HookDataPtr->Synthetic.HookTimeMax   = 0;
+   HookDataPtr->Synthetic.RunTime       = 0;
+   }
+
+/* Frees what the stream holds in its hook data, whatever of it is         */
+/* allocated, and resets it. The pipeline, the conversion pool and the     */
+/* event may be shared by streams and are left to the caller.              */
+/* -----------------------------------------------------------------------   */
+void FreeHookData(HookDataStruct* HookDataPtr)
+   {
+   GvspReceiverFree(HookDataPtr->Receiver);
+   FrameReplayFree(HookDataPtr->Replay);
+   FrameRecorderFree(HookDataPtr->Recorder);
+   FrameShareFree(HookDataPtr->Share);
+   DisplayStageFree(HookDataPtr->Display);
+   FreeGrabBuffers(HookDataPtr);
+   FrameOverlayFree(HookDataPtr->Overlay);
+   FrameHealthFree(HookDataPtr->Health);
+   PoolCacheFree(HookDataPtr->PoolCache);
+   FrameStatsFree(HookDataPtr->Stats);
+   if(HookDataPtr->MilDisplay)
+      MdispFree(HookDataPtr->MilDisplay);
+   if(HookDataPtr->MilDigitizer)
+      MdigFree(HookDataPtr->MilDigitizer);
+
+   HookDataPtr->Receiver     = M_NULL;
+   HookDataPtr->Replay       = M_NULL;
+   HookDataPtr->Recorder     = M_NULL;
+   HookDataPtr->Share        = M_NULL;
+   HookDataPtr->Display      = M_NULL;
+   HookDataPtr->Overlay      = M_NULL;
+   HookDataPtr->Health       = M_NULL;
+   HookDataPtr->PoolCache    = M_NULL;
+   HookDataPtr->Stats        = M_NULL;
+   HookDataPtr->MilDisplay   = M_NULL;
+   HookDataPtr->MilDigitizer = M_NULL;
+   }
+
+/* Parses the command line options.                                          */
+/* -----------------------------------------------------------------------   */
+static bool ParseOption(const MIL_STRING& Argument, const MIL_TEXT_CHAR* Name,
+                        MIL_STRING* ValuePtr)
+   {
+   MIL_STRING Prefix = MIL_STRING(Name) + MIL_TEXT("=");
+
+   if(Argument.compare(0, Prefix.size(), Prefix) != 0)
+      return false;
+   *ValuePtr = Argument.substr(Prefix.size());
+   return true;
+   }
+
+/* Parses the CPU list or the priority of a thread role, -<role>cpus=<list> */
+/* or -<role>priority=<n>. Returns false if Argument is not one of them;    */
+/* *ValidPtr tells if its value is.                                          */
+/* -----------------------------------------------------------------------   */
+static bool ParseThreadOption(const MIL_STRING& Argument, ThreadPlacementStruct* PlacementsPtr,
+                              bool* ValidPtr)
+   {
+   static const MIL_TEXT_CHAR* CpusOptions[eThreadRoleCount] =
+      { MIL_TEXT("-acquisitioncpus"), MIL_TEXT("-workercpus"), MIL_TEXT("-displaycpus") };
+   static const MIL_TEXT_CHAR* PriorityOptions[eThreadRoleCount] =
+      { MIL_TEXT("-acquisitionpriority"), MIL_TEXT("-workerpriority"),
+        MIL_TEXT("-displaypriority") };
+   MIL_STRING Value;
+
+   for(int Role = 0; Role < eThreadRoleCount; Role++)
+      {
+      if(ParseOption(Argument, CpusOptions[Role], &Value))
+         {
+         *ValidPtr = ThreadPlacementParseCpus(std::string(Value.begin(), Value.end()).c_str(),
+                                              &PlacementsPtr[Role].Cpus);
+         return true;
+         }
+      if(ParseOption(Argument, PriorityOptions[Role], &Value))
+         {
+         PlacementsPtr[Role].Priority = std::stoi(Value);
+         *ValidPtr = PlacementsPtr[Role].Priority >= 0 &&
+                     PlacementsPtr[Role].Priority <= THREAD_PRIORITY_MAX;
+         return true;
+         }
+      }
+   return false;
+   }
+
+static MIL_INT ParsePixelFormat(const MIL_STRING& Name)
+   {
+   if(Name == MIL_TEXT("mono8"))    return PFNC_MONO8;
+   if(Name == MIL_TEXT("mono10"))   return PFNC_MONO10;
+   if(Name == MIL_TEXT("mono10p"))  return PFNC_MONO10P;
+   if(Name == MIL_TEXT("mono12"))   return PFNC_MONO12;
+   if(Name == MIL_TEXT("mono12p"))  return PFNC_MONO12P;
+   if(Name == MIL_TEXT("mono16"))   return PFNC_MONO16;
+   if(Name == MIL_TEXT("bayerrg8")) return PFNC_BAYER_RG8;
+   if(Name == MIL_TEXT("bayergr8")) return PFNC_BAYER_GR8;
+   if(Name == MIL_TEXT("bayergb8")) return PFNC_BAYER_GB8;
+   if(Name == MIL_TEXT("bayerbg8")) return PFNC_BAYER_BG8;
+   if(Name == MIL_TEXT("rgb8"))     return PFNC_RGB8;
+   if(Name == MIL_TEXT("bgr8"))     return PFNC_BGR8;
+   if(Name == MIL_TEXT("bgra8"))    return PFNC_BGRA8;
+   return (MIL_INT)std::stoll(Name, M_NULL, 0);
+   }
+
+/* Reads the options of a configuration file, one per line, with or without */
+/* the leading dash; # starts a comment.                                     */
+/* -----------------------------------------------------------------------   */
+static bool LoadConfigFile(const MIL_STRING& Path, std::vector<MIL_STRING>* ArgumentsPtr)
+   {
+   std::string FilePath(Path.begin(), Path.end());
+   FILE*       File = fopen(FilePath.c_str(), "r");
+   char        Line[1024];
+
+   if(!File)
+      {
+      MosPrintf(MIL_TEXT("Could not open the configuration file %s.\n"), Path.c_str());
+      return false;
+      }
+
+   while(fgets(Line, sizeof(Line), File))
+      {
+      std::string Text(Line);
+      size_t      Comment = Text.find('#');
+      size_t      First, Last;
+
+      if(Comment != std::string::npos)
+         Text.resize(Comment);
+      First = Text.find_first_not_of(" \t\r\n");
+      if(First == std::string::npos)
+         continue;
+      Last = Text.find_last_not_of(" \t\r\n");
+      Text = Text.substr(First, Last - First + 1);
+      if(Text[0] != '-')
+         Text.insert(0, 1, '-');
+      ArgumentsPtr->push_back(MIL_STRING(Text.begin(), Text.end()));
+      }
+
+   fclose(File);
+   return true;
+   }
+
+bool ParseCommandLine(int argc, MIL_TEXT_CHAR* argv[], MonitorOptionsStruct* OptionsPtr)
+   {
+   std::vector<MIL_STRING> Arguments(argv + 1, argv + argc);
+   int                     ConfigCount = 0;
+
+   OptionsPtr->Backend     = eAcquisitionMil;
+   OptionsPtr->Simulate    = false;
+   OptionsPtr->UdpPort     = 0;
+   OptionsPtr->RunDuration = 0;
+   OptionsPtr->Daemon      = false;
+   OptionsPtr->LaunchTime  = 0;
+   OptionsPtr->WorkerCount = 0;
+   OptionsPtr->DisplayRate = 60.0;
+   OptionsPtr->Headless    = false;
+   OptionsPtr->MemoryBudget     = 0;
+   OptionsPtr->LatencyTolerance = 0.1;
+   OptionsPtr->HugePages        = false;
+   OptionsPtr->LockMemory       = false;
+   OptionsPtr->StatsPeriod      = 5.0;
+   OptionsPtr->RecordRingSize   = (MIL_INT64)RECORDER_RING_DEFAULT << 20;
+   OptionsPtr->OverlayFields    = OVERLAY_FIELDS_ALL;
+   OptionsPtr->HealthPeriod     = 0;
+   OptionsPtr->ShareSlotCount   = FRAME_SHARE_SLOTS_DEFAULT;
+   OptionsPtr->ShareFrameBytes  = (MIL_INT64)FRAME_SHARE_FRAME_DEFAULT << 20;
+   OptionsPtr->ReplayPacing     = eReplayOriginal;
+   OptionsPtr->ReplayRate       = 0;
+   OptionsPtr->ConvertThreadCount = std::thread::hardware_concurrency() / 4;
+   OptionsPtr->ConvertIsa       = eConvertIsaAvx2;
+   SimulatorDefaultConfig(&OptionsPtr->SourceConfig);
+   for(int Role = 0; Role < eThreadRoleCount; Role++)
+      OptionsPtr->ThreadPlacements[Role].Priority = 0;
+
+   for(size_t i = 0; i < Arguments.size(); i++)
+      {
+      MIL_STRING Argument(Arguments[i]);
+      MIL_STRING Value;
+      bool       Valid;
+
+      try
+         {
+         if(ParseOption(Argument, MIL_TEXT("-config"), &Value))
+            {
+            std::vector<MIL_STRING> Lines;
+
+            /* The options of the file take the place of -config; a file that */
+            /* includes itself stops at the limit.                            */
+            if(++ConfigCount > CONFIG_FILE_MAX || !LoadConfigFile(Value, &Lines))
+               return false;
+            Arguments.insert(Arguments.begin() + i + 1, Lines.begin(), Lines.end());
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-backend"), &Value))
+            {
+            if(Value == MIL_TEXT("mil"))
+               OptionsPtr->Backend = eAcquisitionMil;
+            else if(Value == MIL_TEXT("synthetic"))
+               OptionsPtr->Backend = eAcquisitionSynthetic;
+            else if(Value == MIL_TEXT("native"))
+               OptionsPtr->Backend = eAcquisitionNative;
+            else if(Value == MIL_TEXT("replay"))
+               OptionsPtr->Backend = eAcquisitionReplay;
+            else
+               return false;
+            }
+         else if(Argument == MIL_TEXT("-simulate"))
+            OptionsPtr->Simulate = true;
+         else if(ParseOption(Argument, MIL_TEXT("-address"), &Value))
+            OptionsPtr->MulticastAddress = Value;
+         else if(ParseOption(Argument, MIL_TEXT("-port"), &Value))
+            OptionsPtr->UdpPort = (MIL_INT)std::stoll(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-stream"), &Value))
+            {
+            StreamEntryStruct Entry;
+
+            if(!ParseStreamEntry(Value, &Entry))
+               return false;
+            OptionsPtr->Streams.push_back(Entry);
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-streamlist"), &Value))
+            {
+            if(!LoadStreamList(Value, &OptionsPtr->Streams))
+               return false;
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-sizex"), &Value))
+            OptionsPtr->SourceConfig.SizeX = (MIL_INT)std::stoll(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-sizey"), &Value))
+            OptionsPtr->SourceConfig.SizeY = (MIL_INT)std::stoll(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-pixelformat"), &Value))
+            OptionsPtr->SourceConfig.PixelFormat = ParsePixelFormat(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-fps"), &Value))
+            OptionsPtr->SourceConfig.FrameRate = std::stod(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-packetsize"), &Value))
+            OptionsPtr->SourceConfig.PacketSize = (MIL_INT)std::stoll(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-loss"), &Value))
+            OptionsPtr->SourceConfig.PacketLossPercent = std::stod(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-reorder"), &Value))
+            OptionsPtr->SourceConfig.ReorderPercent = std::stod(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-formatchange"), &Value))
+            OptionsPtr->SourceConfig.FormatChangePeriod = (MIL_INT)std::stoll(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-duration"), &Value))
+            OptionsPtr->RunDuration = std::stod(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-workers"), &Value))
+            OptionsPtr->WorkerCount = (MIL_INT)std::stoll(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-displayrate"), &Value))
+            OptionsPtr->DisplayRate = std::stod(Value);
+         else if(Argument == MIL_TEXT("-headless"))
+            OptionsPtr->Headless = true;
+         else if(Argument == MIL_TEXT("-daemon"))
+            {
+            OptionsPtr->Daemon   = true;
+            OptionsPtr->Headless = true;
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-membudget"), &Value))
+            OptionsPtr->MemoryBudget = (MIL_INT64)(std::stod(Value) * 1048576.0);
+         else if(ParseOption(Argument, MIL_TEXT("-latency"), &Value))
+            OptionsPtr->LatencyTolerance = std::stod(Value) / 1000.0;
+         else if(Argument == MIL_TEXT("-hugepages"))
+            OptionsPtr->HugePages = true;
+         else if(Argument == MIL_TEXT("-lockmemory"))
+            OptionsPtr->LockMemory = true;
+         else if(ParseThreadOption(Argument, OptionsPtr->ThreadPlacements, &Valid))
+            {
+            if(!Valid)
+               return false;
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-stats"), &Value))
+            OptionsPtr->StatsPath.assign(Value.begin(), Value.end());
+         else if(ParseOption(Argument, MIL_TEXT("-statsperiod"), &Value))
+            OptionsPtr->StatsPeriod = std::stod(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-record"), &Value))
+            OptionsPtr->RecordPath.assign(Value.begin(), Value.end());
+         else if(ParseOption(Argument, MIL_TEXT("-recordbuffer"), &Value))
+            OptionsPtr->RecordRingSize = (MIL_INT64)(std::stod(Value) * 1048576.0);
+         else if(ParseOption(Argument, MIL_TEXT("-overlay"), &Value))
+            {
+            if(!FrameOverlayParseFields(std::string(Value.begin(), Value.end()),
+                                        &OptionsPtr->OverlayFields))
+               return false;
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-health"), &Value))
+            {
+            long long Period = std::stoll(Value);
+
+            if(Period < 0 || Period > 0xFFFFFFFFLL)
+               return false;
+            OptionsPtr->HealthPeriod = (uint32_t)Period;
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-share"), &Value))
+            OptionsPtr->SharePath.assign(Value.begin(), Value.end());
+         else if(ParseOption(Argument, MIL_TEXT("-shareslots"), &Value))
+            OptionsPtr->ShareSlotCount = std::stoi(Value);
+         else if(ParseOption(Argument, MIL_TEXT("-shareframe"), &Value))
+            OptionsPtr->ShareFrameBytes = (MIL_INT64)(std::stod(Value) * 1048576.0);
+         else if(ParseOption(Argument, MIL_TEXT("-replay"), &Value))
+            {
+            OptionsPtr->Backend = eAcquisitionReplay;
+            OptionsPtr->ReplayPath.assign(Value.begin(), Value.end());
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-replayspeed"), &Value))
+            {
+            if(Value == MIL_TEXT("original"))
+               OptionsPtr->ReplayPacing = eReplayOriginal;
+            else if(Value == MIL_TEXT("max"))
+               OptionsPtr->ReplayPacing = eReplayMax;
+            else
+               {
+               OptionsPtr->ReplayPacing = eReplayFixedRate;
+               OptionsPtr->ReplayRate   = std::stod(Value);
+               if(OptionsPtr->ReplayRate <= 0)
+                  return false;
+               }
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-bench"), &Value))
+            {
+            OptionsPtr->Backend = eAcquisitionSynthetic;
+            OptionsPtr->BenchPath.assign(Value.begin(), Value.end());
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-convertthreads"), &Value))
+            {
+            OptionsPtr->ConvertThreadCount = (MIL_INT)std::stoll(Value);
+            if(OptionsPtr->ConvertThreadCount < 0 || OptionsPtr->ConvertThreadCount > CONVERT_THREAD_MAX)
+               return false;
+            }
+         else if(ParseOption(Argument, MIL_TEXT("-convertisa"), &Value))
+            {
+            if(Value == MIL_TEXT("scalar"))
+               OptionsPtr->ConvertIsa = eConvertIsaScalar;
+            else if(Value == MIL_TEXT("sse4"))
+               OptionsPtr->ConvertIsa = eConvertIsaSse41;
+            else if(Value == MIL_TEXT("avx2"))
+               OptionsPtr->ConvertIsa = eConvertIsaAvx2;
+            else
+               return false;
+            }
+         else
+            return false;
+         }
+      catch(...)
+         {
+         return false;
+         }
+      }
+
+   if(!OptionsPtr->MulticastAddress.empty() && OptionsPtr->UdpPort == 0)
+      OptionsPtr->UdpPort = OptionsPtr->SourceConfig.UdpPort;
+   if(OptionsPtr->Backend == eAcquisitionReplay && OptionsPtr->ReplayPath.empty())
+      return false;
+   if(OptionsPtr->StatsPeriod <= 0)
+      return false;
+   if(!OptionsPtr->SharePath.empty() &&
+      (OptionsPtr->ShareSlotCount < 2 || OptionsPtr->ShareFrameBytes <= 0))
+      return false;
+
+   /* The image health analysis is never done in the hook. */
+   if(OptionsPtr->HealthPeriod > 0 && OptionsPtr->WorkerCount <= 0 && OptionsPtr->Streams.empty())
+      OptionsPtr->WorkerCount = 1;
+
+   if(!AssignStreamDevices(&OptionsPtr->Streams, OptionsPtr->Backend == eAcquisitionMil))
+      return false;
+
+   /* A recording holds a single stream. */
+   if(!OptionsPtr->Streams.empty() &&
+      (OptionsPtr->Backend == eAcquisitionReplay || !OptionsPtr->RecordPath.empty() ||
+       OptionsPtr->Streams.size() > PIPELINE_LANE_MAX))
+      return false;
+
+   return true;
+   }
+
+void PrintUsage(void)
+   {
+   MosPrintf(MIL_TEXT("Usage: MulticastMonitor [options]\n\n"));
+   MosPrintf(MIL_TEXT("  -backend=<source>       Frame source (default: mil): mil, synthetic,\n"));
+   MosPrintf(MIL_TEXT("                          native to receive the stream with recvmmsg\n"));
+   MosPrintf(MIL_TEXT("                          instead of the MIL digitizer (Linux), or replay.\n"));
+   MosPrintf(MIL_TEXT("  -simulate               Send a local GVSP stream to the multicast group.\n"));
+   MosPrintf(MIL_TEXT("  -address=<ip>           Multicast address, skips the DCF/prompt.\n"));
+   MosPrintf(MIL_TEXT("  -port=<n>               UDP port of the multicast stream.\n"));
+   MosPrintf(MIL_TEXT("  -stream=<ip>:<port>[:<device>[:<dcf>]]\n"));
+   MosPrintf(MIL_TEXT("                          Monitor this stream too; repeat for each stream\n"));
+   MosPrintf(MIL_TEXT("                          (up to %d). The streams share the workers, the\n"),
+      PIPELINE_LANE_MAX);
+   MosPrintf(MIL_TEXT("                          memory budget and the conversion threads. The\n"));
+   MosPrintf(MIL_TEXT("                          MIL backend grabs it from M_DEV0 + <device>\n"));
+   MosPrintf(MIL_TEXT("                          (default: its position); each stream needs its\n"));
+   MosPrintf(MIL_TEXT("                          own device.\n"));
+   MosPrintf(MIL_TEXT("  -streamlist=<file>      Streams to monitor, one -stream value per line,\n"));
+   MosPrintf(MIL_TEXT("                          # for comments.\n"));
+   MosPrintf(MIL_TEXT("  -sizex=<n> -sizey=<n>   Simulated AOI (default: 640x480).\n"));
+   MosPrintf(MIL_TEXT("  -pixelformat=<name>     Simulated pixel format (mono8, mono12p, ...).\n"));
+   MosPrintf(MIL_TEXT("  -fps=<rate>             Simulated frame rate, 0 for max (default: 30).\n"));
+   MosPrintf(MIL_TEXT("  -packetsize=<n>         Simulated packet size (default: 1500).\n"));
+   MosPrintf(MIL_TEXT("  -loss=<percent>         Simulated packet loss (default: 0).\n"));
+   MosPrintf(MIL_TEXT("  -reorder=<percent>      Simulated payload packets sent late (default: 0).\n"));
+   MosPrintf(MIL_TEXT("  -formatchange=<frames>  Toggle the simulated AOI every n frames.\n"));
+   MosPrintf(MIL_TEXT("  -duration=<sec>         Run without prompts for the given time.\n"));
+   MosPrintf(MIL_TEXT("  -daemon                 Run headless without any prompt or banner until\n"));
+   MosPrintf(MIL_TEXT("                          SIGTERM or SIGINT (or -duration), for a service\n"));
+   MosPrintf(MIL_TEXT("                          manager; the acquisition starts as soon as\n"));
+   MosPrintf(MIL_TEXT("                          possible and the time to first frame is printed.\n"));
+   MosPrintf(MIL_TEXT("  -config=<file>          Read options from <file>, one per line, # for\n"));
+   MosPrintf(MIL_TEXT("                          comments, such as backend=native.\n"));
+   MosPrintf(MIL_TEXT("  -workers=<n>            Process frames in n worker threads instead of\n"));
+   MosPrintf(MIL_TEXT("                          the hook (default: 0, in the hook; one per\n"));
+   MosPrintf(MIL_TEXT("                          stream with -stream).\n"));
+   MosPrintf(MIL_TEXT("  -displayrate=<hz>       Display update rate; intermediate frames are\n"));
+   MosPrintf(MIL_TEXT("                          skipped. 0 copies every frame (default: 60).\n"));
+   MosPrintf(MIL_TEXT("  -headless               No display at all.\n"));
+   MosPrintf(MIL_TEXT("  -overlay=<fields>       Lines drawn on the display: frame, fps, latency,\n"));
+   MosPrintf(MIL_TEXT("                          loss, comma-separated, or all or none\n"));
+   MosPrintf(MIL_TEXT("                          (default: all).\n"));
+   MosPrintf(MIL_TEXT("  -health=<n>             Analyse one frame in n for a frozen camera,\n"));
+   MosPrintf(MIL_TEXT("                          black or blown frames and a loss of focus, in\n"));
+   MosPrintf(MIL_TEXT("                          the workers (at least one is started). 1 for\n"));
+   MosPrintf(MIL_TEXT("                          every frame (default: 0, none).\n"));
+   MosPrintf(MIL_TEXT("  -membudget=<MB>         Memory for the grab buffers, of all the streams\n"));
+   MosPrintf(MIL_TEXT("                          with -stream (default: no limit).\n"));
+   MosPrintf(MIL_TEXT("  -latency=<ms>           Processing stall the grab queue must absorb\n"));
+   MosPrintf(MIL_TEXT("                          (default: 100).\n"));
+   MosPrintf(MIL_TEXT("  -hugepages              Back the grab buffers with huge pages.\n"));
+   MosPrintf(MIL_TEXT("  -lockmemory             Lock the grab buffers in memory (ulimit -l).\n"));
+   MosPrintf(MIL_TEXT("                          The buffers are placed on the NUMA node of the\n"));
+   MosPrintf(MIL_TEXT("                          NIC when it is known.\n"));
+   MosPrintf(MIL_TEXT("  -<role>cpus=<list>      Pin the threads of a role to CPUs, such as 2,4-7:\n"));
+   MosPrintf(MIL_TEXT("                          acquisition (the hook thread), worker or\n"));
+   MosPrintf(MIL_TEXT("                          display. Several threads of a role get one CPU\n"));
+   MosPrintf(MIL_TEXT("                          of the list each, in turn.\n"));
+   MosPrintf(MIL_TEXT("  -<role>priority=<n>     Real-time (SCHED_FIFO) priority of the threads\n"));
+   MosPrintf(MIL_TEXT("                          of a role, 1 to %d (default: 0, none).\n"),
+      THREAD_PRIORITY_MAX);
+   MosPrintf(MIL_TEXT("  -stats=<path>           Export the frame statistics to <path>.prom\n"));
+   MosPrintf(MIL_TEXT("                          (Prometheus text format) and <path>.csv.\n"));
+   MosPrintf(MIL_TEXT("  -statsperiod=<sec>      Statistics export period (default: 5).\n"));
+   MosPrintf(MIL_TEXT("  -record=<path>          Record every grabbed frame to <path>.\n"));
+   MosPrintf(MIL_TEXT("  -recordbuffer=<MB>      Memory between the grab and the disk when\n"));
+   MosPrintf(MIL_TEXT("                          recording (default: %d).\n"), RECORDER_RING_DEFAULT);
+   MosPrintf(MIL_TEXT("  -share=<name>           Publish the processed frames into the shared\n"));
+   MosPrintf(MIL_TEXT("                          memory ring /dev/shm/<name> for local consumer\n"));
+   MosPrintf(MIL_TEXT("                          processes (Linux). The frames are copied by the\n"));
+   MosPrintf(MIL_TEXT("                          workers with -workers, else in the hook.\n"));
+   MosPrintf(MIL_TEXT("  -shareslots=<n>         Frames in the ring (default: %d).\n"),
+      FRAME_SHARE_SLOTS_DEFAULT);
+   MosPrintf(MIL_TEXT("  -shareframe=<MB>        Largest frame shared (default: %d).\n"),
+      FRAME_SHARE_FRAME_DEFAULT);
+   MosPrintf(MIL_TEXT("  -replay=<path>          Replay a recording made with -record.\n"));
+   MosPrintf(MIL_TEXT("  -replayspeed=<pace>     original, max, or a frame rate (default:\n"));
+   MosPrintf(MIL_TEXT("                          original).\n"));
+   MosPrintf(MIL_TEXT("  -convertthreads=<n>     Threads, besides the calling one, that unpack,\n"));
+   MosPrintf(MIL_TEXT("                          downshift and debayer the frames by bands of\n"));
+   MosPrintf(MIL_TEXT("                          rows (default: a quarter of the CPUs).\n"));
+   MosPrintf(MIL_TEXT("  -convertisa=<isa>       Best instruction set of the conversion kernels:\n"));
+   MosPrintf(MIL_TEXT("                          scalar, sse4 or avx2 (default: avx2).\n"));
+   MosPrintf(MIL_TEXT("  -bench=<file.json>      Run the benchmark suite of the hook, the display\n"));
+   MosPrintf(MIL_TEXT("                          copy, the grab buffer allocation and the data\n"));
+   MosPrintf(MIL_TEXT("                          format change on the synthetic source, in the\n"));
+   MosPrintf(MIL_TEXT("                          format of -sizex, -sizey and -pixelformat, and\n"));
+   MosPrintf(MIL_TEXT("                          write the results as JSON. -duration sets the\n"));
+   MosPrintf(MIL_TEXT("                          time of the end-to-end runs (default: 3).\n"));
+   }
 
 /* Get Multicast IP address and UDP port number to use.                      */
 /* -----------------------------------------------------------------------   */
@@ -249,124 +1046,567 @@ void GetMulticastInfo(MIL_STRING& oMulticastAddress, MIL_INT& oUdpPort)
    oUdpPort = (MIL_INT)lUdpPort;
    }
 
-/* Allocate acquisition and display buffers.                                 */
+/* Multicast address and UDP port for the native receiver: the command     */
+/* line, else the monitor DCF, else asked to the user. The digitizer is only */
+/* allocated to read the DCF; it does not grab.                             */
 /* -----------------------------------------------------------------------   */
-void AllocateGrabBuffers(MIL_INT MilSystem, HookDataStruct* HookDataPtr)
+void GetNativeMulticastInfo(MIL_ID MilSystem, MIL_INT SystemType,
+                            const MonitorOptionsStruct* OptionsPtr, bool Interactive,
+                            MIL_STRING& oMulticastAddress, MIL_INT& oUdpPort)
    {
-   MIL_INT n = 0;
-   MdigInquire(HookDataPtr->MilDigitizer, M_SOURCE_DATA_FORMAT,
-      &HookDataPtr->SourceDataFormat);
-
-   /* Allocate the display buffer and clear it. */
-   MbufAllocColor(MilSystem,
-                  MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_BAND, M_NULL),
-                  MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_X, M_NULL),
-                  MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_Y, M_NULL),
-                  MdigInquire(HookDataPtr->MilDigitizer, M_TYPE, M_NULL),
-                  M_IMAGE+M_DISP+M_GRAB+M_PROC+HookDataPtr->SourceDataFormat,
-                  &HookDataPtr->MilImageDisp);
-   MbufClear(HookDataPtr->MilImageDisp, M_COLOR_BLACK);
-
-   /* Allocate the grab buffers and clear them. */
-   MappControl(M_ERROR, M_PRINT_DISABLE);
-   for(HookDataPtr->MilGrabBufferListSize = 0; 
-       HookDataPtr->MilGrabBufferListSize<BUFFERING_SIZE_MAX;
-       HookDataPtr->MilGrabBufferListSize++)
-      {
-      MbufAllocColor(MilSystem,
-                     MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_BAND, M_NULL),
-                     MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_X, M_NULL),
-                     MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_Y, M_NULL),
-                     MdigInquire(HookDataPtr->MilDigitizer, M_TYPE, M_NULL),
-                     M_IMAGE+M_GRAB+M_PROC+HookDataPtr->SourceDataFormat,
-                     &HookDataPtr->MilGrabBufferList[HookDataPtr->MilGrabBufferListSize]);
-
-      if (HookDataPtr->MilGrabBufferList[HookDataPtr->MilGrabBufferListSize])
+   oMulticastAddress = OptionsPtr->MulticastAddress;
+   oUdpPort          = OptionsPtr->UdpPort;
+   if(!oMulticastAddress.empty())
+      return;
+
+   if(SystemType == M_SYSTEM_GIGE_VISION_TYPE)
+      {
+      MIL_ID MilDigitizer = M_NULL;
+
+      MappControl(M_DEFAULT, M_ERROR, M_PRINT_DISABLE);
+      MdigAlloc(MilSystem, M_DEFAULT, MIL_TEXT("gigevision_multicast_monitor.dcf"),
+         M_GC_MULTICAST_MONITOR, &MilDigitizer);
+      MappControl(M_DEFAULT, M_ERROR, M_PRINT_ENABLE);
+      if(MilDigitizer)
          {
-         MbufClear(HookDataPtr->MilGrabBufferList[HookDataPtr->MilGrabBufferListSize],
-            M_COLOR_WHITE);
+         MdigInquire(MilDigitizer, M_GC_STREAM_CHANNEL_MULTICAST_ADDRESS_STRING,
+            oMulticastAddress);
+         MdigInquire(MilDigitizer, M_GC_LOCAL_STREAM_PORT, &oUdpPort);
+         MdigFree(MilDigitizer);
          }
+      }
+
+   if(oMulticastAddress.empty() || oMulticastAddress == MIL_TEXT("0.0.0.0") || oUdpPort == 0)
+      {
+      if(Interactive)
+         GetMulticastInfo(oMulticastAddress, oUdpPort);
       else
-         break;
+         {
+         /* The group the simulator streams to by default. */
+         oMulticastAddress = OptionsPtr->SourceConfig.MulticastAddress;
+         oUdpPort          = OptionsPtr->SourceConfig.UdpPort;
+         }
+      }
+   }
+
+/* Makes the grab buffer list and the display buffer those of a pool.      */
+/* -----------------------------------------------------------------------   */
+static void UseBufferPool(HookDataStruct* HookDataPtr, BufferPoolStruct* PoolPtr)
+   {
+   HookDataPtr->ActivePool            = PoolPtr;
+   HookDataPtr->SourceDataFormat      = PoolPtr->SourceDataFormat;
+   HookDataPtr->MilImageDisp          = PoolPtr->ImageDisp;
+   HookDataPtr->MilGrabBufferListSize = PoolPtr->GrabBufferListSize;
+   for(MIL_INT i = 0; i < PoolPtr->GrabBufferListSize; i++)
+      HookDataPtr->MilGrabBufferList[i] = PoolPtr->GrabBufferList[i];
+
+   /* The overlay draws into the display buffer directly if it has a single */
+   /* host address.                                                         */
+   if(HookDataPtr->Overlay)
+      {
+      MIL_UINT8* Address = M_NULL;
+
+      if(PoolPtr->ImageDisp &&
+         (MbufInquire(PoolPtr->ImageDisp, M_SIZE_BAND, M_NULL) == 1 ||
+          (MbufInquire(PoolPtr->ImageDisp, M_DATA_FORMAT, M_NULL) & M_PACKED)))
+         MbufInquire(PoolPtr->ImageDisp, M_HOST_ADDRESS, &Address);
+      FrameOverlaySetTarget(HookDataPtr->Overlay, (uint32_t)PoolPtr->FramePixelFormat, Address,
+         Address ? (size_t)MbufInquire(PoolPtr->ImageDisp, M_PITCH_BYTE, M_NULL) : 0,
+         (uint32_t)PoolPtr->FrameSizeX, (uint32_t)PoolPtr->FrameSizeY);
+      }
+   }
+
+/* Allocate acquisition and display buffers.                                 */
+/* -----------------------------------------------------------------------   */
+void AllocateGrabBuffers(MIL_INT MilSystem, HookDataStruct* HookDataPtr)
+   {
+   MIL_INT SizeBand, SizeX, SizeY, Type;
+   MIL_INT PixelFormat = HookDataPtr->FramePixelFormat;
+   MIL_INT64 SourceDataFormat, BufferBytes, DisplayBytes;
+   MIL_DOUBLE FrameRate = 0;
+   MIL_INT BufferCount;
+   BufferPoolStruct* PoolPtr;
+
+   if(HookDataPtr->MilDigitizer)
+      {
+      MdigInquire(HookDataPtr->MilDigitizer, M_SOURCE_DATA_FORMAT, &SourceDataFormat);
+      MdigInquire(HookDataPtr->MilDigitizer, M_GC_PIXEL_FORMAT, &PixelFormat);
+      SizeBand = MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_BAND, M_NULL);
+      SizeX    = MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_X, M_NULL);
+      SizeY    = MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_Y, M_NULL);
+      Type     = MdigInquire(HookDataPtr->MilDigitizer, M_TYPE, M_NULL);
+      }
+   else
+      {
+      /* No digitizer: the buffers follow the data format of the frames. */
+      GetBufferFormat(PixelFormat, &SizeBand, &Type, &SourceDataFormat);
+      SizeX = HookDataPtr->FrameSizeX;
+      SizeY = HookDataPtr->FrameSizeY;
       }
-   MappControl(M_ERROR, M_PRINT_ENABLE);
 
+   /* Size the grab queue from the frame rate, if known yet. */
+   if(HookDataPtr->FrameInterval > 0)
+      FrameRate = 1.0 / HookDataPtr->FrameInterval;
+   else if(HookDataPtr->Backend == eAcquisitionSynthetic)
+      FrameRate = HookDataPtr->SourceConfig.FrameRate;
+   else if(HookDataPtr->Replay && HookDataPtr->Replay->Pacing == eReplayFixedRate)
+      FrameRate = HookDataPtr->Replay->FrameRate;
+   else if(HookDataPtr->Replay && HookDataPtr->Replay->Pacing == eReplayOriginal &&
+           HookDataPtr->Replay->RecordedDuration > 0)
+      FrameRate = (HookDataPtr->Replay->Frames.size() - 1) / HookDataPtr->Replay->RecordedDuration;
 
+   BufferBytes  = BufferPoolBufferBytes(SizeBand, SizeX, SizeY, Type, SourceDataFormat);
+   DisplayBytes = BufferPoolDisplayBytes(SizeX, SizeY, PixelFormat, BufferBytes,
+                                         HookDataPtr->PoolCache->PoolFlags);
+   BufferCount  = GrabQueueInitialSize(&HookDataPtr->GrabQueue, BufferBytes, DisplayBytes,
+                                       FrameRate);
+
+   /* Idle pools go first if the new one does not fit in the budget. */
+   PoolCacheMakeRoom(HookDataPtr->PoolCache, BufferCount * BufferBytes + DisplayBytes);
+   PoolPtr = BufferPoolAlloc(MilSystem, SizeBand, SizeX, SizeY, Type, SourceDataFormat,
+                             PixelFormat, BufferCount, HookDataPtr->PoolCache->PoolFlags,
+                             HookDataPtr->PoolCache->NumaNode, &HookDataPtr->GrabQueue);
+   UseBufferPool(HookDataPtr, PoolPtr);
    }
 
 /* Free MIL acquisition and display buffers.                                 */
 /* -----------------------------------------------------------------------   */
 void FreeGrabBuffers(HookDataStruct* HookDataPtr)
    {
-   while(HookDataPtr->MilGrabBufferListSize > 0)
-      MbufFree(HookDataPtr->MilGrabBufferList[--HookDataPtr->MilGrabBufferListSize]);
+   BufferPoolFree(HookDataPtr->ActivePool);
+   HookDataPtr->ActivePool            = M_NULL;
+   HookDataPtr->MilGrabBufferListSize = 0;
+   HookDataPtr->MilImageDisp          = M_NULL;
+   if(HookDataPtr->Overlay)
+      FrameOverlaySetTarget(HookDataPtr->Overlay, 0, M_NULL, 0, 0, 0);
+   }
+
+/* Swaps the grab buffers for a pool of the new data format, or of the     */
+/* same format with another number of buffers. The grab is only stopped    */
+/* for the time it takes to swap the buffer lists.                          */
+/* -----------------------------------------------------------------------   */
+void SwitchBufferPool(MIL_INT MilSystem, HookDataStruct* HookDataPtr,
+                      BufferPoolStruct* PoolPtr, bool FromCache)
+   {
+   BufferPoolStruct* PreviousPoolPtr = HookDataPtr->ActivePool;
+   bool FormatChange = !PreviousPoolPtr ||
+                       !BufferPoolMatches(PreviousPoolPtr, PoolPtr->FrameSizeX,
+                                          PoolPtr->FrameSizeY, PoolPtr->FramePixelFormat);
+   MIL_DOUBLE PoolReadyTime, StopTime, RestartTime;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &PoolReadyTime);
+   StopTime = PoolReadyTime;
+
+   /* 1- Stop grabbing? */
+   if(IsAcquisitionInProgress(HookDataPtr))
+      StopAcquisition(HookDataPtr);
+
+   /* 2- Update data format. */
+   if(HookDataPtr->MilDigitizer && FormatChange)
+      {
+      MdigControl(HookDataPtr->MilDigitizer, M_SOURCE_SIZE_X, PoolPtr->FrameSizeX);
+      MdigControl(HookDataPtr->MilDigitizer, M_SOURCE_SIZE_Y, PoolPtr->FrameSizeY);
+      MdigControl(HookDataPtr->MilDigitizer, M_GC_PIXEL_FORMAT, PoolPtr->FramePixelFormat);
+
+      /* The pool was built from the pixel format alone. Fall back to buffers */
+      /* allocated from the digitizer if it expects another buffer format.    */
+      if(MdigInquire(HookDataPtr->MilDigitizer, M_SIZE_BAND, M_NULL) != PoolPtr->SizeBand ||
+         MdigInquire(HookDataPtr->MilDigitizer, M_TYPE, M_NULL) != PoolPtr->Type)
+         {
+         BufferPoolFree(PoolPtr);
+         PoolPtr = M_NULL;
+         }
+      }
+
+   /* 3- Swap the grab buffers. */
+   HookDataPtr->ActivePool = M_NULL;
+   if(PoolPtr)
+      UseBufferPool(HookDataPtr, PoolPtr);
+   else
+      AllocateGrabBuffers(MilSystem, HookDataPtr);
+   if(HookDataPtr->MilDisplay)
+      MdispSelect(HookDataPtr->MilDisplay, HookDataPtr->MilImageDisp);
+
+   /* 4- Resume grab. The hook completes the measurements on the first frame */
+   /* grabbed into the new pool.                                             */
+   HookDataPtr->Switch.PoolReadyTime = PoolReadyTime;
+   HookDataPtr->Switch.FromCache     = FromCache;
+   HookDataPtr->SwitchPending        = (HookDataPtr->Switch.DetectTime > 0);
+   StartAcquisition(HookDataPtr);
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &RestartTime);
+   HookDataPtr->SwitchStopDuration = RestartTime - StopTime;
+
+   /* The previous pool is kept for a switch back to its format. */
+   if(FormatChange)
+      {
+      PoolCachePut(HookDataPtr->PoolCache, PreviousPoolPtr);
+      PrintCameraInfo(HookDataPtr);
+      }
+   else
+      BufferPoolFree(PreviousPoolPtr);
+   }
+
+/* Reports the last data format change completed by the hook.               */
+/* -----------------------------------------------------------------------   */
+void PrintFormatSwitch(HookDataStruct* HookDataPtr)
+   {
+   const FormatSwitchStruct* SwitchPtr = &HookDataPtr->LastSwitch;
+   MIL_DOUBLE Gap = SwitchPtr->FirstFrameTime - SwitchPtr->DetectTime;
 
-   MbufFree(HookDataPtr->MilImageDisp);
+   if(HookDataPtr->StreamIndex >= 0)
+      MosPrintf(MIL_TEXT("Stream %lld: "), (long long)HookDataPtr->StreamIndex);
+   MosPrintf(MIL_TEXT("Data format change: pool %s after %.1f ms, grab stopped %.1f ms, ")
+             MIL_TEXT("gap %.1f ms"), SwitchPtr->FromCache ? MIL_TEXT("from cache") :
+             MIL_TEXT("built"), 1000.0 * (SwitchPtr->PoolReadyTime - SwitchPtr->DetectTime),
+             1000.0 * HookDataPtr->SwitchStopDuration, 1000.0 * Gap);
+   if(SwitchPtr->FrameInterval > 0)
+      MosPrintf(MIL_TEXT(" (~%.0f frames"), Gap / SwitchPtr->FrameInterval);
+   else
+      MosPrintf(MIL_TEXT(" (? frames"));
+   MosPrintf(MIL_TEXT(", %lld grabbed into old buffers).\n"),
+             (long long)SwitchPtr->MismatchedFrames);
    }
 
-/* This routine queries periodically to determine if a data format change    */
-/* has been detected. If so then the grab is stopped, the new data format    */
-/* is applied, the grab buffers are re-allocated and the grab is re started. */
+/* Sets the figures of the overlay from the statistics of the last period. */
 /* -----------------------------------------------------------------------   */
-void AdaptToDataFormatChange(MIL_INT MilSystem, HookDataStruct* HookDataPtr)
+static void SampleOverlayValues(HookDataStruct* HookDataPtr, MIL_DOUBLE CurrentTime)
    {
-   MIL_INT DigProcessInProgress = M_FALSE;
-   bool Done = false;
+   FrameOverlayStruct*         OverlayPtr   = HookDataPtr->Overlay;
+   const StatsHistogramStruct* LatencyPtr   =
+      &HookDataPtr->Stats->Histograms[eStatsTransportLatency];
+   MIL_INT64                   FrameCount   = HookDataPtr->Stats->FrameCount.Value.load();
+   MIL_INT64                   CorruptCount = HookDataPtr->Stats->CorruptCount.Value.load();
+   MIL_INT64                   LatencyCount = LatencyPtr->Count.Value.load();
+   MIL_INT64                   LatencySum   = LatencyPtr->Sum.Value.load();
+   MIL_INT64                   Frames       = FrameCount - OverlayPtr->LastFrameCount;
+   MIL_INT64                   Latencies    = LatencyCount - OverlayPtr->LastLatencyCount;
 
-   do
-      {     
-      /* Sleep. */
-      MthrWait(HookDataPtr->Event, M_EVENT_WAIT+M_EVENT_TIMEOUT(1000), M_NULL);
+   if(OverlayPtr->LastSampleTime > 0)
+      {
+      FrameOverlaySetValue(OverlayPtr, eOverlayFrameRate,
+         Frames / (CurrentTime - OverlayPtr->LastSampleTime));
+      FrameOverlaySetValue(OverlayPtr, eOverlayLatency, Latencies > 0 ?
+         1e-6 * (LatencySum - OverlayPtr->LastLatencySum) / Latencies : NAN);
+      FrameOverlaySetValue(OverlayPtr, eOverlayLoss, Frames > 0 ?
+         100.0 * (CorruptCount - OverlayPtr->LastCorruptCount) / Frames : NAN);
+      }
+
+   OverlayPtr->LastSampleTime   = CurrentTime;
+   OverlayPtr->LastFrameCount   = FrameCount;
+   OverlayPtr->LastCorruptCount = CorruptCount;
+   OverlayPtr->LastLatencyCount = LatencyCount;
+   OverlayPtr->LastLatencySum   = LatencySum;
+   }
+
+/* Reports the image health alerts raised or cleared since the last call.  */
+/* -----------------------------------------------------------------------   */
+static void ReportHealthAlerts(HookDataStruct* HookDataPtr)
+   {
+   static const MIL_TEXT_CHAR* const Descriptions[eHealthAlertCount] =
+      {
+      MIL_TEXT("frozen camera, the frames repeat"),
+      MIL_TEXT("black frames"),
+      MIL_TEXT("blown exposure"),
+      MIL_TEXT("loss of focus"),
+      };
+   FrameHealthStruct* HealthPtr = HookDataPtr->Health;
+   uint32_t           Active    = HealthPtr->ActiveAlerts.load(std::memory_order_acquire);
+   uint32_t           Changed   = Active ^ HealthPtr->ReportedAlerts;
+
+   for(int i = 0; i < eHealthAlertCount; i++)
+      {
+      if(!(Changed & (1u << i)))
+         continue;
+      if(HookDataPtr->StreamIndex >= 0)
+         MosPrintf(MIL_TEXT("Stream %lld: "), (long long)HookDataPtr->StreamIndex);
+      MosPrintf(MIL_TEXT("Image health alert %s: %s (mean %.1f, dark %.1f%%, saturated %.1f%%, ")
+                MIL_TEXT("sharpness %.1f).\n"),
+         (Active & (1u << i)) ? MIL_TEXT("raised") : MIL_TEXT("cleared"), Descriptions[i],
+         HealthPtr->Mean.load(), 100.0 * HealthPtr->DarkRatio.load(),
+         100.0 * HealthPtr->SaturatedRatio.load(), HealthPtr->Sharpness.load());
+      }
+   HealthPtr->ReportedAlerts = Active;
+   }
+
+/* Handles the data format change of a stream, if any: a pool of grab     */
+/* buffers that conform to the new data format is taken from the cache or   */
+/* built in the background while the grab goes on, then the grab is        */
+/* briefly stopped to swap the pools and restarted. Also reviews the size   */
+/* of the grab queue and exports the frame statistics.                       */
+/* -----------------------------------------------------------------------   */
+void ServiceDataFormatChange(MIL_INT MilSystem, HookDataStruct* HookDataPtr)
+   {
+   PoolCacheStruct* CachePtr = HookDataPtr->PoolCache;
+   BufferPoolStruct* BuiltPoolPtr;
+   MIL_DOUBLE CurrentTime;
 
-      /* Validate if data format has changed. */
-      if(HookDataPtr->DataFormatChanged)
+   /* Validate if data format has changed. */
+   if(HookDataPtr->DataFormatChanged.exchange(false, std::memory_order_acquire))
+      HookDataPtr->PoolNeeded = true;
+
+   BuiltPoolPtr = PoolCacheTakeBuilt(CachePtr);
+
+   if(HookDataPtr->PoolNeeded)
+      {
+      MIL_INT SizeX       = HookDataPtr->FrameSizeX;
+      MIL_INT SizeY       = HookDataPtr->FrameSizeY;
+      MIL_INT PixelFormat = HookDataPtr->FramePixelFormat;
+      BufferPoolStruct* PoolPtr = M_NULL;
+      bool FromCache = false;
+
+      if(BuiltPoolPtr && BufferPoolMatches(BuiltPoolPtr, SizeX, SizeY, PixelFormat))
          {
-         // Reset variable
-         HookDataPtr->DataFormatChanged = (HookDataPtr->DataFormatChanged ? false : true);
-
-         /* The camera's data format has changed we must:               */
-         /* 1- Stop any grabs that had previously been started.         */
-         /* 2- Update digitizer's data format.                          */
-         /* 3- Reallocate grab buffers that conform to the data format. */
-         /* 4- Restart the grab.                                        */
-
-         /* 1- Stop grabbing? */
-         MdigInquire(HookDataPtr->MilDigitizer, M_DIG_PROCESS_IN_PROGRESS,
-            &DigProcessInProgress);
-         if(DigProcessInProgress)
-            {
-            MdigProcess(HookDataPtr->MilDigitizer, HookDataPtr->MilGrabBufferList,
-               HookDataPtr->MilGrabBufferListSize, M_STOP, M_DEFAULT, ProcessingFunction,
-               HookDataPtr);
-            }
+         PoolPtr      = BuiltPoolPtr;
+         BuiltPoolPtr = M_NULL;
+         }
+      else
+         {
+         PoolPtr   = PoolCacheTake(CachePtr, SizeX, SizeY, PixelFormat);
+         FromCache = (PoolPtr != M_NULL);
+         }
 
-         /* 2- Update data format. */
-         MdigControl(HookDataPtr->MilDigitizer, M_SOURCE_SIZE_X, HookDataPtr->FrameSizeX);
-         MdigControl(HookDataPtr->MilDigitizer, M_SOURCE_SIZE_Y, HookDataPtr->FrameSizeY);
-         MdigControl(HookDataPtr->MilDigitizer, M_GC_PIXEL_FORMAT,
-            HookDataPtr->FramePixelFormat);
-
-         PrintCameraInfo(HookDataPtr);
-         
-         /* 3- Reallocate grab buffers. */
-         FreeGrabBuffers(HookDataPtr);
-         AllocateGrabBuffers(MilSystem, HookDataPtr);
-         MdispSelect(HookDataPtr->MilDisplay, HookDataPtr->MilImageDisp);
-
-         /* 4- Resume grab. */
-         MdigProcess(HookDataPtr->MilDigitizer, HookDataPtr->MilGrabBufferList,
-            HookDataPtr->MilGrabBufferListSize, M_START, M_DEFAULT, ProcessingFunction,
-            HookDataPtr);
+      if(HookDataPtr->ActivePool &&
+         BufferPoolMatches(HookDataPtr->ActivePool, SizeX, SizeY, PixelFormat))
+         {
+         /* Back to the format of the current pool before the switch. */
+         PoolCachePut(CachePtr, PoolPtr);
+         HookDataPtr->PoolNeeded = false;
+         }
+      else if(PoolPtr)
+         {
+         SwitchBufferPool(MilSystem, HookDataPtr, PoolPtr, FromCache);
+         HookDataPtr->PoolNeeded = false;
          }
+      else
+         {
+         /* Keep grabbing in the current pool until the new one is built; */
+         /* the builder thread sets the event when it is done.             */
+         MIL_INT SizeBand, Type;
+         MIL_INT64 SourceDataFormat, BufferBytes;
+
+         GetBufferFormat(PixelFormat, &SizeBand, &Type, &SourceDataFormat);
+         BufferBytes = BufferPoolBufferBytes(SizeBand, SizeX, SizeY, Type, SourceDataFormat);
+         PoolCacheBuild(CachePtr, SizeX, SizeY, PixelFormat,
+            GrabQueueFitBudget(&HookDataPtr->GrabQueue, HookDataPtr->MilGrabBufferListSize,
+               BufferBytes, BufferPoolDisplayBytes(SizeX, SizeY, PixelFormat, BufferBytes,
+                                                   CachePtr->PoolFlags)));
+         }
+      }
+
+   /* A pool of the current format with another number of buffers, or   */
+   /* one built for a format that did not last.                          */
+   if(BuiltPoolPtr)
+      {
+      if(!HookDataPtr->PoolNeeded && HookDataPtr->ActivePool &&
+         BufferPoolMatches(HookDataPtr->ActivePool, BuiltPoolPtr->FrameSizeX,
+                           BuiltPoolPtr->FrameSizeY, BuiltPoolPtr->FramePixelFormat))
+         SwitchBufferPool(MilSystem, HookDataPtr, BuiltPoolPtr, false);
+      else
+         PoolCachePut(CachePtr, BuiltPoolPtr);
+      }
+
+   /* Review the size of the grab queue. */
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &CurrentTime);
+   if(!HookDataPtr->PoolNeeded && HookDataPtr->ActivePool &&
+      CurrentTime - HookDataPtr->GrabQueue.LastReviewTime >= GRAB_QUEUE_REVIEW_PERIOD)
+      {
+      BufferPoolStruct* ActivePoolPtr = HookDataPtr->ActivePool;
+      MIL_INT Size = GrabQueueReview(&HookDataPtr->GrabQueue,
+                                     ActivePoolPtr->GrabBufferListSize,
+                                     ActivePoolPtr->BufferBytes,
+                                     BufferPoolDisplayBytes(ActivePoolPtr->FrameSizeX,
+                                        ActivePoolPtr->FrameSizeY,
+                                        ActivePoolPtr->FramePixelFormat,
+                                        ActivePoolPtr->BufferBytes, CachePtr->PoolFlags));
+
+      if(Size != ActivePoolPtr->GrabBufferListSize)
+         PoolCacheBuild(CachePtr, ActivePoolPtr->FrameSizeX, ActivePoolPtr->FrameSizeY,
+                        ActivePoolPtr->FramePixelFormat, Size);
+      }
+
+   /* Free the pools of the formats that did not come back. */
+   PoolCacheExpire(CachePtr, CurrentTime);
+
+   /* Export the frame statistics. */
+   FrameStatsExport(HookDataPtr->Stats, false);
+
+   /* Sample the figures of the overlay. */
+   if(HookDataPtr->Overlay &&
+      CurrentTime - HookDataPtr->Overlay->LastSampleTime >= OVERLAY_SAMPLE_PERIOD)
+      SampleOverlayValues(HookDataPtr, CurrentTime);
+
+   /* Report the image health alerts. */
+   if(HookDataPtr->Health)
+      ReportHealthAlerts(HookDataPtr);
+
+   /* Report the consumers of the frame share that fall behind. */
+   if(HookDataPtr->Share &&
+      CurrentTime - HookDataPtr->LastShareReviewTime >= FRAME_SHARE_REVIEW_PERIOD)
+      {
+      FrameShareReviewReaders(HookDataPtr->Share);
+      HookDataPtr->LastShareReviewTime = CurrentTime;
+      }
+
+   /* Report the time to first frame; the hook sets the event on it. */
+   if(!HookDataPtr->FirstFrameReported && HookDataPtr->Stats->FirstFrameTime.load() > 0)
+      {
+      FrameStatsStruct* StatsPtr = HookDataPtr->Stats;
+
+      HookDataPtr->FirstFrameReported = true;
+      if(HookDataPtr->StreamIndex >= 0)
+         MosPrintf(MIL_TEXT("Stream %lld: "), (long long)HookDataPtr->StreamIndex);
+      MosPrintf(MIL_TEXT("First frame %.1f ms after the start (acquisition started after "
+                         "%.1f ms).\n"),
+         1000.0 * (StatsPtr->FirstFrameTime.load() - StatsPtr->LaunchTime),
+         1000.0 * (StatsPtr->AcquisitionStartTime - StatsPtr->LaunchTime));
+      }
+
+   /* Report the data format change once the hook saw its first frame. */
+   if(HookDataPtr->SwitchCompleted.load(std::memory_order_acquire))
+      {
+      FrameStatsFormatChange(HookDataPtr->Stats, HookDataPtr->LastSwitch.FirstFrameTime -
+                                                 HookDataPtr->LastSwitch.DetectTime);
+      PrintFormatSwitch(HookDataPtr);
+      HookDataPtr->SwitchCompleted.store(false, std::memory_order_release);
+      }
+   }
+
+/* Time the next periodic task of ServiceDataFormatChange() is due, 0 if   */
+/* none is: the main thread sleeps until then unless an event wakes it up.  */
+/* -----------------------------------------------------------------------   */
+MIL_DOUBLE NextServiceTime(const HookDataStruct* HookDataPtr)
+   {
+   MIL_DOUBLE NextTime = FrameStatsNextExport(HookDataPtr->Stats);
+   MIL_DOUBLE TaskTime[4] = { 0, 0, 0, 0 };
+
+   if(!HookDataPtr->PoolNeeded && HookDataPtr->ActivePool)
+      TaskTime[0] = HookDataPtr->GrabQueue.LastReviewTime + GRAB_QUEUE_REVIEW_PERIOD;
+   if(HookDataPtr->Overlay)
+      TaskTime[1] = HookDataPtr->Overlay->LastSampleTime + OVERLAY_SAMPLE_PERIOD;
+   if(HookDataPtr->Share)
+      TaskTime[2] = HookDataPtr->LastShareReviewTime + FRAME_SHARE_REVIEW_PERIOD;
+   TaskTime[3] = PoolCacheNextExpiry(HookDataPtr->PoolCache);
+
+   for(int i = 0; i < 4; i++)
+      {
+      if(TaskTime[i] > 0 && (NextTime == 0 || TaskTime[i] < NextTime))
+         NextTime = TaskTime[i];
+      }
+   return NextTime;
+   }
+
+/* This routine waits for data format changes and handles them until the   */
+/* user stops the monitor, a stop signal comes or the run duration elapses. */
+/* It does not poll: it sleeps until an event (data format change, pool     */
+/* built, first frame, stop request) or its next periodic task.            */
+/* -----------------------------------------------------------------------   */
+void AdaptToDataFormatChange(MIL_INT MilSystem, HookDataStruct* HookDataPtr,
+                             ControlStruct* ControlPtr)
+   {
+   MIL_DOUBLE StartTime, CurrentTime, EndTime = 0;
+   bool Done = false;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &StartTime);
+   if(HookDataPtr->RunDuration > 0)
+      EndTime = StartTime + HookDataPtr->RunDuration;
+
+   do
+      {
+      MIL_DOUBLE WakeTime = NextServiceTime(HookDataPtr);
+
+      /* Sleep. */
+      if(EndTime > 0 && (WakeTime == 0 || EndTime < WakeTime))
+         WakeTime = EndTime;
+      ControlWait(ControlPtr, WakeTime);
+
+      ServiceDataFormatChange(MilSystem, HookDataPtr);
 
       /* Must we quit? */
-      if(MosKbhit())
-         {
-         MosGetch();
+      MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &CurrentTime);
+      Done = ControlPtr->StopRequested || (EndTime > 0 && CurrentTime >= EndTime);
+
+      /* The replay ends with the recording. */
+      if(HookDataPtr->Replay && HookDataPtr->Replay->Ended.load())
          Done = true;
-         }
       }
    while(!Done);
+
+   if(ControlPtr->StopSignal != 0)
+      MosPrintf(MIL_TEXT("\nStopped by %s.\n"),
+         ControlPtr->StopSignal == SIGINT ? MIL_TEXT("SIGINT") : MIL_TEXT("SIGTERM"));
+   }
+
+/* Prints the cost of the overlay of the display, if any.                   */
+/* -----------------------------------------------------------------------   */
+void PrintOverlayStatistics(HookDataStruct* HookDataPtr)
+   {
+   FrameOverlayStruct* OverlayPtr = HookDataPtr->Overlay;
+   MIL_INT64           DrawCount  = OverlayPtr ? OverlayPtr->DrawCount.load() : 0;
+
+   if(DrawCount == 0)
+      return;
+
+   MosPrintf(MIL_TEXT("\nDisplay overlay (%d x %d glyph cells):\n"),
+      (int)OverlayPtr->Atlas->CellWidth, (int)OverlayPtr->Atlas->CellHeight);
+   MosPrintf(MIL_TEXT("  Frames drawn:            %lld\n"), (long long)DrawCount);
+   MosPrintf(MIL_TEXT("  Average time:            %.2f us (max %.2f us)\n"),
+      1e-3 * OverlayPtr->DrawTime.load() / DrawCount, 1e-3 * OverlayPtr->DrawTimeMax.load());
+   }
+
+/* Prints the figures of the image health analysis, if any.                */
+/* -----------------------------------------------------------------------   */
+void PrintHealthStatistics(HookDataStruct* HookDataPtr)
+   {
+   FrameHealthStruct* HealthPtr  = HookDataPtr->Health;
+   MIL_INT64          FrameCount = HealthPtr ? HealthPtr->FrameCount.load() : 0;
+
+   if(FrameCount == 0)
+      return;
+
+   MosPrintf(MIL_TEXT("\nImage health (one frame in %u):\n"), (unsigned)HealthPtr->Period);
+   MosPrintf(MIL_TEXT("  Frames analysed:         %lld (%lld skipped, worker busy)\n"),
+      (long long)FrameCount, (long long)HealthPtr->BusyCount.load());
+   MosPrintf(MIL_TEXT("  Average time:            %.2f us (max %.2f us)\n"),
+      1e-3 * HealthPtr->AnalysisTime.load() / FrameCount, 1e-3 * HealthPtr->AnalysisTimeMax.load());
+   MosPrintf(MIL_TEXT("  Repeated frames:         %lld\n"), (long long)HealthPtr->RepeatCount.load());
+   MosPrintf(MIL_TEXT("  Last frame:              mean %.1f, levels %.0f/%.0f/%.0f (p1/p50/p99),\n"),
+      HealthPtr->Mean.load(), HealthPtr->Levels[eHealthLevelP1].load(),
+      HealthPtr->Levels[eHealthLevelP50].load(), HealthPtr->Levels[eHealthLevelP99].load());
+   MosPrintf(MIL_TEXT("                           dark %.1f%%, saturated %.1f%%, sharpness %.1f\n"),
+      100.0 * HealthPtr->DarkRatio.load(), 100.0 * HealthPtr->SaturatedRatio.load(),
+      HealthPtr->Sharpness.load());
+   MosPrintf(MIL_TEXT("  Alerts raised:          "));
+   for(int i = 0; i < eHealthAlertCount; i++)
+      {
+      std::string Name(FrameHealthAlertName((HealthAlertType)i));
+
+      MosPrintf(MIL_TEXT(" %s %lld"), MIL_STRING(Name.begin(), Name.end()).c_str(),
+         (long long)HealthPtr->AlertCounts[i].load());
+      }
+   MosPrintf(MIL_TEXT("\n"));
+   }
+
+/* Prints the work of the pixel conversion kernels, if any.                  */
+/* -----------------------------------------------------------------------   */
+void PrintConversionStatistics(HookDataStruct* HookDataPtr)
+   {
+   PixelConvertPoolStruct* PoolPtr  = HookDataPtr->Converter;
+   MIL_INT64               JobCount = PoolPtr ? PoolPtr->JobCount.load() : 0;
+   MIL_DOUBLE              Seconds;
+   std::string             IsaName;
+
+   if(JobCount == 0)
+      return;
+
+   Seconds = PoolPtr->Nanoseconds.load() / 1e9;
+   IsaName = PixelConvertIsaName(PixelConvertGetIsa());
+   MosPrintf(MIL_TEXT("\nPixel conversion (%s, %d thread(s)):\n"),
+      MIL_STRING(IsaName.begin(), IsaName.end()).c_str(), (int)PoolPtr->Threads.size() + 1);
+   MosPrintf(MIL_TEXT("  Conversions:             %lld\n"), (long long)JobCount);
+   MosPrintf(MIL_TEXT("  Average time:            %.1f us\n"), 1e6 * Seconds / JobCount);
+   MosPrintf(MIL_TEXT("  Throughput:              %.2f GB/s\n"),
+      Seconds > 0 ? PoolPtr->ByteCount.load() / Seconds / 1e9 : 0.0);
    }
 
 /* Prints information regarding the device this slave digitizer is connected to. */
@@ -376,11 +1616,13 @@ void PrintCameraInfo(HookDataStruct* HookDataPtr)
    MIL_INT PortNumber = 0;
 
 #if M_MIL_USE_WINDOWS
-   /* Clear console. */
-   system("cls");
+   /* Clear console, unless the other streams print to it too. */
+   if(HookDataPtr->StreamIndex < 0)
+      system("cls");
 #endif
 
-   if(HookDataPtr->DeviceVendor.empty() && HookDataPtr->DeviceModel.empty())
+   if(HookDataPtr->MilDigitizer &&
+      HookDataPtr->DeviceVendor.empty() && HookDataPtr->DeviceModel.empty())
       {
       /* Inquire camera vendor name. */
       MdigInquire(HookDataPtr->MilDigitizer, M_CAMERA_VENDOR, HookDataPtr->DeviceVendor);
@@ -390,11 +1632,27 @@ void PrintCameraInfo(HookDataStruct* HookDataPtr)
       }
 
    /* Inquire the Multicast address used. */
-   MdigInquire(HookDataPtr->MilDigitizer, M_GC_STREAM_CHANNEL_MULTICAST_ADDRESS_STRING,
-      HookDataPtr->MulticastAddress);
-   MdigInquire(HookDataPtr->MilDigitizer, M_GC_LOCAL_STREAM_PORT, &PortNumber);
+   if(HookDataPtr->MilDigitizer)
+      {
+      MdigInquire(HookDataPtr->MilDigitizer, M_GC_STREAM_CHANNEL_MULTICAST_ADDRESS_STRING,
+         HookDataPtr->MulticastAddress);
+      MdigInquire(HookDataPtr->MilDigitizer, M_GC_LOCAL_STREAM_PORT, &PortNumber);
+      }
+   else if(HookDataPtr->Receiver)
+      PortNumber = HookDataPtr->Receiver->UdpPort;
+   else if(HookDataPtr->StreamIndex >= 0)
+      PortNumber = HookDataPtr->SourceConfig.UdpPort;
 
-   /* Print camera info. */
+   /* Print camera info, on one line in multi-stream mode. */
+   if(HookDataPtr->StreamIndex >= 0)
+      {
+      MosPrintf(MIL_TEXT("Stream %lld: %s:%lld, %s %s, pixel format 0x%x, %lld x %lld.\n"),
+         (long long)HookDataPtr->StreamIndex, HookDataPtr->MulticastAddress.c_str(),
+         (long long)PortNumber, HookDataPtr->DeviceVendor.c_str(),
+         HookDataPtr->DeviceModel.c_str(), (int)HookDataPtr->FramePixelFormat,
+         (long long)HookDataPtr->FrameSizeX, (long long)HookDataPtr->FrameSizeY);
+      return;
+      }
    MosPrintf(MIL_TEXT("\n------------------- Monitor digitizer connection status. ---------"));
    MosPrintf(MIL_TEXT("------------\n\n"));
    MosPrintf(MIL_TEXT("Connected to             %s %s\n"), HookDataPtr->DeviceVendor.c_str(),
@@ -405,65 +1663,266 @@ void PrintCameraInfo(HookDataStruct* HookDataPtr)
    MosPrintf(MIL_TEXT("Multicast address:       %s\n"), HookDataPtr->MulticastAddress.c_str());
    MosPrintf(MIL_TEXT("UDP Port:                %lld\n"), (long long)PortNumber);
 
-   MosPrintf(MIL_TEXT("\nPress <Enter> to stop.\n\n"));
+   if(HookDataPtr->Interactive)
+      MosPrintf(MIL_TEXT("\nPress <Enter> to stop.\n\n"));
    }
 
 /* User's processing function called every time a grab buffer is modified. */
 /* -----------------------------------------------------------------------*/
 
-/* Local defines. */
-#define STRING_LENGTH_MAX  20
-#define STRING_POS_X       20
-#define STRING_POS_Y       20
-
 MIL_INT MFTYPE ProcessingFunction(MIL_INT HookType,
                                   MIL_ID HookId,
                                   void* HookDataPtr)
    {
-   HookDataStruct *UserHookDataPtr = (HookDataStruct *)HookDataPtr;
-   MIL_ID ModifiedBufferId;
-   MIL_TEXT_CHAR Text[STRING_LENGTH_MAX]= {MIL_TEXT('\0'),};
-   MIL_INT IsFrameCorrupt = M_FALSE;
-   MIL_INT FrameSizeX = 0;
-   MIL_INT FrameSizeY = 0;
-   MIL_INT FramePixelFormat = 0;
-   MIL_INT FramePacketSize = 0;
+   FrameInfoStruct FrameInfo;
+   MIL_INT64       DeviceTimestamp = 0;
+
+   MappTimer(M_DEFAULT, M_TIMER_READ + M_SYNCHRONOUS, &FrameInfo.HookEntryTime);
 
    /* Retrieve the MIL_ID of the grabbed buffer. */
-   MdigGetHookInfo(HookId, M_MODIFIED_BUFFER+M_BUFFER_ID,   &ModifiedBufferId);
-   MdigGetHookInfo(HookId, M_CORRUPTED_FRAME,               &IsFrameCorrupt);
-   MdigGetHookInfo(HookId, M_GC_FRAME_SIZE_X,               &FrameSizeX);
-   MdigGetHookInfo(HookId, M_GC_FRAME_SIZE_Y,               &FrameSizeY);
-   MdigGetHookInfo(HookId, M_GC_FRAME_PIXEL_TYPE,           &FramePixelFormat);
-   MdigGetHookInfo(HookId, M_GC_PACKET_SIZE,                &FramePacketSize);
+   MdigGetHookInfo(HookId, M_MODIFIED_BUFFER+M_BUFFER_ID,   &FrameInfo.BufferId);
+   MdigGetHookInfo(HookId, M_MODIFIED_BUFFER+M_BUFFER_INDEX,&FrameInfo.BufferIndex);
+   MdigGetHookInfo(HookId, M_CORRUPTED_FRAME,               &FrameInfo.IsFrameCorrupt);
+   MdigGetHookInfo(HookId, M_GC_FRAME_SIZE_X,               &FrameInfo.FrameSizeX);
+   MdigGetHookInfo(HookId, M_GC_FRAME_SIZE_Y,               &FrameInfo.FrameSizeY);
+   MdigGetHookInfo(HookId, M_GC_FRAME_PIXEL_TYPE,           &FrameInfo.FramePixelFormat);
+   MdigGetHookInfo(HookId, M_GC_PACKET_SIZE,                &FrameInfo.FramePacketSize);
+   MdigGetHookInfo(HookId, M_GC_FRAME_TIMESTAMP,            &DeviceTimestamp);
+   FrameInfo.DeviceTimestamp = DeviceTimestamp / DEVICE_TIMESTAMP_FREQUENCY;
+#ifdef M_GC_FRAME_BLOCK_ID
+   MdigGetHookInfo(HookId, M_GC_FRAME_BLOCK_ID,             &FrameInfo.BlockId);
+#else
+   FrameInfo.BlockId = 0;
+#endif
 
-   UserHookDataPtr->ProcessedImageCount++;
-   if(IsFrameCorrupt)
-      UserHookDataPtr->CorruptImageCount++;
+   /* The digitizer does not tell which packets of a corrupt frame are missing. */
+   FrameInfo.ReceivedPackets    = M_NULL;
+   FrameInfo.PayloadPacketCount = 0;
+
+   ProcessFrame((HookDataStruct *)HookDataPtr, &FrameInfo);
+
+   return 0;
+   }
+
+/* Processing of a grabbed frame, common to all acquisition backends.       */
+/* -----------------------------------------------------------------------*/
+void ProcessFrame(HookDataStruct* UserHookDataPtr, const FrameInfoStruct* FrameInfoPtr)
+   {
+   FrameWorkItemStruct Item;
+   BufferPoolStruct* PoolPtr = UserHookDataPtr->ActivePool;
+   MIL_DOUBLE Now = FrameInfoPtr->HookEntryTime;
+   MIL_INT64 FrameCount;
+   bool IsMismatched;
+
+   /* The thread that calls the hook is placed on its first frame: the      */
+   /* MdigProcess hook thread is not created by this example.               */
+   if(!UserHookDataPtr->AcquisitionPlaced)
+      {
+      UserHookDataPtr->AcquisitionPlaced = true;
+      if(ThreadPlacementIsSet(&UserHookDataPtr->AcquisitionPlacement))
+         ThreadPlacementApply(&UserHookDataPtr->AcquisitionPlacement, eThreadAcquisition,
+                              UserHookDataPtr->StreamIndex >= 0 ?
+                                 (int)UserHookDataPtr->StreamIndex : THREAD_INDEX_ANY);
+      }
+
+   FrameCount = FrameStatsFrameStart(UserHookDataPtr->Stats, Now, FrameInfoPtr->DeviceTimestamp,
+                                     FrameInfoPtr->BlockId, FrameInfoPtr->IsFrameCorrupt != 0);
+   if(FrameCount == 1)
+      MthrControl(UserHookDataPtr->Event, M_EVENT_SET, M_SIGNALED);
+   if(FrameInfoPtr->IsFrameCorrupt && FrameInfoPtr->ReceivedPackets)
+      FrameStatsPacketLoss(UserHookDataPtr->Stats, FrameInfoPtr->ReceivedPackets,
+                           FrameInfoPtr->PayloadPacketCount);
+
+   /* Average frame interval, to express the data format change gaps in frames. */
+   if(UserHookDataPtr->LastFrameTime > 0)
+      {
+      MIL_DOUBLE Interval = Now - UserHookDataPtr->LastFrameTime;
+      UserHookDataPtr->FrameInterval = UserHookDataPtr->FrameInterval > 0 ?
+         0.9 * UserHookDataPtr->FrameInterval + 0.1 * Interval : Interval;
+      }
+   UserHookDataPtr->LastFrameTime = Now;
+   UserHookDataPtr->GrabQueue.FrameCount.fetch_add(1, std::memory_order_relaxed);
 
    /* Check if a data format change has occurred. */
-   if((FrameSizeX       != UserHookDataPtr->FrameSizeX) ||
-      (FrameSizeY       != UserHookDataPtr->FrameSizeY) ||
-      (FramePixelFormat != UserHookDataPtr->FramePixelFormat))
+   if((FrameInfoPtr->FrameSizeX       != UserHookDataPtr->FrameSizeX) ||
+      (FrameInfoPtr->FrameSizeY       != UserHookDataPtr->FrameSizeY) ||
+      (FrameInfoPtr->FramePixelFormat != UserHookDataPtr->FramePixelFormat))
       {
-      UserHookDataPtr->FrameSizeX = FrameSizeX;
-      UserHookDataPtr->FrameSizeY = FrameSizeY;
-      UserHookDataPtr->FramePixelFormat = FramePixelFormat;
+      UserHookDataPtr->FrameSizeX = FrameInfoPtr->FrameSizeX;
+      UserHookDataPtr->FrameSizeY = FrameInfoPtr->FrameSizeY;
+      UserHookDataPtr->FramePixelFormat = FrameInfoPtr->FramePixelFormat;
+
+      if(UserHookDataPtr->Switch.DetectTime == 0)
+         {
+         UserHookDataPtr->Switch.DetectTime       = Now;
+         UserHookDataPtr->Switch.FrameInterval    = UserHookDataPtr->FrameInterval;
+         UserHookDataPtr->Switch.MismatchedFrames = 0;
+         }
 
       // Do not set on first grab, we must initialize data once first.
-      UserHookDataPtr->DataFormatChanged = M_TRUE;
+      UserHookDataPtr->DataFormatChanged.store(true, std::memory_order_release);
       // Wake up main thread to perform buffer re-allocation.
       MthrControl(UserHookDataPtr->Event, M_EVENT_SET, M_SIGNALED);
       }
 
-   /* Print and draw the frame count. */
-   MosSprintf(Text, STRING_LENGTH_MAX, MIL_TEXT("%lld"), 
-                                       (long long)UserHookDataPtr->ProcessedImageCount);
-   MgraText(M_DEFAULT, ModifiedBufferId, STRING_POS_X, STRING_POS_Y, Text);
+   /* Frames grabbed into buffers of another format are part of the gap of  */
+   /* the data format change in progress.                                   */
+   IsMismatched = PoolPtr && !BufferPoolMatches(PoolPtr, FrameInfoPtr->FrameSizeX,
+                                                FrameInfoPtr->FrameSizeY,
+                                                FrameInfoPtr->FramePixelFormat);
+   if(IsMismatched)
+      UserHookDataPtr->Switch.MismatchedFrames++;
+   else if(UserHookDataPtr->Switch.DetectTime > 0)
+      {
+      /* First frame grabbed into a pool of its format since the change. */
+      if(UserHookDataPtr->SwitchPending.exchange(false) &&
+         !UserHookDataPtr->SwitchCompleted.load(std::memory_order_acquire))
+         {
+         UserHookDataPtr->Switch.FirstFrameTime = Now;
+         UserHookDataPtr->LastSwitch            = UserHookDataPtr->Switch;
+         UserHookDataPtr->SwitchCompleted.store(true, std::memory_order_release);
+         MthrControl(UserHookDataPtr->Event, M_EVENT_SET, M_SIGNALED);
+         }
+      UserHookDataPtr->Switch.DetectTime = 0;
+      }
+
+   /* Record the frame before the processing draws on it. */
+   if(UserHookDataPtr->Recorder && PoolPtr)
+      {
+      RecorderIndexEntryStruct Entry;
 
-   /* Perform the processing and update the display. */
-   MbufCopy(ModifiedBufferId, UserHookDataPtr->MilImageDisp);
-   
-   
-   return 0;
+      Entry.FrameNumber     = (uint64_t)FrameCount;
+      Entry.HostTimestamp   = Now;
+      Entry.DeviceTimestamp = FrameInfoPtr->DeviceTimestamp;
+      Entry.PixelFormat     = (uint32_t)FrameInfoPtr->FramePixelFormat;
+      Entry.BlockId         = (uint32_t)FrameInfoPtr->BlockId;
+      Entry.Flags           = (FrameInfoPtr->IsFrameCorrupt ? RECORDER_FRAME_CORRUPT : 0) |
+                              (IsMismatched ? RECORDER_FRAME_MISMATCHED : 0);
+      FrameRecorderAddFrame(UserHookDataPtr->Recorder, PoolPtr, FrameInfoPtr->BufferId, &Entry);
+      }
+
+   Item.BufferId         = FrameInfoPtr->BufferId;
+   Item.BufferIndex      = FrameInfoPtr->BufferIndex;
+   Item.IsFrameCorrupt   = FrameInfoPtr->IsFrameCorrupt;
+   Item.FrameSizeX       = FrameInfoPtr->FrameSizeX;
+   Item.FrameSizeY       = FrameInfoPtr->FrameSizeY;
+   Item.FramePixelFormat = FrameInfoPtr->FramePixelFormat;
+   Item.FrameCount       = FrameCount;
+   Item.HookEntryTime    = Now;
+   Item.DeviceTimestamp  = FrameInfoPtr->DeviceTimestamp;
+
+   /* Hand the frame to the workers, or process it right away in the hook. */
+   /* The hook never waits: the frame is skipped if the workers are behind,  */
+   /* by the buffers MdigProcess fills next or by a full queue.              */
+   if(UserHookDataPtr->Backend == eAcquisitionMil &&
+      !NextGrabBuffersFree(UserHookDataPtr, FrameInfoPtr->BufferIndex))
+      UserHookDataPtr->GrabQueue.SkipCount.fetch_add(1, std::memory_order_relaxed);
+   else if(UserHookDataPtr->Pipeline)
+      {
+      if(!PipelineSubmit(UserHookDataPtr->Pipeline, UserHookDataPtr->PipelineLane, &Item))
+         UserHookDataPtr->GrabQueue.SkipCount.fetch_add(1, std::memory_order_relaxed);
+      }
+   else
+      ProcessGrabbedBuffer(UserHookDataPtr, &Item, M_DEFAULT);
+
+   FrameStatsFrameEnd(UserHookDataPtr->Stats, Now, UserHookDataPtr->Pipeline ?
+                      PipelineQueueDepth(UserHookDataPtr->Pipeline,
+                                         UserHookDataPtr->PipelineLane) :
+                      UserHookDataPtr->GrabQueue.BuffersInUse.load(std::memory_order_relaxed));
+   }
+
+/* Unpacks in place the packed rows of a 16-bit grab buffer. Frames grabbed */
+/* in a buffer of another size, during a data format change, are left as is. */
+/* -----------------------------------------------------------------------*/
+static bool UnpackGrabbedBuffer(HookDataStruct* UserHookDataPtr, const FrameWorkItemStruct* ItemPtr)
+   {
+   ConvertJobStruct Job;
+   MIL_UINT8*       HostAddress = M_NULL;
+
+   if(MbufInquire(ItemPtr->BufferId, M_SIZE_X, M_NULL) != ItemPtr->FrameSizeX ||
+      MbufInquire(ItemPtr->BufferId, M_SIZE_Y, M_NULL) != ItemPtr->FrameSizeY ||
+      MbufInquire(ItemPtr->BufferId, M_SIZE_BIT, M_NULL) != 16)
+      return false;
+   MbufInquire(ItemPtr->BufferId, M_HOST_ADDRESS, &HostAddress);
+   if(!HostAddress)
+      return false;
+
+   Job.Operation   = eConvertUnpack;
+   Job.PixelFormat = (uint32_t)ItemPtr->FramePixelFormat;
+   Job.SizeX       = (uint32_t)ItemPtr->FrameSizeX;
+   Job.SizeY       = (uint32_t)ItemPtr->FrameSizeY;
+   Job.Src         = HostAddress;
+   Job.SrcPitch    = MbufInquire(ItemPtr->BufferId, M_PITCH_BYTE, M_NULL);
+   Job.Dst         = HostAddress;
+   Job.DstPitch    = Job.SrcPitch;
+   PixelConvertRun(UserHookDataPtr->Converter, &Job);
+   return true;
+   }
+
+/* Analyses the health of the image in a grab buffer. Returns true if an  */
+/* alert was raised or cleared.                                             */
+/* -----------------------------------------------------------------------*/
+static bool AnalyzeGrabbedBuffer(HookDataStruct* UserHookDataPtr, const FrameWorkItemStruct* ItemPtr)
+   {
+   MIL_UINT8* HostAddress = M_NULL;
+
+   /* Frames grabbed in a buffer of another format, during a data format    */
+   /* change, are not analysed.                                              */
+   if(!FrameHealthSupports((uint32_t)ItemPtr->FramePixelFormat) ||
+      MbufInquire(ItemPtr->BufferId, M_SIZE_X, M_NULL) != ItemPtr->FrameSizeX ||
+      MbufInquire(ItemPtr->BufferId, M_SIZE_Y, M_NULL) != ItemPtr->FrameSizeY)
+      return false;
+   MbufInquire(ItemPtr->BufferId, M_HOST_ADDRESS, &HostAddress);
+   if(!HostAddress)
+      return false;
+
+   return FrameHealthAnalyze(UserHookDataPtr->Health, (uint32_t)ItemPtr->FramePixelFormat,
+                             HostAddress, (size_t)MbufInquire(ItemPtr->BufferId, M_PITCH_BYTE, M_NULL),
+                             (uint32_t)ItemPtr->FrameSizeX, (uint32_t)ItemPtr->FrameSizeY);
+   }
+
+/* User's processing of a grabbed buffer. Runs in the hook or in a worker.  */
+/* -----------------------------------------------------------------------*/
+void ProcessGrabbedBuffer(HookDataStruct* UserHookDataPtr, const FrameWorkItemStruct* ItemPtr,
+                          MIL_ID GraphicContext)
+   {
+   bool Packed   = UserHookDataPtr->PackedRows &&
+                   PixelConvertIsPacked((uint32_t)ItemPtr->FramePixelFormat);
+   bool Unpacked = false;
+
+   /* Frames of the native receiver and its recordings are as they came on  */
+   /* the wire: unpack the packed formats first.                            */
+   if(Packed)
+      Unpacked = UnpackGrabbedBuffer(UserHookDataPtr, ItemPtr);
+
+   /* Share the frame as grabbed. */
+   if(UserHookDataPtr->Share)
+      FrameSharePublish(UserHookDataPtr->Share, ItemPtr->BufferId, ItemPtr,
+                        (ItemPtr->IsFrameCorrupt ? FRAME_SHARE_FRAME_CORRUPT : 0) |
+                        (Unpacked ? FRAME_SHARE_FRAME_UNPACKED : 0));
+
+   /* Update the display; the frame count is drawn on the display buffer. */
+   UserHookDataPtr->BufferFrameCount[ItemPtr->BufferIndex] = ItemPtr->FrameCount;
+   if(UserHookDataPtr->Display)
+      DisplayStagePublish(UserHookDataPtr->Display, ItemPtr->BufferIndex);
+   else if(UserHookDataPtr->MilImageDisp)
+      {
+      /* The workers take turns on the display buffer, and a frame older  */
+      /* than the one displayed is not copied.                              */
+      std::lock_guard<std::mutex> Lock(UserHookDataPtr->DisplayLock);
+
+      if(ItemPtr->FrameCount > UserHookDataPtr->DisplayedFrameCount)
+         {
+         DisplayStageCopy(UserHookDataPtr, ItemPtr->BufferId, ItemPtr->BufferIndex,
+                          GraphicContext);
+         UserHookDataPtr->DisplayedFrameCount = ItemPtr->FrameCount;
+         }
+      }
+
+   /* Image health of one frame in the period; the main thread reports the  */
+   /* alerts.                                                                */
+   if(UserHookDataPtr->Health && UserHookDataPtr->Pipeline && (!Packed || Unpacked) &&
+      ItemPtr->FrameCount % UserHookDataPtr->Health->Period == 0 &&
+      AnalyzeGrabbedBuffer(UserHookDataPtr, ItemPtr))
+      MthrControl(UserHookDataPtr->Event, M_EVENT_SET, M_SIGNALED);
    }
@@ -0,0 +1,249 @@
+﻿/*************************************************************************************/
+/*
+ * File name: MulticastMonitor.h
+ *
+ * Synopsis:  Declarations shared by the MulticastMonitor example modules.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef MULTICAST_MONITOR_H
+#define MULTICAST_MONITOR_H
+
+#include <mil.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "GvspSimulator.h"
+#include "GvspReceiver.h"
+#include "FramePipeline.h"
+#include "DisplayStage.h"
+#include "MonitorControl.h"
+
+ /* Maximum number of images in the buffering grab queue. The queue is sized
+    at runtime within this limit, see GrabQueue.h.
+  */
+#define BUFFERING_SIZE_MAX 64
+#define IPV4_ADDRESS_SIZE  20
+#define CONFIG_FILE_MAX    16    /* -config files read, included ones too. */
+
+/* Number of grab buffers ahead of the grab that must be free for the hook  */
+/* to hand a frame over; the frame is skipped otherwise.                     */
+#define GRAB_GUARD_DISTANCE 2
+
+#include "BufferPool.h"
+#include "GrabQueue.h"
+#include "FrameStats.h"
+#include "FrameRecorder.h"
+#include "FrameReplay.h"
+#include "FrameShare.h"
+#include "FrameOverlay.h"
+#include "FrameHealth.h"
+#include "PixelConvert.h"
+
+/* Source of the grabbed frames. */
+typedef enum
+   {
+   eAcquisitionMil = 0,       /* M_GC_MULTICAST_MONITOR digitizer with MdigProcess.   */
+   eAcquisitionSynthetic,     /* In-process frame generator, no device nor network.   */
+   eAcquisitionNative,        /* GVSP received from the multicast group with recvmmsg. */
+   eAcquisitionReplay         /* Frames of a recording made with -record.             */
+   } AcquisitionBackendType;
+
+/* One stream of a multi-stream monitor. */
+typedef struct
+   {
+   MIL_STRING MulticastAddress;
+   MIL_INT    UdpPort;
+   MIL_INT    DeviceNumber;        /* MIL backend: M_DEV0 + n, -1 until defaulted   */
+                                   /* to the position of the stream.                */
+   MIL_STRING DcfName;             /* MIL backend, empty for the monitor default.   */
+   } StreamEntryStruct;
+
+#define STREAM_DEVICE_MAX      16  /* M_DEV0 to M_DEV15.                            */
+
+/* Command line options. */
+typedef struct
+   {
+   AcquisitionBackendType Backend;
+   bool                   Simulate;
+   SimulatorConfigStruct  SourceConfig;
+   MIL_STRING             MulticastAddress;
+   MIL_INT                UdpPort;
+   std::vector<StreamEntryStruct> Streams;  /* Multi-stream mode if not empty.  */
+   MIL_DOUBLE             RunDuration;
+   bool                   Daemon;            /* No prompt, no display, no banner. */
+   MIL_DOUBLE             LaunchTime;        /* Start of the process, MappTimer.  */
+   MIL_INT                WorkerCount;
+   MIL_DOUBLE             DisplayRate;
+   bool                   Headless;
+   MIL_INT64              MemoryBudget;
+   MIL_DOUBLE             LatencyTolerance;
+   bool                   HugePages;
+   bool                   LockMemory;
+   ThreadPlacementStruct  ThreadPlacements[eThreadRoleCount];
+   std::string            StatsPath;
+   MIL_DOUBLE             StatsPeriod;
+   std::string            RecordPath;
+   MIL_INT64              RecordRingSize;
+   uint32_t               OverlayFields;
+   uint32_t               HealthPeriod;      /* 0 for no image health analysis. */
+   std::string            SharePath;
+   MIL_INT                ShareSlotCount;
+   MIL_INT64              ShareFrameBytes;
+   std::string            ReplayPath;
+   ReplayPacingType       ReplayPacing;
+   MIL_DOUBLE             ReplayRate;
+   MIL_INT                ConvertThreadCount;
+   ConvertIsaType         ConvertIsa;
+   std::string            BenchPath;         /* Benchmark mode if not empty.      */
+   } MonitorOptionsStruct;
+
+/* Synthetic acquisition source state. */
+typedef struct
+   {
+   MIL_ID            Thread;
+   std::atomic<bool> StopRequested;
+   MIL_INT64         FrameIndex;
+   MIL_UINT64        RandomState;
+   std::vector<MIL_UINT64> ReceivedPackets;
+   MIL_INT64         HookCallCount;
+   MIL_DOUBLE        HookTimeTotal;
+   MIL_DOUBLE        HookTimeMax;
+   MIL_DOUBLE        RunTime;
+   } SyntheticSourceStruct;
+
+/* Information about one grabbed frame, as retrieved by the acquisition backend. */
+typedef struct
+   {
+   MIL_ID  BufferId;
+   MIL_INT BufferIndex;
+   MIL_INT IsFrameCorrupt;
+   MIL_INT FrameSizeX;
+   MIL_INT FrameSizeY;
+   MIL_INT FramePixelFormat;
+   MIL_INT FramePacketSize;
+   MIL_DOUBLE HookEntryTime;       /* Host time the hook was called, in sec.         */
+   MIL_DOUBLE DeviceTimestamp;     /* Device time of the frame in sec, 0 if unknown. */
+   MIL_INT64  BlockId;             /* GVSP block ID, 0 if unknown.                   */
+   const MIL_UINT64* ReceivedPackets; /* Bit n set if payload packet n + 1 arrived,  */
+                                      /* M_NULL if the backend does not know.        */
+   MIL_INT    PayloadPacketCount;
+   } FrameInfoStruct;
+
+/* Measurements of a data format change, from the first frame in the new     */
+/* format to the first frame grabbed into a pool of that format.             */
+typedef struct
+   {
+   MIL_DOUBLE DetectTime;          /* Set by the hook.                               */
+   MIL_DOUBLE FirstFrameTime;
+   MIL_INT64  MismatchedFrames;    /* Frames grabbed into buffers of the old format. */
+   MIL_DOUBLE FrameInterval;
+   MIL_DOUBLE PoolReadyTime;       /* Set by the main thread while the grab is stopped. */
+   bool       FromCache;
+   } FormatSwitchStruct;
+
+/* User's processing function hook data structure. */
+typedef struct
+   {
+   MIL_ID  MilDigitizer;
+   MIL_ID  MilDisplay;
+   MIL_ID  MilImageDisp;
+   MIL_ID  MilGrabBufferList[BUFFERING_SIZE_MAX];
+   MIL_INT MilGrabBufferListSize;
+   MIL_INT FrameSizeX;
+   MIL_INT FrameSizeY;
+   MIL_INT FramePixelFormat;
+   std::atomic<bool> DataFormatChanged;
+   MIL_INT64 SourceDataFormat;
+   MIL_STRING MulticastAddress;
+   MIL_ID Event;
+   MIL_STRING DeviceVendor;
+   MIL_STRING DeviceModel;
+   AcquisitionBackendType Backend;
+   SimulatorConfigStruct SourceConfig;
+   SyntheticSourceStruct Synthetic;
+   bool Interactive;
+   MIL_DOUBLE RunDuration;
+   FramePipelineStruct* Pipeline;
+   MIL_INT PipelineLane;
+   MIL_INT StreamIndex;                /* In multi-stream mode, else -1.      */
+   ThreadPlacementStruct AcquisitionPlacement;
+   bool AcquisitionPlaced;             /* Hook thread placed since the start. */
+   DisplayStageStruct* Display;
+   bool Headless;
+   std::atomic<MIL_INT> BufferRefCount[BUFFERING_SIZE_MAX];
+   GrabQueueStruct GrabQueue;
+   BufferPoolStruct* ActivePool;
+   PoolCacheStruct* PoolCache;
+   FormatSwitchStruct Switch;         /* Data format change in progress.    */
+   FormatSwitchStruct LastSwitch;     /* Last one completed, to report.     */
+   bool PoolNeeded;                   /* Main thread: waiting for a pool.   */
+   std::atomic<bool> SwitchPending;
+   std::atomic<bool> SwitchCompleted;
+   MIL_DOUBLE SwitchStopDuration;
+   MIL_DOUBLE LastFrameTime;
+   MIL_DOUBLE FrameInterval;
+   bool FirstFrameReported;            /* Main thread: time to first frame.   */
+   MIL_DOUBLE LastShareReviewTime;
+   FrameStatsStruct* Stats;
+   GvspReceiverStruct* Receiver;
+   FrameRecorderStruct* Recorder;
+   FrameReplayStruct* Replay;
+   FrameShareStruct* Share;
+   FrameOverlayStruct* Overlay;        /* M_NULL if headless or no fields.    */
+   MIL_INT64 BufferFrameCount[BUFFERING_SIZE_MAX];  /* Frame in each buffer,  */
+                                       /* for the overlay of the display.     */
+   std::mutex DisplayLock;             /* Workers copying to the display.     */
+   MIL_INT64 DisplayedFrameCount;      /* Last one copied, under the lock.    */
+   FrameHealthStruct* Health;          /* M_NULL if not analysed.             */
+   PixelConvertPoolStruct* Converter;
+   bool PackedRows;                    /* Packed formats arrive packed in the */
+                                       /* rows of the grab buffers.           */
+   MIL_DOUBLE AcquisitionCpuStart;
+   MIL_DOUBLE AcquisitionCpuTime;      /* Process CPU time while acquiring.   */
+   } HookDataStruct;
+
+/* MulticastMonitor.cpp */
+MIL_INT MFTYPE ProcessingFunction(MIL_INT HookType,
+                                  MIL_ID HookId,
+                                  void* HookDataPtr);
+void ProcessFrame(HookDataStruct* HookDataPtr, const FrameInfoStruct* FrameInfoPtr);
+void ProcessGrabbedBuffer(HookDataStruct* HookDataPtr, const FrameWorkItemStruct* ItemPtr,
+                          MIL_ID GraphicContext);
+void InitHookData(HookDataStruct* HookDataPtr, const MonitorOptionsStruct* OptionsPtr,
+                  const std::string& StatsPath);
+void FreeHookData(HookDataStruct* HookDataPtr);
+void AllocateGrabBuffers(MIL_INT MilSystem, HookDataStruct* HookDataPtr);
+void FreeGrabBuffers(HookDataStruct* HookDataPtr);
+void ServiceDataFormatChange(MIL_INT MilSystem, HookDataStruct* HookDataPtr);
+MIL_DOUBLE NextServiceTime(const HookDataStruct* HookDataPtr);
+void PrintCameraInfo(HookDataStruct* HookDataPtr);
+void PrintConversionStatistics(HookDataStruct* HookDataPtr);
+void PrintOverlayStatistics(HookDataStruct* HookDataPtr);
+void PrintHealthStatistics(HookDataStruct* HookDataPtr);
+
+/* MultiStream.cpp */
+bool ParseStreamEntry(const MIL_STRING& Value, StreamEntryStruct* EntryPtr);
+bool LoadStreamList(const MIL_STRING& Path, std::vector<StreamEntryStruct>* StreamsPtr);
+bool AssignStreamDevices(std::vector<StreamEntryStruct>* StreamsPtr, bool MilBackend);
+int MultiStreamRun(MIL_ID MilSystem, MonitorOptionsStruct* OptionsPtr);
+
+/* MonitorBench.cpp */
+int MonitorBenchRun(MIL_ID MilSystem, MonitorOptionsStruct* OptionsPtr);
+
+/* AcquisitionBackend.cpp */
+void GetBufferFormat(MIL_INT PixelFormat, MIL_INT* SizeBandPtr, MIL_INT* TypePtr,
+                     MIL_INT64* SourceDataFormatPtr);
+void StartAcquisition(HookDataStruct* HookDataPtr);
+void StopAcquisition(HookDataStruct* HookDataPtr);
+bool IsAcquisitionInProgress(HookDataStruct* HookDataPtr);
+void AcquireGrabBuffer(HookDataStruct* HookDataPtr, MIL_INT BufferIndex);
+void ReleaseGrabBuffer(HookDataStruct* HookDataPtr, MIL_INT BufferIndex);
+bool GrabBufferFree(HookDataStruct* HookDataPtr, MIL_INT BufferIndex);
+bool NextGrabBuffersFree(HookDataStruct* HookDataPtr, MIL_INT BufferIndex);
+void GetAcquisitionStatistics(HookDataStruct* HookDataPtr, MIL_INT* FrameCountPtr,
+                              MIL_DOUBLE* FrameRatePtr);
+
+#endif /* MULTICAST_MONITOR_H */
@@ -0,0 +1,768 @@
+﻿/*************************************************************************************/
+/*
+ * File name: PixelConvert.cpp
+ *
+ * Synopsis:  Pixel format conversion kernels, their runtime dispatch and the pool
+ *            of threads that runs them by bands of rows.
+ *
+ *            The SIMD versions process blocks of pixels and leave the end of each
+ *            row, and the borders of the Bayer rows, to the scalar version. They
+ *            use the same rounding as the scalar version (the Bayer averages are
+ *            those of the pavgb instruction), so all versions give the same
+ *            result. The packed rows are unpacked from their end, so that a row
+ *            can be unpacked in place: a pixel is never written over packed bytes
+ *            that are still to be read.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <string.h>
+#include <chrono>
+#include "GvspProtocol.h"
+#include "PixelConvert.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CONVERT_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CONVERT_TARGET_SSE41
+#define CONVERT_TARGET_AVX2
+#else
+#define CONVERT_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CONVERT_TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+#else
+#define CONVERT_X86 0
+#endif
+
+static std::atomic<int> g_ActiveIsa(-1);
+
+/* Instruction set detection.                                                */
+/* -----------------------------------------------------------------------   */
+ConvertIsaType PixelConvertDetectIsa(void)
+   {
+#if CONVERT_X86 && defined(_MSC_VER)
+   int Info[4];
+
+   __cpuid(Info, 0);
+   if(Info[0] >= 7)
+      {
+      /* AVX2 also needs the OS to save the YMM registers. */
+      __cpuid(Info, 1);
+      bool OsAvx = (Info[2] & (1 << 27)) && (Info[2] & (1 << 28)) &&
+                   (_xgetbv(0) & 0x6) == 0x6;
+      bool Sse41 = (Info[2] & (1 << 19)) != 0;
+
+      __cpuidex(Info, 7, 0);
+      if(OsAvx && (Info[1] & (1 << 5)))
+         return eConvertIsaAvx2;
+      if(Sse41)
+         return eConvertIsaSse41;
+      }
+   return eConvertIsaScalar;
+#elif CONVERT_X86
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+      return eConvertIsaAvx2;
+   if(__builtin_cpu_supports("sse4.1"))
+      return eConvertIsaSse41;
+   return eConvertIsaScalar;
+#else
+   return eConvertIsaScalar;
+#endif
+   }
+
+ConvertIsaType PixelConvertGetIsa(void)
+   {
+   int Isa = g_ActiveIsa.load(std::memory_order_relaxed);
+
+   if(Isa < 0)
+      {
+      Isa = (int)PixelConvertDetectIsa();
+      g_ActiveIsa.store(Isa, std::memory_order_relaxed);
+      }
+   return (ConvertIsaType)Isa;
+   }
+
+/* Forces an instruction set, for comparisons. Capped to what the CPU       */
+/* supports; returns the one selected.                                       */
+/* -----------------------------------------------------------------------   */
+ConvertIsaType PixelConvertSetIsa(ConvertIsaType Isa)
+   {
+   ConvertIsaType Supported = PixelConvertDetectIsa();
+
+   if(Isa > Supported)
+      Isa = Supported;
+   g_ActiveIsa.store((int)Isa, std::memory_order_relaxed);
+   return Isa;
+   }
+
+const char* PixelConvertIsaName(ConvertIsaType Isa)
+   {
+   switch(Isa)
+      {
+      case eConvertIsaAvx2:  return "avx2";
+      case eConvertIsaSse41: return "sse4.1";
+      default:               return "scalar";
+      }
+   }
+
+/* Pixel format properties.                                                  */
+/* -----------------------------------------------------------------------   */
+bool PixelConvertIsPacked(uint32_t PixelFormat)
+   {
+   return PixelFormat == PFNC_MONO10P || PixelFormat == PFNC_MONO12P ||
+          PixelFormat == PFNC_MONO10_PACKED || PixelFormat == PFNC_MONO12_PACKED;
+   }
+
+uint32_t PixelConvertSignificantBits(uint32_t PixelFormat)
+   {
+   switch(PixelFormat)
+      {
+      case PFNC_MONO10:
+      case PFNC_MONO10P:
+      case PFNC_MONO10_PACKED:
+         return 10;
+      case PFNC_MONO12:
+      case PFNC_MONO12P:
+      case PFNC_MONO12_PACKED:
+         return 12;
+      case PFNC_MONO16:
+         return 16;
+      default:
+         return 8;
+      }
+   }
+
+/* Conversion a frame of the given format needs to be shown on an 8-bit     */
+/* display buffer, once unpacked if packed.                                  */
+/* -----------------------------------------------------------------------   */
+ConvertOperationType PixelConvertDisplayOperation(uint32_t PixelFormat)
+   {
+   switch(PixelFormat)
+      {
+      case PFNC_MONO10:
+      case PFNC_MONO10P:
+      case PFNC_MONO10_PACKED:
+      case PFNC_MONO12:
+      case PFNC_MONO12P:
+      case PFNC_MONO12_PACKED:
+      case PFNC_MONO16:
+         return eConvertDownshift;
+      case PFNC_BAYER_GR8:
+      case PFNC_BAYER_RG8:
+      case PFNC_BAYER_GB8:
+      case PFNC_BAYER_BG8:
+         return eConvertDebayer;
+      default:
+         return eConvertNone;
+      }
+   }
+
+size_t PixelConvertSourceRowBytes(const ConvertJobStruct* JobPtr)
+   {
+   switch(JobPtr->Operation)
+      {
+      case eConvertUnpack:    return GvspFrameBytes(JobPtr->PixelFormat, JobPtr->SizeX, 1);
+      case eConvertDownshift: return 2 * (size_t)JobPtr->SizeX;
+      case eConvertDebayer:   return JobPtr->SizeX;
+      default:                return 0;
+      }
+   }
+
+size_t PixelConvertDestinationRowBytes(const ConvertJobStruct* JobPtr)
+   {
+   switch(JobPtr->Operation)
+      {
+      case eConvertUnpack:    return 2 * (size_t)JobPtr->SizeX;
+      case eConvertDownshift: return JobPtr->SizeX;
+      case eConvertDebayer:   return 4 * (size_t)JobPtr->SizeX;
+      default:                return 0;
+      }
+   }
+
+/* Bayer layout of a row: the color of its non-green pixels and the parity  */
+/* of their column.                                                          */
+/* -----------------------------------------------------------------------   */
+static void BayerRowLayout(uint32_t PixelFormat, uint32_t y, bool* IsRedRowPtr,
+                           uint32_t* ColorParityPtr)
+   {
+   bool     Row0Red    = (PixelFormat == PFNC_BAYER_RG8 || PixelFormat == PFNC_BAYER_GR8);
+   uint32_t Row0Parity = (PixelFormat == PFNC_BAYER_RG8 || PixelFormat == PFNC_BAYER_BG8) ? 0 : 1;
+
+   *IsRedRowPtr    = (y & 1) ? !Row0Red : Row0Red;
+   *ColorParityPtr = (y & 1) ? 1 - Row0Parity : Row0Parity;
+   }
+
+/* ------------------------------ Scalar kernels ---------------------------- */
+
+/* Unpacks the pixels [First, End) of a packed row, from the last one.      */
+static void UnpackRowScalar(const uint8_t* Src, uint16_t* Dst, uint32_t PixelFormat,
+                            uint32_t First, uint32_t End)
+   {
+   uint32_t x;
+
+   switch(PixelFormat)
+      {
+      case PFNC_MONO10P:
+      case PFNC_MONO12P:
+         {
+         uint32_t Bits = PixelFormat == PFNC_MONO12P ? 12 : 10;
+         uint32_t Mask = (1u << Bits) - 1;
+
+         for(x = End; x-- > First; )
+            {
+            uint32_t       Bit   = Bits * x;
+            const uint8_t* Bytes = Src + (Bit >> 3);
+
+            Dst[x] = (uint16_t)(((Bytes[0] | (Bytes[1] << 8)) >> (Bit & 7)) & Mask);
+            }
+         }
+         break;
+
+      case PFNC_MONO12_PACKED:
+         for(x = End; x-- > First; )
+            {
+            const uint8_t* Bytes = Src + 3 * (x >> 1);
+
+            Dst[x] = (x & 1) ? (uint16_t)((Bytes[2] << 4) | (Bytes[1] >> 4)) :
+                               (uint16_t)((Bytes[0] << 4) | (Bytes[1] & 0xF));
+            }
+         break;
+
+      case PFNC_MONO10_PACKED:
+         for(x = End; x-- > First; )
+            {
+            const uint8_t* Bytes = Src + 3 * (x >> 1);
+
+            Dst[x] = (x & 1) ? (uint16_t)((Bytes[2] << 2) | ((Bytes[1] >> 4) & 0x3)) :
+                               (uint16_t)((Bytes[0] << 2) | (Bytes[1] & 0x3));
+            }
+         break;
+
+      default:
+         break;
+      }
+   }
+
+static void DownshiftRowScalar(const uint16_t* Src, uint8_t* Dst, uint32_t Shift,
+                               uint32_t First, uint32_t End)
+   {
+   for(uint32_t x = First; x < End; x++)
+      {
+      uint32_t Value = (uint32_t)Src[x] >> Shift;
+      Dst[x] = (uint8_t)(Value > 255 ? 255 : Value);
+      }
+   }
+
+static inline uint8_t Average(uint32_t a, uint32_t b)
+   {
+   return (uint8_t)((a + b + 1) >> 1);
+   }
+
+/* Demosaics the pixels [First, End) of a row. Up and Down are the rows    */
+/* around it, mirrored at the image borders; so are the columns.            */
+static void DebayerRowScalar(const uint8_t* Up, const uint8_t* Center, const uint8_t* Down,
+                             uint8_t* Dst, uint32_t SizeX, bool IsRedRow,
+                             uint32_t ColorParity, uint32_t First, uint32_t End)
+   {
+   for(uint32_t x = First; x < End; x++)
+      {
+      uint32_t Left  = x > 0 ? x - 1 : (SizeX > 1 ? 1 : 0);
+      uint32_t Right = x + 1 < SizeX ? x + 1 : (x > 0 ? x - 1 : 0);
+      uint8_t  H     = Average(Center[Left], Center[Right]);
+      uint8_t  V     = Average(Up[x], Down[x]);
+      uint8_t  D     = Average(Average(Up[Left], Up[Right]), Average(Down[Left], Down[Right]));
+      uint8_t  X     = Average(H, V);
+      bool     Site  = (x & 1) == ColorParity;
+      uint8_t  Color = Site ? Center[x] : H;
+      uint8_t  Green = Site ? X : Center[x];
+      uint8_t  Other = Site ? D : V;
+      uint8_t* Out   = Dst + 4 * x;
+
+      Out[0] = IsRedRow ? Other : Color;
+      Out[1] = Green;
+      Out[2] = IsRedRow ? Color : Other;
+      Out[3] = 0xFF;
+      }
+   }
+
+#if CONVERT_X86
+
+/* ------------------------------ SSE4.1 kernels ---------------------------- */
+
+/* The SIMD unpack works on blocks of 8 pixels. A shuffle puts the two     */
+/* bytes holding each pixel in its 16-bit lane, then:                        */
+/*   - Mono10p, Mono12p: a multiply brings the pixel to the top of the      */
+/*     lane and a fixed right shift extracts it;                            */
+/*   - Mono10Packed, Mono12Packed: the high bits are in the high byte of    */
+/*     the lane and the low bits in the low or high nibble of the low byte, */
+/*     depending on the parity of the pixel.                                */
+typedef struct
+   {
+   uint32_t PixelFormat;
+   uint32_t BlockBytes;       /* Packed bytes of 8 pixels.                      */
+   int8_t   Shuffle[16];
+   int16_t  Multiply[8];      /* Mono10p, Mono12p.                              */
+   int      Shift;
+   uint16_t HighMask;         /* Mono10Packed, Mono12Packed.                    */
+   uint16_t LowMask;
+   } UnpackBlockStruct;
+
+static const UnpackBlockStruct g_UnpackBlocks[] =
+   {
+   { PFNC_MONO10P,       10, {0,1, 1,2, 2,3, 3,4, 5,6, 6,7, 7,8, 8,9},
+                             {64, 16, 4, 1, 64, 16, 4, 1}, 6, 0, 0 },
+   { PFNC_MONO12P,       12, {0,1, 1,2, 3,4, 4,5, 6,7, 7,8, 9,10, 10,11},
+                             {16, 1, 16, 1, 16, 1, 16, 1}, 4, 0, 0 },
+   { PFNC_MONO10_PACKED, 12, {1,0, 1,2, 4,3, 4,5, 7,6, 7,8, 10,9, 10,11},
+                             {0}, 6, 0x3FC, 0x3 },
+   { PFNC_MONO12_PACKED, 12, {1,0, 1,2, 4,3, 4,5, 7,6, 7,8, 10,9, 10,11},
+                             {0}, 4, 0xFF0, 0xF },
+   };
+
+static const UnpackBlockStruct* FindUnpackBlock(uint32_t PixelFormat)
+   {
+   for(size_t i = 0; i < sizeof(g_UnpackBlocks) / sizeof(g_UnpackBlocks[0]); i++)
+      {
+      if(g_UnpackBlocks[i].PixelFormat == PixelFormat)
+         return &g_UnpackBlocks[i];
+      }
+   return NULL;
+   }
+
+CONVERT_TARGET_SSE41
+static inline __m128i UnpackBlockSse41(__m128i Packed, const UnpackBlockStruct* BlockPtr,
+                                       __m128i Shuffle, __m128i Multiply, __m128i OddMask)
+   {
+   __m128i Lanes = _mm_shuffle_epi8(Packed, Shuffle);
+
+   if(BlockPtr->HighMask == 0)
+      return _mm_srli_epi16(_mm_mullo_epi16(Lanes, Multiply), BlockPtr->Shift);
+
+   __m128i High = _mm_and_si128(_mm_srli_epi16(Lanes, BlockPtr->Shift),
+                                _mm_set1_epi16((short)BlockPtr->HighMask));
+   __m128i Low  = _mm_blendv_epi8(Lanes, _mm_srli_epi16(Lanes, 4), OddMask);
+
+   return _mm_or_si128(High, _mm_and_si128(Low, _mm_set1_epi16((short)BlockPtr->LowMask)));
+   }
+
+CONVERT_TARGET_SSE41
+static void UnpackRowSse41(const uint8_t* Src, uint16_t* Dst, uint32_t PixelFormat,
+                           uint32_t SizeX, size_t SrcRowBytes)
+   {
+   const UnpackBlockStruct* BlockPtr = FindUnpackBlock(PixelFormat);
+   uint32_t Blocks;
+
+   if(!BlockPtr)
+      return;
+
+   /* Blocks whose 16-byte load stays in the packed row. */
+   Blocks = SizeX / 8;
+   while(Blocks > 0 && (Blocks - 1) * BlockPtr->BlockBytes + 16 > SrcRowBytes)
+      Blocks--;
+
+   UnpackRowScalar(Src, Dst, PixelFormat, Blocks * 8, SizeX);
+
+   __m128i Shuffle  = _mm_loadu_si128((const __m128i*)BlockPtr->Shuffle);
+   __m128i Multiply = _mm_loadu_si128((const __m128i*)BlockPtr->Multiply);
+   __m128i OddMask  = _mm_set1_epi32((int)0xFFFF0000);
+
+   for(uint32_t b = Blocks; b-- > 0; )
+      {
+      __m128i Packed = _mm_loadu_si128((const __m128i*)(Src + b * BlockPtr->BlockBytes));
+
+      _mm_storeu_si128((__m128i*)(Dst + 8 * b),
+                       UnpackBlockSse41(Packed, BlockPtr, Shuffle, Multiply, OddMask));
+      }
+   }
+
+CONVERT_TARGET_SSE41
+static void DownshiftRowSse41(const uint16_t* Src, uint8_t* Dst, uint32_t Shift, uint32_t SizeX)
+   {
+   __m128i  Count = _mm_cvtsi32_si128((int)Shift);
+   uint32_t x     = 0;
+
+   for(; x + 16 <= SizeX; x += 16)
+      {
+      __m128i Low  = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(Src + x)), Count);
+      __m128i High = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(Src + x + 8)), Count);
+
+      _mm_storeu_si128((__m128i*)(Dst + x), _mm_packus_epi16(Low, High));
+      }
+   DownshiftRowScalar(Src, Dst, Shift, x, SizeX);
+   }
+
+CONVERT_TARGET_SSE41
+static void DebayerRowSse41(const uint8_t* Up, const uint8_t* Center, const uint8_t* Down,
+                            uint8_t* Dst, uint32_t SizeX, bool IsRedRow, uint32_t ColorParity)
+   {
+   __m128i  SiteMask = _mm_set1_epi16(ColorParity ? (short)0xFF00 : (short)0x00FF);
+   __m128i  Alpha    = _mm_set1_epi8((char)0xFF);
+   uint32_t x        = 2;
+
+   DebayerRowScalar(Up, Center, Down, Dst, SizeX, IsRedRow, ColorParity, 0, SizeX < 2 ? SizeX : 2);
+   for(; x + 17 <= SizeX; x += 16)
+      {
+      __m128i CenterLeft  = _mm_loadu_si128((const __m128i*)(Center + x - 1));
+      __m128i CenterPixel = _mm_loadu_si128((const __m128i*)(Center + x));
+      __m128i CenterRight = _mm_loadu_si128((const __m128i*)(Center + x + 1));
+      __m128i UpPixel     = _mm_loadu_si128((const __m128i*)(Up + x));
+      __m128i DownPixel   = _mm_loadu_si128((const __m128i*)(Down + x));
+      __m128i UpDiagonal  = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(Up + x - 1)),
+                                         _mm_loadu_si128((const __m128i*)(Up + x + 1)));
+      __m128i DownDiagonal= _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(Down + x - 1)),
+                                         _mm_loadu_si128((const __m128i*)(Down + x + 1)));
+      __m128i H     = _mm_avg_epu8(CenterLeft, CenterRight);
+      __m128i V     = _mm_avg_epu8(UpPixel, DownPixel);
+      __m128i D     = _mm_avg_epu8(UpDiagonal, DownDiagonal);
+      __m128i X     = _mm_avg_epu8(H, V);
+      __m128i Color = _mm_blendv_epi8(H, CenterPixel, SiteMask);
+      __m128i Green = _mm_blendv_epi8(CenterPixel, X, SiteMask);
+      __m128i Other = _mm_blendv_epi8(V, D, SiteMask);
+      __m128i Blue  = IsRedRow ? Other : Color;
+      __m128i Red   = IsRedRow ? Color : Other;
+      __m128i BgLow  = _mm_unpacklo_epi8(Blue, Green);
+      __m128i BgHigh = _mm_unpackhi_epi8(Blue, Green);
+      __m128i RaLow  = _mm_unpacklo_epi8(Red, Alpha);
+      __m128i RaHigh = _mm_unpackhi_epi8(Red, Alpha);
+      __m128i* Out   = (__m128i*)(Dst + 4 * x);
+
+      _mm_storeu_si128(Out + 0, _mm_unpacklo_epi16(BgLow, RaLow));
+      _mm_storeu_si128(Out + 1, _mm_unpackhi_epi16(BgLow, RaLow));
+      _mm_storeu_si128(Out + 2, _mm_unpacklo_epi16(BgHigh, RaHigh));
+      _mm_storeu_si128(Out + 3, _mm_unpackhi_epi16(BgHigh, RaHigh));
+      }
+   if(x < SizeX)
+      DebayerRowScalar(Up, Center, Down, Dst, SizeX, IsRedRow, ColorParity, x, SizeX);
+   }
+
+/* ------------------------------- AVX2 kernels ----------------------------- */
+
+CONVERT_TARGET_AVX2
+static void UnpackRowAvx2(const uint8_t* Src, uint16_t* Dst, uint32_t PixelFormat,
+                          uint32_t SizeX, size_t SrcRowBytes)
+   {
+   const UnpackBlockStruct* BlockPtr = FindUnpackBlock(PixelFormat);
+   uint32_t BlockBytes;
+   uint32_t Blocks;
+
+   if(!BlockPtr)
+      return;
+
+   /* Blocks of 16 pixels: 8 in each 128-bit lane. */
+   BlockBytes = BlockPtr->BlockBytes;
+   Blocks     = SizeX / 16;
+   while(Blocks > 0 && (2 * Blocks - 1) * BlockBytes + 16 > SrcRowBytes)
+      Blocks--;
+
+   UnpackRowScalar(Src, Dst, PixelFormat, Blocks * 16, SizeX);
+
+   __m256i Shuffle  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)BlockPtr->Shuffle));
+   __m256i Multiply = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)BlockPtr->Multiply));
+   __m256i OddMask  = _mm256_set1_epi32((int)0xFFFF0000);
+   __m256i HighMask = _mm256_set1_epi16((short)BlockPtr->HighMask);
+   __m256i LowMask  = _mm256_set1_epi16((short)BlockPtr->LowMask);
+
+   for(uint32_t b = Blocks; b-- > 0; )
+      {
+      const uint8_t* Block  = Src + 2 * b * BlockBytes;
+      __m256i        Packed = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                                 _mm_loadu_si128((const __m128i*)Block)),
+                                 _mm_loadu_si128((const __m128i*)(Block + BlockBytes)), 1);
+      __m256i        Lanes  = _mm256_shuffle_epi8(Packed, Shuffle);
+      __m256i        Pixels;
+
+      if(BlockPtr->HighMask == 0)
+         Pixels = _mm256_srli_epi16(_mm256_mullo_epi16(Lanes, Multiply), BlockPtr->Shift);
+      else
+         {
+         __m256i High = _mm256_and_si256(_mm256_srli_epi16(Lanes, BlockPtr->Shift), HighMask);
+         __m256i Low  = _mm256_blendv_epi8(Lanes, _mm256_srli_epi16(Lanes, 4), OddMask);
+
+         Pixels = _mm256_or_si256(High, _mm256_and_si256(Low, LowMask));
+         }
+      _mm256_storeu_si256((__m256i*)(Dst + 16 * b), Pixels);
+      }
+   }
+
+CONVERT_TARGET_AVX2
+static void DownshiftRowAvx2(const uint16_t* Src, uint8_t* Dst, uint32_t Shift, uint32_t SizeX)
+   {
+   __m128i  Count = _mm_cvtsi32_si128((int)Shift);
+   uint32_t x     = 0;
+
+   for(; x + 32 <= SizeX; x += 32)
+      {
+      __m256i Low  = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i*)(Src + x)), Count);
+      __m256i High = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i*)(Src + x + 16)), Count);
+
+      /* The pack interleaves the lanes of its operands. */
+      _mm256_storeu_si256((__m256i*)(Dst + x),
+                          _mm256_permute4x64_epi64(_mm256_packus_epi16(Low, High), 0xD8));
+      }
+   DownshiftRowScalar(Src, Dst, Shift, x, SizeX);
+   }
+
+CONVERT_TARGET_AVX2
+static void DebayerRowAvx2(const uint8_t* Up, const uint8_t* Center, const uint8_t* Down,
+                           uint8_t* Dst, uint32_t SizeX, bool IsRedRow, uint32_t ColorParity)
+   {
+   __m256i  SiteMask = _mm256_set1_epi16(ColorParity ? (short)0xFF00 : (short)0x00FF);
+   __m256i  Alpha    = _mm256_set1_epi8((char)0xFF);
+   uint32_t x        = 2;
+
+   DebayerRowScalar(Up, Center, Down, Dst, SizeX, IsRedRow, ColorParity, 0, SizeX < 2 ? SizeX : 2);
+   for(; x + 33 <= SizeX; x += 32)
+      {
+      __m256i CenterLeft  = _mm256_loadu_si256((const __m256i*)(Center + x - 1));
+      __m256i CenterPixel = _mm256_loadu_si256((const __m256i*)(Center + x));
+      __m256i CenterRight = _mm256_loadu_si256((const __m256i*)(Center + x + 1));
+      __m256i UpPixel     = _mm256_loadu_si256((const __m256i*)(Up + x));
+      __m256i DownPixel   = _mm256_loadu_si256((const __m256i*)(Down + x));
+      __m256i UpDiagonal  = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(Up + x - 1)),
+                                            _mm256_loadu_si256((const __m256i*)(Up + x + 1)));
+      __m256i DownDiagonal= _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(Down + x - 1)),
+                                            _mm256_loadu_si256((const __m256i*)(Down + x + 1)));
+      __m256i H     = _mm256_avg_epu8(CenterLeft, CenterRight);
+      __m256i V     = _mm256_avg_epu8(UpPixel, DownPixel);
+      __m256i D     = _mm256_avg_epu8(UpDiagonal, DownDiagonal);
+      __m256i X     = _mm256_avg_epu8(H, V);
+      __m256i Color = _mm256_blendv_epi8(H, CenterPixel, SiteMask);
+      __m256i Green = _mm256_blendv_epi8(CenterPixel, X, SiteMask);
+      __m256i Other = _mm256_blendv_epi8(V, D, SiteMask);
+      __m256i Blue  = IsRedRow ? Other : Color;
+      __m256i Red   = IsRedRow ? Color : Other;
+      __m256i BgLow  = _mm256_unpacklo_epi8(Blue, Green);
+      __m256i BgHigh = _mm256_unpackhi_epi8(Blue, Green);
+      __m256i RaLow  = _mm256_unpacklo_epi8(Red, Alpha);
+      __m256i RaHigh = _mm256_unpackhi_epi8(Red, Alpha);
+
+      /* The unpacks work within the 128-bit lanes: pixels 0-3 and 16-19, */
+      /* 4-7 and 20-23, and so on.                                         */
+      __m256i Pixels0 = _mm256_unpacklo_epi16(BgLow, RaLow);
+      __m256i Pixels1 = _mm256_unpackhi_epi16(BgLow, RaLow);
+      __m256i Pixels2 = _mm256_unpacklo_epi16(BgHigh, RaHigh);
+      __m256i Pixels3 = _mm256_unpackhi_epi16(BgHigh, RaHigh);
+      __m256i* Out    = (__m256i*)(Dst + 4 * x);
+
+      _mm256_storeu_si256(Out + 0, _mm256_permute2x128_si256(Pixels0, Pixels1, 0x20));
+      _mm256_storeu_si256(Out + 1, _mm256_permute2x128_si256(Pixels2, Pixels3, 0x20));
+      _mm256_storeu_si256(Out + 2, _mm256_permute2x128_si256(Pixels0, Pixels1, 0x31));
+      _mm256_storeu_si256(Out + 3, _mm256_permute2x128_si256(Pixels2, Pixels3, 0x31));
+      }
+   if(x < SizeX)
+      DebayerRowScalar(Up, Center, Down, Dst, SizeX, IsRedRow, ColorParity, x, SizeX);
+   }
+
+#endif /* CONVERT_X86 */
+
+/* Converts the rows [FirstRow, FirstRow + RowCount) of a job with the      */
+/* selected instruction set.                                                 */
+/* -----------------------------------------------------------------------   */
+void PixelConvertRows(const ConvertJobStruct* JobPtr, uint32_t FirstRow, uint32_t RowCount)
+   {
+   ConvertIsaType Isa         = PixelConvertGetIsa();
+   uint32_t       SizeX       = JobPtr->SizeX;
+   size_t         SrcRowBytes = PixelConvertSourceRowBytes(JobPtr);
+   uint32_t       Shift       = PixelConvertSignificantBits(JobPtr->PixelFormat) - 8;
+
+   for(uint32_t y = FirstRow; y < FirstRow + RowCount && y < JobPtr->SizeY; y++)
+      {
+      const uint8_t* Src = JobPtr->Src + y * JobPtr->SrcPitch;
+      uint8_t*       Dst = JobPtr->Dst + y * JobPtr->DstPitch;
+
+      switch(JobPtr->Operation)
+         {
+         case eConvertUnpack:
+#if CONVERT_X86
+            if(Isa == eConvertIsaAvx2)
+               UnpackRowAvx2(Src, (uint16_t*)Dst, JobPtr->PixelFormat, SizeX, SrcRowBytes);
+            else if(Isa == eConvertIsaSse41)
+               UnpackRowSse41(Src, (uint16_t*)Dst, JobPtr->PixelFormat, SizeX, SrcRowBytes);
+            else
+#endif
+               UnpackRowScalar(Src, (uint16_t*)Dst, JobPtr->PixelFormat, 0, SizeX);
+            break;
+
+         case eConvertDownshift:
+#if CONVERT_X86
+            if(Isa == eConvertIsaAvx2)
+               DownshiftRowAvx2((const uint16_t*)Src, Dst, Shift, SizeX);
+            else if(Isa == eConvertIsaSse41)
+               DownshiftRowSse41((const uint16_t*)Src, Dst, Shift, SizeX);
+            else
+#endif
+               DownshiftRowScalar((const uint16_t*)Src, Dst, Shift, 0, SizeX);
+            break;
+
+         case eConvertDebayer:
+            {
+            /* Mirrored at the top and bottom borders. */
+            uint32_t UpRow     = y > 0 ? y - 1 : (JobPtr->SizeY > 1 ? 1 : 0);
+            uint32_t DownRow   = y + 1 < JobPtr->SizeY ? y + 1 : (y > 0 ? y - 1 : 0);
+            const uint8_t* Up  = JobPtr->Src + UpRow * JobPtr->SrcPitch;
+            const uint8_t* Down= JobPtr->Src + DownRow * JobPtr->SrcPitch;
+            bool     IsRedRow;
+            uint32_t ColorParity;
+
+            BayerRowLayout(JobPtr->PixelFormat, y, &IsRedRow, &ColorParity);
+#if CONVERT_X86
+            if(Isa == eConvertIsaAvx2)
+               DebayerRowAvx2(Up, Src, Down, Dst, SizeX, IsRedRow, ColorParity);
+            else if(Isa == eConvertIsaSse41)
+               DebayerRowSse41(Up, Src, Down, Dst, SizeX, IsRedRow, ColorParity);
+            else
+#endif
+               DebayerRowScalar(Up, Src, Down, Dst, SizeX, IsRedRow, ColorParity, 0, SizeX);
+            }
+            break;
+
+         default:
+            break;
+         }
+      }
+   (void)SrcRowBytes;
+   (void)Isa;
+   }
+
+/* Band pool.                                                                */
+/* -----------------------------------------------------------------------   */
+
+/* Runs the bands of the first task of the queue. Called with the lock held; */
+/* returns with it held, false if there was no band left to take.           */
+static bool RunOneBand(PixelConvertPoolStruct* PoolPtr, std::unique_lock<std::mutex>& Lock)
+   {
+   ConvertTaskStruct* TaskPtr;
+   uint32_t           Band, Row;
+
+   if(PoolPtr->Tasks.empty())
+      return false;
+
+   TaskPtr = PoolPtr->Tasks.front();
+   Band    = TaskPtr->NextBand.fetch_add(1);
+   Row     = TaskPtr->FirstRow + Band * TaskPtr->BandRows;
+   if(Band + 1 >= TaskPtr->BandCount)
+      PoolPtr->Tasks.pop_front();
+   if(Band >= TaskPtr->BandCount)
+      return true;
+
+   Lock.unlock();
+   PixelConvertRows(TaskPtr->JobPtr, Row, TaskPtr->EndRow - Row < TaskPtr->BandRows ?
+                                          TaskPtr->EndRow - Row : TaskPtr->BandRows);
+
+   /* The task may be gone as soon as its last band is counted. */
+   if(TaskPtr->DoneBands.fetch_add(1) + 1 == TaskPtr->BandCount)
+      {
+      Lock.lock();
+      PoolPtr->WorkDone.notify_all();
+      }
+   else
+      Lock.lock();
+   return true;
+   }
+
+static void ConvertThread(PixelConvertPoolStruct* PoolPtr)
+   {
+   std::unique_lock<std::mutex> Lock(PoolPtr->Lock);
+
+   while(!PoolPtr->StopRequested)
+      {
+      if(!RunOneBand(PoolPtr, Lock))
+         PoolPtr->WorkReady.wait(Lock);
+      }
+   }
+
+/* Allocates a pool of ThreadCount threads, in addition to the threads that */
+/* submit the conversions. 0 runs the conversions in the calling thread.    */
+/* -----------------------------------------------------------------------   */
+PixelConvertPoolStruct* PixelConvertPoolAlloc(uint32_t ThreadCount)
+   {
+   PixelConvertPoolStruct* PoolPtr = new PixelConvertPoolStruct;
+
+   if(ThreadCount > CONVERT_THREAD_MAX)
+      ThreadCount = CONVERT_THREAD_MAX;
+
+   PoolPtr->StopRequested = false;
+   PoolPtr->JobCount      = 0;
+   PoolPtr->ByteCount     = 0;
+   PoolPtr->Nanoseconds   = 0;
+   for(uint32_t i = 0; i < ThreadCount; i++)
+      PoolPtr->Threads.push_back(std::thread(ConvertThread, PoolPtr));
+   return PoolPtr;
+   }
+
+void PixelConvertPoolFree(PixelConvertPoolStruct* PoolPtr)
+   {
+   if(!PoolPtr)
+      return;
+
+   PoolPtr->Lock.lock();
+   PoolPtr->StopRequested = true;
+   PoolPtr->Lock.unlock();
+   PoolPtr->WorkReady.notify_all();
+   for(size_t i = 0; i < PoolPtr->Threads.size(); i++)
+      PoolPtr->Threads[i].join();
+   delete PoolPtr;
+   }
+
+/* Runs a conversion and returns once it is complete. The calling thread    */
+/* takes bands of its own job along with the pool threads.                  */
+/* -----------------------------------------------------------------------   */
+void PixelConvertRun(PixelConvertPoolStruct* PoolPtr, const ConvertJobStruct* JobPtr)
+   {
+   PixelConvertRunRows(PoolPtr, JobPtr, 0, JobPtr->SizeY);
+   }
+
+/* Runs the conversion of RowCount rows of a job from FirstRow, the rows    */
+/* around them being read as in the whole job.                               */
+/* -----------------------------------------------------------------------   */
+void PixelConvertRunRows(PixelConvertPoolStruct* PoolPtr, const ConvertJobStruct* JobPtr,
+                         uint32_t FirstRow, uint32_t RowCount)
+   {
+   auto     Start     = std::chrono::steady_clock::now();
+   uint32_t BandCount = 1;
+
+   if(PoolPtr && !PoolPtr->Threads.empty())
+      {
+      BandCount = (uint32_t)PoolPtr->Threads.size() + 1;
+      if(RowCount / BandCount < CONVERT_BAND_ROWS_MIN)
+         BandCount = RowCount / CONVERT_BAND_ROWS_MIN;
+      if(BandCount < 1)
+         BandCount = 1;
+      }
+
+   if(BandCount == 1)
+      PixelConvertRows(JobPtr, FirstRow, RowCount);
+   else
+      {
+      ConvertTaskStruct            Task;
+      std::unique_lock<std::mutex> Lock(PoolPtr->Lock);
+
+      Task.JobPtr    = JobPtr;
+      Task.FirstRow  = FirstRow;
+      Task.EndRow    = FirstRow + RowCount;
+      Task.BandCount = BandCount;
+      Task.BandRows  = (RowCount + BandCount - 1) / BandCount;
+      Task.NextBand  = 0;
+      Task.DoneBands = 0;
+      PoolPtr->Tasks.push_back(&Task);
+      PoolPtr->WorkReady.notify_all();
+
+      /* Help with the queue until this job has no band left to take. */
+      while(Task.NextBand.load() < BandCount)
+         RunOneBand(PoolPtr, Lock);
+      while(Task.DoneBands.load() < BandCount)
+         PoolPtr->WorkDone.wait(Lock);
+      }
+
+   if(PoolPtr)
+      {
+      PoolPtr->JobCount.fetch_add(1, std::memory_order_relaxed);
+      PoolPtr->ByteCount.fetch_add((int64_t)(PixelConvertSourceRowBytes(JobPtr) * RowCount),
+                                   std::memory_order_relaxed);
+      PoolPtr->Nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::steady_clock::now() - Start).count(), std::memory_order_relaxed);
+      }
+   }
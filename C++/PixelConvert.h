@@ -0,0 +1,116 @@
+﻿/*************************************************************************************/
+/*
+ * File name: PixelConvert.h
+ *
+ * Synopsis:  Pixel format conversion kernels for the display and the processing
+ *            of the GigE Vision pixel formats the monitor display cannot show
+ *            as they are:
+ *
+ *              - unpack of the packed mono formats (Mono10p, Mono12p and the
+ *                GigE Vision Mono10Packed, Mono12Packed) to 16 bits per pixel,
+ *                in place in the rows of a 16-bit grab buffer,
+ *              - downshift of the 10 to 16-bit mono formats to 8 bits,
+ *              - bilinear demosaicing of the Bayer 8-bit formats to BGRA.
+ *
+ *            Each kernel has AVX2, SSE4.1 and scalar versions; the best one the
+ *            CPU supports is selected at runtime. The results of all versions are
+ *            identical. A conversion is split in bands of rows run in parallel by
+ *            a small pool of threads, the calling thread included.
+ *
+ *            This module does not depend on MIL, so that the kernels can be
+ *            benchmarked on their own, see PixelConvertBench.cpp.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CONVERT_THREAD_MAX     16
+#define CONVERT_BAND_ROWS_MIN  64        /* Rows below which a band is not split. */
+
+/* Instruction sets of the kernels, in order of preference. */
+typedef enum
+   {
+   eConvertIsaScalar = 0,
+   eConvertIsaSse41,
+   eConvertIsaAvx2,
+   eConvertIsaCount
+   } ConvertIsaType;
+
+typedef enum
+   {
+   eConvertNone = 0,
+   eConvertUnpack,            /* Packed mono to 16 bits, Dst may be Src.           */
+   eConvertDownshift,         /* 16-bit mono to 8 bits.                            */
+   eConvertDebayer            /* Bayer 8-bit to BGRA.                              */
+   } ConvertOperationType;
+
+typedef struct
+   {
+   ConvertOperationType Operation;
+   uint32_t             PixelFormat;   /* PFNC code of the source.                */
+   uint32_t             SizeX;
+   uint32_t             SizeY;
+   const uint8_t*       Src;
+   ptrdiff_t            SrcPitch;      /* Bytes.                                   */
+   uint8_t*             Dst;
+   ptrdiff_t            DstPitch;
+   } ConvertJobStruct;
+
+/* Job being run by the pool: its rows are handed out band by band. */
+typedef struct
+   {
+   const ConvertJobStruct* JobPtr;
+   uint32_t                FirstRow;
+   uint32_t                EndRow;
+   uint32_t                BandCount;
+   uint32_t                BandRows;
+   std::atomic<uint32_t>   NextBand;
+   std::atomic<uint32_t>   DoneBands;
+   } ConvertTaskStruct;
+
+typedef struct
+   {
+   std::vector<std::thread>        Threads;
+   std::mutex                      Lock;
+   std::condition_variable         WorkReady;
+   std::condition_variable         WorkDone;
+   std::deque<ConvertTaskStruct*>  Tasks;
+   bool                            StopRequested;
+
+   /* Statistics. */
+   std::atomic<int64_t>            JobCount;
+   std::atomic<int64_t>            ByteCount;     /* Source bytes converted.     */
+   std::atomic<int64_t>            Nanoseconds;
+   } PixelConvertPoolStruct;
+
+ConvertIsaType PixelConvertDetectIsa(void);
+ConvertIsaType PixelConvertGetIsa(void);
+ConvertIsaType PixelConvertSetIsa(ConvertIsaType Isa);
+const char* PixelConvertIsaName(ConvertIsaType Isa);
+
+bool PixelConvertIsPacked(uint32_t PixelFormat);
+uint32_t PixelConvertSignificantBits(uint32_t PixelFormat);
+ConvertOperationType PixelConvertDisplayOperation(uint32_t PixelFormat);
+size_t PixelConvertSourceRowBytes(const ConvertJobStruct* JobPtr);
+size_t PixelConvertDestinationRowBytes(const ConvertJobStruct* JobPtr);
+
+void PixelConvertRows(const ConvertJobStruct* JobPtr, uint32_t FirstRow, uint32_t RowCount);
+
+PixelConvertPoolStruct* PixelConvertPoolAlloc(uint32_t ThreadCount);
+void PixelConvertPoolFree(PixelConvertPoolStruct* PoolPtr);
+void PixelConvertRun(PixelConvertPoolStruct* PoolPtr, const ConvertJobStruct* JobPtr);
+void PixelConvertRunRows(PixelConvertPoolStruct* PoolPtr, const ConvertJobStruct* JobPtr,
+                         uint32_t FirstRow, uint32_t RowCount);
+
+#endif /* PIXEL_CONVERT_H */
@@ -0,0 +1,211 @@
+﻿/*************************************************************************************/
+/*
+ * File name: PixelConvertBench.cpp
+ *
+ * Synopsis:  Microbenchmark of the pixel conversion kernels of PixelConvert.h.
+ *            Runs each conversion the monitor uses, with each instruction set the
+ *            CPU supports, on one thread and on the band pool, and reports the
+ *            throughput in GB/s of source data and in Mpixels/s. The results of
+ *            the SIMD kernels are checked against those of the scalar kernels.
+ *
+ *            Does not need MIL: make bench in the linux directory.
+ *
+ *            Usage: PixelConvertBench [-sizex=<n>] [-sizey=<n>] [-threads=<n>]
+ *                                     [-duration=<seconds>]
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "GvspProtocol.h"
+#include "PixelConvert.h"
+
+typedef struct
+   {
+   const char*          Name;
+   ConvertOperationType Operation;
+   uint32_t             PixelFormat;
+   } BenchCaseStruct;
+
+static const BenchCaseStruct g_Cases[] =
+   {
+   { "Mono10p unpack",      eConvertUnpack,    PFNC_MONO10P       },
+   { "Mono12p unpack",      eConvertUnpack,    PFNC_MONO12P       },
+   { "Mono12Packed unpack", eConvertUnpack,    PFNC_MONO12_PACKED },
+   { "Mono10Packed unpack", eConvertUnpack,    PFNC_MONO10_PACKED },
+   { "Mono12 downshift",    eConvertDownshift, PFNC_MONO12        },
+   { "Mono16 downshift",    eConvertDownshift, PFNC_MONO16        },
+   { "BayerRG8 debayer",    eConvertDebayer,   PFNC_BAYER_RG8     },
+   { "BayerGB8 debayer",    eConvertDebayer,   PFNC_BAYER_GB8     },
+   };
+
+/* Source frame of a case: random pixels in the layout of the format.       */
+/* -----------------------------------------------------------------------   */
+static void FillSource(std::vector<uint8_t>& Src, const ConvertJobStruct& Job)
+   {
+   uint32_t Seed = 0x12345678;
+
+   for(size_t i = 0; i < Src.size(); i++)
+      {
+      Seed   = Seed * 1664525 + 1013904223;
+      Src[i] = (uint8_t)(Seed >> 24);
+      }
+
+   /* Keep the 16-bit pixels in their significant bits. */
+   if(Job.Operation == eConvertDownshift)
+      {
+      uint16_t Mask = (uint16_t)((1u << PixelConvertSignificantBits(Job.PixelFormat)) - 1);
+
+      for(uint32_t y = 0; y < Job.SizeY; y++)
+         {
+         uint16_t* Row = (uint16_t*)(Src.data() + y * Job.SrcPitch);
+         for(uint32_t x = 0; x < Job.SizeX; x++)
+            Row[x] &= Mask;
+         }
+      }
+   }
+
+/* Runs a case until the duration has elapsed, and returns the seconds per */
+/* frame. The unpack is run out of place, its source being reused.          */
+/* -----------------------------------------------------------------------   */
+static double TimeCase(PixelConvertPoolStruct* PoolPtr, const ConvertJobStruct& Job, double Duration)
+   {
+   auto    Start = std::chrono::steady_clock::now();
+   double  Elapsed = 0.0;
+   int64_t Count = 0;
+
+   /* Warm up the caches and the pool. */
+   PixelConvertRun(PoolPtr, &Job);
+
+   while(Elapsed < Duration)
+      {
+      for(int i = 0; i < 8; i++)
+         PixelConvertRun(PoolPtr, &Job);
+      Count += 8;
+      Elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+      }
+   return Elapsed / Count;
+   }
+
+int main(int argc, char* argv[])
+   {
+   uint32_t SizeX       = 2448;
+   uint32_t SizeY       = 2048;
+   uint32_t ThreadCount = std::thread::hardware_concurrency();
+   double   Duration    = 0.5;
+   bool     Failed      = false;
+
+   for(int i = 1; i < argc; i++)
+      {
+      if(strncmp(argv[i], "-sizex=", 7) == 0)
+         SizeX = (uint32_t)atoi(argv[i] + 7);
+      else if(strncmp(argv[i], "-sizey=", 7) == 0)
+         SizeY = (uint32_t)atoi(argv[i] + 7);
+      else if(strncmp(argv[i], "-threads=", 9) == 0)
+         ThreadCount = (uint32_t)atoi(argv[i] + 9);
+      else if(strncmp(argv[i], "-duration=", 10) == 0)
+         Duration = atof(argv[i] + 10);
+      else
+         {
+         printf("Usage: %s [-sizex=<n>] [-sizey=<n>] [-threads=<n>] [-duration=<seconds>]\n",
+                argv[0]);
+         return 1;
+         }
+      }
+   if(SizeX < 1 || SizeY < 1)
+      {
+      printf("Invalid frame size.\n");
+      return 1;
+      }
+   if(ThreadCount < 1)
+      ThreadCount = 1;
+   if(ThreadCount > CONVERT_THREAD_MAX + 1)
+      ThreadCount = CONVERT_THREAD_MAX + 1;
+
+   ConvertIsaType Detected = PixelConvertDetectIsa();
+   PixelConvertPoolStruct* PoolPtr = PixelConvertPoolAlloc(ThreadCount - 1);
+
+   printf("Pixel conversion benchmark, %u x %u, %u thread(s), best ISA %s.\n\n",
+          SizeX, SizeY, ThreadCount, PixelConvertIsaName(Detected));
+   printf("%-21s %-7s %7s %9s %9s %9s\n", "Conversion", "ISA", "Threads", "us/frame", "GB/s",
+          "Mpix/s");
+
+   for(size_t c = 0; c < sizeof(g_Cases) / sizeof(g_Cases[0]); c++)
+      {
+      const BenchCaseStruct& Case = g_Cases[c];
+      ConvertJobStruct       Job;
+      std::vector<uint8_t>   Src, Dst, Reference;
+
+      Job.Operation   = Case.Operation;
+      Job.PixelFormat = Case.PixelFormat;
+      Job.SizeX       = SizeX;
+      Job.SizeY       = SizeY;
+      Job.SrcPitch    = (ptrdiff_t)PixelConvertSourceRowBytes(&Job);
+      Job.DstPitch    = (ptrdiff_t)PixelConvertDestinationRowBytes(&Job);
+      Src.resize(Job.SrcPitch * SizeY);
+      Dst.resize(Job.DstPitch * SizeY);
+      Reference.resize(Dst.size());
+      FillSource(Src, Job);
+      Job.Src = Src.data();
+
+      for(int Isa = eConvertIsaScalar; Isa <= (int)Detected; Isa++)
+         {
+         PixelConvertSetIsa((ConvertIsaType)Isa);
+
+         /* Check against the scalar result. */
+         Job.Dst = Isa == eConvertIsaScalar ? Reference.data() : Dst.data();
+         PixelConvertRun(NULL, &Job);
+         if(Isa != eConvertIsaScalar && memcmp(Dst.data(), Reference.data(), Dst.size()) != 0)
+            {
+            printf("%-21s %-7s results differ from the scalar version.\n", Case.Name,
+                   PixelConvertIsaName((ConvertIsaType)Isa));
+            Failed = true;
+            }
+
+         /* Check the unpack in place, as the monitor runs it. */
+         if(Case.Operation == eConvertUnpack && Isa != eConvertIsaScalar)
+            {
+            std::vector<uint8_t> InPlace(Dst.size());
+            ConvertJobStruct     InPlaceJob = Job;
+
+            for(uint32_t y = 0; y < SizeY; y++)
+               memcpy(InPlace.data() + y * Job.DstPitch, Src.data() + y * Job.SrcPitch, Job.SrcPitch);
+            InPlaceJob.Src      = InPlace.data();
+            InPlaceJob.SrcPitch = Job.DstPitch;
+            InPlaceJob.Dst      = InPlace.data();
+            PixelConvertRun(PoolPtr, &InPlaceJob);
+            if(memcmp(InPlace.data(), Reference.data(), Dst.size()) != 0)
+               {
+               printf("%-21s %-7s in place results differ from the scalar version.\n",
+                      Case.Name, PixelConvertIsaName((ConvertIsaType)Isa));
+               Failed = true;
+               }
+            }
+
+         Job.Dst = Dst.data();
+         for(int Pass = 0; Pass < 2; Pass++)
+            {
+            uint32_t Threads = Pass == 0 ? 1 : ThreadCount;
+            double   Seconds;
+
+            if(Pass == 1 && ThreadCount == 1)
+               break;
+            Seconds = TimeCase(Pass == 0 ? NULL : PoolPtr, Job, Duration);
+            printf("%-21s %-7s %7u %9.1f %9.2f %9.1f\n", Case.Name,
+                   PixelConvertIsaName((ConvertIsaType)Isa), Threads, Seconds * 1e6,
+                   (double)Src.size() / Seconds / 1e9,
+                   (double)SizeX * SizeY / Seconds / 1e6);
+            }
+         }
+      }
+
+   PixelConvertPoolFree(PoolPtr);
+   if(Failed)
+      printf("\nSome kernels gave wrong results.\n");
+   return Failed ? 1 : 0;
+   }
@@ -0,0 +1,204 @@
+﻿/*************************************************************************************/
+/*
+ * File name: ThreadJitterBench.cpp
+ *
+ * Synopsis:  Jitter benchmark of the thread placement of ThreadPlacement.h. A
+ *            periodic thread stands for the acquisition thread: it wakes up at
+ *            the frame rate and copies a frame, as the hook does, while load
+ *            threads keep every CPU busy with memory traffic. The same run is
+ *            done unpinned, in the default policy, then pinned to a CPU with a
+ *            SCHED_FIFO priority, and the wake-up latency (time past the frame
+ *            deadline) and the copy time are compared by percentile.
+ *
+ *            Does not need MIL: make bench in the linux directory. Without
+ *            CAP_SYS_NICE or an rtprio limit, the pinned run keeps the default
+ *            policy, as reported.
+ *
+ *            Usage: ThreadJitterBench [-duration=<sec>] [-fps=<rate>]
+ *                                     [-framebytes=<n>] [-cpu=<n>] [-priority=<n>]
+ *                                     [-load=<threads>]
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "ThreadPlacement.h"
+
+#define BENCH_LOAD_BYTES (8 * 1024 * 1024)   /* Copied in turn by a load thread. */
+
+typedef struct
+   {
+   double                   Duration;        /* Seconds per run.                    */
+   double                   FrameRate;
+   size_t                   FrameBytes;
+   ThreadPlacementStruct    Placement;       /* Of the periodic thread, if pinned.  */
+   bool                     Pinned;
+
+   /* Results. */
+   bool                     Placed;
+   std::vector<double>      Latencies;       /* Microseconds past the deadline.     */
+   std::vector<double>      CopyTimes;       /* Microseconds.                       */
+   int64_t                  MissedCount;     /* Woken up after the next deadline.   */
+   } JitterRunStruct;
+
+/* Load thread: copies between two buffers larger than the caches.           */
+/* -----------------------------------------------------------------------   */
+static void LoadThread(std::atomic<bool>* StopPtr)
+   {
+   std::vector<uint8_t> Source(BENCH_LOAD_BYTES, 1), Destination(BENCH_LOAD_BYTES);
+
+   while(!StopPtr->load(std::memory_order_relaxed))
+      {
+      memcpy(Destination.data(), Source.data(), Source.size());
+      Source[Destination[Source.size() / 2] % Source.size()]++;
+      }
+   }
+
+/* Periodic thread: wakes up at the frame rate and copies a frame.           */
+/* -----------------------------------------------------------------------   */
+static void PeriodicThread(JitterRunStruct* RunPtr)
+   {
+   std::vector<uint8_t> Frame(RunPtr->FrameBytes, 2), Copy(RunPtr->FrameBytes);
+   auto                 Period   = std::chrono::nanoseconds((long long)(1e9 / RunPtr->FrameRate));
+   auto                 Start    = std::chrono::steady_clock::now();
+   auto                 End      = Start + std::chrono::nanoseconds((long long)(1e9 *
+                                                                   RunPtr->Duration));
+   auto                 Deadline = Start;
+
+   RunPtr->Placed = !RunPtr->Pinned ||
+                    ThreadPlacementApply(&RunPtr->Placement, eThreadAcquisition,
+                                         THREAD_INDEX_ANY);
+   RunPtr->MissedCount = 0;
+
+   while(Deadline < End)
+      {
+      Deadline += Period;
+      std::this_thread::sleep_until(Deadline);
+
+      auto Woken  = std::chrono::steady_clock::now();
+      memcpy(Copy.data(), Frame.data(), Frame.size());
+      auto Copied = std::chrono::steady_clock::now();
+
+      RunPtr->Latencies.push_back(1e-3 * std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  Woken - Deadline).count());
+      RunPtr->CopyTimes.push_back(1e-3 * std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  Copied - Woken).count());
+      Frame[(size_t)Copy[0] % Frame.size()]++;
+
+      /* A late frame delays the next ones: skip the deadlines already past. */
+      while(Deadline + Period < Copied)
+         {
+         Deadline += Period;
+         RunPtr->MissedCount++;
+         }
+      }
+   }
+
+static double Percentile(std::vector<double>& Values, double Fraction)
+   {
+   size_t Index = (size_t)(Fraction * (Values.size() - 1) + 0.5);
+
+   std::nth_element(Values.begin(), Values.begin() + Index, Values.end());
+   return Values[Index];
+   }
+
+/* Runs the periodic thread against the load threads.                       */
+/* -----------------------------------------------------------------------   */
+static void RunJitter(JitterRunStruct* RunPtr, int LoadCount)
+   {
+   std::atomic<bool>        Stop(false);
+   std::vector<std::thread> Load;
+
+   for(int i = 0; i < LoadCount; i++)
+      Load.push_back(std::thread(LoadThread, &Stop));
+
+   std::thread Periodic(PeriodicThread, RunPtr);
+   Periodic.join();
+
+   Stop = true;
+   for(std::thread& Thread : Load)
+      Thread.join();
+   }
+
+static void PrintRun(const char* Name, JitterRunStruct* RunPtr)
+   {
+   std::vector<double>& Latencies = RunPtr->Latencies;
+   std::vector<double>& CopyTimes = RunPtr->CopyTimes;
+
+   if(Latencies.empty())
+      return;
+   printf("%-9s %7zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %7lld\n", Name, Latencies.size(),
+          Percentile(Latencies, 0.5), Percentile(Latencies, 0.99),
+          Percentile(Latencies, 0.999), *std::max_element(Latencies.begin(), Latencies.end()),
+          Percentile(CopyTimes, 0.5), *std::max_element(CopyTimes.begin(), CopyTimes.end()),
+          (long long)RunPtr->MissedCount);
+   }
+
+int main(int argc, char* argv[])
+   {
+   JitterRunStruct Unpinned, Pinned;
+   int             LoadCount = (int)std::thread::hardware_concurrency();
+   int             Cpu       = LoadCount > 1 ? LoadCount - 1 : 0;
+
+   Unpinned.Duration           = 5.0;
+   Unpinned.FrameRate          = 1000.0;
+   Unpinned.FrameBytes         = 1920 * 1080;
+   Unpinned.Placement.Priority = 80;
+   Unpinned.Pinned             = false;
+
+   for(int i = 1; i < argc; i++)
+      {
+      if(strncmp(argv[i], "-duration=", 10) == 0)
+         Unpinned.Duration = atof(argv[i] + 10);
+      else if(strncmp(argv[i], "-fps=", 5) == 0)
+         Unpinned.FrameRate = atof(argv[i] + 5);
+      else if(strncmp(argv[i], "-framebytes=", 12) == 0)
+         Unpinned.FrameBytes = (size_t)atoll(argv[i] + 12);
+      else if(strncmp(argv[i], "-cpu=", 5) == 0)
+         Cpu = atoi(argv[i] + 5);
+      else if(strncmp(argv[i], "-priority=", 10) == 0)
+         Unpinned.Placement.Priority = atoi(argv[i] + 10);
+      else if(strncmp(argv[i], "-load=", 6) == 0)
+         LoadCount = atoi(argv[i] + 6);
+      else
+         {
+         printf("Usage: %s [-duration=<sec>] [-fps=<rate>] [-framebytes=<n>] [-cpu=<n>]\n"
+                "          [-priority=<n>] [-load=<threads>]\n", argv[0]);
+         return 1;
+         }
+      }
+   if(Unpinned.Duration <= 0 || Unpinned.FrameRate <= 0 || Unpinned.FrameBytes == 0 ||
+      Cpu < 0 || LoadCount < 0 || Unpinned.Placement.Priority < 0 ||
+      Unpinned.Placement.Priority > THREAD_PRIORITY_MAX)
+      {
+      printf("Invalid settings.\n");
+      return 1;
+      }
+   Unpinned.Placement.Cpus.assign(1, Cpu);
+   Pinned        = Unpinned;
+   Pinned.Pinned = true;
+
+   printf("Thread jitter benchmark, %.0f frames/sec of %zu bytes for %.1f sec, %d load "
+          "threads.\n", Unpinned.FrameRate, Unpinned.FrameBytes, Unpinned.Duration, LoadCount);
+   printf("Pinned run: CPU %d, SCHED_FIFO priority %d.\n\n", Cpu, Unpinned.Placement.Priority);
+
+   RunJitter(&Unpinned, LoadCount);
+   RunJitter(&Pinned, LoadCount);
+
+   printf("Wake-up latency past the deadline and frame copy time, in us.\n\n");
+   printf("%-9s %7s %10s %10s %10s %10s %10s %10s %7s\n", "Run", "Frames", "Wake p50",
+          "Wake p99", "Wake p99.9", "Wake max", "Copy p50", "Copy max", "Missed");
+   PrintRun("Unpinned", &Unpinned);
+   PrintRun("Pinned", &Pinned);
+   if(!Pinned.Placed)
+      printf("\nThe pinned run could not be placed as asked, see above.\n");
+   return 0;
+   }
@@ -0,0 +1,170 @@
+﻿/*************************************************************************************/
+/*
+ * File name: ThreadPlacement.cpp
+ *
+ * Synopsis:  Pinning of the calling thread to CPUs and real-time priority.
+ *
+ *            Linux: pthread_setaffinity_np() and SCHED_FIFO with
+ *            pthread_setschedparam(). SCHED_FIFO needs CAP_SYS_NICE or an
+ *            RLIMIT_RTPRIO limit (ulimit -r, or rtprio in limits.conf); without
+ *            them the thread keeps the default policy and a warning is printed.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "ThreadPlacement.h"
+
+/* Roles already warned about, one bit per role. */
+static std::atomic<unsigned> g_WarnedRoles(0);
+
+/* Parses a CPU list, such as "2,4-7". Returns false if it is malformed.    */
+/* -----------------------------------------------------------------------   */
+bool ThreadPlacementParseCpus(const char* List, std::vector<int>* CpusPtr)
+   {
+   const char* Position = List;
+
+   CpusPtr->clear();
+   while(*Position)
+      {
+      char* End;
+      long  First = strtol(Position, &End, 10);
+      long  Last  = First;
+
+      if(End == Position || First < 0)
+         return false;
+      Position = End;
+      if(*Position == '-')
+         {
+         Last = strtol(Position + 1, &End, 10);
+         if(End == Position + 1 || Last < First)
+            return false;
+         Position = End;
+         }
+      for(long Cpu = First; Cpu <= Last; Cpu++)
+         CpusPtr->push_back((int)Cpu);
+      if(*Position == ',')
+         Position++;
+      else if(*Position)
+         return false;
+      }
+   return !CpusPtr->empty();
+   }
+
+bool ThreadPlacementIsSet(const ThreadPlacementStruct* PlacementPtr)
+   {
+   return !PlacementPtr->Cpus.empty() || PlacementPtr->Priority > 0;
+   }
+
+#if !defined(_WIN32)
+
+bool ThreadPinCpus(const std::vector<int>& Cpus)
+   {
+   cpu_set_t Set;
+
+   CPU_ZERO(&Set);
+   for(size_t i = 0; i < Cpus.size(); i++)
+      {
+      if(Cpus[i] >= CPU_SETSIZE)
+         return false;
+      CPU_SET(Cpus[i], &Set);
+      }
+   return pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set) == 0;
+   }
+
+/* Gives the calling thread a SCHED_FIFO priority, or puts it back in the   */
+/* default policy for 0.                                                     */
+/* -----------------------------------------------------------------------   */
+bool ThreadSetRealtime(int Priority)
+   {
+   sched_param Parameters;
+
+   memset(&Parameters, 0, sizeof(Parameters));
+   Parameters.sched_priority = Priority;
+   return pthread_setschedparam(pthread_self(), Priority > 0 ? SCHED_FIFO : SCHED_OTHER,
+                                &Parameters) == 0;
+   }
+
+#else
+
+bool ThreadPinCpus(const std::vector<int>& Cpus)
+   {
+   GROUP_AFFINITY Affinity;
+   int            GroupSize = (int)(8 * sizeof(KAFFINITY));
+
+   memset(&Affinity, 0, sizeof(Affinity));
+   if(Cpus.empty())
+      return false;
+   Affinity.Group = (WORD)(Cpus[0] / GroupSize);
+   for(size_t i = 0; i < Cpus.size(); i++)
+      {
+      if(Cpus[i] / GroupSize != Affinity.Group)
+         return false;
+      Affinity.Mask |= (KAFFINITY)1 << (Cpus[i] % GroupSize);
+      }
+   return SetThreadGroupAffinity(GetCurrentThread(), &Affinity, NULL) != 0;
+   }
+
+bool ThreadSetRealtime(int Priority)
+   {
+   int Level = Priority >= 50 ? THREAD_PRIORITY_TIME_CRITICAL :
+               Priority > 0   ? THREAD_PRIORITY_HIGHEST : THREAD_PRIORITY_NORMAL;
+
+   return SetThreadPriority(GetCurrentThread(), Level) != 0;
+   }
+
+#endif
+
+/* Places the calling thread as set for its role. Index is the instance of  */
+/* the thread in its role, to pin it to one CPU of the list, or             */
+/* THREAD_INDEX_ANY. A failure is reported once per role.                   */
+/* -----------------------------------------------------------------------   */
+bool ThreadPlacementApply(const ThreadPlacementStruct* PlacementPtr, ThreadRoleType Role,
+                          int Index)
+   {
+   bool Pinned = true;
+   bool Raised = true;
+
+   if(!PlacementPtr->Cpus.empty())
+      {
+      if(Index == THREAD_INDEX_ANY)
+         Pinned = ThreadPinCpus(PlacementPtr->Cpus);
+      else
+         Pinned = ThreadPinCpus(std::vector<int>(1, PlacementPtr->Cpus[(size_t)Index %
+                                                                       PlacementPtr->Cpus.size()]));
+      }
+   if(PlacementPtr->Priority > 0)
+      Raised = ThreadSetRealtime(PlacementPtr->Priority);
+
+   if((!Pinned || !Raised) && !(g_WarnedRoles.fetch_or(1u << Role) & (1u << Role)))
+      {
+      if(!Pinned)
+         printf("Could not pin the %s thread to its CPUs; check the CPU list.\n",
+                ThreadRoleName(Role));
+      if(!Raised)
+         printf("Could not give the %s thread the real-time priority %d; it needs "
+                "CAP_SYS_NICE or an rtprio limit.\n", ThreadRoleName(Role),
+                PlacementPtr->Priority);
+      }
+   return Pinned && Raised;
+   }
+
+const char* ThreadRoleName(ThreadRoleType Role)
+   {
+   switch(Role)
+      {
+      case eThreadAcquisition: return "acquisition";
+      case eThreadWorker:      return "worker";
+      case eThreadDisplay:     return "display";
+      default:                 return "unknown";
+      }
+   }
@@ -0,0 +1,57 @@
+﻿/*************************************************************************************/
+/*
+ * File name: ThreadPlacement.h
+ *
+ * Synopsis:  CPU affinity and real-time priority of the threads on the frame path.
+ *            Three roles are placed: the acquisition thread that calls the hook
+ *            (the MdigProcess hook thread, the native receiver, the synthetic or
+ *            replay source), the pipeline workers and the display thread. Each
+ *            role may be pinned to a list of CPUs and given a SCHED_FIFO priority,
+ *            so that the hook and the workers are not preempted by the rest of
+ *            the system nor migrated between cores with a cold cache.
+ *
+ *            A thread of a role with several instances (the workers, or the
+ *            acquisition threads of several streams) is pinned to one CPU of the
+ *            list, in turn; otherwise it may run on all the CPUs of the list.
+ *            A role with no CPU list keeps the NUMA binding of CpuTopology.h.
+ *
+ *            Windows: the CPUs of a list must be in one processor group, and a
+ *            priority is mapped to THREAD_PRIORITY_HIGHEST, or TIME_CRITICAL from
+ *            50 up.
+ *
+ *            This module does not depend on MIL, see ThreadJitterBench.cpp.
+ *
+ * Copyright © Matrox Electronic Systems Ltd., 1992-YYYY.
+ * All Rights Reserved
+ */
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include <vector>
+
+#define THREAD_PRIORITY_MAX  99       /* SCHED_FIFO priorities are 1 to 99.      */
+#define THREAD_INDEX_ANY     (-1)     /* Thread may run on all the CPUs of a list. */
+
+typedef enum
+   {
+   eThreadAcquisition = 0,
+   eThreadWorker,
+   eThreadDisplay,
+   eThreadRoleCount
+   } ThreadRoleType;
+
+typedef struct
+   {
+   std::vector<int> Cpus;             /* Empty: not pinned.                        */
+   int              Priority;         /* SCHED_FIFO priority, 0 for the default.   */
+   } ThreadPlacementStruct;
+
+bool ThreadPlacementParseCpus(const char* List, std::vector<int>* CpusPtr);
+bool ThreadPlacementIsSet(const ThreadPlacementStruct* PlacementPtr);
+bool ThreadPinCpus(const std::vector<int>& Cpus);
+bool ThreadSetRealtime(int Priority);
+bool ThreadPlacementApply(const ThreadPlacementStruct* PlacementPtr, ThreadRoleType Role,
+                          int Index);
+const char* ThreadRoleName(ThreadRoleType Role);
+
+#endif /* THREAD_PLACEMENT_H */